@@ -1,6 +1,24 @@
 import 'dart:async';
+import 'dart:typed_data';
 
+import 'metronome_export.dart';
+import 'metronome_grid.dart';
+import 'metronome_levels.dart';
+import 'metronome_log.dart';
+import 'metronome_memory_usage.dart';
 import 'metronome_platform_interface.dart';
+import 'metronome_route.dart';
+import 'metronome_stream_stats.dart';
+import 'metronome_tick.dart';
+
+export 'metronome_export.dart';
+export 'metronome_grid.dart';
+export 'metronome_levels.dart';
+export 'metronome_log.dart';
+export 'metronome_memory_usage.dart';
+export 'metronome_route.dart';
+export 'metronome_stream_stats.dart';
+export 'metronome_tick.dart';
 
 class Metronome {
   static final Metronome _instance = Metronome._internal();
@@ -21,6 +39,10 @@ class Metronome {
   /// ```
   Stream<int> get tickStream => _platform.tickController.stream;
 
+  ///the same ticks with whether their bar was muted by [setGapClick] (Windows, Linux)
+  Stream<MetronomeTick> get tickEventStream =>
+      _platform.tickEventController.stream;
+
   ///initialize the metronome
   /// ```
   /// @param mainPath: the path of the main audio file
@@ -29,6 +51,8 @@ class Metronome {
   /// @param volume: the volume of the metronome, default `50`%
   /// @param timeSignature: the timeSignature of the metronome, default `4`
   /// @param sampleRate: the sampleRate of the metronome, default `44100`
+  /// @param channels: interleaved output channels, 1 to 8, default `1` (Windows, Linux)
+  /// @param memoryBudget: cap in bytes on memory held for sounds and buffers, `0` for none; init and later sound changes fail rather than go over it (Windows, Linux)
   /// ```
   Future<void> init(
     String mainPath, {
@@ -38,6 +62,8 @@ class Metronome {
     bool enableTickCallback = false,
     int timeSignature = 4,
     int sampleRate = 44100,
+    int channels = 1,
+    int memoryBudget = 0,
   }) async {
     try {
       MetronomePlatform.instance.init(
@@ -48,6 +74,8 @@ class Metronome {
         enableTickCallback: enableTickCallback,
         timeSignature: timeSignature,
         sampleRate: sampleRate,
+        channels: channels,
+        memoryBudget: memoryBudget,
       );
       _initialized = true;
       return;
@@ -83,6 +111,35 @@ class Metronome {
     return MetronomePlatform.instance.setVolume(volume);
   }
 
+  ///peak and RMS of the last block played, for drawing meters; poll it
+  ///once a frame (Windows, Linux)
+  Future<MetronomeLevels> getLevels() async {
+    return MetronomePlatform.instance.getLevels();
+  }
+
+  ///memory held for sounds and buffers against the budget given to [init] (Windows, Linux)
+  Future<MetronomeMemoryUsage> getMemoryUsage() async {
+    return MetronomePlatform.instance.getMemoryUsage();
+  }
+
+  ///output device failovers and how long they took, stalls and underruns (Windows, Linux)
+  Future<MetronomeStreamStats> getStreamStats() async {
+    return MetronomePlatform.instance.getStreamStats();
+  }
+
+  ///send every beat as an OSC bundle over UDP to [host]:[port], for lighting
+  ///and video software: beat, bar, BPM, accent, muted and the time it
+  ///sounds, sent [lookAheadMs] before it does, until [stopOscBroadcast] (Windows, Linux)
+  Future<void> startOscBroadcast(String host, int port,
+      {int lookAheadMs = 0}) async {
+    return MetronomePlatform.instance
+        .startOscBroadcast(host, port, lookAheadMs);
+  }
+
+  Future<void> stopOscBroadcast() async {
+    return MetronomePlatform.instance.stopOscBroadcast();
+  }
+
   ///check if the metronome is playing
   Future<bool?> isPlaying() async {
     return MetronomePlatform.instance.isPlaying();
@@ -117,6 +174,155 @@ class Metronome {
     return timeSignature ?? 0;
   }
 
+  ///switch meter at the next bar line (Windows, Linux)
+  /// ```
+  /// @param numerator, denominator: e.g. 7 and 8; the click falls on every
+  ///   1/denominator note while bpm keeps counting quarter notes
+  /// @param grouping: beats per group, e.g. [2, 2, 3]; group starts are accented
+  /// @param feltInGroups: click only the first beat of each group (6/8 in two)
+  /// ```
+  Future<void> setMeter(int numerator, int denominator,
+      {List<int> grouping = const [], bool feltInGroups = false}) async {
+    return MetronomePlatform.instance.setMeter(numerator, denominator,
+        grouping: grouping, feltInGroups: feltInGroups);
+  }
+
+  ///balance the sounds: each is analysed once when loaded, and with
+  ///[enabled] the accent and grid samples are trimmed to the main sound's
+  ///loudness, never past clipping (Windows, Linux)
+  Future<void> setLoudnessMatching(bool enabled) async {
+    return MetronomePlatform.instance.setLoudnessMatching(enabled);
+  }
+
+  ///send a [MetronomeLayer] to output [channel] and the one after it, with
+  ///[pan] from -1.0 ([channel] alone) through 0.0 (both at full gain) to
+  ///1.0 (the next channel alone); needs `channels` of at least 2 in [init]
+  ///(Windows, Linux)
+  Future<void> setRoute(int layer, {int channel = 0, double pan = 0.0}) async {
+    return MetronomePlatform.instance
+        .setRoute(layer, channel: channel, pan: pan);
+  }
+
+  ///gap-click training: play [playBars] bars, then mute [muteBars], from the
+  ///next bar line (Windows, Linux)
+  /// ```
+  /// @param randomised: mute each bar at random instead, at the same ratio
+  /// ```
+  /// Ticks keep coming during muted bars; see [tickEventStream].
+  /// `muteBars: 0` turns it off.
+  Future<void> setGapClick(int playBars, int muteBars,
+      {bool randomised = false}) async {
+    return MetronomePlatform.instance
+        .setGapClick(playBars, muteBars, randomised: randomised);
+  }
+
+  ///play a step grid instead of the click (Windows, Linux)
+  /// ```
+  /// @param grid: steps per bar and the hits on up to 8 lanes; only the
+  ///   cells that changed since the last call are sent to the audio thread,
+  ///   so it is cheap to call on every edit. A new step count starts at the
+  ///   next bar line, `steps: 0` goes back to the click there.
+  /// ```
+  Future<void> setGrid(MetronomeGrid grid) async {
+    return MetronomePlatform.instance.setGrid(grid);
+  }
+
+  ///play a bar written in pattern notation as a step grid (Windows, Linux)
+  /// ```
+  /// @param notation: e.g. `X.x.|x.x.|(3)xxx|x...`; `|` ends a beat, `X` is
+  ///   an accent, `x` a hit, `.` a rest, `(n)` squeezes the next n into one
+  ///   slot, digits after a hit pick its sample and `;` starts the next lane.
+  ///   Compiled patterns are cached, so switching back to one is cheap.
+  /// ```
+  Future<void> setPattern(String notation) async {
+    return MetronomePlatform.instance.setPattern(notation);
+  }
+
+  ///load the sounds grid hits refer to as sample 2 onwards (Windows, Linux)
+  Future<void> setGridSamples(List<String> paths) async {
+    return MetronomePlatform.instance.setGridSamples(paths);
+  }
+
+  ///render click tracks to files without playing them (Windows)
+  /// ```
+  /// @param songs: the songs to export, rendered concurrently
+  /// @return: one job id per song, as reported by [exportProgressStream]
+  /// ```
+  Future<List<int>> exportSetlist(List<MetronomeSong> songs) async {
+    return MetronomePlatform.instance.exportSetlist(songs);
+  }
+
+  ///cancel one export job, or all of them when [jobId] is omitted
+  Future<void> cancelExport({int? jobId}) async {
+    return MetronomePlatform.instance.cancelExport(jobId: jobId);
+  }
+
+  ///read the tempo, time signature and marker tracks of a type 0/1 MIDI file (Windows)
+  Future<MetronomeTempoMap> importMidi(String path) async {
+    return MetronomePlatform.instance.importMidi(path);
+  }
+
+  ///write the click track of [song] as a type 0 MIDI file; the kit is ignored (Windows)
+  Future<Uint8List> exportMidi(MetronomeSong song) async {
+    return MetronomePlatform.instance.exportMidi(song);
+  }
+
+  ///log every command the engine applies, with the sample frame it took
+  ///effect at, to a binary journal at [path] until [stopJournal] (Windows)
+  Future<void> startJournal(String path) async {
+    return MetronomePlatform.instance.startJournal(path);
+  }
+
+  Future<void> stopJournal() async {
+    return MetronomePlatform.instance.stopJournal();
+  }
+
+  ///replay a journal offline, reproducing the recorded output exactly, and
+  ///write it to [outputPath]; returns the number of frames written (Windows)
+  Future<int> renderJournal(String journalPath, String outputPath,
+      {MetronomeExportFormat format = MetronomeExportFormat.wav}) async {
+    return MetronomePlatform.instance
+        .renderJournal(journalPath, outputPath, format);
+  }
+
+  ///write the engine trace recorded so far to [path]; open chrome traces in
+  ///chrome://tracing and perfetto traces in ui.perfetto.dev. Throws unless the
+  ///plugin was built with METRONOME_ENABLE_TRACING (Windows)
+  Future<bool> dumpTrace(String path,
+      {MetronomeTraceFormat format = MetronomeTraceFormat.chrome}) async {
+    return MetronomePlatform.instance.dumpTrace(path, format);
+  }
+
+  ///drop native log records below [level]; defaults to info (Windows)
+  Future<void> setLogLevel(MetronomeLogLevel level) async {
+    return MetronomePlatform.instance.setLogLevel(level);
+  }
+
+  ///append native log records to the text file at [path]; an empty path
+  ///closes the file (Windows)
+  Future<void> setLogFile(String path) async {
+    return MetronomePlatform.instance.setLogFile(path);
+  }
+
+  /// ```
+  /// metronome.logStream.listen(
+  ///   (MetronomeLogRecord record) {
+  ///     print(record);
+  ///   },
+  /// );
+  /// ```
+  Stream<MetronomeLogRecord> get logStream => _platform.logStream;
+
+  /// ```
+  /// metronome.exportProgressStream.listen(
+  ///   (MetronomeExportProgress progress) {
+  ///     print("export: $progress");
+  ///   },
+  /// );
+  /// ```
+  Stream<MetronomeExportProgress> get exportProgressStream =>
+      _platform.exportProgressController.stream;
+
   ///destroy the metronome
   Future<void> destroy() async {
     _initialized = false;
@@ -0,0 +1,239 @@
+/// Output container for [MetronomeSong] exports.
+enum MetronomeExportFormat { wav, flac }
+
+/// File format written by [Metronome.dumpTrace].
+enum MetronomeTraceFormat { chrome, perfetto }
+
+/// Lifecycle of a single export job, in the order the native side reports it.
+enum MetronomeExportState { queued, running, done, cancelled, failed }
+
+/// Per-beat accent used by [MetronomeSong.pattern].
+enum MetronomeBeatAccent { rest, normal, accented }
+
+/// A tempo change [beat] beats into [bar] (both 0-based). [bpm] counts
+/// quarter notes, as in MIDI files. When [endBpm] is set the tempo ramps
+/// linearly up to the next change or the end of the song.
+class MetronomeTempoChange {
+  final int bar;
+  final double beat;
+  final double bpm;
+  final double? endBpm;
+
+  const MetronomeTempoChange({
+    required this.bar,
+    required this.bpm,
+    this.beat = 0,
+    this.endBpm,
+  });
+
+  factory MetronomeTempoChange.fromMap(Map<dynamic, dynamic> map) {
+    final endBpm = (map['endBpm'] as num).toDouble();
+    return MetronomeTempoChange(
+      bar: map['bar'] as int,
+      beat: (map['beat'] as num).toDouble(),
+      bpm: (map['bpm'] as num).toDouble(),
+      endBpm: endBpm > 0 ? endBpm : null,
+    );
+  }
+
+  Map<String, dynamic> toMap() => {
+        'bar': bar,
+        'beat': beat,
+        'bpm': bpm,
+        'endBpm': endBpm ?? 0.0,
+      };
+}
+
+/// A time signature change at the start of [bar].
+class MetronomeMeterChange {
+  final int bar;
+  final int numerator;
+  final int denominator;
+
+  /// Beats per group, adding up to [numerator], e.g. `[2, 2, 3]` for 7/8.
+  final List<int> grouping;
+
+  /// Click only the first beat of each group, as in 6/8 felt in two.
+  final bool feltInGroups;
+
+  const MetronomeMeterChange({
+    required this.bar,
+    required this.numerator,
+    this.denominator = 4,
+    this.grouping = const [],
+    this.feltInGroups = false,
+  });
+
+  factory MetronomeMeterChange.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeMeterChange(
+      bar: map['bar'] as int,
+      numerator: map['numerator'] as int,
+      denominator: map['denominator'] as int,
+      grouping: (map['grouping'] as List? ?? const []).cast<int>(),
+      feltInGroups: map['feltInGroups'] as bool? ?? false,
+    );
+  }
+
+  Map<String, dynamic> toMap() => {
+        'bar': bar,
+        'numerator': numerator,
+        'denominator': denominator,
+        'grouping': grouping,
+        'feltInGroups': feltInGroups,
+      };
+}
+
+class MetronomeMarker {
+  final int bar;
+  final double beat;
+  final String text;
+
+  const MetronomeMarker({
+    required this.bar,
+    required this.text,
+    this.beat = 0,
+  });
+
+  factory MetronomeMarker.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeMarker(
+      bar: map['bar'] as int,
+      beat: (map['beat'] as num).toDouble(),
+      text: map['text'] as String,
+    );
+  }
+
+  Map<String, dynamic> toMap() => {
+        'bar': bar,
+        'beat': beat,
+        'text': text,
+      };
+}
+
+/// The tempo, meter and marker tracks of a song, as read from a Standard
+/// MIDI File by [Metronome.importMidi].
+class MetronomeTempoMap {
+  final int bars;
+  final List<MetronomeTempoChange> tempoMap;
+  final List<MetronomeMeterChange> meterMap;
+  final List<MetronomeMarker> markers;
+
+  const MetronomeTempoMap({
+    required this.bars,
+    required this.tempoMap,
+    required this.meterMap,
+    required this.markers,
+  });
+
+  factory MetronomeTempoMap.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeTempoMap(
+      bars: map['bars'] as int,
+      tempoMap: (map['tempoMap'] as List)
+          .map((entry) => MetronomeTempoChange.fromMap(entry as Map))
+          .toList(),
+      meterMap: (map['meterMap'] as List)
+          .map((entry) => MetronomeMeterChange.fromMap(entry as Map))
+          .toList(),
+      markers: (map['markers'] as List)
+          .map((entry) => MetronomeMarker.fromMap(entry as Map))
+          .toList(),
+    );
+  }
+}
+
+/// A click track to render offline with [Metronome.exportSetlist].
+class MetronomeSong {
+  final String name;
+
+  /// Absolute path of the file to write.
+  final String outputPath;
+  final MetronomeExportFormat format;
+  final String mainPath;
+  final String accentedPath;
+  final int bars;
+
+  /// Beats per bar when [meterMap] is empty.
+  final int timeSignature;
+  final List<MetronomeMeterChange> meterMap;
+  final List<MetronomeTempoChange> tempoMap;
+  final List<MetronomeMarker> markers;
+
+  /// One accent per beat of the bar; empty accents the first beat only.
+  final List<MetronomeBeatAccent> pattern;
+
+  /// 0 ~ 100
+  final int volume;
+  final int sampleRate;
+
+  const MetronomeSong({
+    required this.outputPath,
+    required this.mainPath,
+    required this.bars,
+    required this.tempoMap,
+    this.name = '',
+    this.format = MetronomeExportFormat.wav,
+    this.accentedPath = '',
+    this.timeSignature = 4,
+    this.meterMap = const [],
+    this.markers = const [],
+    this.pattern = const [],
+    this.volume = 100,
+    this.sampleRate = 44100,
+  });
+
+  /// A song that follows [map], e.g. one imported from a MIDI file.
+  factory MetronomeSong.fromTempoMap(
+    MetronomeTempoMap map, {
+    required String outputPath,
+    required String mainPath,
+    String name = '',
+    MetronomeExportFormat format = MetronomeExportFormat.wav,
+    String accentedPath = '',
+    List<MetronomeBeatAccent> pattern = const [],
+    int volume = 100,
+    int sampleRate = 44100,
+  }) {
+    return MetronomeSong(
+      outputPath: outputPath,
+      mainPath: mainPath,
+      bars: map.bars,
+      tempoMap: map.tempoMap,
+      meterMap: map.meterMap,
+      markers: map.markers,
+      name: name,
+      format: format,
+      accentedPath: accentedPath,
+      pattern: pattern,
+      volume: volume,
+      sampleRate: sampleRate,
+    );
+  }
+}
+
+class MetronomeExportProgress {
+  final int jobId;
+  final MetronomeExportState state;
+
+  /// 0.0 ~ 1.0
+  final double progress;
+  final String error;
+
+  const MetronomeExportProgress({
+    required this.jobId,
+    required this.state,
+    required this.progress,
+    this.error = '',
+  });
+
+  factory MetronomeExportProgress.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeExportProgress(
+      jobId: map['jobId'] as int,
+      state: MetronomeExportState.values[map['state'] as int],
+      progress: (map['progress'] as num).toDouble(),
+      error: map['error'] as String? ?? '',
+    );
+  }
+
+  @override
+  String toString() =>
+      'MetronomeExportProgress($jobId, ${state.name}, $progress${error.isEmpty ? '' : ', $error'})';
+}
@@ -0,0 +1,42 @@
+/// Largest step grid the native engine plays.
+const int kMetronomeMaxGridSteps = 64;
+const int kMetronomeGridLanes = 8;
+
+/// One hit in a [MetronomeGrid]: [sample] 0 is the main sound, 1 the
+/// accented sound and 2 onwards the sounds passed to `setGridSamples`.
+class MetronomeGridHit {
+  final int step;
+  final int lane;
+  final int sample;
+
+  /// 1 to 127.
+  final int velocity;
+
+  const MetronomeGridHit({
+    required this.step,
+    required this.lane,
+    required this.sample,
+    this.velocity = 100,
+  });
+
+  Map<String, dynamic> toMap() => {
+        'step': step,
+        'lane': lane,
+        'sample': sample,
+        'velocity': velocity,
+      };
+}
+
+/// A bar split into [steps] equal steps, played instead of the click.
+/// Steps with no hit on a lane are silent; `steps: 0` goes back to the click.
+class MetronomeGrid {
+  final int steps;
+  final List<MetronomeGridHit> hits;
+
+  const MetronomeGrid({required this.steps, this.hits = const []});
+
+  Map<String, dynamic> toMap() => {
+        'steps': steps,
+        'hits': hits.map((hit) => hit.toMap()).toList(),
+      };
+}
@@ -0,0 +1,47 @@
+/// Peak and RMS of one rendered block, 1.0 being full scale.
+class MetronomeLevel {
+  final double peak;
+  final double rms;
+
+  const MetronomeLevel({this.peak = 0, this.rms = 0});
+
+  factory MetronomeLevel.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeLevel(
+      peak: (map['peak'] as num).toDouble(),
+      rms: (map['rms'] as num).toDouble(),
+    );
+  }
+
+  @override
+  String toString() => 'MetronomeLevel(peak: $peak, rms: $rms)';
+}
+
+/// Levels of the last block the engine rendered: the mixed [output], and
+/// what the [click] and each grid lane contributed to it.
+class MetronomeLevels {
+  final MetronomeLevel output;
+  final MetronomeLevel click;
+
+  /// One per grid lane.
+  final List<MetronomeLevel> lanes;
+
+  const MetronomeLevels({
+    this.output = const MetronomeLevel(),
+    this.click = const MetronomeLevel(),
+    this.lanes = const [],
+  });
+
+  factory MetronomeLevels.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeLevels(
+      output: MetronomeLevel.fromMap(map['output'] as Map),
+      click: MetronomeLevel.fromMap(map['click'] as Map),
+      lanes: (map['lanes'] as List)
+          .map((lane) => MetronomeLevel.fromMap(lane as Map))
+          .toList(),
+    );
+  }
+
+  @override
+  String toString() =>
+      'MetronomeLevels(output: $output, click: $click, lanes: $lanes)';
+}
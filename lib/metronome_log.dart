@@ -0,0 +1,32 @@
+/// Severity of a [MetronomeLogRecord]; [off] silences the log entirely.
+enum MetronomeLogLevel { debug, info, warning, error, off }
+
+/// One entry of the native diagnostic log.
+class MetronomeLogRecord {
+  final DateTime time;
+  final MetronomeLogLevel level;
+
+  /// The native subsystem that wrote the record, e.g. "metronome" or "export".
+  final String category;
+  final String message;
+
+  const MetronomeLogRecord({
+    required this.time,
+    required this.level,
+    required this.category,
+    required this.message,
+  });
+
+  factory MetronomeLogRecord.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeLogRecord(
+      time: DateTime.fromMicrosecondsSinceEpoch(map['time'] as int, isUtc: true),
+      level: MetronomeLogLevel.values[map['level'] as int],
+      category: map['category'] as String,
+      message: map['message'] as String,
+    );
+  }
+
+  @override
+  String toString() =>
+      'MetronomeLogRecord(${time.toIso8601String()}, ${level.name}, $category: $message)';
+}
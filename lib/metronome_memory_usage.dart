@@ -0,0 +1,43 @@
+/// Memory held against the budget given to [Metronome.init], in bytes.
+class MetronomeMemoryUsage {
+  /// Zero when there is no cap.
+  final int limit;
+  final int used;
+
+  /// Sounds held by the engine, including a kit waiting to be swapped in.
+  final int kits;
+
+  /// Render-ahead and mirror rings.
+  final int rings;
+
+  /// Command journal ring.
+  final int journal;
+
+  /// Allocations refused for want of room.
+  final int refusals;
+
+  const MetronomeMemoryUsage({
+    this.limit = 0,
+    this.used = 0,
+    this.kits = 0,
+    this.rings = 0,
+    this.journal = 0,
+    this.refusals = 0,
+  });
+
+  factory MetronomeMemoryUsage.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeMemoryUsage(
+      limit: map['limit'] as int,
+      used: map['used'] as int,
+      kits: map['kits'] as int,
+      rings: map['rings'] as int,
+      journal: map['journal'] as int,
+      refusals: map['refusals'] as int,
+    );
+  }
+
+  @override
+  String toString() =>
+      'MetronomeMemoryUsage(limit: $limit, used: $used, kits: $kits, '
+      'rings: $rings, journal: $journal, refusals: $refusals)';
+}
@@ -4,7 +4,14 @@ import 'dart:io';
 import 'package:flutter/foundation.dart';
 import 'package:flutter/services.dart';
 
+import 'metronome_export.dart';
+import 'metronome_grid.dart';
+import 'metronome_levels.dart';
+import 'metronome_log.dart';
+import 'metronome_memory_usage.dart';
 import 'metronome_platform_interface.dart';
+import 'metronome_stream_stats.dart';
+import 'metronome_tick.dart';
 
 /// An implementation of [MetronomePlatform] that uses method channels.
 class MethodChannelMetronome extends MetronomePlatform {
@@ -12,12 +19,20 @@ class MethodChannelMetronome extends MetronomePlatform {
   @visibleForTesting
   final methodChannel = const MethodChannel('metronome');
   final eventTickChannel = const EventChannel("metronome_tick");
+  final eventExportChannel = const EventChannel("metronome_export");
+  StreamSubscription<dynamic>? _exportSubscription;
+  final eventLogChannel = const EventChannel("metronome_log");
+  Stream<MetronomeLogRecord>? _logStream;
 
   MethodChannelMetronome() {
     eventTickChannel.receiveBroadcastStream().listen(
       (event) {
         if (event is int) {
           tickController.add(event);
+        } else if (event is Map) {
+          final tick = MetronomeTick.fromMap(event);
+          tickController.add(tick.beat);
+          tickEventController.add(tick);
         }
       },
       onError: (error) {
@@ -34,6 +49,8 @@ class MethodChannelMetronome extends MetronomePlatform {
     bool enableTickCallback = false,
     int timeSignature = 4,
     int sampleRate = 44100,
+    int channels = 1,
+    int memoryBudget = 0,
   }) async {
     if (mainPath == '') {
       throw Exception('Main path cannot be empty');
@@ -41,8 +58,8 @@ class MethodChannelMetronome extends MetronomePlatform {
     if (volume > 100 || volume < 0) {
       throw Exception('Volume must be between 0 and 100');
     }
-    if (bpm <= 0) {
-      throw Exception('BPM must be greater than 0');
+    if (bpm < 1 || bpm > 1000) {
+      throw Exception('BPM must be between 1 and 1000');
     }
     if (timeSignature < 0) {
       throw Exception('timeSignature must be greater than 0');
@@ -50,6 +67,12 @@ class MethodChannelMetronome extends MetronomePlatform {
     if (sampleRate <= 0) {
       throw Exception('sampleRate must be greater than 0');
     }
+    if (channels < 1 || channels > 8) {
+      throw Exception('channels must be between 1 and 8');
+    }
+    if (memoryBudget < 0) {
+      throw Exception('memoryBudget cannot be negative');
+    }
     Uint8List mainFileBytes = await loadFileBytes(mainPath);
     Uint8List accentedFileBytes = Uint8List.fromList([]);
     if (accentedPath != '') {
@@ -64,6 +87,8 @@ class MethodChannelMetronome extends MetronomePlatform {
         'enableTickCallback': enableTickCallback,
         'timeSignature': timeSignature,
         'sampleRate': sampleRate,
+        'channels': channels,
+        'memoryBudget': memoryBudget,
       });
     } catch (e) {
       if (kDebugMode) {
@@ -107,8 +132,8 @@ class MethodChannelMetronome extends MetronomePlatform {
 
   @override
   Future<void> setBPM(int bpm) async {
-    if (bpm <= 0) {
-      throw Exception('BPM must be greater than 0');
+    if (bpm < 1 || bpm > 1000) {
+      throw Exception('BPM must be between 1 and 1000');
     }
     try {
       await methodChannel.invokeMethod<void>('setBPM', {
@@ -150,6 +175,113 @@ class MethodChannelMetronome extends MetronomePlatform {
     }
   }
 
+  @override
+  Future<void> setMeter(int numerator, int denominator,
+      {List<int> grouping = const [], bool feltInGroups = false}) async {
+    if (numerator <= 0 || denominator <= 0) {
+      throw Exception('numerator and denominator must be positive integers');
+    }
+    try {
+      await methodChannel.invokeMethod<void>('setMeter', {
+        'numerator': numerator,
+        'denominator': denominator,
+        'grouping': grouping,
+        'feltInGroups': feltInGroups,
+      });
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> setLoudnessMatching(bool enabled) async {
+    try {
+      await methodChannel
+          .invokeMethod<void>('setLoudnessMatching', {'enabled': enabled});
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> setRoute(int layer, {int channel = 0, double pan = 0.0}) async {
+    try {
+      await methodChannel.invokeMethod<void>(
+          'setRoute', {'layer': layer, 'channel': channel, 'pan': pan});
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> setGapClick(int playBars, int muteBars,
+      {bool randomised = false}) async {
+    if (playBars < 1 || muteBars < 0) {
+      throw Exception('playBars must be positive and muteBars non-negative');
+    }
+    try {
+      await methodChannel.invokeMethod<void>('setGapClick', {
+        'playBars': playBars,
+        'muteBars': muteBars,
+        'randomised': randomised,
+      });
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> setGrid(MetronomeGrid grid) async {
+    if (grid.steps < 0 || grid.steps > kMetronomeMaxGridSteps) {
+      throw Exception('steps must be between 0 and $kMetronomeMaxGridSteps');
+    }
+    try {
+      await methodChannel.invokeMethod<void>('setGrid', grid.toMap());
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> setPattern(String notation) async {
+    try {
+      await methodChannel.invokeMethod<void>('setPattern', {
+        'notation': notation,
+      });
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> setGridSamples(List<String> paths) async {
+    final samples = <Uint8List>[];
+    for (final path in paths) {
+      samples.add(await loadFileBytes(path));
+    }
+    try {
+      await methodChannel.invokeMethod<void>('setGridSamples', {
+        'samples': samples,
+      });
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
   @override
   Future<int?> getTimeSignature() async {
     try {
@@ -176,6 +308,69 @@ class MethodChannelMetronome extends MetronomePlatform {
     }
   }
 
+  @override
+  Future<MetronomeLevels> getLevels() async {
+    try {
+      final levels = await methodChannel.invokeMethod<Map>('getLevels');
+      return levels == null
+          ? const MetronomeLevels()
+          : MetronomeLevels.fromMap(levels);
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+      return const MetronomeLevels();
+    }
+  }
+
+  @override
+  Future<MetronomeMemoryUsage> getMemoryUsage() async {
+    try {
+      final usage = await methodChannel.invokeMethod<Map>('getMemoryUsage');
+      return usage == null
+          ? const MetronomeMemoryUsage()
+          : MetronomeMemoryUsage.fromMap(usage);
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+      return const MetronomeMemoryUsage();
+    }
+  }
+
+  @override
+  Future<MetronomeStreamStats> getStreamStats() async {
+    try {
+      final stats = await methodChannel.invokeMethod<Map>('getStreamStats');
+      return stats == null
+          ? const MetronomeStreamStats()
+          : MetronomeStreamStats.fromMap(stats);
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+      return const MetronomeStreamStats();
+    }
+  }
+
+  @override
+  Future<void> startOscBroadcast(
+      String host, int port, int lookAheadMs) async {
+    if (port < 1 || port > 65535) {
+      throw Exception('port must be between 1 and 65535');
+    }
+    await methodChannel.invokeMethod<void>('startOscBroadcast', {
+      'host': host,
+      'port': port,
+      'lookAheadMs': lookAheadMs,
+    });
+  }
+
+  @override
+  Future<void> stopOscBroadcast() async {
+    await methodChannel.invokeMethod<void>('stopOscBroadcast');
+  }
+
   @override
   Future<void> setVolume(int volume) async {
     if (volume > 100 || volume < 0) {
@@ -244,6 +439,133 @@ class MethodChannelMetronome extends MetronomePlatform {
     }
   }
 
+  @override
+  Future<List<int>> exportSetlist(List<MetronomeSong> songs) async {
+    // Only platforms that can export register this channel, so listen lazily.
+    _exportSubscription ??= eventExportChannel.receiveBroadcastStream().listen(
+      (event) {
+        if (event is Map) {
+          exportProgressController.add(MetronomeExportProgress.fromMap(event));
+        }
+      },
+    );
+    final List<Map<String, dynamic>> arguments = [];
+    for (final song in songs) {
+      if (song.mainPath == '') {
+        throw Exception('Main path cannot be empty');
+      }
+      if (song.volume > 100 || song.volume < 0) {
+        throw Exception('Volume must be between 0 and 100');
+      }
+      arguments.add({
+        ..._songToMap(song),
+        'path': song.outputPath,
+        'format': song.format.name,
+        'mainFileBytes': await loadFileBytes(song.mainPath),
+        'accentedFileBytes': song.accentedPath == ''
+            ? Uint8List.fromList([])
+            : await loadFileBytes(song.accentedPath),
+      });
+    }
+    final jobIds = await methodChannel.invokeListMethod<int>('exportSetlist', {
+      'songs': arguments,
+    });
+    return jobIds ?? [];
+  }
+
+  @override
+  Future<MetronomeTempoMap> importMidi(String path) async {
+    final map = await methodChannel.invokeMapMethod<dynamic, dynamic>(
+      'importMidi',
+      {'midiFileBytes': await loadFileBytes(path)},
+    );
+    return MetronomeTempoMap.fromMap(map!);
+  }
+
+  @override
+  Future<Uint8List> exportMidi(MetronomeSong song) async {
+    final bytes = await methodChannel.invokeMethod<Uint8List>('exportMidi', {
+      'song': _songToMap(song),
+    });
+    return bytes!;
+  }
+
+  Map<String, dynamic> _songToMap(MetronomeSong song) => {
+        'name': song.name,
+        'sampleRate': song.sampleRate,
+        'bars': song.bars,
+        'timeSignature': song.timeSignature,
+        'volume': song.volume / 100.0,
+        'tempoMap': song.tempoMap.map((change) => change.toMap()).toList(),
+        'meterMap': song.meterMap.map((change) => change.toMap()).toList(),
+        'markers': song.markers.map((marker) => marker.toMap()).toList(),
+        'pattern': song.pattern.map((accent) => accent.index).toList(),
+      };
+
+  @override
+  Future<void> cancelExport({int? jobId}) async {
+    try {
+      await methodChannel.invokeMethod<void>('cancelExport', {
+        'jobId': jobId ?? 0,
+      });
+    } catch (e) {
+      if (kDebugMode) {
+        print(e);
+      }
+    }
+  }
+
+  @override
+  Future<void> startJournal(String path) async {
+    await methodChannel.invokeMethod<void>('startJournal', {'path': path});
+  }
+
+  @override
+  Future<void> stopJournal() async {
+    await methodChannel.invokeMethod<void>('stopJournal');
+  }
+
+  @override
+  Future<int> renderJournal(
+      String journalPath, String outputPath, MetronomeExportFormat format) async {
+    final frames = await methodChannel.invokeMethod<int>('renderJournal', {
+      'journalPath': journalPath,
+      'outputPath': outputPath,
+      'format': format.name,
+    });
+    return frames ?? 0;
+  }
+
+  @override
+  Future<bool> dumpTrace(String path, MetronomeTraceFormat format) async {
+    final written = await methodChannel.invokeMethod<bool>('dumpTrace', {
+      'path': path,
+      'format': format.name,
+    });
+    return written ?? false;
+  }
+
+  @override
+  Future<void> setLogLevel(MetronomeLogLevel level) async {
+    await methodChannel.invokeMethod<void>('setLogLevel', {
+      'level': level.index,
+    });
+  }
+
+  @override
+  Future<void> setLogFile(String path) async {
+    await methodChannel.invokeMethod<void>('setLogFile', {'path': path});
+  }
+
+  @override
+  Stream<MetronomeLogRecord> get logStream {
+    // The native side forwards records only while someone listens.
+    return _logStream ??= eventLogChannel
+        .receiveBroadcastStream()
+        .where((event) => event is Map)
+        .map((event) => MetronomeLogRecord.fromMap(event as Map));
+  }
+
   Future<Uint8List> loadFileBytes(String filePath) async {
     if (!filePath.startsWith('/')) {
       ByteData data = await rootBundle.load(filePath);
@@ -1,8 +1,16 @@
 import 'dart:async';
+import 'dart:typed_data';
 
 import 'package:plugin_platform_interface/plugin_platform_interface.dart';
 
+import 'metronome_export.dart';
+import 'metronome_grid.dart';
+import 'metronome_levels.dart';
+import 'metronome_log.dart';
+import 'metronome_memory_usage.dart';
 import 'metronome_method_channel.dart';
+import 'metronome_stream_stats.dart';
+import 'metronome_tick.dart';
 
 abstract class MetronomePlatform extends PlatformInterface {
   /// Constructs a MetronomePlatform.
@@ -28,6 +36,12 @@ abstract class MetronomePlatform extends PlatformInterface {
   final StreamController<int> tickController =
       StreamController<int>.broadcast();
 
+  final StreamController<MetronomeTick> tickEventController =
+      StreamController<MetronomeTick>.broadcast();
+
+  final StreamController<MetronomeExportProgress> exportProgressController =
+      StreamController<MetronomeExportProgress>.broadcast();
+
   Future<void> init(
     String mainPath, {
     String accentedPath = '',
@@ -36,6 +50,8 @@ abstract class MetronomePlatform extends PlatformInterface {
     bool enableTickCallback = false,
     int timeSignature = 4,
     int sampleRate = 44100,
+    int channels = 1,
+    int memoryBudget = 0,
   }) {
     throw UnimplementedError('init() has not been implemented.');
   }
@@ -60,6 +76,26 @@ abstract class MetronomePlatform extends PlatformInterface {
     throw UnimplementedError('setVolume() has not been implemented.');
   }
 
+  Future<MetronomeLevels> getLevels() {
+    throw UnimplementedError('getLevels() has not been implemented.');
+  }
+
+  Future<MetronomeMemoryUsage> getMemoryUsage() {
+    throw UnimplementedError('getMemoryUsage() has not been implemented.');
+  }
+
+  Future<MetronomeStreamStats> getStreamStats() {
+    throw UnimplementedError('getStreamStats() has not been implemented.');
+  }
+
+  Future<void> startOscBroadcast(String host, int port, int lookAheadMs) {
+    throw UnimplementedError('startOscBroadcast() has not been implemented.');
+  }
+
+  Future<void> stopOscBroadcast() {
+    throw UnimplementedError('stopOscBroadcast() has not been implemented.');
+  }
+
   Future<bool?> isPlaying() {
     throw UnimplementedError('isPlaying() has not been implemented.');
   }
@@ -87,10 +123,85 @@ abstract class MetronomePlatform extends PlatformInterface {
     throw UnimplementedError('getTimeSignature() has not been implemented.');
   }
 
+  Future<void> setMeter(int numerator, int denominator,
+      {List<int> grouping = const [], bool feltInGroups = false}) {
+    throw UnimplementedError('setMeter() has not been implemented.');
+  }
+
+  Future<void> setLoudnessMatching(bool enabled) {
+    throw UnimplementedError('setLoudnessMatching() has not been implemented.');
+  }
+
+  Future<void> setRoute(int layer, {int channel = 0, double pan = 0.0}) {
+    throw UnimplementedError('setRoute() has not been implemented.');
+  }
+
+  Future<void> setGapClick(int playBars, int muteBars,
+      {bool randomised = false}) {
+    throw UnimplementedError('setGapClick() has not been implemented.');
+  }
+
+  Future<void> setGrid(MetronomeGrid grid) {
+    throw UnimplementedError('setGrid() has not been implemented.');
+  }
+
+  Future<void> setPattern(String notation) {
+    throw UnimplementedError('setPattern() has not been implemented.');
+  }
+
+  Future<void> setGridSamples(List<String> paths) {
+    throw UnimplementedError('setGridSamples() has not been implemented.');
+  }
+
   Future<void> destroy() {
     throw UnimplementedError('destroy() has not been implemented.');
   }
 
+  Future<List<int>> exportSetlist(List<MetronomeSong> songs) {
+    throw UnimplementedError('exportSetlist() has not been implemented.');
+  }
+
+  Future<void> cancelExport({int? jobId}) {
+    throw UnimplementedError('cancelExport() has not been implemented.');
+  }
+
+  Future<MetronomeTempoMap> importMidi(String path) {
+    throw UnimplementedError('importMidi() has not been implemented.');
+  }
+
+  Future<Uint8List> exportMidi(MetronomeSong song) {
+    throw UnimplementedError('exportMidi() has not been implemented.');
+  }
+
+  Future<void> startJournal(String path) {
+    throw UnimplementedError('startJournal() has not been implemented.');
+  }
+
+  Future<void> stopJournal() {
+    throw UnimplementedError('stopJournal() has not been implemented.');
+  }
+
+  Future<int> renderJournal(
+      String journalPath, String outputPath, MetronomeExportFormat format) {
+    throw UnimplementedError('renderJournal() has not been implemented.');
+  }
+
+  Future<bool> dumpTrace(String path, MetronomeTraceFormat format) {
+    throw UnimplementedError('dumpTrace() has not been implemented.');
+  }
+
+  Future<void> setLogLevel(MetronomeLogLevel level) {
+    throw UnimplementedError('setLogLevel() has not been implemented.');
+  }
+
+  Future<void> setLogFile(String path) {
+    throw UnimplementedError('setLogFile() has not been implemented.');
+  }
+
+  Stream<MetronomeLogRecord> get logStream {
+    throw UnimplementedError('logStream has not been implemented.');
+  }
+
   Stream<dynamic> onListenTick(onEvent) {
     throw UnimplementedError('onListenTick() has not been implemented.');
   }
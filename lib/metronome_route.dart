@@ -0,0 +1,14 @@
+/// The parts of the mix `Metronome.setRoute` can send to their own output
+/// channels.
+class MetronomeLayer {
+  MetronomeLayer._();
+
+  /// The click on unaccented beats.
+  static const int click = 0;
+
+  /// The click on accented beats and group starts.
+  static const int accent = 1;
+
+  /// Grid lane [lane], 0 to 7.
+  static int lane(int lane) => 2 + lane;
+}
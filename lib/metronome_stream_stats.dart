@@ -0,0 +1,50 @@
+/// How the audio output has held up since [Metronome.init].
+class MetronomeStreamStats {
+  /// Periods written to the device; always 0 on Windows.
+  final int periods;
+
+  /// Underruns; always 0 on Windows.
+  final int xruns;
+
+  /// Frames skipped to stay on the beat after underruns.
+  final int lostFrames;
+
+  /// Times the output device was lost, changed or stalled and reopened.
+  final int failovers;
+
+  /// From noticing the loss to audio flowing again, in milliseconds.
+  final double lastFailoverMs;
+  final double maxFailoverMs;
+
+  /// Failovers because the device stopped playing without an error.
+  final int stalls;
+
+  const MetronomeStreamStats({
+    this.periods = 0,
+    this.xruns = 0,
+    this.lostFrames = 0,
+    this.failovers = 0,
+    this.lastFailoverMs = 0.0,
+    this.maxFailoverMs = 0.0,
+    this.stalls = 0,
+  });
+
+  factory MetronomeStreamStats.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeStreamStats(
+      periods: map['periods'] as int,
+      xruns: map['xruns'] as int,
+      lostFrames: map['lostFrames'] as int,
+      failovers: map['failovers'] as int,
+      lastFailoverMs: (map['lastFailoverMs'] as num).toDouble(),
+      maxFailoverMs: (map['maxFailoverMs'] as num).toDouble(),
+      stalls: map['stalls'] as int,
+    );
+  }
+
+  @override
+  String toString() =>
+      'MetronomeStreamStats(periods: $periods, xruns: $xruns, '
+      'lostFrames: $lostFrames, failovers: $failovers, '
+      'lastFailoverMs: $lastFailoverMs, maxFailoverMs: $maxFailoverMs, '
+      'stalls: $stalls)';
+}
@@ -0,0 +1,20 @@
+/// A click as it reached the audio device.
+class MetronomeTick {
+  /// Beat within the bar, from 0.
+  final int beat;
+
+  /// The bar was muted by gap-click mode, so nothing was heard.
+  final bool muted;
+
+  const MetronomeTick({required this.beat, this.muted = false});
+
+  factory MetronomeTick.fromMap(Map<dynamic, dynamic> map) {
+    return MetronomeTick(
+      beat: map['beat'] as int,
+      muted: map['muted'] as bool? ?? false,
+    );
+  }
+
+  @override
+  String toString() => 'MetronomeTick($beat${muted ? ', muted' : ''})';
+}
@@ -47,6 +47,7 @@ class MetronomeWeb extends MetronomePlatform {
     bool enableTickCallback = false,
     int timeSignature = 4,
     int sampleRate = 44100,
+    int channels = 1,
   }) async {
     _sampleRate = sampleRate;
     _audioContext = web.AudioContext(
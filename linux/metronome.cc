@@ -0,0 +1,264 @@
+#include "metronome.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+#include "metronome_audio_file.h"
+#include "metronome_loudness.h"
+
+Metronome::Metronome(const std::vector<uint8_t> &mainFileBytes,
+                     const std::vector<uint8_t> &accentedFileBytes,
+                     int bpm, int timeSignature, double volume, int sampleRate, int channels,
+                     size_t memoryBudget)
+    : audioBpm(bpm), audioTimeSignature(timeSignature), budget(memoryBudget), audioVolume(volume)
+{
+    if (mainFileBytes.empty())
+    {
+        throw std::invalid_argument("Main sound file cannot be empty");
+    }
+
+    kit.mainSound = metronome::BytesToPcm16(mainFileBytes);
+    kit.accentedSound = accentedFileBytes.empty() ? kit.mainSound : metronome::BytesToPcm16(accentedFileBytes);
+    engine = std::make_unique<metronome::ClickEngine>(kit, bpm, timeSignature, volume, sampleRate, channels, &budget);
+    metronome::AnalyseKit(kit, sampleRate);
+    // 10 ms periods, four deep, as on Windows.
+    metronome::SinkConfig config;
+    config.periodFrames = std::max(1, sampleRate / 100);
+    config.periods = 4;
+    stream = std::make_unique<metronome::AudioStream>(*engine, sink, config);
+    metronome::AudioStream *watched = stream.get();
+    watchdog = std::make_unique<metronome::StallWatchdog>([watched]
+                                                          { return watched->PlayedPosition(); },
+                                                          [watched]
+                                                          { watched->RestartStalled(); },
+                                                          std::chrono::milliseconds(kStallMs));
+}
+
+Metronome::~Metronome()
+{
+    Destroy();
+}
+
+void Metronome::Play()
+{
+    if (IsPlaying())
+    {
+        return;
+    }
+    Stop();
+    engine->Restart();
+    stream->Start();
+    watchdog->Start();
+    if (tickCallback && tickSource == 0)
+    {
+        tickSource = g_timeout_add(kTickIntervalMs, &Metronome::DispatchTicks, this);
+    }
+}
+
+void Metronome::Pause()
+{
+    // The click restarts from beat one on the next Play, as on Windows.
+    Stop();
+}
+
+void Metronome::Stop()
+{
+    if (tickSource != 0)
+    {
+        g_source_remove(tickSource);
+        tickSource = 0;
+    }
+    if (watchdog)
+    {
+        watchdog->Stop();
+    }
+    if (stream)
+    {
+        stream->Stop();
+    }
+}
+
+void Metronome::SetBPM(int bpm)
+{
+    if (audioBpm != bpm)
+    {
+        engine->SetBpm(bpm);
+        audioBpm = bpm;
+        ApplyWhileStopped();
+    }
+}
+
+void Metronome::SetTimeSignature(int timeSignature)
+{
+    if (audioTimeSignature != timeSignature)
+    {
+        engine->SetTimeSignature(timeSignature);
+        audioTimeSignature = timeSignature;
+        ApplyWhileStopped();
+    }
+}
+
+void Metronome::SetMeter(int numerator, int denominator, const std::vector<int> &grouping, bool feltInGroups)
+{
+    engine->SetMeter(numerator, denominator, grouping, feltInGroups);
+    audioTimeSignature = numerator;
+    ApplyWhileStopped();
+}
+
+void Metronome::SetGrid(const metronome::StepGrid &grid)
+{
+    engine->SetGrid(grid);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetPattern(const std::string &notation)
+{
+    SetGrid(*patterns.Compile(notation));
+}
+
+void Metronome::SetGridSamples(const std::vector<std::vector<uint8_t>> &samples)
+{
+    kit.samples.clear();
+    for (const std::vector<uint8_t> &bytes : samples)
+    {
+        kit.samples.push_back(metronome::BytesToPcm16(bytes));
+    }
+    kit.loudness.resize(2);
+    metronome::AnalyseKit(kit, engine->SampleRate());
+    engine->SetKit(kit);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetLoudnessMatching(bool enabled)
+{
+    kit.matchLoudness = enabled;
+    engine->SetKit(kit);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetRoute(int layer, int channel, double pan)
+{
+    engine->SetRoute(layer, channel, pan);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetGapClick(int playBars, int muteBars, bool randomised)
+{
+    engine->SetGapClick(playBars, muteBars, randomised);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetVolume(double volume)
+{
+    if (volume < 0.0 || volume > 1.0)
+    {
+        throw std::invalid_argument("Volume must be between 0.0 and 1.0");
+    }
+    engine->SetVolume(volume);
+    audioVolume = volume;
+    ApplyWhileStopped();
+}
+
+void Metronome::SetAudioFile(const std::vector<uint8_t> &mainFileBytes,
+                             const std::vector<uint8_t> &accentedFileBytes)
+{
+    if (mainFileBytes.empty() && accentedFileBytes.empty())
+    {
+        return;
+    }
+    if (!mainFileBytes.empty())
+    {
+        kit.mainSound = metronome::BytesToPcm16(mainFileBytes);
+        kit.ForgetLoudness(0);
+    }
+    if (!accentedFileBytes.empty())
+    {
+        kit.accentedSound = metronome::BytesToPcm16(accentedFileBytes);
+        kit.ForgetLoudness(1);
+    }
+    metronome::AnalyseKit(kit, engine->SampleRate());
+    engine->SetKit(kit);
+    ApplyWhileStopped();
+}
+
+void Metronome::EnableTickCallback(std::function<void(const metronome::TickEvent &)> callback)
+{
+    tickCallback = std::move(callback);
+}
+
+bool Metronome::IsPlaying() const
+{
+    return stream && stream->Running();
+}
+
+int Metronome::GetVolume() const
+{
+    return static_cast<int>(audioVolume * 100);
+}
+
+metronome::BlockLevels Metronome::GetLevels() const
+{
+    return engine->Levels();
+}
+
+metronome::MemoryUsage Metronome::GetMemoryUsage() const
+{
+    return budget.Usage();
+}
+
+metronome::StreamStats Metronome::GetStreamStats() const
+{
+    return stream->Stats();
+}
+
+void Metronome::StartOscBroadcast(const std::string &host, int port, int lookAheadMs)
+{
+    // The old publisher turns the engine's tick tap off as it goes.
+    osc.reset();
+    metronome::OscConfig config;
+    config.host = host;
+    config.port = port;
+    config.lookAhead = std::chrono::milliseconds(std::max(0, lookAheadMs));
+    metronome::AudioStream *played = stream.get();
+    osc = std::make_unique<metronome::OscBeatPublisher>(*engine, [played]
+                                                         { return played->PlayedPosition(); },
+                                                         config);
+    osc->Start();
+}
+
+void Metronome::StopOscBroadcast()
+{
+    osc.reset();
+}
+
+void Metronome::Destroy()
+{
+    Stop();
+    osc.reset();
+    watchdog.reset();
+    stream.reset();
+    sink.Close();
+}
+
+gboolean Metronome::DispatchTicks(gpointer self)
+{
+    auto *metronome = static_cast<Metronome *>(self);
+    metronome::TickEvent tick;
+    while (metronome->stream->PopPlayedTick(tick))
+    {
+        metronome->tickCallback(tick);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// With no stream running this thread is the engine's only consumer, so it
+// applies commands itself instead of letting them pile up in the queue.
+void Metronome::ApplyWhileStopped()
+{
+    if (!IsPlaying())
+    {
+        engine->ApplyPending();
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef METRONOME_H_
+#define METRONOME_H_
+
+#include <glib.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "metronome_alsa_sink.h"
+#include "metronome_engine.h"
+#include "metronome_log.h"
+#include "metronome_memory_budget.h"
+#include "metronome_osc.h"
+#include "metronome_pattern.h"
+#include "metronome_stream.h"
+#include "metronome_watchdog.h"
+
+// Live playback for the Linux plugin: the shared ClickEngine streamed to
+// ALSA by an AudioStream. Everything but the stream thread runs on the
+// GLib main loop.
+class Metronome
+{
+public:
+    Metronome(const std::vector<uint8_t> &mainFileBytes,
+              const std::vector<uint8_t> &accentedFileBytes,
+              int bpm, int timeSignature, double volume, int sampleRate, int channels = 1,
+              size_t memoryBudget = 0);
+    ~Metronome();
+
+    void Play();
+    void Pause();
+    void Stop();
+    void SetBPM(int bpm);
+    void SetTimeSignature(int timeSignature);
+    // Takes over at the next bar line; see ClickEngine::SetMeter.
+    void SetMeter(int numerator, int denominator, const std::vector<int> &grouping, bool feltInGroups);
+    // Plays grid instead of the click; see ClickEngine::SetGrid.
+    void SetGrid(const metronome::StepGrid &grid);
+    // Plays notation as a grid; see CompilePattern.
+    void SetPattern(const std::string &notation);
+    // Sounds for grid sample indices 2 onwards, replacing earlier ones.
+    void SetGridSamples(const std::vector<std::vector<uint8_t>> &samples);
+    // Trims every sound to the main sound's loudness; see MatchKitLoudness.
+    void SetLoudnessMatching(bool enabled);
+    // Sends a layer to an output channel; see ClickEngine::SetRoute.
+    void SetRoute(int layer, int channel, double pan);
+    // Plays playBars then mutes muteBars; see ClickEngine::SetGapClick.
+    void SetGapClick(int playBars, int muteBars, bool randomised);
+    void SetVolume(double volume);
+    void SetAudioFile(const std::vector<uint8_t> &mainFileBytes, const std::vector<uint8_t> &accentedFileBytes);
+    // Called on the main loop with the beat of every click as it reaches
+    // the device output.
+    void EnableTickCallback(std::function<void(const metronome::TickEvent &)> callback);
+    bool IsPlaying() const;
+    void Destroy();
+    int GetVolume() const;
+    // Levels of the last block rendered, for meters.
+    metronome::BlockLevels GetLevels() const;
+    // Memory held against the budget given at construction.
+    metronome::MemoryUsage GetMemoryUsage() const;
+    // Periods, xruns, device failovers and stalls; see AudioStream::Stats.
+    metronome::StreamStats GetStreamStats() const;
+    // Sends every beat as OSC to host:port, lookAheadMs before it sounds,
+    // replacing any earlier broadcast; see OscBeatPublisher.
+    void StartOscBroadcast(const std::string &host, int port, int lookAheadMs);
+    void StopOscBroadcast();
+    int audioBpm = 120;
+    int audioTimeSignature = 4;
+
+private:
+    // How often ticks are checked for while playing.
+    static constexpr guint kTickIntervalMs = 5;
+    // The device is restarted when the played position is stuck this
+    // long; several times the 40 ms buffer.
+    static constexpr int kStallMs = 250;
+
+    static gboolean DispatchTicks(gpointer self);
+    void ApplyWhileStopped();
+
+    // Caps the engine's kits; outlives it. Zero only keeps count.
+    metronome::MemoryBudget budget;
+    std::unique_ptr<metronome::ClickEngine> engine;
+    metronome::AlsaSink sink;
+    std::unique_ptr<metronome::AudioStream> stream;
+    // Runs while playing; restarts the stream if the device stalls.
+    std::unique_ptr<metronome::StallWatchdog> watchdog;
+    // Sends beats while it exists, playing or not.
+    std::unique_ptr<metronome::OscBeatPublisher> osc;
+    std::function<void(const metronome::TickEvent &)> tickCallback;
+    // Patterns already compiled, for switching back to one.
+    metronome::PatternCache patterns;
+    guint tickSource = 0;
+    // The sounds last sent to the engine, for partial SetAudioFile calls.
+    metronome::Kit kit;
+    double audioVolume = 1.0;
+};
+
+#endif // METRONOME_H_
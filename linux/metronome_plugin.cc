@@ -0,0 +1,361 @@
+#include "include/metronome/metronome_plugin.h"
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "metronome.h"
+#include "metronome_log.h"
+
+#define METRONOME_PLUGIN(obj)                                     \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), metronome_plugin_get_type(), \
+                              MetronomePlugin))
+
+struct _MetronomePlugin {
+  GObject parent_instance;
+
+  FlEventChannel* tick_channel;
+  gboolean tick_listening;
+  // Owned; a raw pointer because GObject structs are zero-initialised C.
+  Metronome* metronome;
+};
+
+G_DEFINE_TYPE(MetronomePlugin, metronome_plugin, g_object_get_type())
+
+namespace {
+
+FlValue* Lookup(FlValue* arguments, const char* key) {
+  FlValue* value = arguments != nullptr &&
+                           fl_value_get_type(arguments) == FL_VALUE_TYPE_MAP
+                       ? fl_value_lookup_string(arguments, key)
+                       : nullptr;
+  if (value == nullptr) {
+    throw std::invalid_argument(std::string("Missing argument ") + key);
+  }
+  return value;
+}
+
+int IntArgument(FlValue* arguments, const char* key) {
+  return static_cast<int>(fl_value_get_int(Lookup(arguments, key)));
+}
+
+double DoubleArgument(FlValue* arguments, const char* key) {
+  return fl_value_get_float(Lookup(arguments, key));
+}
+
+std::vector<uint8_t> BytesArgument(FlValue* arguments, const char* key) {
+  FlValue* value = Lookup(arguments, key);
+  const uint8_t* bytes = fl_value_get_uint8_list(value);
+  return std::vector<uint8_t>(bytes, bytes + fl_value_get_length(value));
+}
+
+std::vector<int> IntListArgument(FlValue* arguments, const char* key) {
+  FlValue* value = Lookup(arguments, key);
+  std::vector<int> values;
+  for (size_t i = 0; i < fl_value_get_length(value); i++) {
+    values.push_back(
+        static_cast<int>(fl_value_get_int(fl_value_get_list_value(value, i))));
+  }
+  return values;
+}
+
+// A grid as sent by MetronomeGrid.toMap: a step count and sparse hits.
+metronome::StepGrid GridArgument(FlValue* arguments) {
+  metronome::StepGrid grid;
+  grid.steps = IntArgument(arguments, "steps");
+  FlValue* hits = Lookup(arguments, "hits");
+  for (size_t i = 0; i < fl_value_get_length(hits); i++) {
+    FlValue* hit = fl_value_get_list_value(hits, i);
+    const int step = IntArgument(hit, "step");
+    const int lane = IntArgument(hit, "lane");
+    const int sample = IntArgument(hit, "sample");
+    const int velocity = IntArgument(hit, "velocity");
+    if (step < 0 || step >= metronome::kMaxGridSteps || lane < 0 ||
+        lane >= metronome::kGridLanes || sample < 0 || sample > 255 ||
+        velocity < 0 || velocity > 127) {
+      throw std::invalid_argument("Grid hit out of range");
+    }
+    grid.cells[step][lane] = metronome::GridCell{
+        static_cast<uint8_t>(sample), static_cast<uint8_t>(velocity)};
+  }
+  return grid;
+}
+
+std::vector<std::vector<uint8_t>> BytesListArgument(FlValue* arguments,
+                                                    const char* key) {
+  FlValue* value = Lookup(arguments, key);
+  std::vector<std::vector<uint8_t>> values;
+  for (size_t i = 0; i < fl_value_get_length(value); i++) {
+    FlValue* item = fl_value_get_list_value(value, i);
+    const uint8_t* bytes = fl_value_get_uint8_list(item);
+    values.emplace_back(bytes, bytes + fl_value_get_length(item));
+  }
+  return values;
+}
+
+FlValue* LevelValue(const metronome::Level& level) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "peak", fl_value_new_float(level.peak));
+  fl_value_set_string_take(value, "rms", fl_value_new_float(level.rms));
+  return value;
+}
+
+FlValue* LevelsValue(const metronome::BlockLevels& levels) {
+  FlValue* lanes = fl_value_new_list();
+  for (const metronome::Level& lane : levels.lanes) {
+    fl_value_append_take(lanes, LevelValue(lane));
+  }
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "output", LevelValue(levels.output));
+  fl_value_set_string_take(value, "click", LevelValue(levels.click));
+  fl_value_set_string_take(value, "lanes", lanes);
+  return value;
+}
+
+FlValue* MemoryUsageValue(const metronome::MemoryUsage& usage) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "limit", fl_value_new_int(usage.limit));
+  fl_value_set_string_take(value, "used", fl_value_new_int(usage.used));
+  for (int component = 0; component < metronome::kMemoryComponents;
+       component++) {
+    fl_value_set_string_take(
+        value,
+        metronome::MemoryComponentName(
+            static_cast<metronome::MemoryComponent>(component)),
+        fl_value_new_int(usage.components[component]));
+  }
+  fl_value_set_string_take(value, "refusals",
+                           fl_value_new_int(usage.refusals));
+  return value;
+}
+
+FlValue* StreamStatsValue(const metronome::StreamStats& stats) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "periods", fl_value_new_int(stats.periods));
+  fl_value_set_string_take(value, "xruns", fl_value_new_int(stats.xruns));
+  fl_value_set_string_take(value, "lostFrames",
+                           fl_value_new_int(stats.lostFrames));
+  fl_value_set_string_take(value, "failovers",
+                           fl_value_new_int(stats.failovers));
+  fl_value_set_string_take(value, "lastFailoverMs",
+                           fl_value_new_float(stats.lastFailoverMs));
+  fl_value_set_string_take(value, "maxFailoverMs",
+                           fl_value_new_float(stats.maxFailoverMs));
+  fl_value_set_string_take(value, "stalls", fl_value_new_int(stats.stalls));
+  return value;
+}
+
+FlMethodResponse* Success(FlValue* value) {
+  g_autoptr(FlValue) owned = value;
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(owned));
+}
+
+// Fails the call and keeps a record of it in the diagnostic log.
+FlMethodResponse* Error(const char* method, const char* code,
+                        const char* message) {
+  metronome::Log(metronome::LogLevel::Error, "plugin", "%s failed (%s): %s",
+                 method, code, message);
+  return FL_METHOD_RESPONSE(
+      fl_method_error_response_new(code, message, nullptr));
+}
+
+FlMethodResponse* HandleMetronomeCall(MetronomePlugin* self,
+                                      const gchar* method,
+                                      FlValue* arguments) {
+  if (strcmp(method, "init") == 0) {
+    delete self->metronome;
+    self->metronome = nullptr;
+    self->metronome = new Metronome(
+        BytesArgument(arguments, "mainFileBytes"),
+        BytesArgument(arguments, "accentedFileBytes"),
+        IntArgument(arguments, "bpm"), IntArgument(arguments, "timeSignature"),
+        DoubleArgument(arguments, "volume"),
+        IntArgument(arguments, "sampleRate"),
+        IntArgument(arguments, "channels"),
+        static_cast<size_t>(
+            std::max<int64_t>(0, fl_value_get_int(Lookup(arguments, "memoryBudget")))));
+    if (fl_value_get_bool(Lookup(arguments, "enableTickCallback"))) {
+      self->metronome->EnableTickCallback(
+          [self](const metronome::TickEvent& tick) {
+            if (self->tick_listening) {
+              g_autoptr(FlValue) value = fl_value_new_map();
+              fl_value_set_string_take(value, "beat",
+                                       fl_value_new_int(tick.beat));
+              fl_value_set_string_take(value, "muted",
+                                       fl_value_new_bool(tick.muted));
+              fl_event_channel_send(self->tick_channel, value, nullptr,
+                                    nullptr);
+            }
+          });
+    }
+    return Success(fl_value_new_bool(TRUE));
+  }
+
+  if (self->metronome == nullptr) {
+    return Error(method, "not_initialized", "Call init first");
+  }
+  Metronome& metronome = *self->metronome;
+  if (strcmp(method, "play") == 0) {
+    metronome.Play();
+  } else if (strcmp(method, "pause") == 0) {
+    metronome.Pause();
+  } else if (strcmp(method, "stop") == 0) {
+    metronome.Stop();
+  } else if (strcmp(method, "setBPM") == 0) {
+    metronome.SetBPM(IntArgument(arguments, "bpm"));
+  } else if (strcmp(method, "getBPM") == 0) {
+    return Success(fl_value_new_int(metronome.audioBpm));
+  } else if (strcmp(method, "setTimeSignature") == 0) {
+    metronome.SetTimeSignature(IntArgument(arguments, "timeSignature"));
+  } else if (strcmp(method, "setMeter") == 0) {
+    metronome.SetMeter(IntArgument(arguments, "numerator"),
+                       IntArgument(arguments, "denominator"),
+                       IntListArgument(arguments, "grouping"),
+                       fl_value_get_bool(Lookup(arguments, "feltInGroups")));
+  } else if (strcmp(method, "setGrid") == 0) {
+    metronome.SetGrid(GridArgument(arguments));
+  } else if (strcmp(method, "setPattern") == 0) {
+    metronome.SetPattern(fl_value_get_string(Lookup(arguments, "notation")));
+  } else if (strcmp(method, "setGridSamples") == 0) {
+    metronome.SetGridSamples(BytesListArgument(arguments, "samples"));
+  } else if (strcmp(method, "setLoudnessMatching") == 0) {
+    metronome.SetLoudnessMatching(
+        fl_value_get_bool(Lookup(arguments, "enabled")));
+  } else if (strcmp(method, "setRoute") == 0) {
+    metronome.SetRoute(IntArgument(arguments, "layer"),
+                       IntArgument(arguments, "channel"),
+                       DoubleArgument(arguments, "pan"));
+  } else if (strcmp(method, "setGapClick") == 0) {
+    metronome.SetGapClick(IntArgument(arguments, "playBars"),
+                          IntArgument(arguments, "muteBars"),
+                          fl_value_get_bool(Lookup(arguments, "randomised")));
+  } else if (strcmp(method, "getTimeSignature") == 0) {
+    return Success(fl_value_new_int(metronome.audioTimeSignature));
+  } else if (strcmp(method, "setVolume") == 0) {
+    metronome.SetVolume(DoubleArgument(arguments, "volume"));
+  } else if (strcmp(method, "getVolume") == 0) {
+    return Success(fl_value_new_int(metronome.GetVolume()));
+  } else if (strcmp(method, "getLevels") == 0) {
+    return Success(LevelsValue(metronome.GetLevels()));
+  } else if (strcmp(method, "getMemoryUsage") == 0) {
+    return Success(MemoryUsageValue(metronome.GetMemoryUsage()));
+  } else if (strcmp(method, "getStreamStats") == 0) {
+    return Success(StreamStatsValue(metronome.GetStreamStats()));
+  } else if (strcmp(method, "startOscBroadcast") == 0) {
+    metronome.StartOscBroadcast(
+        fl_value_get_string(Lookup(arguments, "host")),
+        IntArgument(arguments, "port"), IntArgument(arguments, "lookAheadMs"));
+  } else if (strcmp(method, "stopOscBroadcast") == 0) {
+    metronome.StopOscBroadcast();
+  } else if (strcmp(method, "setAudioFile") == 0) {
+    metronome.SetAudioFile(BytesArgument(arguments, "mainFileBytes"),
+                           BytesArgument(arguments, "accentedFileBytes"));
+  } else if (strcmp(method, "isPlaying") == 0) {
+    return Success(fl_value_new_bool(metronome.IsPlaying()));
+  } else if (strcmp(method, "destroy") == 0) {
+    delete self->metronome;
+    self->metronome = nullptr;
+  } else {
+    return nullptr;
+  }
+  return Success(fl_value_new_bool(TRUE));
+}
+
+}  // namespace
+
+// Called when a method call is received from Flutter.
+static void metronome_plugin_handle_method_call(MetronomePlugin* self,
+                                                FlMethodCall* method_call) {
+  g_autoptr(FlMethodResponse) response = nullptr;
+
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* arguments = fl_method_call_get_args(method_call);
+
+  try {
+    if (strcmp(method, "setLogLevel") == 0) {
+      const int level = std::clamp(
+          IntArgument(arguments, "level"), 0,
+          static_cast<int>(metronome::LogLevel::Off));
+      metronome::SetLogLevel(static_cast<metronome::LogLevel>(level));
+      response = Success(fl_value_new_bool(TRUE));
+    } else if (strcmp(method, "setLogFile") == 0) {
+      metronome::SetLogFile(
+          fl_value_get_string(Lookup(arguments, "path")));
+      response = Success(fl_value_new_bool(TRUE));
+    } else {
+      response = HandleMetronomeCall(self, method, arguments);
+    }
+  } catch (const std::invalid_argument& e) {
+    response = Error(method, "invalid_argument", e.what());
+  } catch (const std::exception& e) {
+    response = Error(method, "audio_error", e.what());
+  }
+  if (response == nullptr) {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+static void metronome_plugin_dispose(GObject* object) {
+  MetronomePlugin* self = METRONOME_PLUGIN(object);
+  delete self->metronome;
+  self->metronome = nullptr;
+  g_clear_object(&self->tick_channel);
+
+  G_OBJECT_CLASS(metronome_plugin_parent_class)->dispose(object);
+}
+
+static void metronome_plugin_class_init(MetronomePluginClass* klass) {
+  G_OBJECT_CLASS(klass)->dispose = metronome_plugin_dispose;
+}
+
+static void metronome_plugin_init(MetronomePlugin* self) {}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  MetronomePlugin* plugin = METRONOME_PLUGIN(user_data);
+  metronome_plugin_handle_method_call(plugin, method_call);
+}
+
+static FlMethodErrorResponse* tick_listen_cb(FlEventChannel* channel,
+                                             FlValue* args,
+                                             gpointer user_data) {
+  METRONOME_PLUGIN(user_data)->tick_listening = TRUE;
+  return nullptr;
+}
+
+static FlMethodErrorResponse* tick_cancel_cb(FlEventChannel* channel,
+                                             FlValue* args,
+                                             gpointer user_data) {
+  METRONOME_PLUGIN(user_data)->tick_listening = FALSE;
+  return nullptr;
+}
+
+void metronome_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
+  MetronomePlugin* plugin = METRONOME_PLUGIN(
+      g_object_new(metronome_plugin_get_type(), nullptr));
+
+  FlBinaryMessenger* messenger = fl_plugin_registrar_get_messenger(registrar);
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  g_autoptr(FlMethodChannel) channel =
+      fl_method_channel_new(messenger, "metronome", FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(channel, method_call_cb,
+                                            g_object_ref(plugin),
+                                            g_object_unref);
+
+  plugin->tick_channel =
+      fl_event_channel_new(messenger, "metronome_tick", FL_METHOD_CODEC(codec));
+  // The plugin owns the channel, so the handlers must not hold a reference
+  // back to it.
+  fl_event_channel_set_stream_handlers(plugin->tick_channel, tick_listen_cb,
+                                       tick_cancel_cb, plugin, nullptr);
+
+  g_object_unref(plugin);
+}
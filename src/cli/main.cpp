@@ -0,0 +1,963 @@
+// metronome_cli: the engine core without Flutter, for rendering, playing
+// and profiling on machines with no UI (build servers, CI, ops boxes).
+//
+//   metronome_cli render --out click.wav --bpm 132 --bars 16
+//   metronome_cli play --seconds 10 --device null
+//   metronome_cli bench --seconds 600 --block 256
+//   metronome_cli stats --midi song.mid
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metronome_audio_file.h"
+#include "metronome_engine.h"
+#include "metronome_log.h"
+#include "metronome_loudness.h"
+#include "metronome_memory_budget.h"
+#include "metronome_midi.h"
+#include "metronome_mirror_stream.h"
+#include "metronome_null_sink.h"
+#include "metronome_osc.h"
+#include "metronome_pattern.h"
+#include "metronome_peer_sync.h"
+#include "metronome_render_ahead.h"
+#include "metronome_renderer.h"
+#include "metronome_snapshot.h"
+#include "metronome_stream.h"
+#include "metronome_timeline.h"
+#include "metronome_trace.h"
+#include "metronome_transport.h"
+#include "metronome_transport_publisher.h"
+#include "metronome_watchdog.h"
+#if defined(METRONOME_HAVE_ALSA)
+#include "metronome_alsa_sink.h"
+#endif
+
+namespace metronome
+{
+    namespace cli
+    {
+        namespace
+        {
+            constexpr const char *kUsage =
+                "usage: metronome_cli <command> [options]\n"
+                "\n"
+                "commands:\n"
+                "  render   write a click track to --out (WAV or FLAC)\n"
+                "  play     stream the live engine to an audio device\n"
+                "  bench    time the live engine and the offline renderer\n"
+                "  stats    summarise the compiled timeline of a song\n"
+                "  snapshot save the engine play would build to --out, for play --snapshot\n"
+                "  follow   print where a play --transport is, ten times a second\n"
+                "\n"
+                "song and engine options:\n"
+                "  --bpm X                tempo in quarter notes per minute (120)\n"
+                "  --time-signature N     beats per bar (4)\n"
+                "  --denominator N        note value of a beat, a power of two (4)\n"
+                "  --grouping A+B+...     beats per group within the bar, e.g. 2+2+3\n"
+                "  --felt-in-groups BOOL  click only the first beat of each group (false)\n"
+                "  --bars N               song length for render and stats (8)\n"
+                "  --volume V             0.0 to 1.0 (1.0)\n"
+                "  --sample-rate R        frames per second (44100)\n"
+                "  --main FILE            16-bit PCM click sound (built-in beep)\n"
+                "  --accent FILE          accented click sound (--main)\n"
+                "  --match-loudness BOOL  trim the accent to the main sound's loudness (false)\n"
+                "  --midi FILE            take tempo, meter and bars from a MIDI file\n"
+                "\n"
+                "command options:\n"
+                "  --out FILE             render, snapshot: output path\n"
+                "  --format wav|flac      render: container (from the extension)\n"
+                "  --seconds S            play, bench, follow: duration (10)\n"
+                "  --device NAME          play: ALSA PCM name, or null (default)\n"
+                "  --snapshot FILE        play: start from a saved engine instead of the song\n"
+                "                         and engine options\n"
+                "  --mirror NAME          play: also play on this device, drift-compensated\n"
+                "  --render-ahead FRAMES  play: render on a thread of its own, this many frames\n"
+                "                         ahead; at least period x periods (0, off)\n"
+                "  --watchdog MS          play: restart the device if it plays nothing for\n"
+                "                         this long without an error (0, off)\n"
+                "  --osc HOST:PORT        play: send each beat as OSC over UDP\n"
+                "  --osc-lookahead MS     play: send beats this long before they sound (0)\n"
+                "  --transport NAME       play: publish where the output is to shared memory;\n"
+                "                         follow: read it\n"
+                "  --peer-sync GROUP:PORT play: share tempo and bar phase with peers on this\n"
+                "                         multicast group\n"
+                "  --peer-interface ADDR  play: interface address to join the group on\n"
+                "                         (0.0.0.0; 127.0.0.1 for this machine only)\n"
+                "  --memory-budget BYTES  play: cap on memory for kits and rings, refused at\n"
+                "                         startup if exceeded (0, no cap)\n"
+                "  --period FRAMES        play: frames per period (10 ms)\n"
+                "  --periods N            play: periods in the device buffer (4)\n"
+                "  --block FRAMES         bench: frames per render call (512)\n"
+                "  --mute-bars N          play, bench: gap click, muting N bars (0, off)\n"
+                "  --play-bars N          play, bench: bars to play between gaps (1)\n"
+                "  --random-gaps BOOL     play, bench: mute bars at random instead (false)\n"
+                "  --grid STEPS           play, bench: a step grid with a hit on every lane of\n"
+                "                         every step instead of the click (0, off)\n"
+                "  --pattern NOTATION     play, bench: a bar in pattern notation instead of\n"
+                "                         --grid, e.g. \"X.x.|x.x.|(3)xxx|x...\"\n"
+                "  --channels N           play, bench: interleaved output channels, with grid\n"
+                "                         lanes spread across them (1)\n"
+                "  --pan P                play, bench: click pan between channels 0 and 1 (0.0)\n"
+                "  --log-level LEVEL      debug, info, warning, error or off (warning)\n"
+                "  --trace FILE           write a Chrome trace (tracing builds only)\n";
+
+            struct Options
+            {
+                std::string command;
+                std::map<std::string, std::string> values;
+
+                bool Has(const std::string &key) const { return values.count(key) != 0; }
+
+                std::string String(const std::string &key, const std::string &fallback) const
+                {
+                    auto it = values.find(key);
+                    return it == values.end() ? fallback : it->second;
+                }
+
+                double Number(const std::string &key, double fallback) const
+                {
+                    auto it = values.find(key);
+                    if (it == values.end())
+                    {
+                        return fallback;
+                    }
+                    size_t used = 0;
+                    double value = 0.0;
+                    try
+                    {
+                        value = std::stod(it->second, &used);
+                    }
+                    catch (const std::exception &)
+                    {
+                    }
+                    if (used == 0 || used != it->second.size())
+                    {
+                        throw std::invalid_argument("--" + key + " expects a number, got '" + it->second + "'");
+                    }
+                    return value;
+                }
+
+                int Integer(const std::string &key, int fallback) const
+                {
+                    const double value = Number(key, fallback);
+                    if (value != std::floor(value))
+                    {
+                        throw std::invalid_argument("--" + key + " expects a whole number");
+                    }
+                    return static_cast<int>(value);
+                }
+
+                bool Bool(const std::string &key, bool fallback) const
+                {
+                    const std::string value = String(key, fallback ? "true" : "false");
+                    if (value != "true" && value != "false")
+                    {
+                        throw std::invalid_argument("--" + key + " expects true or false");
+                    }
+                    return value == "true";
+                }
+
+                // "2+2+3" as {2, 2, 3}; empty when the option is absent.
+                std::vector<int> Grouping(const std::string &key) const
+                {
+                    std::vector<int> grouping;
+                    const std::string value = String(key, "");
+                    size_t start = 0;
+                    while (start < value.size())
+                    {
+                        size_t end = value.find('+', start);
+                        if (end == std::string::npos)
+                        {
+                            end = value.size();
+                        }
+                        const std::string part = value.substr(start, end - start);
+                        if (part.empty() || part.find_first_not_of("0123456789") != std::string::npos)
+                        {
+                            throw std::invalid_argument("--" + key + " expects counts joined by '+', got '" + value + "'");
+                        }
+                        grouping.push_back(std::stoi(part));
+                        start = end + 1;
+                    }
+                    return grouping;
+                }
+            };
+
+            Options ParseOptions(int argc, char **argv)
+            {
+                if (argc < 2)
+                {
+                    throw std::invalid_argument("missing command");
+                }
+                Options options;
+                options.command = argv[1];
+                for (int i = 2; i < argc; i++)
+                {
+                    std::string argument = argv[i];
+                    if (argument.compare(0, 2, "--") != 0 || argument.size() == 2)
+                    {
+                        throw std::invalid_argument("unexpected argument '" + argument + "'");
+                    }
+                    argument.erase(0, 2);
+                    const size_t equals = argument.find('=');
+                    if (equals != std::string::npos)
+                    {
+                        options.values[argument.substr(0, equals)] = argument.substr(equals + 1);
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        options.values[argument] = argv[++i];
+                    }
+                    else
+                    {
+                        throw std::invalid_argument("--" + argument + " needs a value");
+                    }
+                }
+                return options;
+            }
+
+            std::vector<uint8_t> ReadFile(const std::string &path)
+            {
+                std::ifstream file(path, std::ios::binary);
+                if (!file)
+                {
+                    throw std::runtime_error("Failed to open " + path);
+                }
+                return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            }
+
+            constexpr double kPi = 3.14159265358979323846;
+
+            // A 30 ms decaying sine, so the tool works without sound files.
+            std::vector<int16_t> Beep(int sampleRate, double frequency)
+            {
+                std::vector<int16_t> pcm(static_cast<size_t>(sampleRate * 0.03));
+                for (size_t i = 0; i < pcm.size(); i++)
+                {
+                    const double t = static_cast<double>(i) / sampleRate;
+                    pcm[i] = static_cast<int16_t>(std::lround(20000.0 * std::exp(-t * 150.0) *
+                                                              std::sin(2.0 * kPi * frequency * t)));
+                }
+                return pcm;
+            }
+
+            Kit KitFrom(const Options &options, int sampleRate)
+            {
+                Kit kit;
+                kit.mainSound = options.Has("main") ? BytesToPcm16(ReadFile(options.String("main", ""))) : Beep(sampleRate, 1000.0);
+                if (options.Has("accent"))
+                {
+                    kit.accentedSound = BytesToPcm16(ReadFile(options.String("accent", "")));
+                }
+                else
+                {
+                    kit.accentedSound = options.Has("main") ? kit.mainSound : Beep(sampleRate, 1500.0);
+                }
+                kit.matchLoudness = options.Bool("match-loudness", false);
+                return kit;
+            }
+
+            bool HasMeter(const Options &options)
+            {
+                return options.Has("denominator") || options.Has("grouping") || options.Has("felt-in-groups");
+            }
+
+            MeterChange MeterFrom(const Options &options, int numerator)
+            {
+                MeterChange meter = {0, numerator, options.Integer("denominator", 4)};
+                meter.grouping = options.Grouping("grouping");
+                meter.feltInGroups = options.Bool("felt-in-groups", false);
+                return meter;
+            }
+
+            Song SongFrom(const Options &options)
+            {
+                Song song;
+                if (options.Has("midi"))
+                {
+                    song = ReadMidiFile(ReadFile(options.String("midi", "")));
+                }
+                else
+                {
+                    song.bars = 8;
+                }
+                if (options.Has("bpm") || song.tempoMap.empty())
+                {
+                    TempoSegment tempo;
+                    tempo.bpm = options.Number("bpm", 120.0);
+                    song.tempoMap.assign(1, tempo);
+                }
+                song.bars = options.Integer("bars", song.bars);
+                song.timeSignature = options.Integer("time-signature", song.timeSignature);
+                song.sampleRate = options.Integer("sample-rate", song.sampleRate);
+                song.volume = options.Number("volume", song.volume);
+                song.kit = KitFrom(options, song.sampleRate);
+                if (HasMeter(options))
+                {
+                    song.meterMap.assign(1, MeterFrom(options, song.timeSignature));
+                }
+                return song;
+            }
+
+            // A worst-case grid: every lane hit on every step, quietly enough
+            // that the mix does not clip. Or --pattern, compiled.
+            void ApplyGrid(ClickEngine &engine, const Options &options)
+            {
+                if (options.Has("pattern"))
+                {
+                    engine.SetGrid(CompilePattern(options.String("pattern", "")));
+                    return;
+                }
+                StepGrid grid;
+                grid.steps = options.Integer("grid", 0);
+                for (int step = 0; step < std::min(grid.steps, kMaxGridSteps); step++)
+                {
+                    for (int lane = 0; lane < kGridLanes; lane++)
+                    {
+                        grid.cells[step][lane] = GridCell{static_cast<uint8_t>(step == 0 ? 1 : 0), 16};
+                    }
+                }
+                engine.SetGrid(grid);
+            }
+
+            // Pans the click, and gives each grid lane a channel of its own
+            // as far as they go.
+            void ApplyRoutes(ClickEngine &engine, const Options &options)
+            {
+                const double pan = options.Number("pan", 0.0);
+                engine.SetRoute(0, 0, pan);
+                engine.SetRoute(1, 0, pan);
+                for (int lane = 0; lane < kGridLanes; lane++)
+                {
+                    engine.SetRoute(2 + lane, lane % engine.Channels(), 0.0);
+                }
+            }
+
+            void ApplyGapClick(ClickEngine &engine, const Options &options)
+            {
+                if (options.Has("mute-bars"))
+                {
+                    engine.SetGapClick(options.Integer("play-bars", 1), options.Integer("mute-bars", 0),
+                                       options.Bool("random-gaps", false));
+                }
+            }
+
+            // Gives a live engine the meter options, if any were given.
+            void ApplyMeter(ClickEngine &engine, const Options &options, int numerator)
+            {
+                if (HasMeter(options))
+                {
+                    const MeterChange meter = MeterFrom(options, numerator);
+                    engine.SetMeter(meter.numerator, meter.denominator, meter.grouping, meter.feltInGroups);
+                }
+            }
+
+            // Collects samples and prints percentiles and a log2-bucketed
+            // bar chart.
+            class Histogram
+            {
+            public:
+                explicit Histogram(std::string unit) : unit(std::move(unit)) {}
+
+                void Add(int64_t value) { values.push_back(value); }
+                size_t Count() const { return values.size(); }
+
+                void Print(const std::string &title) const
+                {
+                    std::printf("%s (%zu samples, %s)\n", title.c_str(), values.size(), unit.c_str());
+                    if (values.empty())
+                    {
+                        return;
+                    }
+                    std::vector<int64_t> sorted = values;
+                    std::sort(sorted.begin(), sorted.end());
+                    auto percentile = [&](double p)
+                    {
+                        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+                    };
+                    std::printf("  min %lld  p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+                                static_cast<long long>(sorted.front()), static_cast<long long>(percentile(0.5)),
+                                static_cast<long long>(percentile(0.9)), static_cast<long long>(percentile(0.99)),
+                                static_cast<long long>(sorted.back()));
+
+                    std::map<int, size_t> buckets;
+                    for (int64_t value : sorted)
+                    {
+                        int bucket = 0;
+                        while (bucket < 62 && (int64_t(1) << (bucket + 1)) <= std::max<int64_t>(1, value))
+                        {
+                            bucket++;
+                        }
+                        buckets[value <= 0 ? -1 : bucket]++;
+                    }
+                    size_t largest = 0;
+                    for (const auto &bucket : buckets)
+                    {
+                        largest = std::max(largest, bucket.second);
+                    }
+                    for (const auto &bucket : buckets)
+                    {
+                        const std::string bar(std::max<size_t>(1, bucket.second * 50 / largest), '#');
+                        if (bucket.first < 0)
+                        {
+                            std::printf("  %22s %8zu %s\n", "<= 0", bucket.second, bar.c_str());
+                        }
+                        else
+                        {
+                            std::printf("  [%9lld, %9lld) %8zu %s\n", static_cast<long long>(int64_t(1) << bucket.first),
+                                        static_cast<long long>(int64_t(1) << (bucket.first + 1)), bucket.second, bar.c_str());
+                        }
+                    }
+                }
+
+            private:
+                std::string unit;
+                std::vector<int64_t> values;
+            };
+
+            using Clock = std::chrono::steady_clock;
+
+            int64_t Nanoseconds(Clock::duration duration)
+            {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+            }
+
+            std::atomic<bool> interrupted{false};
+
+            void OnInterrupt(int)
+            {
+                interrupted.store(true);
+            }
+
+            int Render(const Options &options)
+            {
+                const std::string out = options.String("out", "");
+                if (out.empty())
+                {
+                    throw std::invalid_argument("render needs --out");
+                }
+                std::string format = options.String("format", "");
+                if (format.empty())
+                {
+                    format = out.size() >= 5 && out.compare(out.size() - 5, 5, ".flac") == 0 ? "flac" : "wav";
+                }
+                if (format != "wav" && format != "flac")
+                {
+                    throw std::invalid_argument("--format must be wav or flac");
+                }
+
+                const Song song = SongFrom(options);
+                const Clock::time_point start = Clock::now();
+                OfflineRenderer renderer(song);
+                auto writer = CreateAudioFileWriter(out, format == "flac" ? AudioFileFormat::Flac : AudioFileFormat::Wav,
+                                                    song.sampleRate);
+                std::vector<int16_t> block(8192);
+                while (size_t frames = renderer.Render(block.data(), block.size()))
+                {
+                    writer->Write(block.data(), frames);
+                }
+                writer->Close();
+                const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                const double length = static_cast<double>(renderer.Length()) / song.sampleRate;
+                std::printf("wrote %s: %lld frames (%.2f s of audio) in %.3f s, %.0fx realtime\n", out.c_str(),
+                            static_cast<long long>(renderer.Length()), length, seconds, length / std::max(seconds, 1e-9));
+                return 0;
+            }
+
+            std::unique_ptr<AudioSink> OpenSink(const std::string &device)
+            {
+                if (device == "null")
+                {
+                    return std::make_unique<NullSink>();
+                }
+#if defined(METRONOME_HAVE_ALSA)
+                return std::make_unique<AlsaSink>(device);
+#else
+                throw std::invalid_argument("this build has no audio device support; use --device null");
+#endif
+            }
+
+            // The engine play and snapshot start from: loaded from --snapshot
+            // when given, else built from the song options.
+            std::unique_ptr<ClickEngine> EngineFrom(const Options &options, MemoryBudget *budget)
+            {
+                if (options.Has("snapshot"))
+                {
+                    const std::string path = options.String("snapshot", "");
+                    const Clock::time_point start = Clock::now();
+                    std::unique_ptr<ClickEngine> engine = LoadSnapshot(path, budget);
+                    std::printf("loaded %s in %.2f ms\n", path.c_str(),
+                                std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+                    return engine;
+                }
+                const int sampleRate = options.Integer("sample-rate", 44100);
+                auto engine = std::make_unique<ClickEngine>(KitFrom(options, sampleRate), options.Number("bpm", 120.0),
+                                                            options.Integer("time-signature", 4),
+                                                            options.Number("volume", 1.0), sampleRate,
+                                                            options.Integer("channels", 1), budget);
+                ApplyMeter(*engine, options, options.Integer("time-signature", 4));
+                ApplyGrid(*engine, options);
+                ApplyRoutes(*engine, options);
+                ApplyGapClick(*engine, options);
+                return engine;
+            }
+
+            int Snapshot(const Options &options)
+            {
+                if (!options.Has("out"))
+                {
+                    throw std::invalid_argument("snapshot needs --out");
+                }
+                const std::string out = options.String("out", "");
+                std::unique_ptr<ClickEngine> engine = EngineFrom(options, nullptr);
+                WriteSnapshot(*engine, out);
+                std::printf("wrote %s: %d Hz, %d channels, %zu sounds\n", out.c_str(), engine->SampleRate(),
+                            engine->Channels(), engine->PlayingKit().SampleCount());
+                return 0;
+            }
+
+            int Play(const Options &options)
+            {
+                const double seconds = options.Number("seconds", 10.0);
+#if defined(METRONOME_HAVE_ALSA)
+                const std::string device = options.String("device", "default");
+#else
+                const std::string device = options.String("device", "null");
+#endif
+                // Declared first, so it outlives everything reserved from it.
+                MemoryBudget budget(static_cast<size_t>(std::max(0, options.Integer("memory-budget", 0))));
+                const std::unique_ptr<ClickEngine> built = EngineFrom(options, &budget);
+                ClickEngine &engine = *built;
+                const int sampleRate = engine.SampleRate();
+                std::unique_ptr<AudioSink> sink = OpenSink(device);
+                SinkConfig config;
+                config.sampleRate = sampleRate;
+                config.channels = engine.Channels();
+                config.periodFrames = options.Integer("period", std::max(1, sampleRate / 100));
+                config.periods = options.Integer("periods", 4);
+                // Declared first, so the stream stops it before it goes.
+                std::unique_ptr<AudioSink> mirrorSink;
+                std::unique_ptr<MirrorStream> mirror;
+                if (options.Has("mirror"))
+                {
+                    mirrorSink = OpenSink(options.String("mirror", "null"));
+                    mirror = std::make_unique<MirrorStream>(*mirrorSink, config, &budget);
+                }
+                std::unique_ptr<TransportPublisher> transport;
+                if (options.Has("transport"))
+                {
+                    transport = std::make_unique<TransportPublisher>(options.String("transport", ""), sampleRate);
+                }
+                AudioStream stream(engine, *sink, config);
+                if (transport)
+                {
+                    stream.SetTransportPublisher(*transport);
+                }
+                if (mirror)
+                {
+                    stream.AddMirror(*mirror);
+                }
+                std::unique_ptr<RenderAhead> ahead;
+                if (options.Integer("render-ahead", 0) > 0)
+                {
+                    ahead = std::make_unique<RenderAhead>(engine, static_cast<size_t>(options.Integer("render-ahead", 0)),
+                                                          static_cast<size_t>(config.periodFrames), &budget);
+                    stream.SetRenderAhead(*ahead);
+                }
+
+                std::unique_ptr<StallWatchdog> watchdog;
+                if (options.Integer("watchdog", 0) > 0)
+                {
+                    watchdog = std::make_unique<StallWatchdog>([&stream]
+                                                               { return stream.PlayedPosition(); },
+                                                               [&stream]
+                                                               { stream.RestartStalled(); },
+                                                               std::chrono::milliseconds(options.Integer("watchdog", 0)));
+                }
+
+                std::unique_ptr<OscBeatPublisher> osc;
+                if (options.Has("osc"))
+                {
+                    const std::string target = options.String("osc", "");
+                    const size_t colon = target.rfind(':');
+                    if (colon == std::string::npos || colon == 0)
+                    {
+                        throw std::invalid_argument("--osc expects HOST:PORT, got '" + target + "'");
+                    }
+                    OscConfig oscConfig;
+                    oscConfig.host = target.substr(0, colon);
+                    oscConfig.port = std::atoi(target.c_str() + colon + 1);
+                    oscConfig.lookAhead = std::chrono::milliseconds(options.Integer("osc-lookahead", 0));
+                    osc = std::make_unique<OscBeatPublisher>(engine, [&stream]
+                                                             { return stream.PlayedPosition(); }, oscConfig);
+                }
+
+                std::unique_ptr<PeerSync> peerSync;
+                if (options.Has("peer-sync"))
+                {
+                    const std::string group = options.String("peer-sync", "");
+                    const size_t colon = group.rfind(':');
+                    if (colon == std::string::npos || colon == 0)
+                    {
+                        throw std::invalid_argument("--peer-sync expects GROUP:PORT, got '" + group + "'");
+                    }
+                    PeerSyncConfig syncConfig;
+                    syncConfig.group = group.substr(0, colon);
+                    syncConfig.port = std::atoi(group.c_str() + colon + 1);
+                    syncConfig.interfaceAddress = options.String("peer-interface", "0.0.0.0");
+                    peerSync = std::make_unique<PeerSync>(engine, [&stream]
+                                                          { return stream.PlayedPosition(); }, syncConfig);
+                }
+
+                std::signal(SIGINT, OnInterrupt);
+                stream.Start();
+                if (watchdog)
+                {
+                    watchdog->Start();
+                }
+                if (osc)
+                {
+                    osc->Start();
+                }
+                if (peerSync)
+                {
+                    peerSync->Start();
+                }
+                std::printf("playing on %s: %d Hz, %d channels, %d periods of %d frames; Ctrl-C stops\n", device.c_str(),
+                            stream.Config().sampleRate, stream.Config().channels, stream.Config().periods,
+                            stream.Config().periodFrames);
+
+                // How far each tick's arrival strays from the grid set by the
+                // first one. Ticks are polled every millisecond, so this is
+                // a coarse view of delivery jitter, not of the audio itself.
+                Histogram jitter("us");
+                Clock::time_point firstArrival;
+                int64_t firstFrame = -1;
+                size_t mutedTicks = 0;
+                const Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                                 std::chrono::duration<double>(seconds));
+                while (Clock::now() < end && stream.Running() && !interrupted.load())
+                {
+                    TickEvent tick;
+                    while (stream.PopPlayedTick(tick))
+                    {
+                        const Clock::time_point now = Clock::now();
+                        mutedTicks += tick.muted ? 1 : 0;
+                        if (firstFrame < 0)
+                        {
+                            firstFrame = tick.frame;
+                            firstArrival = now;
+                        }
+                        const double expected = static_cast<double>(tick.frame - firstFrame) / sampleRate;
+                        const double actual = std::chrono::duration<double>(now - firstArrival).count();
+                        jitter.Add(std::llround(std::fabs(actual - expected) * 1e6));
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                const bool failed = !stream.Running();
+                if (peerSync)
+                {
+                    peerSync->Stop();
+                }
+                if (osc)
+                {
+                    osc->Stop();
+                }
+                if (watchdog)
+                {
+                    watchdog->Stop();
+                }
+                stream.Stop();
+                std::signal(SIGINT, SIG_DFL);
+
+                const StreamStats stats = stream.Stats();
+                std::printf("periods %llu  xruns %llu  skipped frames %lld  ticks %zu (%zu muted)\n",
+                            static_cast<unsigned long long>(stats.periods), static_cast<unsigned long long>(stats.xruns),
+                            static_cast<long long>(stats.lostFrames), jitter.Count(), mutedTicks);
+                std::printf("device failovers %llu (%llu stalled)  last %.1f ms  worst %.1f ms\n",
+                            static_cast<unsigned long long>(stats.failovers), static_cast<unsigned long long>(stats.stalls),
+                            stats.lastFailoverMs, stats.maxFailoverMs);
+                if (ahead)
+                {
+                    const RenderAheadStats rendered = ahead->Stats();
+                    std::printf("rendered ahead %zu frames  blocks %llu  late frames %lld  slowest block %.1f us\n",
+                                ahead->WatermarkFrames(), static_cast<unsigned long long>(rendered.blocks),
+                                static_cast<long long>(rendered.lateFrames), rendered.maxRenderUs);
+                }
+                if (mirror)
+                {
+                    const MirrorStats mirrored = mirror->Stats();
+                    std::printf("mirror %s  drift %+.1f ppm  delay %.1f frames (%+.2f)  xruns %llu  starved %lld  dropped %lld\n",
+                                options.String("mirror", "null").c_str(), mirrored.driftPpm, mirrored.delayFrames,
+                                mirrored.delayError, static_cast<unsigned long long>(mirrored.xruns),
+                                static_cast<long long>(mirrored.starvedFrames), static_cast<long long>(mirrored.droppedFrames));
+                }
+                if (osc)
+                {
+                    const OscStats sent = osc->Stats();
+                    std::printf("osc %s  sent %llu  failed %llu\n", options.String("osc", "").c_str(),
+                                static_cast<unsigned long long>(sent.sent), static_cast<unsigned long long>(sent.failed));
+                }
+                if (peerSync)
+                {
+                    const PeerSyncStats synced = peerSync->Stats();
+                    std::printf("peer sync %s  peers %d  %.2f BPM  phase error %+.2f ms (mean %.2f)  offset +/-%.2f ms\n",
+                                options.String("peer-sync", "").c_str(), synced.peers, synced.bpm, synced.phaseErrorMs,
+                                synced.meanPhaseErrorMs, synced.offsetUncertaintyMs);
+                }
+                if (options.Has("memory-budget"))
+                {
+                    const MemoryUsage usage = budget.Usage();
+                    std::printf("memory %zu of %zu bytes  kits %zu  rings %zu  journal %zu  refused %llu\n", usage.used,
+                                usage.limit, usage.Component(MemoryComponent::Kits),
+                                usage.Component(MemoryComponent::Rings), usage.Component(MemoryComponent::Journal),
+                                static_cast<unsigned long long>(usage.refusals));
+                }
+                jitter.Print("tick delivery jitter");
+                if (failed)
+                {
+                    std::fprintf(stderr, "error: the stream stopped early; see the log\n");
+                    return 1;
+                }
+                return 0;
+            }
+
+            int Bench(const Options &options)
+            {
+                const Song song = SongFrom(options);
+                const double seconds = options.Number("seconds", 10.0);
+                const size_t block = static_cast<size_t>(std::max(1, options.Integer("block", 512)));
+                const int64_t frames = static_cast<int64_t>(seconds * song.sampleRate);
+                const int channels = options.Integer("channels", 1);
+                std::vector<int16_t> buffer(block * static_cast<size_t>(std::max(1, channels)));
+
+                ClickEngine engine(song.kit, song.tempoMap.front().bpm, song.timeSignature, song.volume, song.sampleRate,
+                                   channels);
+                ApplyMeter(engine, options, song.timeSignature);
+                ApplyGrid(engine, options);
+                ApplyRoutes(engine, options);
+                ApplyGapClick(engine, options);
+                Histogram live("ns per block");
+                Clock::time_point start = Clock::now();
+                for (int64_t done = 0; done < frames; done += static_cast<int64_t>(block))
+                {
+                    const Clock::time_point before = Clock::now();
+                    engine.Render(buffer.data(), block);
+                    live.Add(Nanoseconds(Clock::now() - before));
+                    TickEvent tick;
+                    while (engine.PopTick(tick))
+                    {
+                    }
+                }
+                double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+                std::printf("live engine: %.2f s of audio in %.4f s, %.0fx realtime; block deadline %lld ns\n", seconds,
+                            elapsed, seconds / std::max(elapsed, 1e-9),
+                            static_cast<long long>(1000000000LL * static_cast<long long>(block) / song.sampleRate));
+                live.Print("live engine render time");
+
+                OfflineRenderer renderer(song);
+                Histogram offline("ns per block");
+                start = Clock::now();
+                while (true)
+                {
+                    const Clock::time_point before = Clock::now();
+                    if (renderer.Render(buffer.data(), block) == 0)
+                    {
+                        break;
+                    }
+                    offline.Add(Nanoseconds(Clock::now() - before));
+                }
+                elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+                const double length = static_cast<double>(renderer.Length()) / song.sampleRate;
+                std::printf("offline renderer: %.2f s of audio (%d bars) in %.4f s, %.0fx realtime\n", length, song.bars,
+                            elapsed, length / std::max(elapsed, 1e-9));
+                offline.Print("offline render time");
+                return 0;
+            }
+
+            int Stats(const Options &options)
+            {
+                const Song song = SongFrom(options);
+                const Clock::time_point start = Clock::now();
+                const Timeline timeline = CompileTimeline(song);
+                const double compileMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+                size_t accented = 0;
+                size_t grouped = 0;
+                size_t rests = 0;
+                Histogram intervals("frames between clicks");
+                for (size_t i = 0; i < timeline.events.size(); i++)
+                {
+                    const ClickEvent &event = timeline.events[i];
+                    accented += event.accent == BeatAccent::Accented;
+                    grouped += event.accent == BeatAccent::Group;
+                    rests += event.accent == BeatAccent::Rest;
+                    if (i > 0)
+                    {
+                        intervals.Add(event.frame - timeline.events[i - 1].frame);
+                    }
+                }
+                std::printf("%d bars, %lld frames (%.2f s) at %d Hz, compiled in %.3f ms\n", song.bars,
+                            static_cast<long long>(timeline.length), static_cast<double>(timeline.length) / timeline.sampleRate,
+                            timeline.sampleRate, compileMs);
+                std::printf("beats %zu  accented %zu  group starts %zu  rests %zu  markers %zu  tempo segments %zu  meter changes %zu\n",
+                            timeline.events.size(), accented, grouped, rests, timeline.markers.size(), song.tempoMap.size(),
+                            song.meterMap.size());
+                intervals.Print("beat lengths");
+
+                Kit kit = song.kit;
+                AnalyseKit(kit, song.sampleRate);
+                if (kit.matchLoudness)
+                {
+                    MatchKitLoudness(kit, song.sampleRate);
+                }
+                const char *names[] = {"main", "accent"};
+                for (int index = 0; index < 2; index++)
+                {
+                    const SampleLoudness &loudness = kit.loudness[static_cast<size_t>(index)];
+                    std::printf("%-6s peak %6.1f dBFS  rms %6.1f dBFS  loudness %6.1f LUFS  trim %+.1f dB\n", names[index],
+                                20.0 * std::log10(std::max(loudness.peak, 1e-6f)),
+                                20.0 * std::log10(std::max(loudness.rms, 1e-6f)), loudness.lufs,
+                                20.0 * std::log10(kit.Trim(index)));
+                }
+                return 0;
+            }
+
+            int Follow(const Options &options)
+            {
+                if (!options.Has("transport"))
+                {
+                    throw std::invalid_argument("follow needs --transport");
+                }
+                const TransportReader reader(options.String("transport", ""));
+                const double seconds = options.Number("seconds", 10.0);
+                const Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                                 std::chrono::duration<double>(seconds));
+                std::signal(SIGINT, OnInterrupt);
+                while (Clock::now() < end && !interrupted.load())
+                {
+                    TransportState state;
+                    if (!reader.Read(state))
+                    {
+                        throw std::runtime_error("the publisher stopped in the middle of an update");
+                    }
+                    // Run on from when the state was published.
+                    const int64_t nowNs =
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+                    const int64_t frame = state.playing != 0
+                                              ? state.frame + (nowNs - state.hostTimeNs) * reader.SampleRate() / 1000000000
+                                              : state.frame;
+                    std::printf("%s  bar %lld  beat %d  phase %.2f  %.2f BPM  frame %lld\n",
+                                state.playing != 0 ? "playing" : "stopped", static_cast<long long>(state.bar),
+                                state.beat + 1, state.phase, state.bpm, static_cast<long long>(frame));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                std::signal(SIGINT, SIG_DFL);
+                return 0;
+            }
+
+            LogLevel ParseLogLevel(const std::string &name)
+            {
+                for (LogLevel level : {LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Error, LogLevel::Off})
+                {
+                    if (name == LogLevelName(level))
+                    {
+                        return level;
+                    }
+                }
+                throw std::invalid_argument("unknown log level '" + name + "'");
+            }
+
+            int Run(int argc, char **argv)
+            {
+                const Options options = ParseOptions(argc, argv);
+                if (options.command == "help" || options.command == "--help")
+                {
+                    std::fputs(kUsage, stdout);
+                    return 0;
+                }
+
+                SetLogLevel(ParseLogLevel(options.String("log-level", "warning")));
+                SetLogCallback([](const LogRecord &record)
+                               { std::fprintf(stderr, "%s\n", FormatLogRecord(record).c_str()); });
+
+                int status;
+                if (options.command == "render")
+                {
+                    status = Render(options);
+                }
+                else if (options.command == "play")
+                {
+                    status = Play(options);
+                }
+                else if (options.command == "bench")
+                {
+                    status = Bench(options);
+                }
+                else if (options.command == "stats")
+                {
+                    status = Stats(options);
+                }
+                else if (options.command == "snapshot")
+                {
+                    status = Snapshot(options);
+                }
+                else if (options.command == "follow")
+                {
+                    status = Follow(options);
+                }
+                else
+                {
+                    throw std::invalid_argument("unknown command '" + options.command + "'");
+                }
+
+                if (options.Has("trace"))
+                {
+                    if (!kTracingEnabled)
+                    {
+                        throw std::invalid_argument("--trace needs a build with METRONOME_ENABLE_TRACING");
+                    }
+                    std::ofstream trace(options.String("trace", ""));
+                    WriteChromeTrace(trace);
+                }
+                FlushLog();
+                SetLogCallback(nullptr);
+                return status;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        return metronome::cli::Run(argc, argv);
+    }
+    catch (const std::invalid_argument &e)
+    {
+        std::fprintf(stderr, "error: %s\n\n%s", e.what(), metronome::cli::kUsage);
+        return 2;
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,281 @@
+#include "metronome_alsa_sink.h"
+
+#include <alsa/asoundlib.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "metronome_log.h"
+
+namespace metronome
+{
+    namespace
+    {
+        void Check(int error, const char *what)
+        {
+            if (error < 0)
+            {
+                throw std::runtime_error(std::string(what) + ": " + snd_strerror(error));
+            }
+        }
+
+        int64_t FramesBetween(const snd_htimestamp_t &from, const snd_htimestamp_t &to, int sampleRate)
+        {
+            const int64_t nanoseconds = (static_cast<int64_t>(to.tv_sec) - from.tv_sec) * 1000000000 +
+                                        (static_cast<int64_t>(to.tv_nsec) - from.tv_nsec);
+            return nanoseconds * sampleRate / 1000000000;
+        }
+    }
+
+    AlsaSink::AlsaSink(std::string device) : device(std::move(device))
+    {
+    }
+
+    AlsaSink::~AlsaSink()
+    {
+        Close();
+    }
+
+    SinkConfig AlsaSink::Open(const SinkConfig &requested)
+    {
+        Close();
+        Check(snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK), "snd_pcm_open");
+        try
+        {
+            snd_pcm_hw_params_t *hw;
+            snd_pcm_hw_params_alloca(&hw);
+            Check(snd_pcm_hw_params_any(pcm, hw), "snd_pcm_hw_params_any");
+            Check(snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED), "mmap access");
+            Check(snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16), "S16 format");
+            Check(snd_pcm_hw_params_set_channels(pcm, hw, static_cast<unsigned>(requested.channels)), "channels");
+            // Exact: the engine's timeline is counted in frames of this rate.
+            Check(snd_pcm_hw_params_set_rate(pcm, hw, static_cast<unsigned>(requested.sampleRate), 0), "sample rate");
+            snd_pcm_uframes_t period = static_cast<snd_pcm_uframes_t>(requested.periodFrames);
+            Check(snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, nullptr), "period size");
+            snd_pcm_uframes_t buffer = period * static_cast<snd_pcm_uframes_t>(requested.periods);
+            Check(snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer), "buffer size");
+            Check(snd_pcm_hw_params(pcm, hw), "snd_pcm_hw_params");
+
+            snd_pcm_sw_params_t *sw;
+            snd_pcm_sw_params_alloca(&sw);
+            Check(snd_pcm_sw_params_current(pcm, sw), "snd_pcm_sw_params_current");
+            Check(snd_pcm_sw_params_set_avail_min(pcm, sw, period), "avail min");
+            // Started explicitly once the buffer is full; see StartIfFull.
+            Check(snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer), "start threshold");
+            Check(snd_pcm_sw_params_set_tstamp_mode(pcm, sw, SND_PCM_TSTAMP_ENABLE), "timestamps");
+            Check(snd_pcm_sw_params(pcm, sw), "snd_pcm_sw_params");
+
+            const int count = snd_pcm_poll_descriptors_count(pcm);
+            Check(count, "snd_pcm_poll_descriptors_count");
+            fds.resize(static_cast<size_t>(count));
+            Check(snd_pcm_poll_descriptors(pcm, fds.data(), static_cast<unsigned>(count)), "snd_pcm_poll_descriptors");
+
+            config = requested;
+            config.periodFrames = static_cast<int>(period);
+            config.periods = static_cast<int>(buffer / period);
+        }
+        catch (...)
+        {
+            Close();
+            throw;
+        }
+        Log(LogLevel::Info, "alsa", "Opened %s: %d Hz, %d channels, %d x %d frames", device.c_str(), config.sampleRate,
+            config.channels, config.periods, config.periodFrames);
+        return config;
+    }
+
+    void AlsaSink::Close()
+    {
+        if (pcm != nullptr)
+        {
+            snd_pcm_close(pcm);
+            pcm = nullptr;
+        }
+        fds.clear();
+    }
+
+    SinkStatus AlsaSink::Wait(int timeoutMs, size_t &writable)
+    {
+        SinkStatus status = Avail(writable);
+        if (status != SinkStatus::Ok || writable >= static_cast<size_t>(config.periodFrames))
+        {
+            return status;
+        }
+        const int ready = poll(fds.data(), static_cast<nfds_t>(fds.size()), timeoutMs);
+        if (ready < 0 && errno != EINTR)
+        {
+            throw std::runtime_error(std::string("poll: ") + std::strerror(errno));
+        }
+        if (ready > 0)
+        {
+            unsigned short revents = 0;
+            Check(snd_pcm_poll_descriptors_revents(pcm, fds.data(), static_cast<unsigned>(fds.size()), &revents),
+                  "snd_pcm_poll_descriptors_revents");
+            if (revents & POLLERR)
+            {
+                switch (snd_pcm_state(pcm))
+                {
+                case SND_PCM_STATE_XRUN:
+                    return StatusFor(-EPIPE);
+                case SND_PCM_STATE_SUSPENDED:
+                    return StatusFor(-ESTRPIPE);
+                case SND_PCM_STATE_DISCONNECTED:
+                    return StatusFor(-ENODEV);
+                default:
+                    break;
+                }
+            }
+        }
+        return Avail(writable);
+    }
+
+    SinkStatus AlsaSink::Begin(size_t frames, int16_t *&area, size_t &granted)
+    {
+        const snd_pcm_channel_area_t *areas = nullptr;
+        snd_pcm_uframes_t offset = 0;
+        snd_pcm_uframes_t count = static_cast<snd_pcm_uframes_t>(frames);
+        const int error = snd_pcm_mmap_begin(pcm, &areas, &offset, &count);
+        if (error < 0)
+        {
+            return StatusFor(error);
+        }
+        // Interleaved: step is a whole frame, first the offset of channel 0.
+        area = reinterpret_cast<int16_t *>(static_cast<uint8_t *>(areas[0].addr) + areas[0].first / 8 +
+                                           offset * (areas[0].step / 8));
+        granted = static_cast<size_t>(count);
+        mappedOffset = offset;
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus AlsaSink::Commit(size_t frames)
+    {
+        const snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, mappedOffset, static_cast<snd_pcm_uframes_t>(frames));
+        if (committed < 0)
+        {
+            return StatusFor(static_cast<int>(committed));
+        }
+        if (static_cast<size_t>(committed) != frames)
+        {
+            // A short commit means the device overtook us.
+            return StatusFor(-EPIPE);
+        }
+        return StartIfFull();
+    }
+
+    SinkStatus AlsaSink::Recover(int64_t &lostFrames)
+    {
+        lostFrames = 0;
+        snd_pcm_status_t *status;
+        snd_pcm_status_alloca(&status);
+        int error = snd_pcm_status(pcm, status);
+        if (error < 0)
+        {
+            return StatusFor(error);
+        }
+
+        const snd_pcm_state_t state = snd_pcm_status_get_state(status);
+        if (state == SND_PCM_STATE_XRUN)
+        {
+            // The trigger timestamp marks when the device stopped.
+            snd_htimestamp_t now;
+            snd_htimestamp_t stopped;
+            snd_pcm_status_get_htstamp(status, &now);
+            snd_pcm_status_get_trigger_htstamp(status, &stopped);
+            if (stopped.tv_sec != 0 || stopped.tv_nsec != 0)
+            {
+                lostFrames = FramesBetween(stopped, now, config.sampleRate);
+            }
+            if (lostFrames <= 0)
+            {
+                // Plugins without timestamps: time since we noticed.
+                lostFrames = std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - xrunSeen)
+                                 .count() *
+                             config.sampleRate / 1000000;
+            }
+        }
+        else if (state == SND_PCM_STATE_SUSPENDED)
+        {
+            // After a system suspend the beat grid is not worth keeping.
+            while ((error = snd_pcm_resume(pcm)) == -EAGAIN)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (error == 0)
+            {
+                return SinkStatus::Ok;
+            }
+        }
+
+        error = snd_pcm_prepare(pcm);
+        if (error < 0)
+        {
+            return StatusFor(error);
+        }
+        return SinkStatus::Ok;
+    }
+
+    void AlsaSink::Drop()
+    {
+        if (pcm != nullptr)
+        {
+            snd_pcm_drop(pcm);
+            snd_pcm_prepare(pcm);
+        }
+    }
+
+    SinkStatus AlsaSink::Avail(size_t &writable)
+    {
+        writable = 0;
+        const snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0)
+        {
+            return StatusFor(static_cast<int>(avail));
+        }
+        writable = static_cast<size_t>(avail);
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus AlsaSink::StartIfFull()
+    {
+        if (snd_pcm_state(pcm) != SND_PCM_STATE_PREPARED)
+        {
+            return SinkStatus::Ok;
+        }
+        const snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0)
+        {
+            return StatusFor(static_cast<int>(avail));
+        }
+        if (avail < config.periodFrames)
+        {
+            const int error = snd_pcm_start(pcm);
+            if (error < 0)
+            {
+                return StatusFor(error);
+            }
+        }
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus AlsaSink::StatusFor(int error)
+    {
+        switch (error)
+        {
+        case -EPIPE:
+        case -ESTRPIPE:
+            xrunSeen = std::chrono::steady_clock::now();
+            return SinkStatus::Xrun;
+        case -ENODEV:
+        case -EBADFD:
+        case -EIO:
+            return SinkStatus::Lost;
+        default:
+            throw std::runtime_error(std::string("ALSA: ") + snd_strerror(error));
+        }
+    }
+}
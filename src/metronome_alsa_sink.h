@@ -0,0 +1,55 @@
+#ifndef METRONOME_ALSA_SINK_H_
+#define METRONOME_ALSA_SINK_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+#include "metronome_sink.h"
+
+// As declared by <alsa/pcm.h>, which stays out of this header.
+typedef struct _snd_pcm snd_pcm_t;
+
+namespace metronome
+{
+    // Linux output through ALSA. Frames are rendered straight into the
+    // device's mmap'd ring and the stream thread sleeps in poll() until a
+    // period frees up. Only built when ALSA is found (METRONOME_HAVE_ALSA).
+    //
+    // Any PCM name works, including "null" and file plugins, which is how
+    // the tests run without a sound card.
+    class AlsaSink : public AudioSink
+    {
+    public:
+        explicit AlsaSink(std::string device = "default");
+        ~AlsaSink() override;
+
+        AlsaSink(const AlsaSink &) = delete;
+        AlsaSink &operator=(const AlsaSink &) = delete;
+
+        SinkConfig Open(const SinkConfig &requested) override;
+        void Close() override;
+        SinkStatus Wait(int timeoutMs, size_t &writable) override;
+        SinkStatus Begin(size_t frames, int16_t *&area, size_t &granted) override;
+        SinkStatus Commit(size_t frames) override;
+        SinkStatus Recover(int64_t &lostFrames) override;
+        void Drop() override;
+
+    private:
+        SinkStatus Avail(size_t &writable);
+        SinkStatus StartIfFull();
+        // Maps an ALSA error code to a status, throwing for anything else.
+        SinkStatus StatusFor(int error);
+
+        const std::string device;
+        snd_pcm_t *pcm = nullptr;
+        SinkConfig config;
+        std::vector<pollfd> fds;
+        unsigned long mappedOffset = 0;
+        std::chrono::steady_clock::time_point xrunSeen;
+    };
+}
+
+#endif // METRONOME_ALSA_SINK_H_
@@ -0,0 +1,371 @@
+#include "metronome_audio_file.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace metronome
+{
+    namespace
+    {
+        void PutLE(std::ofstream &file, uint32_t value, int bytes)
+        {
+            for (int i = 0; i < bytes; i++)
+            {
+                file.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+            }
+        }
+
+        class BitWriter
+        {
+        public:
+            explicit BitWriter(std::vector<uint8_t> &bytes) : bytes(bytes) {}
+
+            void Put(uint32_t value, int bits)
+            {
+                while (bits > 0)
+                {
+                    const int take = std::min(bits, 8 - used);
+                    const uint32_t chunk = (value >> (bits - take)) & ((1u << take) - 1);
+                    if (used == 0)
+                    {
+                        bytes.push_back(0);
+                    }
+                    bytes.back() |= static_cast<uint8_t>(chunk << (8 - used - take));
+                    used = (used + take) & 7;
+                    bits -= take;
+                }
+            }
+
+            void PutSigned(int32_t value, int bits)
+            {
+                Put(static_cast<uint32_t>(value) & ((bits == 32) ? 0xFFFFFFFFu : ((1u << bits) - 1)), bits);
+            }
+
+            void PutUnary(uint32_t zeros)
+            {
+                while (zeros >= 16)
+                {
+                    Put(0, 16);
+                    zeros -= 16;
+                }
+                Put(1, static_cast<int>(zeros) + 1);
+            }
+
+            void Align() { used = 0; }
+
+        private:
+            std::vector<uint8_t> &bytes;
+            int used = 0;
+        };
+
+        uint8_t Crc8(const uint8_t *data, size_t size)
+        {
+            uint8_t crc = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                crc ^= data[i];
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+                }
+            }
+            return crc;
+        }
+
+        uint16_t Crc16(const uint8_t *data, size_t size)
+        {
+            uint16_t crc = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                crc ^= static_cast<uint16_t>(data[i] << 8);
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+                }
+            }
+            return crc;
+        }
+
+        void PutFrameNumber(BitWriter &bits, uint32_t value)
+        {
+            if (value < 0x80)
+            {
+                bits.Put(value, 8);
+                return;
+            }
+            int continuation = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 : value < 0x4000000 ? 4 : 5;
+            const uint32_t lead = (0xFF00u >> (continuation + 1)) & 0xFF;
+            bits.Put(lead | (value >> (6 * continuation)), 8);
+            while (continuation-- > 0)
+            {
+                bits.Put(0x80 | ((value >> (6 * continuation)) & 0x3F), 8);
+            }
+        }
+
+        int32_t FixedResidual(const int32_t *x, int order)
+        {
+            switch (order)
+            {
+            case 0:
+                return x[0];
+            case 1:
+                return x[0] - x[-1];
+            case 2:
+                return x[0] - 2 * x[-1] + x[-2];
+            case 3:
+                return x[0] - 3 * x[-1] + 3 * x[-2] - x[-3];
+            default:
+                return x[0] - 4 * x[-1] + 6 * x[-2] - 4 * x[-3] + x[-4];
+            }
+        }
+
+        uint32_t Fold(int32_t residual)
+        {
+            return residual >= 0 ? static_cast<uint32_t>(residual) << 1
+                                 : (static_cast<uint32_t>(-(residual + 1)) << 1) | 1;
+        }
+
+        void EncodeSubframe(BitWriter &bits, const std::vector<int32_t> &x)
+        {
+            const size_t n = x.size();
+            if (std::all_of(x.begin(), x.end(), [&](int32_t s)
+                            { return s == x[0]; }))
+            {
+                bits.Put(0x00, 8);
+                bits.PutSigned(x[0], 16);
+                return;
+            }
+
+            int bestOrder = -1;
+            int bestRice = 0;
+            uint64_t bestBits = 16ull * n;
+            for (int order = 0; order <= 4 && static_cast<size_t>(order) < n; order++)
+            {
+                uint64_t sum = 0;
+                for (size_t i = order; i < n; i++)
+                {
+                    sum += Fold(FixedResidual(&x[i], order));
+                }
+                const uint64_t count = n - order;
+                int rice = 0;
+                while (rice < 14 && (count << (rice + 1)) < sum)
+                {
+                    rice++;
+                }
+                uint64_t cost = 16ull * order + 6 + 4 + count * (rice + 1);
+                for (size_t i = order; i < n; i++)
+                {
+                    cost += Fold(FixedResidual(&x[i], order)) >> rice;
+                }
+                if (cost < bestBits)
+                {
+                    bestBits = cost;
+                    bestOrder = order;
+                    bestRice = rice;
+                }
+            }
+
+            if (bestOrder < 0)
+            {
+                bits.Put(0x02, 8);
+                for (int32_t sample : x)
+                {
+                    bits.PutSigned(sample, 16);
+                }
+                return;
+            }
+
+            bits.Put(static_cast<uint32_t>(0x10 | (bestOrder << 1)), 8);
+            for (int i = 0; i < bestOrder; i++)
+            {
+                bits.PutSigned(x[i], 16);
+            }
+            bits.Put(0, 2);
+            bits.Put(0, 4);
+            bits.Put(static_cast<uint32_t>(bestRice), 4);
+            for (size_t i = bestOrder; i < n; i++)
+            {
+                const uint32_t folded = Fold(FixedResidual(&x[i], bestOrder));
+                bits.PutUnary(folded >> bestRice);
+                if (bestRice > 0)
+                {
+                    bits.Put(folded & ((1u << bestRice) - 1), bestRice);
+                }
+            }
+        }
+    }
+
+    WavWriter::WavWriter(const std::string &path, int sampleRate, int channels)
+        : file(path, std::ios::binary | std::ios::trunc), sampleRate(sampleRate), channels(channels)
+    {
+        if (!file)
+        {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        WriteHeader();
+    }
+
+    WavWriter::~WavWriter()
+    {
+        // An unclosed file was abandoned (e.g. a cancelled export); it is not
+        // worth finalising the header of something about to be deleted.
+        file.close();
+    }
+
+    void WavWriter::WriteHeader()
+    {
+        const uint32_t dataSize = static_cast<uint32_t>(std::min<uint64_t>(dataBytes, 0xFFFFFFFFull - 36));
+        file.write("RIFF", 4);
+        PutLE(file, 36 + dataSize, 4);
+        file.write("WAVEfmt ", 8);
+        PutLE(file, 16, 4);
+        PutLE(file, 1, 2);
+        PutLE(file, static_cast<uint32_t>(channels), 2);
+        PutLE(file, static_cast<uint32_t>(sampleRate), 4);
+        PutLE(file, static_cast<uint32_t>(sampleRate * channels * 2), 4);
+        PutLE(file, static_cast<uint32_t>(channels * 2), 2);
+        PutLE(file, 16, 2);
+        file.write("data", 4);
+        PutLE(file, dataSize, 4);
+    }
+
+    void WavWriter::Write(const int16_t *samples, size_t frames)
+    {
+        const size_t bytes = frames * channels * sizeof(int16_t);
+        file.write(reinterpret_cast<const char *>(samples), static_cast<std::streamsize>(bytes));
+        dataBytes += bytes;
+    }
+
+    void WavWriter::Close()
+    {
+        file.seekp(0);
+        WriteHeader();
+        file.close();
+        if (file.fail())
+        {
+            throw std::runtime_error("Failed to write WAV file");
+        }
+    }
+
+    FlacWriter::FlacWriter(const std::string &path, int sampleRate, int channels)
+        : file(path, std::ios::binary | std::ios::trunc), sampleRate(sampleRate), channels(channels)
+    {
+        if (!file)
+        {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        if (channels < 1 || channels > 8)
+        {
+            throw std::invalid_argument("FLAC supports 1 to 8 channels");
+        }
+        file.write("fLaC", 4);
+        WriteStreamInfo();
+        pending.reserve(static_cast<size_t>(kBlockSize) * channels);
+    }
+
+    FlacWriter::~FlacWriter()
+    {
+        // An unclosed file was abandoned (e.g. a cancelled export); it is not
+        // worth finalising the header of something about to be deleted.
+        file.close();
+    }
+
+    void FlacWriter::WriteStreamInfo()
+    {
+        std::vector<uint8_t> info;
+        BitWriter bits(info);
+        bits.Put(0x80, 8);
+        bits.Put(34, 24);
+        bits.Put(kBlockSize, 16);
+        bits.Put(kBlockSize, 16);
+        bits.Put(minFrameBytes, 24);
+        bits.Put(maxFrameBytes, 24);
+        bits.Put(static_cast<uint32_t>(sampleRate), 20);
+        bits.Put(static_cast<uint32_t>(channels - 1), 3);
+        bits.Put(15, 5);
+        bits.Put(static_cast<uint32_t>(totalFrames >> 32) & 0xF, 4);
+        bits.Put(static_cast<uint32_t>(totalFrames & 0xFFFFFFFFu), 32);
+        info.resize(info.size() + 16, 0);
+        file.write(reinterpret_cast<const char *>(info.data()), static_cast<std::streamsize>(info.size()));
+    }
+
+    void FlacWriter::Write(const int16_t *samples, size_t frames)
+    {
+        const size_t blockSamples = static_cast<size_t>(kBlockSize) * channels;
+        size_t remaining = frames * channels;
+        while (remaining > 0)
+        {
+            const size_t take = std::min(remaining, blockSamples - pending.size());
+            pending.insert(pending.end(), samples, samples + take);
+            samples += take;
+            remaining -= take;
+            if (pending.size() == blockSamples)
+            {
+                EncodeFrame(pending.data(), kBlockSize);
+                pending.clear();
+            }
+        }
+    }
+
+    void FlacWriter::EncodeFrame(const int16_t *samples, size_t frames)
+    {
+        frameBytes.clear();
+        BitWriter bits(frameBytes);
+        bits.Put(0x3FFE, 14);
+        bits.Put(0, 2);
+        bits.Put(0x7, 4);
+        bits.Put(0x0, 4);
+        bits.Put(static_cast<uint32_t>(channels - 1), 4);
+        bits.Put(0x4, 3);
+        bits.Put(0, 1);
+        PutFrameNumber(bits, static_cast<uint32_t>(frameNumber));
+        bits.Put(static_cast<uint32_t>(frames - 1), 16);
+        bits.Put(Crc8(frameBytes.data(), frameBytes.size()), 8);
+
+        std::vector<int32_t> channel(frames);
+        for (int c = 0; c < channels; c++)
+        {
+            for (size_t i = 0; i < frames; i++)
+            {
+                channel[i] = samples[i * channels + c];
+            }
+            EncodeSubframe(bits, channel);
+        }
+        bits.Align();
+        const uint16_t crc = Crc16(frameBytes.data(), frameBytes.size());
+        bits.Put(crc, 16);
+
+        file.write(reinterpret_cast<const char *>(frameBytes.data()), static_cast<std::streamsize>(frameBytes.size()));
+        const uint32_t size = static_cast<uint32_t>(frameBytes.size());
+        minFrameBytes = minFrameBytes == 0 ? size : std::min(minFrameBytes, size);
+        maxFrameBytes = std::max(maxFrameBytes, size);
+        totalFrames += frames;
+        frameNumber++;
+    }
+
+    void FlacWriter::Close()
+    {
+        if (!pending.empty())
+        {
+            EncodeFrame(pending.data(), pending.size() / channels);
+            pending.clear();
+        }
+        file.seekp(4);
+        WriteStreamInfo();
+        file.close();
+        if (file.fail())
+        {
+            throw std::runtime_error("Failed to write FLAC file");
+        }
+    }
+
+    std::unique_ptr<AudioFileWriter> CreateAudioFileWriter(
+        const std::string &path, AudioFileFormat format, int sampleRate, int channels)
+    {
+        if (format == AudioFileFormat::Flac)
+        {
+            return std::make_unique<FlacWriter>(path, sampleRate, channels);
+        }
+        return std::make_unique<WavWriter>(path, sampleRate, channels);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef METRONOME_AUDIO_FILE_H_
+#define METRONOME_AUDIO_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace metronome
+{
+    enum class AudioFileFormat
+    {
+        Wav,
+        Flac,
+    };
+
+    // Streams interleaved 16-bit PCM to disk. Sizes that are only known at
+    // the end (RIFF chunk sizes, FLAC total samples) are patched in Close(),
+    // which must be called for the file to be valid.
+    class AudioFileWriter
+    {
+    public:
+        virtual ~AudioFileWriter() = default;
+        virtual void Write(const int16_t *samples, size_t frames) = 0;
+        virtual void Close() = 0;
+    };
+
+    class WavWriter : public AudioFileWriter
+    {
+    public:
+        WavWriter(const std::string &path, int sampleRate, int channels);
+        ~WavWriter() override;
+
+        void Write(const int16_t *samples, size_t frames) override;
+        void Close() override;
+
+    private:
+        void WriteHeader();
+
+        std::ofstream file;
+        int sampleRate;
+        int channels;
+        uint64_t dataBytes = 0;
+    };
+
+    // Encodes with FLAC's fixed linear predictors (orders 0-4) and a single
+    // Rice partition per subframe. Click tracks are mostly digital silence,
+    // which becomes constant subframes of a few bytes each.
+    class FlacWriter : public AudioFileWriter
+    {
+    public:
+        static constexpr int kBlockSize = 4096;
+
+        FlacWriter(const std::string &path, int sampleRate, int channels);
+        ~FlacWriter() override;
+
+        void Write(const int16_t *samples, size_t frames) override;
+        void Close() override;
+
+    private:
+        void WriteStreamInfo();
+        void EncodeFrame(const int16_t *samples, size_t frames);
+
+        std::ofstream file;
+        int sampleRate;
+        int channels;
+        uint64_t totalFrames = 0;
+        uint64_t frameNumber = 0;
+        uint32_t minFrameBytes = 0;
+        uint32_t maxFrameBytes = 0;
+        std::vector<int16_t> pending;
+        std::vector<uint8_t> frameBytes;
+    };
+
+    std::unique_ptr<AudioFileWriter> CreateAudioFileWriter(
+        const std::string &path, AudioFileFormat format, int sampleRate, int channels = 1);
+}
+
+#endif // METRONOME_AUDIO_FILE_H_
@@ -0,0 +1,1196 @@
+#include "metronome_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "metronome_journal.h"
+#include "metronome_loudness.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr size_t kCommandCapacity = 1024;
+        constexpr size_t kTickCapacity = 256;
+
+        Kit ValidatedKit(Kit kit, int sampleRate)
+        {
+            if (kit.mainSound.empty())
+            {
+                throw std::invalid_argument("Main sound file cannot be empty");
+            }
+            if (kit.accentedSound.empty())
+            {
+                kit.accentedSound = kit.mainSound;
+            }
+            if (kit.matchLoudness)
+            {
+                MatchKitLoudness(kit, sampleRate);
+            }
+            return kit;
+        }
+
+        // Rounds half away from zero like std::lround, without the library
+        // call or a branch. Adding the largest double below one half rather
+        // than 0.5 keeps 0.49999999999999994 from being carried up to one;
+        // the result matches std::lround for every value a mix can reach.
+        inline int RoundHalfAway(double value)
+        {
+            return static_cast<int>(value + std::copysign(0.49999999999999994, value));
+        }
+
+        // Adds count scaled samples onto target, clipping at full scale, and
+        // gathers the peak and sum of squares of what it added. The loop has
+        // no branches, so the compiler vectorises the mix and the metering
+        // together.
+        void MixInto(int16_t *target, const int16_t *source, int64_t count, double gain, int &peak,
+                     int64_t &sumSquares)
+        {
+            int loopPeak = peak;
+            int64_t loopSum = 0;
+            for (int64_t i = 0; i < count; i++)
+            {
+                const double scaled = source[i] * gain;
+                const int value = RoundHalfAway(scaled);
+                loopPeak = std::max(loopPeak, std::abs(value));
+                loopSum += value * value;
+                const int mixed = target[i] + value;
+                target[i] = static_cast<int16_t>(std::min(32767, std::max(-32768, mixed)));
+            }
+            peak = loopPeak;
+            sumSquares += loopSum;
+        }
+
+        // MixInto for interleaved output, compiled once per channel count so
+        // the frame stride is a constant: adds source at gain * left to
+        // channel and at gain * right to the channel after it, unless right
+        // is 0. Levels are of the voice before panning.
+        template <int Channels>
+        void MixPanned(int16_t *target, const int16_t *source, int64_t count, double gain, int channel, double left,
+                       double right, int &peak, int64_t &sumSquares)
+        {
+            int16_t *first = target + channel;
+            const bool pair = right != 0.0;
+            int loopPeak = peak;
+            int64_t loopSum = 0;
+            for (int64_t i = 0; i < count; i++)
+            {
+                const double scaled = source[i] * gain;
+                const int value = RoundHalfAway(scaled);
+                loopPeak = std::max(loopPeak, std::abs(value));
+                loopSum += value * value;
+                const double leftScaled = scaled * left;
+                const int leftMixed = first[i * Channels] + RoundHalfAway(leftScaled);
+                first[i * Channels] = static_cast<int16_t>(std::min(32767, std::max(-32768, leftMixed)));
+                if (pair)
+                {
+                    const double rightScaled = scaled * right;
+                    const int rightMixed =
+                        first[i * Channels + 1] + RoundHalfAway(rightScaled);
+                    first[i * Channels + 1] = static_cast<int16_t>(std::min(32767, std::max(-32768, rightMixed)));
+                }
+            }
+            peak = loopPeak;
+            sumSquares += loopSum;
+        }
+
+        // Indexed by channel count; mono uses MixInto.
+        constexpr void (*kPannedMixes[kMaxOutputChannels + 1])(int16_t *, const int16_t *, int64_t, double, int, double,
+                                                                double, int &, int64_t &) = {
+            nullptr,       nullptr,       MixPanned<2>, MixPanned<3>, MixPanned<4>,
+            MixPanned<5>, MixPanned<6>, MixPanned<7>, MixPanned<8>,
+        };
+
+        void Measure(const int16_t *pcm, int64_t count, int &peak, int64_t &sumSquares)
+        {
+            int loopPeak = peak;
+            int64_t loopSum = 0;
+            for (int64_t i = 0; i < count; i++)
+            {
+                const int value = pcm[i];
+                loopPeak = std::max(loopPeak, std::abs(value));
+                loopSum += value * value;
+            }
+            peak = loopPeak;
+            sumSquares += loopSum;
+        }
+
+        Level ToLevel(int peak, int64_t sumSquares, int frames)
+        {
+            Level level;
+            level.peak = std::min(1.0f, static_cast<float>(peak / 32768.0));
+            if (frames > 0)
+            {
+                level.rms = static_cast<float>(std::sqrt(static_cast<double>(sumSquares) / frames) / 32768.0);
+            }
+            return level;
+        }
+
+        // play 8 bits, mute 8, random state 32.
+        double PackGapClick(int playBars, int muteBars, uint32_t random)
+        {
+            return static_cast<double>(static_cast<uint64_t>(playBars) | static_cast<uint64_t>(muteBars) << 8 |
+                                       static_cast<uint64_t>(random) << 16);
+        }
+
+        // layer 4 bits, channel 3, pan + 32767 16.
+        double PackRoute(int layer, int channel, int pan)
+        {
+            return static_cast<double>(layer | channel << 4 | (pan + 32767) << 7);
+        }
+
+        // step 6 bits, lane 3, sample 8, velocity 7.
+        double PackGridCell(int step, int lane, int sample, int velocity)
+        {
+            return static_cast<double>(step | lane << 6 | sample << 9 | velocity << 17);
+        }
+    }
+
+    double BeatClock::FrameAt(double quarter, int sampleRate) const
+    {
+        if (nextQuarter > lastQuarter && quarter < nextQuarter)
+        {
+            return lastFrame + (quarter - lastQuarter) * (nextFrame - lastFrame) / (nextQuarter - lastQuarter);
+        }
+        return nextFrame + (quarter - nextQuarter) * sampleRate * 60.0 / bpm;
+    }
+
+    double BeatClock::QuarterAt(double frame, int sampleRate) const
+    {
+        if (nextFrame > lastFrame && nextQuarter > lastQuarter && frame < nextFrame)
+        {
+            return lastQuarter + (frame - lastFrame) * (nextQuarter - lastQuarter) / (nextFrame - lastFrame);
+        }
+        return nextQuarter + (frame - nextFrame) * bpm / (sampleRate * 60.0);
+    }
+
+    double ClickEngine::Meter::Pack() const
+    {
+        int log2Denominator = 0;
+        while ((1 << log2Denominator) < denominator)
+        {
+            log2Denominator++;
+        }
+        // 16 + 3 + 1 + 32 bits: exact in a double.
+        const uint64_t packed = static_cast<uint64_t>(numerator) | static_cast<uint64_t>(log2Denominator) << 16 |
+                                static_cast<uint64_t>(feltInGroups) << 19 | static_cast<uint64_t>(groupStarts) << 20;
+        return static_cast<double>(packed);
+    }
+
+    ClickEngine::Meter ClickEngine::Meter::Unpack(double value)
+    {
+        const uint64_t packed = static_cast<uint64_t>(value);
+        Meter meter;
+        meter.numerator = std::max(1, static_cast<int>(packed & 0xFFFF));
+        meter.denominator = 1 << (packed >> 16 & 7);
+        meter.feltInGroups = (packed >> 19 & 1) != 0;
+        meter.groupStarts = static_cast<uint32_t>(packed >> 20) | 1;
+        return meter;
+    }
+
+    ClickEngine::ClickEngine(Kit kit, double bpm, int timeSignature, double volume, int sampleRate, int channels,
+                             MemoryBudget *budget)
+        : sampleRate(sampleRate), channels(channels), budget(budget), commands(kCommandCapacity), bpm(bpm), volume(volume), ticks(kTickCapacity),
+          tappedTicks(kTickCapacity)
+    {
+        meter.numerator = std::max(1, timeSignature);
+        if (sampleRate <= 0)
+        {
+            throw std::invalid_argument("sampleRate must be greater than 0");
+        }
+        if (channels < 1 || channels > kMaxOutputChannels)
+        {
+            throw std::invalid_argument("channels must be 1 to " + std::to_string(kMaxOutputChannels));
+        }
+        if (!(bpm >= kMinBpm && bpm <= kMaxBpm))
+        {
+            throw std::invalid_argument("BPM must be between 1 and 1000");
+        }
+        if (volume < 0.0 || volume > 1.0)
+        {
+            throw std::invalid_argument("Volume must be between 0.0 and 1.0");
+        }
+        kitId = RegisterKitLocked(std::move(kit));
+        this->kit = kits.back().kit.get();
+        appliedKitId.store(kitId);
+        pannedMix = kPannedMixes[channels];
+        PublishClock();
+    }
+
+    ClickEngine::~ClickEngine() = default;
+
+    void ClickEngine::SetBpm(double bpm)
+    {
+        if (!(bpm >= kMinBpm && bpm <= kMaxBpm))
+        {
+            throw std::invalid_argument("BPM must be between 1 and 1000");
+        }
+        Push(EngineCommand{CommandType::SetBpm, bpm});
+    }
+
+    void ClickEngine::SetTimeSignature(int timeSignature)
+    {
+        Push(EngineCommand{CommandType::SetTimeSignature, static_cast<double>(std::max(1, timeSignature))});
+    }
+
+    void ClickEngine::SetMeter(int numerator, int denominator, const std::vector<int> &grouping, bool feltInGroups)
+    {
+        ValidateMeter(numerator, denominator, grouping);
+        if (numerator > 0xFFFF || (!grouping.empty() && numerator > kMaxGroupedBeats))
+        {
+            throw std::invalid_argument("Bar is too long for the live engine");
+        }
+        Meter meter;
+        meter.numerator = numerator;
+        meter.denominator = denominator;
+        meter.groupStarts = static_cast<uint32_t>(GroupStartMask(numerator, grouping));
+        meter.feltInGroups = feltInGroups;
+        Push(EngineCommand{CommandType::SetMeter, meter.Pack()});
+    }
+
+    void ClickEngine::SetVolume(double volume)
+    {
+        if (volume < 0.0 || volume > 1.0)
+        {
+            throw std::invalid_argument("Volume must be between 0.0 and 1.0");
+        }
+        Push(EngineCommand{CommandType::SetVolume, volume});
+    }
+
+    void ClickEngine::SetGridSteps(int steps)
+    {
+        if (steps < 0 || steps > kMaxGridSteps)
+        {
+            throw std::invalid_argument("A grid has 0 to " + std::to_string(kMaxGridSteps) + " steps");
+        }
+        std::lock_guard<std::mutex> lock(controlMutex);
+        PushLocked(EngineCommand{CommandType::SetGridSteps, static_cast<double>(steps)});
+        sentGrid.steps = steps;
+    }
+
+    void ClickEngine::SetGridCell(int step, int lane, int sample, int velocity)
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        SetGridCellLocked(step, lane, sample, velocity);
+    }
+
+    void ClickEngine::SetGridCellLocked(int step, int lane, int sample, int velocity)
+    {
+        if (step < 0 || step >= kMaxGridSteps || lane < 0 || lane >= kGridLanes || sample < 0 || sample > 255 ||
+            velocity < 0 || velocity > 127)
+        {
+            throw std::invalid_argument("Grid cell out of range");
+        }
+        PushLocked(EngineCommand{CommandType::SetGridCell, PackGridCell(step, lane, sample, velocity)});
+        sentGrid.cells[step][lane] = GridCell{static_cast<uint8_t>(sample), static_cast<uint8_t>(velocity)};
+    }
+
+    void ClickEngine::SetGrid(const StepGrid &grid)
+    {
+        if (grid.steps < 0 || grid.steps > kMaxGridSteps)
+        {
+            throw std::invalid_argument("A grid has 0 to " + std::to_string(kMaxGridSteps) + " steps");
+        }
+        for (const auto &lanes : grid.cells)
+        {
+            for (const GridCell &cell : lanes)
+            {
+                if (cell.velocity > 127)
+                {
+                    throw std::invalid_argument("Grid velocities run from 0 to 127");
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(controlMutex);
+        for (int step = 0; step < kMaxGridSteps; step++)
+        {
+            for (int lane = 0; lane < kGridLanes; lane++)
+            {
+                const GridCell &cell = grid.cells[step][lane];
+                const GridCell &sent = sentGrid.cells[step][lane];
+                // Silent cells differ only if one of them sounds.
+                if (cell.velocity != sent.velocity || (cell.velocity != 0 && cell.sample != sent.sample))
+                {
+                    SetGridCellLocked(step, lane, cell.sample, cell.velocity);
+                }
+            }
+        }
+        if (grid.steps != sentGrid.steps)
+        {
+            PushLocked(EngineCommand{CommandType::SetGridSteps, static_cast<double>(grid.steps)});
+            sentGrid.steps = grid.steps;
+        }
+    }
+
+    void ClickEngine::SetGapClick(int playBars, int muteBars, bool randomised, uint32_t seed)
+    {
+        if (playBars < 1 || playBars > 255 || muteBars < 0 || muteBars > 255)
+        {
+            throw std::invalid_argument("Gap click needs 1-255 bars to play and 0-255 to mute");
+        }
+        if (randomised && seed == 0)
+        {
+            seed = std::random_device()();
+        }
+        // xorshift never leaves zero, which marks a fixed cycle.
+        const uint32_t random = randomised ? (seed != 0 ? seed : 1u) : 0u;
+        Push(EngineCommand{CommandType::SetGapClick, PackGapClick(playBars, muteBars, random)});
+    }
+
+    void ClickEngine::SetRoute(int layer, int channel, double pan)
+    {
+        if (layer < 0 || layer >= kRouteLayers)
+        {
+            throw std::invalid_argument("Route layer must be 0 to " + std::to_string(kRouteLayers - 1));
+        }
+        if (channel < 0 || channel >= channels)
+        {
+            throw std::invalid_argument("Route channel must be below the output's " + std::to_string(channels));
+        }
+        if (!(pan >= -1.0 && pan <= 1.0))
+        {
+            throw std::invalid_argument("Pan must be between -1.0 and 1.0");
+        }
+        Push(EngineCommand{CommandType::SetRoute, PackRoute(layer, channel, static_cast<int>(std::lround(pan * 32767.0)))});
+    }
+
+    void ClickEngine::SetKit(Kit kit)
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        const uint32_t id = RegisterKitLocked(std::move(kit));
+        if (!commands.TryPush(EngineCommand{CommandType::SetKit, static_cast<double>(id), kits.back().kit.get()}))
+        {
+            throw std::runtime_error("Engine command queue is full");
+        }
+    }
+
+    void ClickEngine::Restart()
+    {
+        Push(EngineCommand{CommandType::Restart, 0.0});
+    }
+
+    void ClickEngine::Follow(const ClickEngine *master, double ratio)
+    {
+        if (!(ratio >= 0.0))
+        {
+            throw std::invalid_argument("Tempo ratio must not be negative");
+        }
+        if (master == this)
+        {
+            throw std::invalid_argument("An engine cannot follow itself");
+        }
+        if (master != nullptr && master->SampleRate() != sampleRate)
+        {
+            throw std::invalid_argument("A master must run at the follower's sample rate");
+        }
+        EngineCommand command{CommandType::Follow, master != nullptr ? ratio : 0.0};
+        command.master = ratio > 0.0 ? master : nullptr;
+        Push(command);
+    }
+
+    uint32_t ClickEngine::RegisterKit(Kit kit)
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        return RegisterKitLocked(std::move(kit));
+    }
+
+    uint32_t ClickEngine::RegisterKitLocked(Kit kit)
+    {
+        // Kits older than the one in use can no longer be referenced by the
+        // audio thread or by a queued command.
+        const uint32_t applied = appliedKitId.load(std::memory_order_acquire);
+        kits.erase(std::remove_if(kits.begin(), kits.end(),
+                                  [applied](const KitEntry &entry)
+                                  { return entry.id < applied; }),
+                   kits.end());
+
+        Kit validated = ValidatedKit(std::move(kit), sampleRate);
+        MemoryReservation memory = Reserve(budget, MemoryComponent::Kits, validated.Bytes());
+        const uint32_t id = nextKitId++;
+        kits.push_back(KitEntry{id, std::make_unique<const Kit>(std::move(validated)), std::move(memory)});
+        if (CommandJournal *journal = requestedJournal.load())
+        {
+            journal->RecordKit(id, *kits.back().kit);
+        }
+        return id;
+    }
+
+    void ClickEngine::SetJournal(CommandJournal *journal)
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        if (journal != nullptr)
+        {
+            journal->RecordLayout(channels);
+            for (const KitEntry &entry : kits)
+            {
+                journal->RecordKit(entry.id, *entry.kit);
+            }
+        }
+        requestedJournal.store(journal, std::memory_order_release);
+    }
+
+    void ClickEngine::Push(const EngineCommand &command)
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        PushLocked(command);
+    }
+
+    void ClickEngine::PushLocked(const EngineCommand &command)
+    {
+        if (!commands.TryPush(command))
+        {
+            throw std::runtime_error("Engine command queue is full");
+        }
+    }
+
+    size_t ClickEngine::Render(int16_t *out, size_t frames)
+    {
+        METRONOME_TRACE_SCOPE("render_block");
+        SwitchJournal();
+        ApplyQueued();
+        SyncToMaster();
+
+        std::memset(out, 0, frames * channels * sizeof(int16_t));
+        blockLevels = BlockLevelSums();
+        Advance(out, frames);
+        PublishLevels(frames);
+        return frames;
+    }
+
+    void ClickEngine::LevelSum::Add(const LevelSum &other)
+    {
+        peak = std::max(peak, other.peak);
+        sumSquares += other.sumSquares;
+    }
+
+    void ClickEngine::PublishLevels(size_t frames)
+    {
+        bool silent = true;
+        for (const LevelSum &layer : blockLevels.layers)
+        {
+            silent = silent && layer.Silent();
+        }
+        // A run of silent blocks is published once, so an idle engine
+        // spends nothing on metering.
+        if (silent && levelsSilent)
+        {
+            return;
+        }
+        levelsSilent = silent;
+        blockLevels.frame = position;
+        blockLevels.frames = static_cast<int>(frames);
+        levels.Store(blockLevels);
+    }
+
+    BlockLevels ClickEngine::Levels() const
+    {
+        const BlockLevelSums sums = levels.Load();
+        BlockLevels result;
+        result.frame = sums.frame;
+        result.frames = sums.frames;
+        result.output = ToLevel(sums.layers[0].peak, sums.layers[0].sumSquares, sums.frames * channels);
+        result.click = ToLevel(sums.layers[1].peak, sums.layers[1].sumSquares, sums.frames);
+        for (int lane = 0; lane < kGridLanes; lane++)
+        {
+            result.lanes[lane] = ToLevel(sums.layers[2 + lane].peak, sums.layers[2 + lane].sumSquares, sums.frames);
+        }
+        return result;
+    }
+
+    void ClickEngine::Skip(size_t frames)
+    {
+        SwitchJournal();
+        ApplyQueued();
+        SyncToMaster();
+        Apply(EngineCommand{CommandType::Skip, static_cast<double>(frames)});
+    }
+
+    void ClickEngine::Advance(int16_t *out, size_t frames)
+    {
+        const int64_t end = position + static_cast<int64_t>(frames);
+        int64_t cursor = position;
+        while (cursor < end)
+        {
+            int64_t segmentEnd = std::min(end, nextClick);
+            if (GridStepDue())
+            {
+                segmentEnd = std::min(segmentEnd, nextGridStep);
+            }
+            // Levels of this segment: one voice's are the output's too, so
+            // only overlapping voices need the mix measured again.
+            LevelSum mixedLevel;
+            int mixedVoices = 0;
+            int64_t mixedEnd = cursor;
+            if (voice != nullptr && segmentEnd > cursor)
+            {
+                const int64_t voiceEnd = voiceStart + static_cast<int64_t>(voice->size());
+                const int64_t stop = std::min(segmentEnd, voiceEnd);
+                if (out != nullptr)
+                {
+                    MixVoice(out + (cursor - position) * channels, voice->data() + (cursor - voiceStart), stop - cursor,
+                             volume * voiceGain, voiceAccent == BeatAccent::Normal ? 0 : 1, mixedLevel);
+                    blockLevels.layers[1].Add(mixedLevel);
+                    mixedVoices++;
+                    mixedEnd = std::max(mixedEnd, stop);
+                }
+                if (stop >= voiceEnd)
+                {
+                    voice = nullptr;
+                }
+            }
+            // Only lanes that are sounding cost anything.
+            for (int lane = 0; soundingLanes >> lane != 0 && segmentEnd > cursor; lane++)
+            {
+                if ((soundingLanes >> lane & 1) == 0)
+                {
+                    continue;
+                }
+                const Voice &laneVoice = laneVoices[lane];
+                const int64_t voiceEnd = laneVoice.start + static_cast<int64_t>(laneVoice.sound->size());
+                const int64_t stop = std::min(segmentEnd, voiceEnd);
+                if (out != nullptr)
+                {
+                    LevelSum laneLevel;
+                    MixVoice(out + (cursor - position) * channels, laneVoice.sound->data() + (cursor - laneVoice.start),
+                             stop - cursor, volume * laneVoice.gain, 2 + lane, laneLevel);
+                    blockLevels.layers[2 + lane].Add(laneLevel);
+                    mixedLevel.Add(laneLevel);
+                    mixedVoices++;
+                    mixedEnd = std::max(mixedEnd, stop);
+                }
+                if (stop >= voiceEnd)
+                {
+                    soundingLanes = static_cast<uint8_t>(soundingLanes & ~(1 << lane));
+                }
+            }
+            // Voice levels are taken before panning, so with more than one
+            // channel the output is always measured.
+            if (mixedVoices > 1 || (channels > 1 && mixedVoices > 0))
+            {
+                mixedLevel = LevelSum();
+                Measure(out + (cursor - position) * channels, (mixedEnd - cursor) * channels, mixedLevel.peak,
+                        mixedLevel.sumSquares);
+            }
+            blockLevels.layers[0].Add(mixedLevel);
+            cursor = segmentEnd;
+            if (cursor >= end)
+            {
+                break;
+            }
+
+            if (cursor == nextClick)
+            {
+                if (beat == 0 && hasPendingMeter)
+                {
+                    meter = pendingMeter;
+                    hasPendingMeter = false;
+                }
+                BeatAccent accent = BeatAccent::Normal;
+                if (meter.numerator >= 2)
+                {
+                    accent = beat == 0 ? BeatAccent::Accented : meter.GroupStart(beat) ? BeatAccent::Group : BeatAccent::Normal;
+                }
+                if (beat == 0)
+                {
+                    bars++;
+                    barMuted = NextBarMuted();
+                    // The grid restarts from every downbeat, so it never
+                    // drifts from the beat.
+                    barSteps = gridSteps;
+                    gridStep = 0;
+                    lastGridStep = nextGridStep = cursor;
+                    lastGridStepFraction = nextGridStepFraction = nextClickFraction;
+                }
+                if (barSteps == 0 && !barMuted)
+                {
+                    voice = accent == BeatAccent::Normal ? &kit->mainSound : &kit->accentedSound;
+                    voiceAccent = accent;
+                    voiceGain = ClickGain(accent);
+                    voiceStart = cursor;
+                }
+                if (out != nullptr)
+                {
+                    const TickEvent tick{cursor, beat, accent, barMuted};
+                    ticks.TryPush(tick);
+                    if (tapping.load(std::memory_order_relaxed))
+                    {
+                        tappedTicks.TryPush(tick);
+                    }
+                    METRONOME_TRACE_INSTANT("tick", beat);
+                }
+
+                lastClick = nextClick;
+                lastClickFraction = nextClickFraction;
+                lastQuarter = nextQuarter;
+                lastBeat = beat;
+                int next = beat + 1;
+                while (meter.feltInGroups && next < meter.numerator && !meter.GroupStart(next))
+                {
+                    next++;
+                }
+                stepBeats = next - beat;
+                beat = next % meter.numerator;
+                ScheduleNext(true);
+            }
+            if (GridStepDue() && cursor == nextGridStep)
+            {
+                PlayGridStep(cursor);
+            }
+        }
+
+        position = end;
+        publishedPosition.store(position, std::memory_order_release);
+        PublishClock();
+    }
+
+    void ClickEngine::PublishClock()
+    {
+        BeatClock published;
+        published.epoch = epoch;
+        published.bpm = bpm;
+        published.lastFrame = static_cast<double>(lastClick) + lastClickFraction;
+        published.nextFrame = static_cast<double>(nextClick) + nextClickFraction;
+        published.lastQuarter = lastQuarter;
+        published.nextQuarter = nextQuarter;
+        published.beat = lastBeat;
+        published.bar = bars;
+        beatClock.Store(published);
+    }
+
+    void ClickEngine::PlayGridStep(int64_t frame)
+    {
+        for (int lane = 0; lane < kGridLanes && !barMuted; lane++)
+        {
+            if ((gridHits[gridStep] >> lane & 1) != 0)
+            {
+                const GridCell &cell = grid[gridStep][lane];
+                StartLaneVoice(lane, cell.sample, cell.velocity, frame);
+            }
+        }
+        lastGridStep = nextGridStep;
+        lastGridStepFraction = nextGridStepFraction;
+        gridStep++;
+        if (GridStepDue())
+        {
+            ScheduleGridStep(true);
+        }
+    }
+
+    double ClickEngine::ClickGain(BeatAccent accent) const
+    {
+        const double gain = accent == BeatAccent::Group ? kGroupAccentGain : 1.0;
+        return gain * kit->Trim(accent == BeatAccent::Accented || accent == BeatAccent::Group ? 1 : 0);
+    }
+
+    void ClickEngine::StartLaneVoice(int lane, int sample, int velocity, int64_t start)
+    {
+        Voice &laneVoice = laneVoices[lane];
+        laneVoice.sound = kit->Sample(sample);
+        laneVoice.start = start;
+        // The sample's trim rides on the voice gain, so it costs nothing
+        // per sample.
+        laneVoice.gain = velocity / 127.0 * kit->Trim(sample);
+        laneVoice.sample = static_cast<uint8_t>(sample);
+        laneVoice.velocity = static_cast<uint8_t>(velocity);
+        // A missing or empty sample still chokes what the lane was playing.
+        if (laneVoice.sound != nullptr && !laneVoice.sound->empty())
+        {
+            soundingLanes = static_cast<uint8_t>(soundingLanes | 1 << lane);
+        }
+        else
+        {
+            soundingLanes = static_cast<uint8_t>(soundingLanes & ~(1 << lane));
+        }
+    }
+
+    bool ClickEngine::NextBarMuted()
+    {
+        if (gapMuteBars == 0)
+        {
+            return false;
+        }
+        const int cycle = gapPlayBars + gapMuteBars;
+        if (gapRandom != 0)
+        {
+            gapRandom ^= gapRandom << 13;
+            gapRandom ^= gapRandom >> 17;
+            gapRandom ^= gapRandom << 5;
+            return static_cast<int>(gapRandom % static_cast<uint32_t>(cycle)) < gapMuteBars;
+        }
+        const bool muted = gapBar >= gapPlayBars;
+        gapBar = (gapBar + 1) % cycle;
+        return muted;
+    }
+
+    void ClickEngine::StopLaneVoices()
+    {
+        soundingLanes = 0;
+    }
+
+    void ClickEngine::ApplyPending()
+    {
+        SwitchJournal();
+        ApplyQueued();
+    }
+
+    void ClickEngine::ApplyQueued()
+    {
+        EngineCommand command;
+        while (commands.TryPop(command))
+        {
+            Apply(command);
+        }
+    }
+
+    void ClickEngine::Apply(const EngineCommand &command)
+    {
+        switch (command.type)
+        {
+        case CommandType::SetBpm:
+            // A follower takes its tempo from master.
+            if (master != nullptr)
+            {
+                break;
+            }
+            bpm = command.value;
+            ScheduleNext(false);
+            if (GridStepDue())
+            {
+                ScheduleGridStep(false);
+            }
+            break;
+        case CommandType::Follow:
+            master = command.value > 0.0 ? command.master : nullptr;
+            linkRatio = master != nullptr ? command.value : 0.0;
+            if (master != nullptr)
+            {
+                linkClock = master->Clock();
+                bpm = linkClock.bpm * linkRatio;
+                AnchorToMaster();
+            }
+            break;
+        case CommandType::SetTimeSignature:
+            meter.numerator = std::max(1, static_cast<int>(command.value));
+            meter.groupStarts = 1;
+            meter.feltInGroups = false;
+            hasPendingMeter = false;
+            beat %= meter.numerator;
+            break;
+        case CommandType::SetMeter:
+            pendingMeter = Meter::Unpack(command.value);
+            hasPendingMeter = true;
+            break;
+        case CommandType::SyncMeter:
+            meter = Meter::Unpack(command.value);
+            beat %= meter.numerator;
+            break;
+        case CommandType::SyncStepBeats:
+            stepBeats = std::max(1, static_cast<int>(command.value));
+            break;
+        case CommandType::SetGridSteps:
+            gridSteps = std::min(kMaxGridSteps, std::max(0, static_cast<int>(command.value)));
+            break;
+        case CommandType::SetGridCell:
+            ApplyGridCell(command.value);
+            break;
+        case CommandType::SetGapClick:
+        {
+            const uint64_t packed = static_cast<uint64_t>(command.value);
+            gapPlayBars = std::max(1, static_cast<int>(packed & 0xFF));
+            gapMuteBars = static_cast<int>(packed >> 8 & 0xFF);
+            gapRandom = static_cast<uint32_t>(packed >> 16);
+            gapBar = 0;
+            break;
+        }
+        case CommandType::SyncGapBar:
+            gapBar = static_cast<int>(command.value) & 0xFF;
+            barMuted = (static_cast<int>(command.value) >> 8 & 1) != 0;
+            break;
+        case CommandType::SetVolume:
+            volume = command.value;
+            break;
+        case CommandType::SetRoute:
+            ApplyRoute(command.value);
+            break;
+        case CommandType::SetKit:
+        {
+            const uint32_t id = static_cast<uint32_t>(command.value);
+            const Kit *target = command.kit != nullptr ? command.kit : FindKit(id);
+            if (target == nullptr)
+            {
+                return;
+            }
+            kit = target;
+            kitId = id;
+            voice = nullptr;
+            StopLaneVoices();
+            appliedKitId.store(id, std::memory_order_release);
+            break;
+        }
+        case CommandType::Restart:
+            if (master != nullptr)
+            {
+                voice = nullptr;
+                StopLaneVoices();
+                AnchorToMaster();
+                break;
+            }
+            beat = 0;
+            stepBeats = 1;
+            lastClick = nextClick = position;
+            lastClickFraction = nextClickFraction = 0.0;
+            voice = nullptr;
+            StopLaneVoices();
+            gapBar = 0;
+            barMuted = false;
+            lastQuarter = nextQuarter = 0.0;
+            lastBeat = 0;
+            bars = 0;
+            epoch++;
+            break;
+        case CommandType::Skip:
+            // Journaled at the frame the gap starts, so a replay can
+            // reproduce it.
+            METRONOME_TRACE_INSTANT("skip", static_cast<int64_t>(command.value));
+            Journal(command.type, command.value);
+            Advance(nullptr, static_cast<size_t>(command.value));
+            return;
+        case CommandType::SyncBeat:
+            beat = static_cast<int>(command.value) % meter.numerator;
+            break;
+        case CommandType::SyncLastClick:
+            lastClick = position + static_cast<int64_t>(command.value);
+            break;
+        case CommandType::SyncLastClickFraction:
+            lastClickFraction = command.value;
+            break;
+        case CommandType::SyncNextClick:
+            nextClick = position + static_cast<int64_t>(command.value);
+            break;
+        case CommandType::SyncNextClickFraction:
+            nextClickFraction = command.value;
+            break;
+        case CommandType::SyncVoice:
+            voiceStart = position - static_cast<int64_t>(command.value);
+            voice = command.value < 0.0 ? nullptr : &kit->mainSound;
+            break;
+        case CommandType::SyncVoiceAccent:
+            voiceAccent = static_cast<BeatAccent>(static_cast<int>(command.value));
+            voiceGain = ClickGain(voiceAccent);
+            if (voice != nullptr)
+            {
+                voice = voiceAccent == BeatAccent::Accented || voiceAccent == BeatAccent::Group ? &kit->accentedSound
+                                                                                               : &kit->mainSound;
+            }
+            break;
+        case CommandType::SyncGridStep:
+        {
+            const int packed = static_cast<int>(command.value);
+            gridStep = packed & 0xFF;
+            barSteps = std::min(kMaxGridSteps, packed >> 8);
+            break;
+        }
+        case CommandType::SyncGridLastStep:
+            lastGridStep = position + static_cast<int64_t>(command.value);
+            break;
+        case CommandType::SyncGridLastStepFraction:
+            lastGridStepFraction = command.value;
+            break;
+        case CommandType::SyncGridNextStep:
+            nextGridStep = position + static_cast<int64_t>(command.value);
+            break;
+        case CommandType::SyncGridNextStepFraction:
+            nextGridStepFraction = command.value;
+            break;
+        case CommandType::SyncLaneVoice:
+        {
+            // Frames played 32 bits, lane 3, sample 8, velocity 7.
+            const uint64_t packed = static_cast<uint64_t>(command.value);
+            StartLaneVoice(static_cast<int>(packed >> 32 & 7), static_cast<int>(packed >> 35 & 0xFF),
+                           static_cast<int>(packed >> 43 & 0x7F), position - static_cast<int64_t>(packed & 0xFFFFFFFF));
+            break;
+        }
+        case CommandType::End:
+            return;
+        }
+        METRONOME_TRACE_INSTANT("command_applied", static_cast<int>(command.type));
+        Journal(command.type, command.value);
+    }
+
+    template <typename Emit>
+    void ClickEngine::EmitState(Emit emit) const
+    {
+        emit(CommandType::SetKit, kitId);
+        emit(CommandType::SetBpm, bpm);
+        emit(CommandType::SyncMeter, meter.Pack());
+        if (hasPendingMeter)
+        {
+            emit(CommandType::SetMeter, pendingMeter.Pack());
+        }
+        emit(CommandType::SetVolume, volume);
+        emit(CommandType::SyncBeat, beat);
+        emit(CommandType::SyncStepBeats, stepBeats);
+        emit(CommandType::SyncLastClick, static_cast<double>(lastClick - position));
+        emit(CommandType::SyncLastClickFraction, lastClickFraction);
+        emit(CommandType::SyncNextClick, static_cast<double>(nextClick - position));
+        emit(CommandType::SyncNextClickFraction, nextClickFraction);
+        emit(CommandType::SyncVoice, voice != nullptr ? static_cast<double>(position - voiceStart) : -1.0);
+        emit(CommandType::SyncVoiceAccent, static_cast<int>(voiceAccent));
+        emit(CommandType::SetGridSteps, gridSteps);
+        for (int step = 0; step < kMaxGridSteps; step++)
+        {
+            for (int lane = 0; lane < kGridLanes; lane++)
+            {
+                const GridCell &cell = grid[step][lane];
+                if (cell.velocity != 0)
+                {
+                    emit(CommandType::SetGridCell, PackGridCell(step, lane, cell.sample, cell.velocity));
+                }
+            }
+        }
+        emit(CommandType::SyncGridStep, gridStep | barSteps << 8);
+        emit(CommandType::SetGapClick, PackGapClick(gapPlayBars, gapMuteBars, gapRandom));
+        emit(CommandType::SyncGapBar, gapBar | static_cast<int>(barMuted) << 8);
+        for (int layer = 0; layer < kRouteLayers; layer++)
+        {
+            if (routes[layer].channel != 0 || routes[layer].pan != 0)
+            {
+                emit(CommandType::SetRoute, PackRoute(layer, routes[layer].channel, routes[layer].pan));
+            }
+        }
+        emit(CommandType::SyncGridLastStep, static_cast<double>(lastGridStep - position));
+        emit(CommandType::SyncGridLastStepFraction, lastGridStepFraction);
+        emit(CommandType::SyncGridNextStep, static_cast<double>(nextGridStep - position));
+        emit(CommandType::SyncGridNextStepFraction, nextGridStepFraction);
+        for (int lane = 0; lane < kGridLanes; lane++)
+        {
+            if ((soundingLanes >> lane & 1) != 0)
+            {
+                const Voice &laneVoice = laneVoices[lane];
+                const uint64_t packed = static_cast<uint64_t>(position - laneVoice.start) |
+                                        static_cast<uint64_t>(lane) << 32 |
+                                        static_cast<uint64_t>(laneVoice.sample) << 35 |
+                                        static_cast<uint64_t>(laneVoice.velocity) << 43;
+                emit(CommandType::SyncLaneVoice, static_cast<double>(packed));
+            }
+        }
+    }
+
+    void ClickEngine::SwitchJournal()
+    {
+        CommandJournal *requested = requestedJournal.load(std::memory_order_acquire);
+        if (requested == journal)
+        {
+            return;
+        }
+        journal = requested;
+        activeJournal.store(journal, std::memory_order_release);
+        if (journal == nullptr)
+        {
+            return;
+        }
+
+        // Everything a fresh engine needs to continue exactly from here.
+        EmitState([this](CommandType type, double value)
+                  { Journal(type, value); });
+        if (master != nullptr)
+        {
+            // Not state a fresh engine can take on, but replay must know.
+            Journal(CommandType::Follow, linkRatio);
+        }
+    }
+
+    std::vector<EngineCommand> ClickEngine::State() const
+    {
+        std::vector<EngineCommand> commands;
+        EmitState([&commands](CommandType type, double value)
+                  { commands.push_back(EngineCommand{type, value}); });
+        return commands;
+    }
+
+    void ClickEngine::MixVoice(int16_t *out, const int16_t *source, int64_t count, double gain, int layer,
+                               LevelSum &level) const
+    {
+        if (pannedMix == nullptr)
+        {
+            MixInto(out, source, count, gain, level.peak, level.sumSquares);
+            return;
+        }
+        const Route &route = routes[layer];
+        pannedMix(out, source, count, gain, route.channel, route.left, route.right, level.peak, level.sumSquares);
+    }
+
+    void ClickEngine::ApplyRoute(double packed)
+    {
+        const int value = static_cast<int>(packed);
+        if ((value & 15) >= kRouteLayers)
+        {
+            return;
+        }
+        Route &route = routes[value & 15];
+        // A journal replayed with fewer channels keeps every layer audible.
+        route.channel = std::min(value >> 4 & 7, channels - 1);
+        route.pan = (value >> 7) - 32767;
+        const double pan = route.pan / 32767.0;
+        if (route.channel + 1 < channels)
+        {
+            route.left = std::min(1.0, 1.0 - pan);
+            route.right = std::min(1.0, 1.0 + pan);
+        }
+        else
+        {
+            route.left = 1.0;
+            route.right = 0.0;
+        }
+    }
+
+    void ClickEngine::Journal(CommandType type, double value)
+    {
+        if (journal != nullptr)
+        {
+            journal->Record(JournalEntry{position, type, value});
+        }
+    }
+
+    void ClickEngine::ScheduleNext(bool fromLastClick)
+    {
+        // Before the first click after a restart there is no beat to stretch.
+        if (!fromLastClick && nextClick == lastClick)
+        {
+            return;
+        }
+        nextQuarter = lastQuarter + 4.0 * stepBeats / meter.denominator;
+        if (master != nullptr)
+        {
+            // Where master's clicks put this point of its beat.
+            const double frame = linkClock.FrameAt(nextQuarter / linkRatio, sampleRate);
+            nextClick = std::max(lastClick + 1, static_cast<int64_t>(std::llround(frame)));
+            nextClickFraction = std::min(0.5, std::max(-0.5, frame - static_cast<double>(nextClick)));
+        }
+        else
+        {
+            // Click times are kept as a whole frame plus a fraction in
+            // [-0.5, 0.5], so the arithmetic is the same at any stream
+            // position and a replay from a journal lands on the same frames.
+            const double next = lastClickFraction + StepFrames();
+            const int64_t whole = std::max<int64_t>(1, std::llround(next));
+            nextClick = lastClick + whole;
+            nextClickFraction = next - static_cast<double>(whole);
+        }
+        if (nextClick < position)
+        {
+            nextClick = position;
+            nextClickFraction = 0.0;
+        }
+    }
+
+    void ClickEngine::SyncToMaster()
+    {
+        if (master == nullptr)
+        {
+            return;
+        }
+        const BeatClock latest = master->Clock();
+        const bool restarted = latest.epoch != linkClock.epoch;
+        linkClock = latest;
+        bpm = linkClock.bpm * linkRatio;
+        if (restarted)
+        {
+            AnchorToMaster();
+            return;
+        }
+        // Master's tempo may have changed since the last block; aim the
+        // click and grid step due next at where it now puts them.
+        ScheduleNext(false);
+        if (GridStepDue())
+        {
+            ScheduleGridStep(false);
+        }
+    }
+
+    void ClickEngine::AnchorToMaster()
+    {
+        const double step = 4.0 / meter.denominator;
+        const double quarter = linkClock.QuarterAt(static_cast<double>(position), sampleRate) * linkRatio;
+        // Tolerates the rounding of a beat landing exactly on this frame.
+        const double next = std::ceil(quarter / step - 1e-9) * step;
+        beat = 0;
+        stepBeats = 1;
+        lastQuarter = next - step;
+        nextQuarter = next;
+        const double nextFrame = linkClock.FrameAt(nextQuarter / linkRatio, sampleRate);
+        nextClick = std::max(position, static_cast<int64_t>(std::llround(nextFrame)));
+        nextClickFraction = std::min(0.5, std::max(-0.5, nextFrame - static_cast<double>(nextClick)));
+        const double lastFrame = linkClock.FrameAt(lastQuarter / linkRatio, sampleRate);
+        lastClick = std::min(nextClick - 1, static_cast<int64_t>(std::llround(lastFrame)));
+        lastClickFraction = std::min(0.5, std::max(-0.5, lastFrame - static_cast<double>(lastClick)));
+        // The grid and gap-click cycle pick up from the coming downbeat.
+        gridStep = barSteps;
+        gapBar = 0;
+        barMuted = false;
+        lastBeat = 0;
+        bars = 0;
+        epoch++;
+    }
+
+    double ClickEngine::StepFrames() const
+    {
+        // Exactly the quarter-note length for one beat of x/4.
+        return sampleRate * 60.0 / bpm * (4.0 * stepBeats / meter.denominator);
+    }
+
+    void ClickEngine::ScheduleGridStep(bool fromLastStep)
+    {
+        if (!fromLastStep && nextGridStep == lastGridStep)
+        {
+            return;
+        }
+        // The same whole-plus-fraction arithmetic as ScheduleNext, with a
+        // step being 1/barSteps of the bar.
+        const double barFrames = sampleRate * 60.0 / bpm * (4.0 * meter.numerator / meter.denominator);
+        const double next = lastGridStepFraction + barFrames / barSteps;
+        const int64_t whole = std::max<int64_t>(1, std::llround(next));
+        nextGridStep = lastGridStep + whole;
+        nextGridStepFraction = next - static_cast<double>(whole);
+        if (nextGridStep < position)
+        {
+            nextGridStep = position;
+            nextGridStepFraction = 0.0;
+        }
+    }
+
+    void ClickEngine::ApplyGridCell(double packed)
+    {
+        const int value = static_cast<int>(packed);
+        const int step = value & 0x3F;
+        const int lane = value >> 6 & 7;
+        GridCell &cell = grid[step][lane];
+        cell.sample = static_cast<uint8_t>(value >> 9 & 0xFF);
+        cell.velocity = static_cast<uint8_t>(value >> 17 & 0x7F);
+        if (cell.velocity != 0)
+        {
+            gridHits[step] = static_cast<uint8_t>(gridHits[step] | 1 << lane);
+        }
+        else
+        {
+            gridHits[step] = static_cast<uint8_t>(gridHits[step] & ~(1 << lane));
+        }
+    }
+
+    const Kit *ClickEngine::FindKit(uint32_t id) const
+    {
+        for (const KitEntry &entry : kits)
+        {
+            if (entry.id == id)
+            {
+                return entry.kit.get();
+            }
+        }
+        return nullptr;
+    }
+}
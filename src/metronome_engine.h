@@ -0,0 +1,508 @@
+#ifndef METRONOME_ENGINE_H_
+#define METRONOME_ENGINE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "metronome_memory_budget.h"
+#include "metronome_seqlock.h"
+#include "metronome_song.h"
+#include "metronome_spsc_queue.h"
+
+namespace metronome
+{
+    class ClickEngine;
+    class CommandJournal;
+
+    enum class CommandType : uint8_t
+    {
+        SetBpm = 1,
+        SetTimeSignature = 2,
+        SetVolume = 3,
+        // value is the id of a kit registered with SetKit.
+        SetKit = 4,
+        // Start again from beat one at the current frame.
+        Restart = 5,
+        // Advance value frames without output; see ClickEngine::Skip.
+        Skip = 6,
+        // value packs a meter (see ClickEngine::SetMeter), which takes over
+        // at the next bar line.
+        SetMeter = 7,
+        // Steps per bar of the step grid, 0 for none; see
+        // ClickEngine::SetGridSteps.
+        SetGridSteps = 8,
+        // value packs one grid cell (see ClickEngine::SetGridCell).
+        SetGridCell = 9,
+        // value packs bars to play and to mute, and a random seed; see
+        // ClickEngine::SetGapClick.
+        SetGapClick = 10,
+        // value packs a layer's output channel and pan; see
+        // ClickEngine::SetRoute.
+        SetRoute = 11,
+        // value is the tempo ratio to the engine passed to
+        // ClickEngine::Follow, 0 to stop following.
+        Follow = 12,
+        // The remaining types only appear in journals: they restore the beat
+        // clock when recording starts mid-stream, and mark its end.
+        SyncBeat = 16,
+        SyncLastClick = 17,
+        SyncLastClickFraction = 18,
+        SyncNextClick = 19,
+        SyncNextClickFraction = 20,
+        SyncVoice = 21,
+        SyncVoiceAccent = 22,
+        // A packed meter taking over at once, and the beats between the last
+        // click and the next.
+        SyncMeter = 23,
+        SyncStepBeats = 24,
+        // The grid step due next and the steps in this bar, packed; the
+        // last and next step frames; one sounding lane voice, packed.
+        SyncGridStep = 25,
+        SyncGridLastStep = 26,
+        SyncGridLastStepFraction = 27,
+        SyncGridNextStep = 28,
+        SyncGridNextStepFraction = 29,
+        SyncLaneVoice = 30,
+        End = 31,
+        // Where the gap-click cycle is, and whether this bar is muted.
+        SyncGapBar = 32,
+    };
+
+    struct EngineCommand
+    {
+        CommandType type = CommandType::Restart;
+        double value = 0.0;
+        // For SetKit, resolved on the control side so that the audio thread
+        // never searches the kit list. When null the id in value is looked
+        // up instead, which is only safe with no control thread (replay).
+        const Kit *kit = nullptr;
+        // For Follow, the master it was called with, carried in the command
+        // so that each Follow applies its own master. Never journaled.
+        const ClickEngine *master = nullptr;
+    };
+
+    // A click as it was scheduled by the engine.
+    struct TickEvent
+    {
+        int64_t frame = 0;
+        int beat = 0;
+        BeatAccent accent = BeatAccent::Normal;
+        // The bar was muted by gap-click mode: nothing sounded.
+        bool muted = false;
+    };
+
+    constexpr int kMaxGridSteps = 64;
+    constexpr int kGridLanes = 8;
+
+    // Most interleaved output channels the engine mixes.
+    constexpr int kMaxOutputChannels = 8;
+    // Tempos the engine accepts, in quarter notes per minute.
+    constexpr double kMinBpm = 1.0;
+    constexpr double kMaxBpm = 1000.0;
+    // Parts of the mix that can be routed on their own: the click's main
+    // sound, its accented sound, then the grid lanes.
+    constexpr int kRouteLayers = 2 + kGridLanes;
+
+    // One step of one grid lane: which kit sample to play (see Kit::Sample)
+    // and how hard, from 1 to 127; velocity 0 leaves the step silent.
+    struct GridCell
+    {
+        uint8_t sample = 0;
+        uint8_t velocity = 0;
+    };
+
+    // A bar of evenly spaced steps, each able to trigger one sample per lane.
+    struct StepGrid
+    {
+        // 0 turns the grid off.
+        int steps = 0;
+        GridCell cells[kMaxGridSteps][kGridLanes] = {};
+    };
+
+    // Peak and RMS over one rendered block, 1.0 being full scale.
+    struct Level
+    {
+        float peak = 0.0f;
+        float rms = 0.0f;
+    };
+
+    // The levels of the last block Render produced: the mixed output over
+    // all its channels, and what the click and each grid lane contributed
+    // to it before routing.
+    struct BlockLevels
+    {
+        // Engine frame the block ended at, and its length.
+        int64_t frame = 0;
+        int frames = 0;
+        Level output;
+        Level click;
+        Level lanes[kGridLanes];
+    };
+
+    // Where an engine's beat stands, as it publishes it after each block
+    // for engines following it (see ClickEngine::Follow): the last click
+    // and the next as exact frames, and the quarter notes counted since the
+    // last restart at each.
+    struct BeatClock
+    {
+        // Restarts so far.
+        uint32_t epoch = 0;
+        double bpm = 120.0;
+        double lastFrame = 0.0;
+        double nextFrame = 0.0;
+        double lastQuarter = 0.0;
+        double nextQuarter = 0.0;
+        // The click at lastFrame: its beat of the bar, from 0, and the bars
+        // started since the last restart, itself included.
+        int beat = 0;
+        int64_t bar = 0;
+
+        // Where the clock puts a quarter note of its count, and the reverse.
+        // Between the clicks the beat may be stretched by a tempo change,
+        // so the two clicks place it; elsewhere it runs at bpm.
+        double FrameAt(double quarter, int sampleRate) const;
+        double QuarterAt(double frame, int sampleRate) const;
+    };
+
+    // Realtime click generator for live playback. Control threads change its
+    // parameters through the Set* methods, which only enqueue commands; the
+    // audio thread picks them up at the start of its next Render call, so
+    // each command takes effect at a well-defined sample frame. Render never
+    // locks or allocates, and its output does not depend on the block size.
+    //
+    // A tempo change stretches or shortens the beat in progress: the next
+    // click moves to the last click plus the new beat length, or to the
+    // current frame if that has already passed.
+    class ClickEngine
+    {
+    public:
+        // Renders channels interleaved channels, 1 to kMaxOutputChannels.
+        // Kits are reserved against budget, if given, as they are
+        // registered; it must outlive the engine.
+        ClickEngine(Kit kit, double bpm, int timeSignature, double volume, int sampleRate, int channels = 1,
+                    MemoryBudget *budget = nullptr);
+        ~ClickEngine();
+
+        ClickEngine(const ClickEngine &) = delete;
+        ClickEngine &operator=(const ClickEngine &) = delete;
+
+        // Control side. Safe to call from any thread; throws
+        // std::invalid_argument on out-of-range values and
+        // std::runtime_error if the command queue is full.
+        void SetBpm(double bpm);
+        // Switches to timeSignature beats per bar at once, dropping any beat
+        // grouping. The beat keeps its note value.
+        void SetTimeSignature(int timeSignature);
+        // Switches meter at the next bar line. Clicks fall on every
+        // 1/denominator note, bpm still counting quarter notes, or only on
+        // the first beat of each group when feltInGroups is set. Group starts
+        // after the downbeat click with BeatAccent::Group. Throws
+        // std::invalid_argument for meters ValidateMeter rejects and for
+        // grouped bars longer than kMaxGroupedBeats.
+        void SetMeter(int numerator, int denominator, const std::vector<int> &grouping = {},
+                      bool feltInGroups = false);
+        void SetVolume(double volume);
+        // Plays a step grid instead of the click: from each downbeat the bar
+        // is split into steps equal parts, and every lane with a non-zero
+        // velocity at a step triggers its sample, cutting off the lane's
+        // previous one. Ticks are still reported per beat. A new step count
+        // takes over at the next bar line; 0 goes back to the click there.
+        void SetGridSteps(int steps);
+        // Edits one cell, heard from the next time its step comes round.
+        // Throws std::invalid_argument for a step, lane, sample (0-255) or
+        // velocity (0-127) out of range.
+        void SetGridCell(int step, int lane, int sample, int velocity);
+        // Switches to grid, queueing only the cells and step count that
+        // differ from what was last sent, so live edits stay cheap.
+        void SetGrid(const StepGrid &grid);
+        // Gap-click training: from the next bar line, plays playBars bars and
+        // then mutes muteBars, over and over. When randomised, every bar is
+        // muted with probability muteBars / (playBars + muteBars) instead,
+        // drawn from seed (0 picks one). Muted bars still report ticks, with
+        // TickEvent::muted set. muteBars 0 turns it off. Throws
+        // std::invalid_argument unless both counts are within 0-255 and
+        // playBars is at least 1.
+        void SetGapClick(int playBars, int muteBars, bool randomised = false, uint32_t seed = 0);
+        // Sends a layer (0 the main click, 1 the accented click, 2 + n grid
+        // lane n) to output channel and the one after it, panned between
+        // the two: 0 plays both at full gain, -1 channel alone and 1 the next
+        // one alone. A layer on the last channel plays there alone, and
+        // mono output ignores routes. Every layer starts on channel 0,
+        // centred. Throws std::invalid_argument for a layer, channel or pan
+        // out of range.
+        void SetRoute(int layer, int channel, double pan);
+        void SetKit(Kit kit);
+        void Restart();
+        // Makes kit available to SetKit commands without switching to it, and
+        // returns its id. Kits superseded by the one playing are freed
+        // first; SetKit and this throw std::runtime_error if the budget
+        // still has no room for kit.
+        uint32_t RegisterKit(Kit kit);
+        // Locks this engine's beat to master's at ratio times its tempo, so
+        // 1.5 plays three beats to master's two. Each click is placed where
+        // master's own clicks put that point of its beat, rather than
+        // scheduled from a tempo of its own, so the two stay phase-locked
+        // through master's tempo changes. The link starts a bar at the next
+        // beat the two share, and again whenever either restarts. Both
+        // engines must count the same frames, master rendering each block
+        // first; one created later should Skip to master's Position()
+        // before following. SetBpm has no effect while linked. ratio 0 goes
+        // back to running free at the last linked tempo. master must
+        // outlive the link. A journal records that the engine was linked
+        // but not master's clock, so RenderJournal refuses to replay it.
+        // Throws std::invalid_argument for a negative ratio, a master at
+        // another sample rate, or this engine.
+        void Follow(const ClickEngine *master, double ratio);
+
+        // Starts logging applied commands to journal, or stops with nullptr.
+        // The audio thread switches over at its next block; ActiveJournal()
+        // reports when it has, after which a previous journal may be closed.
+        void SetJournal(CommandJournal *journal);
+        CommandJournal *ActiveJournal() const { return activeJournal.load(std::memory_order_acquire); }
+
+        // Audio side. Fills all frames (the stream never ends) and returns
+        // frames.
+        size_t Render(int16_t *out, size_t frames);
+        // Advances the stream by frames without producing output, as if they
+        // had been rendered and thrown away, except that clicks falling in
+        // the gap are not reported as ticks. Used to keep the beat grid in
+        // step with the wall clock across frames the device never played.
+        void Skip(size_t frames);
+        // Applies queued commands without rendering, for callers that own the
+        // audio side while no stream is running.
+        void ApplyPending();
+        // Applies a command immediately, bypassing the queue. Only for the
+        // thread that renders, e.g. when replaying a journal.
+        void Apply(const EngineCommand &command);
+
+        // Clicks scheduled by Render, oldest first; dropped when nobody
+        // reads them. Single consumer.
+        bool PopTick(TickEvent &tick) { return ticks.TryPop(tick); }
+        // A second copy of the same ticks, for one more consumer such as an
+        // OscBeatPublisher; only kept while the tap is on. Any thread.
+        void SetTickTap(bool enabled) { tapping.store(enabled, std::memory_order_release); }
+        bool PopTappedTick(TickEvent &tick) { return tappedTicks.TryPop(tick); }
+
+        // Levels of the last block rendered; readable from any thread without
+        // blocking the audio thread. Blocks after a silent one are not
+        // published until something sounds again.
+        BlockLevels Levels() const;
+        // Changes whenever new levels are published.
+        uint32_t LevelsVersion() const { return levels.Version(); }
+
+        // Audio side, or while no stream runs. The commands that take an
+        // engine built with the kit playing to exactly this state through
+        // Apply, as a journal records them when it starts mid-stream. The
+        // first is a SetKit of that kit's id; frames in Sync commands are
+        // relative to Position().
+        std::vector<EngineCommand> State() const;
+        // Audio side, or while no stream runs: the kit playing.
+        const Kit &PlayingKit() const { return *kit; }
+
+        // This engine's beat as of its last block; readable from any
+        // thread.
+        BeatClock Clock() const { return beatClock.Load(); }
+
+        // Frames rendered so far; readable from any thread.
+        int64_t Position() const { return publishedPosition.load(std::memory_order_acquire); }
+        int SampleRate() const { return sampleRate; }
+        int Channels() const { return channels; }
+
+    private:
+        struct KitEntry
+        {
+            uint32_t id;
+            std::unique_ptr<const Kit> kit;
+            MemoryReservation memory;
+        };
+
+        // A meter in the form the audio thread uses; packs losslessly into
+        // a command value.
+        struct Meter
+        {
+            int numerator = 4;
+            int denominator = 4;
+            // Bit n set when beat n starts a group.
+            uint32_t groupStarts = 1;
+            bool feltInGroups = false;
+
+            bool GroupStart(int beat) const { return beat < 32 && (groupStarts >> beat & 1) != 0; }
+            double Pack() const;
+            static Meter Unpack(double value);
+        };
+
+        // Integer peak and sum of squares, as gathered while mixing.
+        struct LevelSum
+        {
+            int peak = 0;
+            int64_t sumSquares = 0;
+
+            void Add(const LevelSum &other);
+            bool Silent() const { return peak == 0; }
+        };
+
+        // One LevelSum per layer: output, click, then the lanes.
+        struct BlockLevelSums
+        {
+            int64_t frame = 0;
+            int frames = 0;
+            LevelSum layers[2 + kGridLanes];
+        };
+
+        // A layer's route as the mixer applies it. pan stays in the steps
+        // the command carries (+-32767), so a replay computes equal gains.
+        struct Route
+        {
+            int channel = 0;
+            int pan = 0;
+            // Gains on channel and on the one after it; right is 0 when
+            // there is no channel after it.
+            double left = 1.0;
+            double right = 1.0;
+        };
+
+        // Mixes one voice into interleaved output; see MixPanned.
+        using PannedMix = void (*)(int16_t *, const int16_t *, int64_t, double, int, double, double, int &, int64_t &);
+
+        // A sample sounding from start, scaled by gain.
+        struct Voice
+        {
+            const std::vector<int16_t> *sound = nullptr;
+            int64_t start = 0;
+            double gain = 1.0;
+            uint8_t sample = 0;
+            uint8_t velocity = 0;
+        };
+
+        uint32_t RegisterKitLocked(Kit kit);
+        void Push(const EngineCommand &command);
+        void PushLocked(const EngineCommand &command);
+        void SetGridCellLocked(int step, int lane, int sample, int velocity);
+        void ApplyQueued();
+        void SwitchJournal();
+        // Calls emit(type, value) for each of State()'s commands.
+        template <typename Emit>
+        void EmitState(Emit emit) const;
+        void Journal(CommandType type, double value);
+        // Renders into out, or only advances the clicks when out is null.
+        void Advance(int16_t *out, size_t frames);
+        // Mixes count frames of source into out along layer's route.
+        void MixVoice(int16_t *out, const int16_t *source, int64_t count, double gain, int layer, LevelSum &level) const;
+        void ApplyRoute(double packed);
+        void PublishLevels(size_t frames);
+        void ScheduleNext(bool fromLastClick);
+        // Picks up master's latest clock at the start of a block.
+        void SyncToMaster();
+        // Starts a bar at the first beat on master's grid from now on.
+        void AnchorToMaster();
+        void PublishClock();
+        // Frames from the last click to the next at the current tempo.
+        double StepFrames() const;
+        void ScheduleGridStep(bool fromLastStep);
+        // Triggers the lanes of the grid step due at frame.
+        void PlayGridStep(int64_t frame);
+        bool GridStepDue() const { return gridStep < barSteps; }
+        void ApplyGridCell(double packed);
+        // Gain of a click with this accent, including its sound's trim.
+        double ClickGain(BeatAccent accent) const;
+        void StartLaneVoice(int lane, int sample, int velocity, int64_t start);
+        void StopLaneVoices();
+        // Decides at a downbeat whether the coming bar is muted.
+        bool NextBarMuted();
+        const Kit *FindKit(uint32_t id) const;
+
+        const int sampleRate;
+        const int channels;
+        MemoryBudget *const budget;
+
+        // Control side.
+        std::mutex controlMutex;
+        std::vector<KitEntry> kits;
+        uint32_t nextKitId = 1;
+        SpscQueue<EngineCommand> commands;
+        std::atomic<CommandJournal *> requestedJournal{nullptr};
+        // The grid as last queued, for SetGrid to diff against.
+        StepGrid sentGrid;
+
+        // Audio side.
+        double bpm;
+        Meter meter;
+        Meter pendingMeter;
+        bool hasPendingMeter = false;
+        // Beats from the last click to the next; more than one between the
+        // groups of a meter felt in groups.
+        int stepBeats = 1;
+        double volume;
+        const Kit *kit = nullptr;
+        uint32_t kitId = 0;
+        int64_t position = 0;
+        int beat = 0;
+        int64_t lastClick = 0;
+        double lastClickFraction = 0.0;
+        int64_t nextClick = 0;
+        double nextClickFraction = 0.0;
+        // Quarter notes counted since the last restart at the last click
+        // and the next; in a follower, master's count times the ratio.
+        double lastQuarter = 0.0;
+        double nextQuarter = 0.0;
+        uint32_t epoch = 0;
+        // The beat of the last click, and downbeats played since the last
+        // restart.
+        int lastBeat = 0;
+        int64_t bars = 0;
+        // Following: null when running free. linkClock is master's clock
+        // as read at the start of the block.
+        const ClickEngine *master = nullptr;
+        double linkRatio = 0.0;
+        BeatClock linkClock;
+        const std::vector<int16_t> *voice = nullptr;
+        BeatAccent voiceAccent = BeatAccent::Normal;
+        double voiceGain = 1.0;
+        int64_t voiceStart = 0;
+        // Step grid: the requested step count and the one the current bar
+        // plays, and a bit per lane with a hit at each step.
+        int gridSteps = 0;
+        int barSteps = 0;
+        GridCell grid[kMaxGridSteps][kGridLanes] = {};
+        uint8_t gridHits[kMaxGridSteps] = {};
+        int gridStep = 0;
+        int64_t lastGridStep = 0;
+        double lastGridStepFraction = 0.0;
+        int64_t nextGridStep = 0;
+        double nextGridStepFraction = 0.0;
+        // One voice per lane; a bit per lane that is sounding.
+        Voice laneVoices[kGridLanes];
+        uint8_t soundingLanes = 0;
+        // Gap-click mode: off while gapMuteBars is 0. gapRandom is the
+        // xorshift state when randomised, else 0.
+        int gapPlayBars = 0;
+        int gapMuteBars = 0;
+        uint32_t gapRandom = 0;
+        int gapBar = 0;
+        bool barMuted = false;
+        CommandJournal *journal = nullptr;
+        // Per layer; see SetRoute. pannedMix is the kernel for this channel
+        // count, null in mono.
+        Route routes[kRouteLayers];
+        PannedMix pannedMix = nullptr;
+        // Levels of the block being rendered; published when it is done.
+        BlockLevelSums blockLevels;
+        bool levelsSilent = true;
+
+        SpscQueue<TickEvent> ticks;
+        SpscQueue<TickEvent> tappedTicks;
+        std::atomic<bool> tapping{false};
+        std::atomic<uint32_t> appliedKitId{0};
+        std::atomic<CommandJournal *> activeJournal{nullptr};
+        std::atomic<int64_t> publishedPosition{0};
+        Seqlock<BlockLevelSums> levels;
+        Seqlock<BeatClock> beatClock;
+    };
+}
+
+#endif // METRONOME_ENGINE_H_
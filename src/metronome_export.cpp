@@ -0,0 +1,183 @@
+#include "metronome_export.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <utility>
+
+#include "metronome_log.h"
+#include "metronome_renderer.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    BatchExporter::BatchExporter(ProgressCallback onProgress, unsigned threads)
+        : onProgress(std::move(onProgress))
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; i++)
+        {
+            workers.emplace_back(&BatchExporter::WorkerLoop, this);
+        }
+    }
+
+    BatchExporter::~BatchExporter()
+    {
+        CancelAll();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCV.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    int BatchExporter::Submit(ExportJob job)
+    {
+        int id;
+        std::shared_ptr<std::atomic<bool>> cancelled = std::make_shared<std::atomic<bool>>(false);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            id = nextJobId++;
+            active[id] = cancelled;
+        }
+        // Before a worker can see the job, so Queued always comes first.
+        Report(ExportProgress{id, ExportState::Queued, 0.0, ""});
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(QueuedJob{id, std::move(job), cancelled});
+        }
+        queueCV.notify_one();
+        return id;
+    }
+
+    void BatchExporter::Cancel(int jobId)
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        auto it = active.find(jobId);
+        if (it != active.end())
+        {
+            it->second->store(true);
+        }
+    }
+
+    void BatchExporter::CancelAll()
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        for (auto &entry : active)
+        {
+            entry.second->store(true);
+        }
+    }
+
+    void BatchExporter::Wait()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        idleCV.wait(lock, [this]
+                    { return active.empty(); });
+    }
+
+    void BatchExporter::WorkerLoop()
+    {
+        METRONOME_TRACE_THREAD_NAME("export worker");
+        while (true)
+        {
+            QueuedJob queued;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCV.wait(lock, [this]
+                             { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    return;
+                }
+                queued = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            Run(queued);
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                active.erase(queued.id);
+            }
+            idleCV.notify_all();
+        }
+    }
+
+    void BatchExporter::Run(QueuedJob &queued)
+    {
+        ExportProgress progress{queued.id, ExportState::Running, 0.0, ""};
+        if (queued.cancelled->load())
+        {
+            progress.state = ExportState::Cancelled;
+            Report(progress);
+            return;
+        }
+
+        // Only a file this job created is removed when it fails.
+        bool created = false;
+        try
+        {
+            OfflineRenderer renderer(queued.job.song);
+            auto writer = CreateAudioFileWriter(queued.job.path, queued.job.format, renderer.SampleRate());
+            created = true;
+            Report(progress);
+
+            std::vector<int16_t> block(kBlockFrames);
+            const double length = static_cast<double>(std::max<int64_t>(1, renderer.Length()));
+            int reportedPercent = 0;
+            size_t rendered;
+            while ((rendered = renderer.Render(block.data(), block.size())) > 0)
+            {
+                if (queued.cancelled->load())
+                {
+                    writer.reset();
+                    std::remove(queued.job.path.c_str());
+                    progress.state = ExportState::Cancelled;
+                    Report(progress);
+                    return;
+                }
+                writer->Write(block.data(), rendered);
+
+                const int percent = static_cast<int>(renderer.Position() * 100 / length);
+                if (percent > reportedPercent && percent < 100)
+                {
+                    reportedPercent = percent;
+                    progress.progress = percent / 100.0;
+                    Report(progress);
+                }
+            }
+            writer->Close();
+
+            progress.state = ExportState::Done;
+            progress.progress = 1.0;
+        }
+        catch (const std::exception &e)
+        {
+            progress.state = ExportState::Failed;
+            progress.error = e.what();
+            Log(LogLevel::Error, "export", "Job %d failed: %s", progress.jobId, e.what());
+            if (created)
+            {
+                std::remove(queued.job.path.c_str());
+            }
+        }
+        Report(progress);
+    }
+
+    void BatchExporter::Report(const ExportProgress &progress)
+    {
+        if (onProgress)
+        {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            onProgress(progress);
+        }
+    }
+}
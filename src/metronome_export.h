@@ -0,0 +1,89 @@
+#ifndef METRONOME_EXPORT_H_
+#define METRONOME_EXPORT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metronome_audio_file.h"
+#include "metronome_song.h"
+
+namespace metronome
+{
+    struct ExportJob
+    {
+        Song song;
+        std::string path;
+        AudioFileFormat format = AudioFileFormat::Wav;
+    };
+
+    enum class ExportState
+    {
+        Queued,
+        Running,
+        Done,
+        Cancelled,
+        Failed,
+    };
+
+    struct ExportProgress
+    {
+        int jobId = 0;
+        ExportState state = ExportState::Queued;
+        double progress = 0.0;
+        std::string error;
+    };
+
+    // Renders queued songs through the offline renderer on a pool of worker
+    // threads, one song per worker. The progress callback reports Queued on
+    // the thread calling Submit and everything after it from the worker
+    // threads, at most once per percent for each job. Calls never overlap.
+    class BatchExporter
+    {
+    public:
+        using ProgressCallback = std::function<void(const ExportProgress &)>;
+
+        static constexpr size_t kBlockFrames = 8192;
+
+        explicit BatchExporter(ProgressCallback onProgress, unsigned threads = 0);
+        ~BatchExporter();
+
+        int Submit(ExportJob job);
+        void Cancel(int jobId);
+        void CancelAll();
+        // Blocks until every submitted job has finished, failed or been cancelled.
+        void Wait();
+
+    private:
+        struct QueuedJob
+        {
+            int id;
+            ExportJob job;
+            std::shared_ptr<std::atomic<bool>> cancelled;
+        };
+
+        void WorkerLoop();
+        void Run(QueuedJob &queued);
+        void Report(const ExportProgress &progress);
+
+        ProgressCallback onProgress;
+        std::mutex queueMutex;
+        std::condition_variable queueCV;
+        std::condition_variable idleCV;
+        std::deque<QueuedJob> queue;
+        std::map<int, std::shared_ptr<std::atomic<bool>>> active;
+        std::mutex reportMutex;
+        std::vector<std::thread> workers;
+        int nextJobId = 1;
+        bool stopping = false;
+    };
+}
+
+#endif // METRONOME_EXPORT_H_
@@ -0,0 +1,422 @@
+#include "metronome_journal.h"
+
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "metronome_log.h"
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr char kMagic[4] = {'M', 'T', 'J', '1'};
+        constexpr char kKitChunk = 'K';
+        constexpr char kCommandChunk = 'C';
+        constexpr char kLayoutChunk = 'L';
+        constexpr size_t kEntrySize = 17;
+        constexpr auto kDrainInterval = std::chrono::milliseconds(50);
+
+        void PutU32(std::string &out, uint32_t value)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+            }
+        }
+
+        void PutU64(std::string &out, uint64_t value)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+            }
+        }
+
+        void PutPcm(std::string &out, const std::vector<int16_t> &pcm)
+        {
+            for (int16_t sample : pcm)
+            {
+                out.push_back(static_cast<char>(static_cast<uint16_t>(sample) & 0xFF));
+                out.push_back(static_cast<char>(static_cast<uint16_t>(sample) >> 8));
+            }
+        }
+
+        void PutEntry(std::string &out, const JournalEntry &entry)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &entry.value, sizeof(bits));
+            PutU64(out, static_cast<uint64_t>(entry.frame));
+            out.push_back(static_cast<char>(entry.type));
+            PutU64(out, bits);
+        }
+
+        std::string Chunk(char tag, const std::string &payload)
+        {
+            std::string chunk(1, tag);
+            PutU32(chunk, static_cast<uint32_t>(payload.size()));
+            return chunk + payload;
+        }
+
+        class ByteReader
+        {
+        public:
+            ByteReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+            bool AtEnd() const { return offset == size; }
+
+            uint8_t U8()
+            {
+                Need(1);
+                return data[offset++];
+            }
+
+            uint64_t Uint(int bytes)
+            {
+                Need(bytes);
+                uint64_t value = 0;
+                for (int i = 0; i < bytes; i++)
+                {
+                    value |= static_cast<uint64_t>(data[offset + i]) << (8 * i);
+                }
+                offset += bytes;
+                return value;
+            }
+
+            const uint8_t *Take(size_t bytes)
+            {
+                Need(bytes);
+                const uint8_t *start = data + offset;
+                offset += bytes;
+                return start;
+            }
+
+        private:
+            void Need(size_t bytes) const
+            {
+                if (size - offset < bytes)
+                {
+                    throw std::invalid_argument("Truncated journal");
+                }
+            }
+
+            const uint8_t *data;
+            size_t size;
+            size_t offset = 0;
+        };
+
+        std::vector<int16_t> ReadPcm(ByteReader &reader, uint32_t count)
+        {
+            std::vector<int16_t> pcm(count);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pcm[i] = static_cast<int16_t>(reader.Uint(2));
+            }
+            return pcm;
+        }
+    }
+
+    CommandJournal::CommandJournal(const std::string &path, int sampleRate, size_t capacity, MemoryBudget *budget)
+        : memory(Reserve(budget, MemoryComponent::Journal,
+                         SpscQueue<JournalEntry>::RoundUp(capacity) * sizeof(JournalEntry))),
+          file(path, std::ios::binary | std::ios::trunc), entries(capacity)
+    {
+        if (!file)
+        {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        std::string header(kMagic, sizeof(kMagic));
+        PutU32(header, static_cast<uint32_t>(sampleRate));
+        file.write(header.data(), static_cast<std::streamsize>(header.size()));
+        drainer = std::thread(&CommandJournal::DrainLoop, this);
+    }
+
+    CommandJournal::~CommandJournal()
+    {
+        try
+        {
+            Close(lastFrame.load());
+        }
+        catch (...)
+        {
+        }
+    }
+
+    bool CommandJournal::Record(const JournalEntry &entry)
+    {
+        lastFrame.store(entry.frame, std::memory_order_relaxed);
+        if (!entries.TryPush(entry))
+        {
+            if (dropped.fetch_add(1, std::memory_order_relaxed) == 0)
+            {
+                Log(LogLevel::Warning, "journal", "Ring full at frame %lld; dropping commands",
+                    static_cast<long long>(entry.frame));
+            }
+            return false;
+        }
+        return true;
+    }
+
+    void CommandJournal::RecordKit(uint32_t id, const Kit &kit)
+    {
+        std::string payload;
+        PutU32(payload, id);
+        PutU32(payload, static_cast<uint32_t>(kit.mainSound.size()));
+        PutU32(payload, static_cast<uint32_t>(kit.accentedSound.size()));
+        for (const auto *sound : {&kit.mainSound, &kit.accentedSound})
+        {
+            PutPcm(payload, *sound);
+        }
+        if (!kit.samples.empty() || !kit.trims.empty())
+        {
+            PutU32(payload, static_cast<uint32_t>(kit.samples.size()));
+            for (const std::vector<int16_t> &sound : kit.samples)
+            {
+                PutU32(payload, static_cast<uint32_t>(sound.size()));
+                PutPcm(payload, sound);
+            }
+        }
+        // The trims as applied, so a replay needs no analysis.
+        if (!kit.trims.empty())
+        {
+            PutU32(payload, static_cast<uint32_t>(kit.trims.size()));
+            for (float trim : kit.trims)
+            {
+                uint32_t bits;
+                std::memcpy(&bits, &trim, sizeof(bits));
+                PutU32(payload, bits);
+            }
+        }
+        const std::string chunk = Chunk(kKitChunk, payload);
+
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (!closed)
+        {
+            file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        }
+    }
+
+    void CommandJournal::RecordLayout(int channels)
+    {
+        std::string payload;
+        PutU32(payload, static_cast<uint32_t>(channels));
+        const std::string chunk = Chunk(kLayoutChunk, payload);
+
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (!closed)
+        {
+            file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        }
+    }
+
+    void CommandJournal::Close(int64_t endFrame)
+    {
+        {
+            std::lock_guard<std::mutex> lock(drainMutex);
+            if (stopping)
+            {
+                return;
+            }
+            stopping = true;
+        }
+        drainCV.notify_all();
+        if (drainer.joinable())
+        {
+            drainer.join();
+        }
+        Drain();
+
+        std::string payload;
+        PutEntry(payload, JournalEntry{endFrame, CommandType::End, 0.0});
+        const std::string chunk = Chunk(kCommandChunk, payload);
+        std::lock_guard<std::mutex> lock(fileMutex);
+        file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        file.close();
+        closed = true;
+        if (file.fail())
+        {
+            throw std::runtime_error("Failed to write journal");
+        }
+    }
+
+    void CommandJournal::DrainLoop()
+    {
+        std::unique_lock<std::mutex> lock(drainMutex);
+        while (!stopping)
+        {
+            drainCV.wait_for(lock, kDrainInterval, [this]
+                             { return stopping; });
+            lock.unlock();
+            Drain();
+            lock.lock();
+        }
+    }
+
+    void CommandJournal::Drain()
+    {
+        std::string payload;
+        JournalEntry entry;
+        while (entries.TryPop(entry))
+        {
+            PutEntry(payload, entry);
+        }
+        if (payload.empty())
+        {
+            return;
+        }
+        const std::string chunk = Chunk(kCommandChunk, payload);
+        std::lock_guard<std::mutex> lock(fileMutex);
+        file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        file.flush();
+    }
+
+    Journal ReadJournal(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        ByteReader reader(bytes.data(), bytes.size());
+        if (bytes.size() < sizeof(kMagic) || std::memcmp(reader.Take(sizeof(kMagic)), kMagic, sizeof(kMagic)) != 0)
+        {
+            throw std::invalid_argument("Not a metronome journal");
+        }
+        Journal journal;
+        journal.sampleRate = static_cast<int>(reader.Uint(4));
+        while (!reader.AtEnd())
+        {
+            const char tag = static_cast<char>(reader.U8());
+            const uint32_t size = static_cast<uint32_t>(reader.Uint(4));
+            ByteReader chunk(reader.Take(size), size);
+            if (tag == kKitChunk)
+            {
+                const uint32_t id = static_cast<uint32_t>(chunk.Uint(4));
+                const uint32_t mainCount = static_cast<uint32_t>(chunk.Uint(4));
+                const uint32_t accentedCount = static_cast<uint32_t>(chunk.Uint(4));
+                Kit kit;
+                kit.mainSound = ReadPcm(chunk, mainCount);
+                kit.accentedSound = ReadPcm(chunk, accentedCount);
+                // Journals from before step grids end here.
+                if (!chunk.AtEnd())
+                {
+                    const uint32_t sampleCount = static_cast<uint32_t>(chunk.Uint(4));
+                    for (uint32_t i = 0; i < sampleCount; i++)
+                    {
+                        kit.samples.push_back(ReadPcm(chunk, static_cast<uint32_t>(chunk.Uint(4))));
+                    }
+                }
+                // And from before gain trims here.
+                if (!chunk.AtEnd())
+                {
+                    const uint32_t trimCount = static_cast<uint32_t>(chunk.Uint(4));
+                    for (uint32_t i = 0; i < trimCount; i++)
+                    {
+                        const uint32_t bits = static_cast<uint32_t>(chunk.Uint(4));
+                        float trim;
+                        std::memcpy(&trim, &bits, sizeof(trim));
+                        kit.trims.push_back(trim);
+                    }
+                }
+                journal.kits[id] = std::move(kit);
+            }
+            else if (tag == kLayoutChunk)
+            {
+                journal.channels = static_cast<int>(chunk.Uint(4));
+                if (journal.channels < 1 || journal.channels > kMaxOutputChannels)
+                {
+                    throw std::invalid_argument("Corrupt journal layout chunk");
+                }
+            }
+            else if (tag == kCommandChunk)
+            {
+                if (size % kEntrySize != 0)
+                {
+                    throw std::invalid_argument("Corrupt journal command chunk");
+                }
+                while (!chunk.AtEnd())
+                {
+                    JournalEntry entry;
+                    entry.frame = static_cast<int64_t>(chunk.Uint(8));
+                    entry.type = static_cast<CommandType>(chunk.U8());
+                    const uint64_t bits = chunk.Uint(8);
+                    std::memcpy(&entry.value, &bits, sizeof(bits));
+                    journal.entries.push_back(entry);
+                }
+            }
+            // Unknown chunks are skipped so the format can grow.
+        }
+        return journal;
+    }
+
+    std::vector<int16_t> RenderJournal(const Journal &journal)
+    {
+        std::vector<int16_t> pcm;
+        if (journal.entries.empty())
+        {
+            return pcm;
+        }
+        const JournalEntry &first = journal.entries.front();
+        if (first.type != CommandType::SetKit || journal.kits.count(static_cast<uint32_t>(first.value)) == 0)
+        {
+            throw std::invalid_argument("Journal does not start with a recorded kit");
+        }
+
+        ClickEngine engine(journal.kits.at(static_cast<uint32_t>(first.value)), 120.0, 4, 1.0, journal.sampleRate,
+                           journal.channels);
+        const size_t channels = static_cast<size_t>(journal.channels);
+        std::map<uint32_t, uint32_t> engineKitIds;
+        for (const auto &entry : journal.kits)
+        {
+            engineKitIds[entry.first] = engine.RegisterKit(entry.second);
+        }
+
+        int64_t position = first.frame;
+        auto renderTo = [&](int64_t frame)
+        {
+            if (frame > position)
+            {
+                const size_t offset = pcm.size();
+                pcm.resize(offset + static_cast<size_t>(frame - position) * channels);
+                engine.Render(pcm.data() + offset, static_cast<size_t>(frame - position));
+                position = frame;
+            }
+        };
+
+        for (const JournalEntry &entry : journal.entries)
+        {
+            renderTo(entry.frame);
+            if (entry.type == CommandType::End)
+            {
+                break;
+            }
+            if (entry.type == CommandType::Follow && entry.value > 0.0)
+            {
+                // The clicks followed another engine's clock, which the
+                // journal does not hold.
+                throw std::invalid_argument("Journal of an engine following another cannot be replayed");
+            }
+            EngineCommand command{entry.type, entry.value};
+            if (entry.type == CommandType::SetKit)
+            {
+                auto it = engineKitIds.find(static_cast<uint32_t>(entry.value));
+                if (it == engineKitIds.end())
+                {
+                    throw std::invalid_argument("Journal references a kit it does not contain");
+                }
+                command.value = it->second;
+            }
+            engine.Apply(command);
+            if (entry.type == CommandType::Skip)
+            {
+                // The device played nothing while the engine skipped ahead.
+                pcm.resize(pcm.size() + static_cast<size_t>(entry.value) * channels, 0);
+                position += static_cast<int64_t>(entry.value);
+            }
+        }
+        return pcm;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef METRONOME_JOURNAL_H_
+#define METRONOME_JOURNAL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metronome_engine.h"
+#include "metronome_memory_budget.h"
+#include "metronome_song.h"
+#include "metronome_spsc_queue.h"
+
+namespace metronome
+{
+    // One applied command, tagged with the engine frame it took effect at.
+    struct JournalEntry
+    {
+        int64_t frame = 0;
+        CommandType type = CommandType::End;
+        double value = 0.0;
+    };
+
+    // Binary log of the commands a ClickEngine applies. The audio thread
+    // appends to a preallocated ring (lock- and allocation-free); a
+    // background thread drains it to disk. Kits are written from the
+    // control thread when they are registered, so a journal holds everything
+    // needed to reproduce the session offline.
+    //
+    // File layout (little-endian): "MTJ1", u32 sample rate, then chunks of
+    // u8 tag, u32 payload size, payload. 'K' chunks hold a kit (u32 id, u32
+    // main and accented lengths, int16 samples, then optionally u32 count
+    // and that many grid samples as u32 length plus int16 samples, then
+    // optionally u32 count and that many f32 gain trims); 'L' chunks hold
+    // the output layout (u32 channels, 1 if absent); 'C' chunks hold
+    // 17-byte entries (i64 frame, u8 type, f64 value).
+    class CommandJournal
+    {
+    public:
+        // Throws std::runtime_error if the file can't be opened or budget
+        // has no room for capacity entries.
+        CommandJournal(const std::string &path, int sampleRate, size_t capacity = 4096,
+                       MemoryBudget *budget = nullptr);
+        // Closes at the last recorded frame if Close was not called.
+        ~CommandJournal();
+
+        CommandJournal(const CommandJournal &) = delete;
+        CommandJournal &operator=(const CommandJournal &) = delete;
+
+        // Audio thread. Returns false (and counts a drop) if the ring is full.
+        bool Record(const JournalEntry &entry);
+        // Control thread.
+        void RecordKit(uint32_t id, const Kit &kit);
+        // Control thread; the number of interleaved channels recorded.
+        void RecordLayout(int channels);
+        // Writes an End entry at endFrame, drains and closes the file. The
+        // engine must no longer be recording into this journal.
+        void Close(int64_t endFrame);
+
+        uint64_t Dropped() const { return dropped.load(); }
+
+    private:
+        void DrainLoop();
+        void Drain();
+
+        // Taken first, so a refusal leaves the file alone.
+        MemoryReservation memory;
+        std::mutex fileMutex;
+        std::ofstream file;
+        SpscQueue<JournalEntry> entries;
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<int64_t> lastFrame{0};
+        bool closed = false;
+
+        std::mutex drainMutex;
+        std::condition_variable drainCV;
+        bool stopping = false;
+        std::thread drainer;
+    };
+
+    struct Journal
+    {
+        int sampleRate = 44100;
+        int channels = 1;
+        std::map<uint32_t, Kit> kits;
+        std::vector<JournalEntry> entries;
+    };
+
+    // Throws std::runtime_error if the file can't be read and
+    // std::invalid_argument if it is not a journal.
+    Journal ReadJournal(const std::string &path);
+
+    // Replays the journal through a fresh engine, from the first recorded
+    // frame to the End entry, reproducing the recorded output exactly, with
+    // the recorded number of channels interleaved.
+    // Frames the engine skipped over (see ClickEngine::Skip) come out as
+    // silence, as they did on the device. Throws std::invalid_argument if
+    // the engine was following another (see ClickEngine::Follow).
+    std::vector<int16_t> RenderJournal(const Journal &journal);
+}
+
+#endif // METRONOME_JOURNAL_H_
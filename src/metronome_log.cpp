@@ -0,0 +1,308 @@
+#include "metronome_log.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr size_t kLogCapacity = 1024;
+        constexpr auto kDrainInterval = std::chrono::milliseconds(20);
+
+        // Bounded multi-producer ring after Dmitry Vyukov's MPMC queue: each
+        // cell's sequence number says whether it is free for the producer at
+        // a given position or holds a record for the consumer.
+        class LogRing
+        {
+        public:
+            LogRing()
+            {
+                for (size_t i = 0; i < cells.size(); i++)
+                {
+                    cells[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            // Reserves a cell, lets fill write the record in place and
+            // publishes it. Returns false if the ring is full.
+            template <typename Fill>
+            bool Push(Fill &&fill)
+            {
+                size_t position = tail.load(std::memory_order_relaxed);
+                Cell *cell;
+                while (true)
+                {
+                    cell = &cells[position % cells.size()];
+                    const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                    const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                    if (difference == 0)
+                    {
+                        if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        {
+                            break;
+                        }
+                    }
+                    else if (difference < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        position = tail.load(std::memory_order_relaxed);
+                    }
+                }
+                fill(cell->record);
+                cell->sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Single consumer: callers hold the drainer's mutex.
+            bool Pop(LogRecord &record)
+            {
+                Cell &cell = cells[head % cells.size()];
+                if (cell.sequence.load(std::memory_order_acquire) != head + 1)
+                {
+                    return false;
+                }
+                record = cell.record;
+                cell.sequence.store(head + cells.size(), std::memory_order_release);
+                head++;
+                return true;
+            }
+
+        private:
+            struct Cell
+            {
+                std::atomic<size_t> sequence;
+                LogRecord record;
+            };
+
+            std::array<Cell, kLogCapacity> cells;
+            alignas(64) std::atomic<size_t> tail{0};
+            alignas(64) size_t head = 0;
+        };
+
+        class LogDrainer
+        {
+        public:
+            ~LogDrainer()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+                if (thread.joinable())
+                {
+                    thread.join();
+                }
+            }
+
+            void SetFile(const std::string &path)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                file.close();
+                if (!path.empty())
+                {
+                    file.clear();
+                    file.open(path, std::ios::app);
+                    if (!file)
+                    {
+                        throw std::runtime_error("Failed to open " + path);
+                    }
+                }
+                StartLocked();
+            }
+
+            void SetCallback(LogCallback callback)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                this->callback = std::move(callback);
+                StartLocked();
+            }
+
+            void Flush()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                DrainLocked();
+            }
+
+        private:
+            void StartLocked()
+            {
+                if (!thread.joinable() && (file.is_open() || callback))
+                {
+                    thread = std::thread(&LogDrainer::Run, this);
+                }
+            }
+
+            void Run()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopping)
+                {
+                    DrainLocked();
+                    wake.wait_for(lock, kDrainInterval, [this]
+                                  { return stopping; });
+                }
+                DrainLocked();
+            }
+
+            void DrainLocked()
+            {
+                if (!file.is_open() && !callback)
+                {
+                    return;
+                }
+                LogRecord record;
+                bool wrote = false;
+                while (ring.Pop(record))
+                {
+                    if (file.is_open())
+                    {
+                        file << FormatLogRecord(record) << '\n';
+                        wrote = true;
+                    }
+                    if (callback)
+                    {
+                        callback(record);
+                    }
+                }
+                if (wrote)
+                {
+                    file.flush();
+                }
+            }
+
+        public:
+            LogRing ring;
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<LogLevel> level{LogLevel::Info};
+
+        private:
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::ofstream file;
+            LogCallback callback;
+            bool stopping = false;
+            std::thread thread;
+        };
+
+        LogDrainer &Drainer()
+        {
+            static LogDrainer drainer;
+            return drainer;
+        }
+
+        int64_t NowMicros()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        }
+    }
+
+    void SetLogLevel(LogLevel level)
+    {
+        Drainer().level.store(level, std::memory_order_relaxed);
+    }
+
+    LogLevel GetLogLevel()
+    {
+        return Drainer().level.load(std::memory_order_relaxed);
+    }
+
+    bool LogEnabled(LogLevel level)
+    {
+        return level != LogLevel::Off && level >= GetLogLevel();
+    }
+
+    void Log(LogLevel level, const char *category, const char *format, ...)
+    {
+        if (!LogEnabled(level))
+        {
+            return;
+        }
+        LogDrainer &drainer = Drainer();
+        va_list arguments;
+        va_start(arguments, format);
+        const bool pushed = drainer.ring.Push([&](LogRecord &record)
+                                              {
+                                                  record.time = NowMicros();
+                                                  record.level = level;
+                                                  record.category = category;
+                                                  std::vsnprintf(record.message, sizeof(record.message), format, arguments);
+                                              });
+        va_end(arguments);
+        if (!pushed)
+        {
+            drainer.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void SetLogFile(const std::string &path)
+    {
+        Drainer().SetFile(path);
+    }
+
+    void SetLogCallback(LogCallback callback)
+    {
+        Drainer().SetCallback(std::move(callback));
+    }
+
+    void FlushLog()
+    {
+        Drainer().Flush();
+    }
+
+    uint64_t DroppedLogRecords()
+    {
+        return Drainer().dropped.load(std::memory_order_relaxed);
+    }
+
+    const char *LogLevelName(LogLevel level)
+    {
+        switch (level)
+        {
+        case LogLevel::Debug:
+            return "debug";
+        case LogLevel::Info:
+            return "info";
+        case LogLevel::Warning:
+            return "warning";
+        case LogLevel::Error:
+            return "error";
+        case LogLevel::Off:
+            break;
+        }
+        return "off";
+    }
+
+    std::string FormatLogRecord(const LogRecord &record)
+    {
+        const std::time_t seconds = static_cast<std::time_t>(record.time / 1000000);
+        std::tm utc{};
+#if defined(_WIN32)
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &utc);
+        char line[64 + kLogMessageSize];
+        std::snprintf(line, sizeof(line), "%s.%06d %c %s: %s", stamp, static_cast<int>(record.time % 1000000),
+                      std::toupper(static_cast<unsigned char>(LogLevelName(record.level)[0])), record.category, record.message);
+        return line;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef METRONOME_LOG_H_
+#define METRONOME_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace metronome
+{
+    enum class LogLevel : uint8_t
+    {
+        Debug = 0,
+        Info = 1,
+        Warning = 2,
+        Error = 3,
+        Off = 4,
+    };
+
+    constexpr size_t kLogMessageSize = 112;
+
+    struct LogRecord
+    {
+        // Microseconds since the Unix epoch.
+        int64_t time = 0;
+        LogLevel level = LogLevel::Info;
+        // A string literal naming the subsystem, e.g. "engine".
+        const char *category = "";
+        // Truncated to fit.
+        char message[kLogMessageSize] = {};
+    };
+
+    using LogCallback = std::function<void(const LogRecord &)>;
+
+    // Records below the level are discarded before they are formatted.
+    // Defaults to Info.
+    void SetLogLevel(LogLevel level);
+    LogLevel GetLogLevel();
+    bool LogEnabled(LogLevel level);
+
+    // printf-style. Never blocks and never allocates, so it may be called
+    // from the audio thread: the record is formatted into a slot of a
+    // preallocated ring, or dropped if the ring is full. A background
+    // thread delivers records to the sinks below; until one is set, records
+    // stay queued.
+    void Log(LogLevel level, const char *category, const char *format, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+
+    // Appends one line per record to path; an empty path closes the file.
+    // Throws std::runtime_error if the file can't be opened.
+    void SetLogFile(const std::string &path);
+    // Called on the drainer thread for every record; nullptr removes it.
+    void SetLogCallback(LogCallback callback);
+    // Delivers every queued record before returning.
+    void FlushLog();
+    uint64_t DroppedLogRecords();
+
+    const char *LogLevelName(LogLevel level);
+    // "2024-01-31 12:34:56.789012 W engine: message".
+    std::string FormatLogRecord(const LogRecord &record);
+}
+
+#endif // METRONOME_LOG_H_
@@ -0,0 +1,137 @@
+#include "metronome_loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr double kPi = 3.14159265358979323846;
+
+        struct Biquad
+        {
+            double b0, b1, b2, a1, a2;
+            double z1 = 0.0;
+            double z2 = 0.0;
+
+            double Process(double x)
+            {
+                const double y = b0 * x + z1;
+                z1 = b1 * x - a1 * y + z2;
+                z2 = b2 * x - a2 * y;
+                return y;
+            }
+        };
+
+        // BS.1770's two K-weighting stages, designed for any sample rate from
+        // the analogue prototypes behind its 48 kHz coefficients.
+        Biquad HighShelf(int sampleRate)
+        {
+            const double f0 = 1681.974450955533;
+            const double gainDb = 3.999843853973347;
+            const double q = 0.7071752369554196;
+            const double k = std::tan(kPi * f0 / sampleRate);
+            const double vh = std::pow(10.0, gainDb / 20.0);
+            const double vb = std::pow(vh, 0.4996667741545416);
+            const double a0 = 1.0 + k / q + k * k;
+            return Biquad{(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                          2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+        }
+
+        Biquad HighPass(int sampleRate)
+        {
+            const double f0 = 38.13547087602444;
+            const double q = 0.5003270373238773;
+            const double k = std::tan(kPi * f0 / sampleRate);
+            const double a0 = 1.0 + k / q + k * k;
+            return Biquad{1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+        }
+    }
+
+    SampleLoudness AnalyseLoudness(const std::vector<int16_t> &pcm, int sampleRate)
+    {
+        if (sampleRate <= 0)
+        {
+            throw std::invalid_argument("Sample rate must be positive");
+        }
+        SampleLoudness result;
+        result.analysed = true;
+        if (pcm.empty())
+        {
+            return result;
+        }
+
+        int peak = 0;
+        double sumSquares = 0.0;
+        for (int16_t sample : pcm)
+        {
+            peak = std::max(peak, std::abs(static_cast<int>(sample)));
+            sumSquares += static_cast<double>(sample) * sample;
+        }
+        result.peak = static_cast<float>(peak / 32768.0);
+        result.rms = static_cast<float>(std::sqrt(sumSquares / pcm.size()) / 32768.0);
+
+        // Filtered through a window of silence too, so the loudness of the
+        // last window includes the filters' ringing.
+        const size_t window = std::max<size_t>(1, static_cast<size_t>(sampleRate) * 4 / 10);
+        const size_t hop = std::max<size_t>(1, window / 4);
+        Biquad shelf = HighShelf(sampleRate);
+        Biquad highPass = HighPass(sampleRate);
+        std::vector<double> weighted(pcm.size() + window + 1, 0.0);
+        for (size_t i = 0; i + 1 < weighted.size(); i++)
+        {
+            const double x = i < pcm.size() ? pcm[i] / 32768.0 : 0.0;
+            const double y = highPass.Process(shelf.Process(x));
+            // Running sum of squares: a window is then a subtraction.
+            weighted[i + 1] = weighted[i] + y * y;
+        }
+        double loudest = 0.0;
+        for (size_t start = 0; start < pcm.size(); start += hop)
+        {
+            loudest = std::max(loudest, (weighted[start + window] - weighted[start]) / window);
+        }
+        if (loudest > 0.0)
+        {
+            result.lufs = std::max(kSilentLufs, static_cast<float>(-0.691 + 10.0 * std::log10(loudest)));
+        }
+        return result;
+    }
+
+    void AnalyseKit(Kit &kit, int sampleRate)
+    {
+        kit.loudness.resize(kit.SampleCount());
+        for (size_t index = 0; index < kit.loudness.size(); index++)
+        {
+            if (!kit.loudness[index].analysed)
+            {
+                kit.loudness[index] = AnalyseLoudness(*kit.Sample(static_cast<int>(index)), sampleRate);
+            }
+        }
+    }
+
+    void MatchKitLoudness(Kit &kit, int sampleRate)
+    {
+        AnalyseKit(kit, sampleRate);
+        kit.trims.assign(kit.loudness.size(), 1.0f);
+        const float target = kit.loudness[0].lufs;
+        if (target <= kSilentLufs)
+        {
+            return;
+        }
+        for (size_t index = 1; index < kit.loudness.size(); index++)
+        {
+            const SampleLoudness &loudness = kit.loudness[index];
+            if (loudness.lufs <= kSilentLufs)
+            {
+                continue;
+            }
+            // Boosting stops short of full scale.
+            const double headroom = 32767.0 / 32768.0 / loudness.peak;
+            const double trim = std::pow(10.0, (target - loudness.lufs) / 20.0);
+            kit.trims[index] = static_cast<float>(std::min(trim, headroom));
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef METRONOME_LOUDNESS_H_
+#define METRONOME_LOUDNESS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "metronome_song.h"
+
+namespace metronome
+{
+    // Floor of the loudness scale; digital silence reads as this.
+    constexpr float kSilentLufs = -70.0f;
+
+    // Peak, RMS and a short-term loudness estimate of mono 16-bit PCM. The
+    // loudness follows ITU-R BS.1770: K-weighting, then mean square over
+    // 400 ms windows stepped by 100 ms, keeping the loudest. A sound shorter
+    // than a window is measured as if followed by silence, so a click is
+    // compared with other clicks the way a listener hears them.
+    SampleLoudness AnalyseLoudness(const std::vector<int16_t> &pcm, int sampleRate);
+
+    // Analyses every sound of kit that has no cached result yet.
+    void AnalyseKit(Kit &kit, int sampleRate);
+
+    // Analyses kit as needed and sets its trims so each sound is as loud as
+    // mainSound, without any of them clipping. Silent sounds keep a trim of
+    // 1, as do all of them when mainSound is silent.
+    void MatchKitLoudness(Kit &kit, int sampleRate);
+}
+
+#endif // METRONOME_LOUDNESS_H_
@@ -0,0 +1,101 @@
+#include "metronome_memory_budget.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace metronome
+{
+    const char *MemoryComponentName(MemoryComponent component)
+    {
+        switch (component)
+        {
+        case MemoryComponent::Kits:
+            return "kits";
+        case MemoryComponent::Rings:
+            return "rings";
+        case MemoryComponent::Journal:
+            return "journal";
+        }
+        return "unknown";
+    }
+
+    MemoryReservation::MemoryReservation(MemoryBudget *budget, MemoryComponent component, size_t bytes)
+        : budget(budget), component(component), bytes(bytes)
+    {
+    }
+
+    MemoryReservation::~MemoryReservation()
+    {
+        Release();
+    }
+
+    MemoryReservation::MemoryReservation(MemoryReservation &&other) noexcept
+        : budget(other.budget), component(other.component), bytes(other.bytes)
+    {
+        other.budget = nullptr;
+        other.bytes = 0;
+    }
+
+    MemoryReservation &MemoryReservation::operator=(MemoryReservation &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            budget = other.budget;
+            component = other.component;
+            bytes = other.bytes;
+            other.budget = nullptr;
+            other.bytes = 0;
+        }
+        return *this;
+    }
+
+    void MemoryReservation::Release()
+    {
+        if (budget != nullptr)
+        {
+            budget->Release(component, bytes);
+        }
+        budget = nullptr;
+        bytes = 0;
+    }
+
+    MemoryBudget::MemoryBudget(size_t limitBytes) : limit(limitBytes)
+    {
+        usage.limit = limitBytes;
+    }
+
+    MemoryReservation MemoryBudget::Reserve(MemoryComponent component, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (limit > 0 && bytes > limit - usage.used)
+        {
+            usage.refusals++;
+            throw std::runtime_error("Memory budget exceeded: " + std::to_string(bytes) + " bytes of " +
+                                     MemoryComponentName(component) + " with " +
+                                     std::to_string(limit - usage.used) + " of " + std::to_string(limit) +
+                                     " left");
+        }
+        usage.used += bytes;
+        usage.components[static_cast<int>(component)] += bytes;
+        return MemoryReservation(this, component, bytes);
+    }
+
+    void MemoryBudget::Release(MemoryComponent component, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        usage.used -= bytes;
+        usage.components[static_cast<int>(component)] -= bytes;
+    }
+
+    MemoryUsage MemoryBudget::Usage() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return usage;
+    }
+
+    MemoryReservation Reserve(MemoryBudget *budget, MemoryComponent component, size_t bytes)
+    {
+        return budget != nullptr ? budget->Reserve(component, bytes) : MemoryReservation();
+    }
+}
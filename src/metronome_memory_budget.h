@@ -0,0 +1,98 @@
+#ifndef METRONOME_MEMORY_BUDGET_H_
+#define METRONOME_MEMORY_BUDGET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace metronome
+{
+    // What a reservation is for, as reported in MemoryUsage.
+    enum class MemoryComponent
+    {
+        // Sounds held by engines, including kits waiting to be swapped in.
+        Kits,
+        // PCM rings for rendering ahead and mirrored outputs.
+        Rings,
+        // Command journal rings.
+        Journal,
+    };
+
+    constexpr int kMemoryComponents = 3;
+
+    const char *MemoryComponentName(MemoryComponent component);
+
+    struct MemoryUsage
+    {
+        // Zero when the budget only keeps count.
+        size_t limit = 0;
+        size_t used = 0;
+        // Bytes held, indexed by MemoryComponent.
+        size_t components[kMemoryComponents] = {};
+        // Reservations refused for want of room.
+        uint64_t refusals = 0;
+
+        size_t Component(MemoryComponent component) const { return components[static_cast<int>(component)]; }
+    };
+
+    class MemoryBudget;
+
+    // Bytes held against a MemoryBudget until this is destroyed or
+    // assigned over. Empty when default constructed or moved from.
+    class MemoryReservation
+    {
+    public:
+        MemoryReservation() = default;
+        ~MemoryReservation();
+
+        MemoryReservation(MemoryReservation &&other) noexcept;
+        MemoryReservation &operator=(MemoryReservation &&other) noexcept;
+
+        size_t Bytes() const { return bytes; }
+
+    private:
+        friend class MemoryBudget;
+        MemoryReservation(MemoryBudget *budget, MemoryComponent component, size_t bytes);
+        void Release();
+
+        MemoryBudget *budget = nullptr;
+        MemoryComponent component = MemoryComponent::Kits;
+        size_t bytes = 0;
+    };
+
+    // A hard cap on the memory the core holds for long-lived buffers. Each
+    // owner reserves what it is about to allocate before allocating it, on
+    // the control side, so going over the cap is refused where the
+    // allocation was asked for and always for the same request, never
+    // partway through playback: the audio path only uses memory reserved
+    // up front. Must outlive every reservation made against it.
+    class MemoryBudget
+    {
+    public:
+        // limitBytes of zero keeps count without refusing anything.
+        explicit MemoryBudget(size_t limitBytes);
+
+        MemoryBudget(const MemoryBudget &) = delete;
+        MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+        // Throws std::runtime_error, and counts a refusal, if bytes more
+        // would go over the limit.
+        MemoryReservation Reserve(MemoryComponent component, size_t bytes);
+
+        MemoryUsage Usage() const;
+        size_t Limit() const { return limit; }
+
+    private:
+        friend class MemoryReservation;
+        void Release(MemoryComponent component, size_t bytes);
+
+        const size_t limit;
+        mutable std::mutex mutex;
+        MemoryUsage usage;
+    };
+
+    // Reserves against budget, or nothing when budget is null.
+    MemoryReservation Reserve(MemoryBudget *budget, MemoryComponent component, size_t bytes);
+}
+
+#endif // METRONOME_MEMORY_BUDGET_H_
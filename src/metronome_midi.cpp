@@ -0,0 +1,430 @@
+#include "metronome_midi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "metronome_timeline.h"
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr int kPulsesPerQuarter = 480;
+        constexpr uint8_t kAccentKey = 76; // Hi Wood Block
+        constexpr uint8_t kNormalKey = 77; // Low Wood Block
+
+        class ByteReader
+        {
+        public:
+            ByteReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+            bool AtEnd() const { return offset >= size; }
+            size_t Remaining() const { return size - offset; }
+
+            uint8_t Peek()
+            {
+                Need(1);
+                return data[offset];
+            }
+
+            uint8_t U8()
+            {
+                Need(1);
+                return data[offset++];
+            }
+
+            uint32_t BigEndian(int bytes)
+            {
+                uint32_t value = 0;
+                while (bytes-- > 0)
+                {
+                    value = (value << 8) | U8();
+                }
+                return value;
+            }
+
+            uint32_t VarLen()
+            {
+                uint32_t value = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    const uint8_t byte = U8();
+                    value = (value << 7) | (byte & 0x7F);
+                    if ((byte & 0x80) == 0)
+                    {
+                        return value;
+                    }
+                }
+                throw std::invalid_argument("Malformed MIDI file: variable-length quantity too long");
+            }
+
+            const uint8_t *Take(size_t count)
+            {
+                Need(count);
+                const uint8_t *start = data + offset;
+                offset += count;
+                return start;
+            }
+
+        private:
+            void Need(size_t count) const
+            {
+                if (size - offset < count)
+                {
+                    throw std::invalid_argument("Malformed MIDI file: unexpected end of data");
+                }
+            }
+
+            const uint8_t *data;
+            size_t size;
+            size_t offset = 0;
+        };
+
+        struct TempoEvent
+        {
+            uint64_t tick;
+            uint32_t microsPerQuarter;
+        };
+
+        struct MeterEvent
+        {
+            uint64_t tick;
+            int numerator;
+            int denominator;
+        };
+
+        struct MarkerEvent
+        {
+            uint64_t tick;
+            std::string text;
+        };
+
+        struct MetaEvents
+        {
+            std::vector<TempoEvent> tempos;
+            std::vector<MeterEvent> meters;
+            std::vector<MarkerEvent> markers;
+            uint64_t endTick = 0;
+        };
+
+        void ReadTrack(ByteReader &track, MetaEvents &meta)
+        {
+            uint64_t tick = 0;
+            uint8_t runningStatus = 0;
+            while (!track.AtEnd())
+            {
+                tick += track.VarLen();
+                uint8_t status = track.Peek();
+                if (status & 0x80)
+                {
+                    track.U8();
+                }
+                else if (runningStatus != 0)
+                {
+                    status = runningStatus;
+                }
+                else
+                {
+                    throw std::invalid_argument("Malformed MIDI file: data byte without status");
+                }
+
+                if (status == 0xFF)
+                {
+                    const uint8_t type = track.U8();
+                    const uint32_t length = track.VarLen();
+                    const uint8_t *data = track.Take(length);
+                    if (type == 0x51 && length == 3)
+                    {
+                        const uint32_t micros = (data[0] << 16) | (data[1] << 8) | data[2];
+                        if (micros == 0)
+                        {
+                            throw std::invalid_argument("Malformed MIDI file: zero tempo");
+                        }
+                        meta.tempos.push_back(TempoEvent{tick, micros});
+                    }
+                    else if (type == 0x58 && length >= 2)
+                    {
+                        if (data[0] == 0 || data[1] > 6)
+                        {
+                            throw std::invalid_argument("Malformed MIDI file: invalid time signature");
+                        }
+                        meta.meters.push_back(MeterEvent{tick, data[0], 1 << data[1]});
+                    }
+                    else if (type == 0x06)
+                    {
+                        meta.markers.push_back(MarkerEvent{tick, std::string(reinterpret_cast<const char *>(data), length)});
+                    }
+                    else if (type == 0x2F)
+                    {
+                        break;
+                    }
+                }
+                else if (status == 0xF0 || status == 0xF7)
+                {
+                    track.Take(track.VarLen());
+                    runningStatus = 0;
+                }
+                else if (status < 0xF0)
+                {
+                    runningStatus = status;
+                    const uint8_t type = status & 0xF0;
+                    track.Take(type == 0xC0 || type == 0xD0 ? 1 : 2);
+                }
+                else
+                {
+                    throw std::invalid_argument("Malformed MIDI file: unexpected system message");
+                }
+            }
+            meta.endTick = std::max(meta.endTick, tick);
+        }
+
+        void PutVarLen(std::vector<uint8_t> &out, uint32_t value)
+        {
+            uint8_t buffer[5];
+            int count = 0;
+            do
+            {
+                buffer[count++] = static_cast<uint8_t>(value & 0x7F);
+                value >>= 7;
+            } while (value != 0);
+            while (count-- > 0)
+            {
+                out.push_back(static_cast<uint8_t>(buffer[count] | (count > 0 ? 0x80 : 0)));
+            }
+        }
+
+        void PutBigEndian(std::vector<uint8_t> &out, uint32_t value, int bytes)
+        {
+            while (bytes-- > 0)
+            {
+                out.push_back(static_cast<uint8_t>((value >> (8 * bytes)) & 0xFF));
+            }
+        }
+
+        struct TrackEvent
+        {
+            uint64_t tick;
+            // Orders simultaneous events: meta-events, then note-offs, then note-ons.
+            int order;
+            std::vector<uint8_t> bytes;
+        };
+    }
+
+    Song ReadMidiFile(const std::vector<uint8_t> &bytes)
+    {
+        ByteReader reader(bytes.data(), bytes.size());
+        if (bytes.size() < 14 || std::memcmp(reader.Take(4), "MThd", 4) != 0)
+        {
+            throw std::invalid_argument("Not a Standard MIDI File");
+        }
+        const uint32_t headerLength = reader.BigEndian(4);
+        if (headerLength < 6)
+        {
+            throw std::invalid_argument("Malformed MIDI file: short header");
+        }
+        const uint32_t format = reader.BigEndian(2);
+        reader.BigEndian(2);
+        const uint32_t division = reader.BigEndian(2);
+        reader.Take(headerLength - 6);
+        if (format > 1)
+        {
+            throw std::invalid_argument("Only type 0 and type 1 MIDI files are supported");
+        }
+        if (division == 0 || (division & 0x8000) != 0)
+        {
+            throw std::invalid_argument("SMPTE time division is not supported");
+        }
+
+        MetaEvents meta;
+        while (reader.Remaining() >= 8)
+        {
+            const uint8_t *id = reader.Take(4);
+            const uint32_t length = reader.BigEndian(4);
+            const uint8_t *chunk = reader.Take(length);
+            if (std::memcmp(id, "MTrk", 4) == 0)
+            {
+                ByteReader track(chunk, length);
+                ReadTrack(track, meta);
+            }
+        }
+
+        // Type 1 files may spread meta-events over several tracks.
+        auto byTick = [](const auto &a, const auto &b)
+        { return a.tick < b.tick; };
+        std::stable_sort(meta.tempos.begin(), meta.tempos.end(), byTick);
+        std::stable_sort(meta.meters.begin(), meta.meters.end(), byTick);
+        std::stable_sort(meta.markers.begin(), meta.markers.end(), byTick);
+
+        struct MeterSpan
+        {
+            uint64_t tick;
+            int bar;
+            int numerator;
+            int denominator;
+            double barTicks;
+            double beatTicks;
+        };
+        std::vector<MeterSpan> spans;
+        if (meta.meters.empty() || meta.meters.front().tick > 0)
+        {
+            meta.meters.insert(meta.meters.begin(), MeterEvent{0, 4, 4});
+        }
+        for (const MeterEvent &event : meta.meters)
+        {
+            const double beatTicks = division * 4.0 / event.denominator;
+            MeterSpan span{event.tick, 0, event.numerator, event.denominator, beatTicks * event.numerator, beatTicks};
+            if (!spans.empty())
+            {
+                const MeterSpan &previous = spans.back();
+                if (event.tick <= previous.tick)
+                {
+                    // At, or in the bar before, the bar line another change
+                    // is waiting for: this one replaces it.
+                    span.tick = previous.tick;
+                    span.bar = previous.bar;
+                    spans.pop_back();
+                }
+                else
+                {
+                    // A change that is not on a bar line takes effect at the
+                    // next one, and its span is measured from there.
+                    const double bars = std::ceil((event.tick - previous.tick) / previous.barTicks - 1e-9);
+                    span.tick = previous.tick + static_cast<uint64_t>(std::llround(bars * previous.barTicks));
+                    span.bar = previous.bar + static_cast<int>(bars);
+                }
+            }
+            spans.push_back(span);
+        }
+
+        auto locate = [&](uint64_t tick, int &bar, double &beatOffset)
+        {
+            auto span = std::upper_bound(spans.begin(), spans.end(), tick,
+                                         [](uint64_t t, const MeterSpan &s)
+                                         { return t < s.tick; }) -
+                        1;
+            const double relative = static_cast<double>(tick - span->tick);
+            const double bars = std::floor(relative / span->barTicks);
+            bar = span->bar + static_cast<int>(bars);
+            beatOffset = (relative - bars * span->barTicks) / span->beatTicks;
+        };
+
+        Song song;
+        for (const MeterSpan &span : spans)
+        {
+            song.meterMap.push_back(MeterChange{span.bar, span.numerator, span.denominator});
+        }
+        song.timeSignature = spans.front().numerator;
+
+        if (meta.tempos.empty() || meta.tempos.front().tick > 0)
+        {
+            song.tempoMap.push_back(TempoSegment{});
+        }
+        for (const TempoEvent &event : meta.tempos)
+        {
+            TempoSegment segment;
+            locate(event.tick, segment.startBar, segment.beatOffset);
+            segment.bpm = 60000000.0 / event.microsPerQuarter;
+            song.tempoMap.push_back(segment);
+        }
+
+        for (const MarkerEvent &event : meta.markers)
+        {
+            Marker marker;
+            locate(event.tick, marker.bar, marker.beatOffset);
+            marker.text = event.text;
+            song.markers.push_back(marker);
+        }
+
+        int lastBar;
+        double lastOffset;
+        locate(meta.endTick, lastBar, lastOffset);
+        song.bars = std::max(1, lastBar + (lastOffset > 1e-9 ? 1 : 0));
+
+        return song;
+    }
+
+    std::vector<uint8_t> WriteMidiFile(const Song &song)
+    {
+        const BeatGrid grid = BuildBeatGrid(song);
+        auto tickOf = [](double quarter)
+        {
+            return static_cast<uint64_t>(std::llround(quarter * kPulsesPerQuarter));
+        };
+
+        std::vector<TrackEvent> events;
+        for (const MeterChange &meter : grid.meters)
+        {
+            if (meter.startBar >= song.bars)
+            {
+                continue;
+            }
+            int power = 0;
+            while ((1 << power) < meter.denominator)
+            {
+                power++;
+            }
+            events.push_back(TrackEvent{tickOf(grid.barStarts[std::max(0, meter.startBar)]), 0,
+                                        {0xFF, 0x58, 0x04,
+                                         static_cast<uint8_t>(std::min(meter.numerator, 255)),
+                                         static_cast<uint8_t>(power),
+                                         static_cast<uint8_t>(96 / meter.denominator), 8}});
+        }
+        for (const BeatGrid::TempoStep &step : grid.tempo)
+        {
+            const uint32_t micros = static_cast<uint32_t>(std::clamp<long long>(std::llround(60000000.0 / step.bpm), 1, 0xFFFFFF));
+            std::vector<uint8_t> bytes{0xFF, 0x51, 0x03};
+            PutBigEndian(bytes, micros, 3);
+            events.push_back(TrackEvent{tickOf(step.quarter), 0, bytes});
+        }
+        for (const BeatGrid::GridMarker &marker : grid.markers)
+        {
+            std::vector<uint8_t> bytes{0xFF, 0x06};
+            PutVarLen(bytes, static_cast<uint32_t>(marker.text.size()));
+            bytes.insert(bytes.end(), marker.text.begin(), marker.text.end());
+            events.push_back(TrackEvent{tickOf(marker.quarter), 0, bytes});
+        }
+        for (size_t i = 0; i < grid.beats.size(); i++)
+        {
+            const BeatGrid::Beat &beat = grid.beats[i];
+            if (beat.accent == BeatAccent::Rest)
+            {
+                continue;
+            }
+            const uint64_t tick = tickOf(beat.quarter);
+            const uint64_t next = tickOf(i + 1 < grid.beats.size() ? grid.beats[i + 1].quarter : grid.barStarts.back());
+            const uint64_t gate = std::max<uint64_t>(1, std::min<uint64_t>(kPulsesPerQuarter / 8, (next - tick) / 2));
+            const bool accented = beat.accent == BeatAccent::Accented || beat.accent == BeatAccent::Group;
+            const uint8_t key = accented ? kAccentKey : kNormalKey;
+            const uint8_t velocity = beat.accent == BeatAccent::Accented ? 127 : beat.accent == BeatAccent::Group ? 110 : 100;
+            events.push_back(TrackEvent{tick, 2, {0x99, key, velocity}});
+            events.push_back(TrackEvent{tick + gate, 1, {0x89, key, 0}});
+        }
+        std::stable_sort(events.begin(), events.end(),
+                         [](const TrackEvent &a, const TrackEvent &b)
+                         { return a.tick != b.tick ? a.tick < b.tick : a.order < b.order; });
+
+        std::vector<uint8_t> track;
+        uint64_t tick = 0;
+        for (const TrackEvent &event : events)
+        {
+            PutVarLen(track, static_cast<uint32_t>(event.tick - tick));
+            track.insert(track.end(), event.bytes.begin(), event.bytes.end());
+            tick = event.tick;
+        }
+        PutVarLen(track, static_cast<uint32_t>(std::max(tick, tickOf(grid.barStarts.back())) - tick));
+        track.insert(track.end(), {0xFF, 0x2F, 0x00});
+
+        std::vector<uint8_t> file{'M', 'T', 'h', 'd'};
+        PutBigEndian(file, 6, 4);
+        PutBigEndian(file, 0, 2);
+        PutBigEndian(file, 1, 2);
+        PutBigEndian(file, kPulsesPerQuarter, 2);
+        file.insert(file.end(), {'M', 'T', 'r', 'k'});
+        PutBigEndian(file, static_cast<uint32_t>(track.size()), 4);
+        file.insert(file.end(), track.begin(), track.end());
+        return file;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef METRONOME_MIDI_H_
+#define METRONOME_MIDI_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "metronome_song.h"
+
+namespace metronome
+{
+    // Reads the tempo, time signature and marker meta-events of a type 0 or
+    // type 1 Standard MIDI File in a single forward pass over the bytes, and
+    // returns them as a song (tempoMap, meterMap, markers and bars; the kit
+    // is left empty). Throws std::invalid_argument on malformed input.
+    Song ReadMidiFile(const std::vector<uint8_t> &bytes);
+
+    // Writes the song's click track as a type 0 Standard MIDI File: tempo,
+    // time signature and marker meta-events plus one General MIDI
+    // percussion note per sounding beat (high wood block for accents).
+    std::vector<uint8_t> WriteMidiFile(const Song &song);
+}
+
+#endif // METRONOME_MIDI_H_
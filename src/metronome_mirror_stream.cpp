@@ -0,0 +1,405 @@
+#include "metronome_mirror_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include "metronome_log.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace
+    {
+        // The ring holds this many of the mirror's buffers, so the main
+        // stream can run ahead through a stall of the mirror.
+        constexpr size_t kRingBuffers = 4;
+        // Real clocks are within a few hundred ppm of each other; the ratio
+        // never strays further than this.
+        constexpr double kMaxDrift = 1e-3;
+        // Each period moves the error estimate this far toward the measured
+        // one, to ride out scheduling jitter in the timestamps.
+        constexpr double kErrorSmoothing = 0.1;
+        // Proportional gain of the loop, per period; the integral gain is
+        // set for critical damping, so the loop settles in about 2 /
+        // kLoopGain periods without overshooting.
+        constexpr double kLoopGain = 0.004;
+        // A delay this many buffers off target is a glitch, not drift; the
+        // mirror jumps back rather than slew.
+        constexpr double kResyncBuffers = 1.0;
+        constexpr double kOne = 4294967296.0;
+    }
+
+    MirrorStream::MirrorStream(AudioSink &sink, SinkConfig config, MemoryBudget *budget)
+        : sink(sink), config(config),
+          ring(std::max<size_t>(1, config.BufferFrames() * kRingBuffers), std::max(1, config.channels), budget),
+          now(&Clock::now)
+    {
+        if (config.periodFrames <= 0 || config.periods < 2 || config.channels <= 0)
+        {
+            throw std::invalid_argument("A mirror needs at least two periods of one frame");
+        }
+    }
+
+    MirrorStream::~MirrorStream()
+    {
+        Stop();
+    }
+
+    void MirrorStream::Open()
+    {
+        if (open)
+        {
+            return;
+        }
+        const SinkConfig granted = sink.Open(config);
+        if (granted.sampleRate != config.sampleRate || granted.channels != config.channels)
+        {
+            sink.Close();
+            throw std::runtime_error("Mirror sink does not support " + std::to_string(config.sampleRate) + " Hz, " +
+                                     std::to_string(config.channels) + " channels");
+        }
+        config = granted;
+        open = true;
+        primed = false;
+        locked = false;
+        // Enough for a period at the fastest ratio, after the history.
+        const size_t channels = static_cast<size_t>(config.channels);
+        work.assign((3 + 2 * static_cast<size_t>(config.periodFrames) + 2) * channels, 0);
+        phase = 0;
+        // A new device has a clock of its own.
+        integral = 0.0;
+        step = uint64_t(1) << 32;
+        driftPpb.store(0, std::memory_order_relaxed);
+    }
+
+    void MirrorStream::SetClock(std::function<Clock::time_point()> now)
+    {
+        this->now = std::move(now);
+    }
+
+    void MirrorStream::Start()
+    {
+        Stop();
+        running.store(true, std::memory_order_release);
+        thread = std::thread(&MirrorStream::Run, this);
+    }
+
+    void MirrorStream::Stop()
+    {
+        running.store(false, std::memory_order_release);
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        if (open)
+        {
+            sink.Drop();
+            sink.Close();
+            open = false;
+        }
+    }
+
+    void MirrorStream::Run()
+    {
+        METRONOME_TRACE_THREAD_NAME("mirror");
+        const int timeoutMs = std::max(10, 2 * config.periodFrames * 1000 / config.sampleRate);
+        int retryMs = 10;
+        try
+        {
+            while (running.load(std::memory_order_acquire))
+            {
+                if (Pump(timeoutMs))
+                {
+                    retryMs = 10;
+                    continue;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(retryMs));
+                retryMs = std::min(500, retryMs * 2);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            Log(LogLevel::Error, "mirror", "Mirror playback stopped: %s", e.what());
+        }
+    }
+
+    bool MirrorStream::Pump(int timeoutMs)
+    {
+        if (!open)
+        {
+            try
+            {
+                Open();
+            }
+            catch (const std::runtime_error &e)
+            {
+                Log(LogLevel::Debug, "mirror", "Opening the mirror output failed: %s", e.what());
+                return false;
+            }
+        }
+        size_t writable = 0;
+        SinkStatus status = sink.Wait(timeoutMs, writable);
+        if (status == SinkStatus::Ok)
+        {
+            status = Fill(writable);
+        }
+        if (status == SinkStatus::Xrun)
+        {
+            int64_t lost = 0;
+            status = sink.Recover(lost);
+            if (status == SinkStatus::Ok)
+            {
+                // What should have played while the device was stopped is
+                // stale now; dropping it keeps the mirror in phase.
+                ring.Discard(static_cast<size_t>(std::max<int64_t>(0, lost)));
+                xruns.fetch_add(1, std::memory_order_relaxed);
+                Log(LogLevel::Warning, "mirror", "Mirror xrun; skipped %lld frames", static_cast<long long>(lost));
+                status = sink.Wait(0, writable);
+            }
+            if (status == SinkStatus::Ok)
+            {
+                status = Fill(writable);
+            }
+        }
+        if (status == SinkStatus::Lost)
+        {
+            Log(LogLevel::Warning, "mirror", "Mirror output lost; reopening");
+            sink.Drop();
+            sink.Close();
+            open = false;
+            return false;
+        }
+        return true;
+    }
+
+    void MirrorStream::Feed(const int16_t *pcm, size_t frames)
+    {
+        const size_t written = ring.Write(pcm, frames);
+        if (written < frames)
+        {
+            droppedFrames.fetch_add(static_cast<int64_t>(frames - written), std::memory_order_relaxed);
+        }
+    }
+
+    void MirrorStream::FeedSilence(size_t frames)
+    {
+        const size_t written = ring.WriteSilence(frames);
+        if (written < frames)
+        {
+            droppedFrames.fetch_add(static_cast<int64_t>(frames - written), std::memory_order_relaxed);
+        }
+    }
+
+    void MirrorStream::MarkOutput(size_t queued, Clock::time_point when)
+    {
+        OutputMark mark;
+        mark.position = static_cast<int64_t>(ring.TotalWritten()) - static_cast<int64_t>(queued);
+        mark.atNs = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+        mark.dropped = droppedFrames.load(std::memory_order_relaxed);
+        mark.valid = true;
+        mainOutput.Store(mark);
+    }
+
+    SinkStatus MirrorStream::Fill(size_t writable)
+    {
+        const size_t period = static_cast<size_t>(config.periodFrames);
+        const size_t buffer = config.BufferFrames();
+        const OutputMark mark = mainOutput.Load();
+        if (!mark.valid)
+        {
+            return SinkStatus::Ok;
+        }
+        if (!primed)
+        {
+            // Start with the device buffer full and a buffer's worth in the
+            // ring, whatever piled up while the device was closed.
+            const size_t wanted = buffer + writable;
+            const size_t available = ring.Available();
+            if (available < wanted)
+            {
+                return SinkStatus::Ok;
+            }
+            ring.Discard(available - wanted);
+            primed = true;
+            locked = false;
+        }
+        if (writable < period)
+        {
+            return SinkStatus::Ok;
+        }
+
+        // Both outputs as positions in what was fed: the main device's
+        // carried forward from its mark, and the mirror's behind the frame
+        // it resamples next by what its device still has queued.
+        const double ratio = static_cast<double>(step) / kOne;
+        const double elapsed = std::chrono::duration<double>(now().time_since_epoch()).count() - mark.atNs * 1e-9;
+        const double mainAt = static_cast<double>(mark.position) + elapsed * config.sampleRate;
+        const double queued = static_cast<double>(buffer - std::min(writable, buffer));
+        const double mirrorAt = static_cast<double>(ring.TotalRead()) - 2.0 + phase / kOne - queued * ratio;
+        const double behind = mainAt - mirrorAt;
+        if (!locked)
+        {
+            targetDelay = behind;
+            filteredError = 0.0;
+            locked = true;
+        }
+        const double off = behind - targetDelay;
+        if (mark.dropped != droppedSeen || std::fabs(off) > kResyncBuffers * static_cast<double>(buffer))
+        {
+            // Skip ahead or hold back by whole frames; the loop carries on
+            // from the locked delay. A hold longer than the device has room
+            // for finishes next time.
+            Log(LogLevel::Warning, "mirror", "Mirror %.0f frames off its delay; resynchronising", off);
+            const long frames = std::lround(off);
+            size_t held = 0;
+            if (frames > 0)
+            {
+                ring.Discard(static_cast<size_t>(frames));
+            }
+            else if (frames < 0)
+            {
+                held = std::min(static_cast<size_t>(-frames), writable);
+                const SinkStatus status = Hold(held);
+                if (status != SinkStatus::Ok)
+                {
+                    return status;
+                }
+                writable -= held;
+            }
+            if (held == static_cast<size_t>(std::labs(frames)) || frames > 0)
+            {
+                droppedSeen = mark.dropped;
+            }
+            filteredError = 0.0;
+        }
+        else
+        {
+            Steer(behind, period);
+        }
+        delay.store(behind, std::memory_order_relaxed);
+
+        for (; writable >= period; writable -= period)
+        {
+            size_t remaining = period;
+            while (remaining > 0)
+            {
+                int16_t *area = nullptr;
+                size_t granted = 0;
+                SinkStatus status = sink.Begin(remaining, area, granted);
+                if (status != SinkStatus::Ok || granted == 0)
+                {
+                    return status;
+                }
+                Resample(area, granted);
+                METRONOME_TRACE_BEGIN("mirror_submit");
+                status = sink.Commit(granted);
+                METRONOME_TRACE_END("mirror_submit");
+                if (status != SinkStatus::Ok)
+                {
+                    return status;
+                }
+                remaining -= granted;
+            }
+            periods.fetch_add(1, std::memory_order_relaxed);
+        }
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus MirrorStream::Hold(size_t frames)
+    {
+        const size_t channels = static_cast<size_t>(config.channels);
+        while (frames > 0)
+        {
+            int16_t *area = nullptr;
+            size_t granted = 0;
+            SinkStatus status = sink.Begin(frames, area, granted);
+            if (status != SinkStatus::Ok || granted == 0)
+            {
+                return status;
+            }
+            std::memset(area, 0, granted * channels * sizeof(int16_t));
+            status = sink.Commit(granted);
+            if (status != SinkStatus::Ok)
+            {
+                return status;
+            }
+            frames -= granted;
+        }
+        return SinkStatus::Ok;
+    }
+
+    void MirrorStream::Resample(int16_t *out, size_t frames)
+    {
+        const size_t channels = static_cast<size_t>(config.channels);
+        const uint64_t end = phase + frames * step;
+        const size_t needed = static_cast<size_t>(end >> 32);
+        int16_t *input = work.data() + 3 * channels;
+        const size_t got = ring.Read(input, needed);
+        if (got < needed)
+        {
+            std::memset(input + got * channels, 0, (needed - got) * channels * sizeof(int16_t));
+            starvedFrames.fetch_add(static_cast<int64_t>(needed - got), std::memory_order_relaxed);
+        }
+
+        // Output frame i lies between work frames k + 1 and k + 2; a
+        // four-point cubic Hermite through k to k + 3 interpolates it.
+        uint64_t position = phase;
+        for (size_t i = 0; i < frames; i++, position += step)
+        {
+            const int16_t *x = work.data() + static_cast<size_t>(position >> 32) * channels;
+            const uint32_t fraction = static_cast<uint32_t>(position);
+            if (fraction == 0)
+            {
+                std::memcpy(out + i * channels, x + channels, channels * sizeof(int16_t));
+                continue;
+            }
+            const double t = fraction / kOne;
+            for (size_t c = 0; c < channels; c++)
+            {
+                const double xm = x[c];
+                const double x0 = x[channels + c];
+                const double x1 = x[2 * channels + c];
+                const double x2 = x[3 * channels + c];
+                const double c1 = 0.5 * (x1 - xm);
+                const double c2 = xm - 2.5 * x0 + 2.0 * x1 - 0.5 * x2;
+                const double c3 = 0.5 * (x2 - xm) + 1.5 * (x0 - x1);
+                const double y = ((c3 * t + c2) * t + c1) * t + x0;
+                out[i * channels + c] = static_cast<int16_t>(std::lround(std::min(32767.0, std::max(-32768.0, y))));
+            }
+        }
+        std::memmove(work.data(), work.data() + needed * channels, 3 * channels * sizeof(int16_t));
+        phase = static_cast<uint32_t>(end);
+    }
+
+    void MirrorStream::Steer(double behind, size_t frames)
+    {
+        filteredError += kErrorSmoothing * (behind - targetDelay - filteredError);
+        delayError.store(filteredError, std::memory_order_relaxed);
+        // Error per output frame, so the gains hold for any period length.
+        // Trailing further behind means reading faster.
+        const double error = filteredError / static_cast<double>(frames);
+        integral = std::min(kMaxDrift, std::max(-kMaxDrift, integral + kLoopGain * kLoopGain / 4.0 * error));
+        const double ratio = 1.0 + std::min(kMaxDrift, std::max(-kMaxDrift, integral + kLoopGain * error));
+        step = static_cast<uint64_t>(std::llround(ratio * kOne));
+        driftPpb.store(static_cast<int64_t>(std::llround(integral * 1e9)), std::memory_order_relaxed);
+    }
+
+    MirrorStats MirrorStream::Stats() const
+    {
+        MirrorStats stats;
+        stats.driftPpm = driftPpb.load(std::memory_order_relaxed) / 1000.0;
+        stats.delayFrames = delay.load(std::memory_order_relaxed);
+        stats.delayError = delayError.load(std::memory_order_relaxed);
+        stats.fill = static_cast<int64_t>(ring.Available());
+        stats.periods = periods.load(std::memory_order_relaxed);
+        stats.xruns = xruns.load(std::memory_order_relaxed);
+        stats.starvedFrames = starvedFrames.load(std::memory_order_relaxed);
+        stats.droppedFrames = droppedFrames.load(std::memory_order_relaxed);
+        return stats;
+    }
+}
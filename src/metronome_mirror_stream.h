@@ -0,0 +1,149 @@
+#ifndef METRONOME_MIRROR_STREAM_H_
+#define METRONOME_MIRROR_STREAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "metronome_pcm_ring.h"
+#include "metronome_seqlock.h"
+#include "metronome_sink.h"
+
+namespace metronome
+{
+    struct MirrorStats
+    {
+        // How much faster the main device's clock runs than this one's, in
+        // parts per million, as the drift loop has measured it.
+        double driftPpm = 0.0;
+        // How far the mirror's output trails the main device's, in frames,
+        // and how far that is off the delay the loop locked to.
+        double delayFrames = 0.0;
+        double delayError = 0.0;
+        // Frames waiting in the ring.
+        int64_t fill = 0;
+        uint64_t periods = 0;
+        uint64_t xruns = 0;
+        // Frames played as silence because the ring ran dry, and frames the
+        // main stream dropped because it was full.
+        int64_t starvedFrames = 0;
+        int64_t droppedFrames = 0;
+    };
+
+    // Plays what an AudioStream renders on a second sink, for a second pair
+    // of ears on another device. The two devices nominally share a sample
+    // rate, but each runs from its own clock, so the main stream copies
+    // every block into a ring and the mirror plays it back through a
+    // resampler. Each side stamps the frame at its device output with a
+    // shared clock, and a loop steers the resampling ratio to hold the
+    // mirror a fixed delay behind the main device; the ratio it settles on
+    // is the drift between the two clocks. The ring's fill is no use for
+    // this: the main stream writes it in bursts, and their phase against
+    // the mirror's reads wanders with the very drift being measured.
+    //
+    // Attach it with AudioStream::AddMirror, which opens, starts and stops
+    // it along with the main stream. Feed and MarkOutput are called from
+    // the main stream's thread and everything else from the mirror's own.
+    class MirrorStream
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // sink must outlive the mirror. config.channels must match the
+        // engine feeding it; sampleRate is the engine's nominal rate.
+        // Throws std::invalid_argument for a config with fewer than two
+        // periods, and std::runtime_error if budget has no room for the
+        // ring.
+        MirrorStream(AudioSink &sink, SinkConfig config, MemoryBudget *budget = nullptr);
+        ~MirrorStream();
+
+        MirrorStream(const MirrorStream &) = delete;
+        MirrorStream &operator=(const MirrorStream &) = delete;
+
+        // Opens the sink and primes the loop; throws std::runtime_error if
+        // the device can't be opened at the requested rate and channels.
+        void Open();
+        void Start();
+        void Stop();
+        // One pass of the mirror loop, for callers driving it themselves.
+        // Returns false while its device is gone.
+        bool Pump(int timeoutMs);
+
+        // Main stream thread: frames it sent to its own device, and silence
+        // for frames its device skipped.
+        void Feed(const int16_t *pcm, size_t frames);
+        void FeedSilence(size_t frames);
+        // Main stream thread: its device had queued frames of what was fed
+        // so far, at when.
+        void MarkOutput(size_t queued, Clock::time_point when);
+        // Replaces the clock the mirror's output is stamped with, which
+        // must be the one the main stream marks with; call before Start.
+        void SetClock(std::function<Clock::time_point()> now);
+
+        const SinkConfig &Config() const { return config; }
+        MirrorStats Stats() const;
+
+    private:
+        void Run();
+        SinkStatus Fill(size_t writable);
+        // Plays frames of silence, to fall back behind the main output.
+        SinkStatus Hold(size_t frames);
+        // Resamples frames from the ring into out at the current ratio.
+        void Resample(int16_t *out, size_t frames);
+        // Moves the ratio toward holding the delay behind the main output
+        // at the locked one.
+        void Steer(double delay, size_t frames);
+
+        // Where the main device's output was, as a count of frames fed.
+        struct OutputMark
+        {
+            int64_t position = 0;
+            int64_t atNs = 0;
+            // Frames the ring had dropped by then.
+            int64_t dropped = 0;
+            bool valid = false;
+        };
+
+        AudioSink &sink;
+        SinkConfig config;
+        PcmRing ring;
+        Seqlock<OutputMark> mainOutput;
+        std::function<Clock::time_point()> now;
+        std::atomic<bool> running{false};
+        bool open = false;
+        // Waits for the ring to fill before playing, after opening, then
+        // locks to the delay it starts with.
+        bool primed = false;
+        bool locked = false;
+        std::thread thread;
+
+        // Input frames per output frame, as 32.32 fixed point, and the
+        // position between input frames. Fixed point keeps the frames read
+        // from the ring exact.
+        uint64_t step = uint64_t(1) << 32;
+        uint32_t phase = 0;
+        // The last three input frames, which the cubic needs ahead of the
+        // block's new ones; then room for a block's worth.
+        std::vector<int16_t> work;
+        double targetDelay = 0.0;
+        // Drops the loop has caught up with; a drop shifts what the ring
+        // holds against the main output.
+        int64_t droppedSeen = 0;
+        double filteredError = 0.0;
+        double integral = 0.0;
+
+        std::atomic<int64_t> driftPpb{0};
+        std::atomic<double> delay{0.0};
+        std::atomic<double> delayError{0.0};
+        std::atomic<uint64_t> periods{0};
+        std::atomic<uint64_t> xruns{0};
+        std::atomic<int64_t> starvedFrames{0};
+        std::atomic<int64_t> droppedFrames{0};
+    };
+}
+
+#endif // METRONOME_MIRROR_STREAM_H_
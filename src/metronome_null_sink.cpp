@@ -0,0 +1,98 @@
+#include "metronome_null_sink.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace metronome
+{
+    SinkConfig NullSink::Open(const SinkConfig &requested)
+    {
+        config = requested;
+        staging.assign(config.BufferFrames() * static_cast<size_t>(config.channels), 0);
+        Drop();
+        return config;
+    }
+
+    void NullSink::Close()
+    {
+        staging.clear();
+        staging.shrink_to_fit();
+    }
+
+    SinkStatus NullSink::Wait(int timeoutMs, size_t &writable)
+    {
+        const int64_t buffer = static_cast<int64_t>(config.BufferFrames());
+        const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (true)
+        {
+            const Clock::time_point now = Clock::now();
+            const int64_t consumed = started ? Consumed(now) : base;
+            if (consumed > written)
+            {
+                writable = 0;
+                return SinkStatus::Xrun;
+            }
+            const int64_t free = buffer - (written - consumed);
+            if (free >= config.periodFrames || now >= deadline)
+            {
+                writable = static_cast<size_t>(free);
+                return SinkStatus::Ok;
+            }
+            // Sleep until the missing frames have played.
+            const auto needed = std::chrono::microseconds((config.periodFrames - free) * 1000000 / config.sampleRate + 1);
+            std::this_thread::sleep_for(std::min<Clock::duration>(needed, deadline - now));
+        }
+    }
+
+    SinkStatus NullSink::Begin(size_t frames, int16_t *&area, size_t &granted)
+    {
+        granted = std::min(frames, staging.size() / static_cast<size_t>(config.channels));
+        area = staging.data();
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus NullSink::Commit(size_t frames)
+    {
+        const Clock::time_point now = Clock::now();
+        if (started && Consumed(now) > written)
+        {
+            return SinkStatus::Xrun;
+        }
+        written += static_cast<int64_t>(frames);
+        if (!started && written - base + config.periodFrames > static_cast<int64_t>(config.BufferFrames()))
+        {
+            started = true;
+            startTime = now;
+        }
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus NullSink::Recover(int64_t &lostFrames)
+    {
+        lostFrames = 0;
+        if (started)
+        {
+            // The device ran dry when it had played everything written.
+            const Clock::time_point now = Clock::now();
+            lostFrames = std::max<int64_t>(0, Consumed(now) - written);
+        }
+        Drop();
+        return SinkStatus::Ok;
+    }
+
+    void NullSink::Drop()
+    {
+        started = false;
+        base = written;
+    }
+
+    int64_t NullSink::Consumed(Clock::time_point now) const
+    {
+        return base + FramesSince(startTime, now);
+    }
+
+    int64_t NullSink::FramesSince(Clock::time_point from, Clock::time_point to) const
+    {
+        return static_cast<int64_t>(std::chrono::duration<double>(to - from).count() * config.sampleRate);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef METRONOME_NULL_SINK_H_
+#define METRONOME_NULL_SINK_H_
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "metronome_sink.h"
+
+namespace metronome
+{
+    // Discards audio at the pace of a real device, timed by the steady
+    // clock. Behaves like a hardware ring: it starts once its buffer is
+    // full, and stops with an xrun if the writer falls behind. Useful on
+    // machines without a sound card, e.g. for the CLI's play command.
+    class NullSink : public AudioSink
+    {
+    public:
+        SinkConfig Open(const SinkConfig &requested) override;
+        void Close() override;
+        SinkStatus Wait(int timeoutMs, size_t &writable) override;
+        SinkStatus Begin(size_t frames, int16_t *&area, size_t &granted) override;
+        SinkStatus Commit(size_t frames) override;
+        SinkStatus Recover(int64_t &lostFrames) override;
+        void Drop() override;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // Frames the device has consumed by now; may run past written.
+        int64_t Consumed(Clock::time_point now) const;
+        int64_t FramesSince(Clock::time_point from, Clock::time_point to) const;
+
+        SinkConfig config;
+        std::vector<int16_t> staging;
+        bool started = false;
+        Clock::time_point startTime;
+        // Frames consumed before startTime.
+        int64_t base = 0;
+        int64_t written = 0;
+    };
+}
+
+#endif // METRONOME_NULL_SINK_H_
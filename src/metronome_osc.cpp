@@ -0,0 +1,207 @@
+#include "metronome_osc.h"
+
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+#include "metronome_log.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace
+    {
+        // How often the sender thread looks for beats that are due.
+        constexpr std::chrono::milliseconds kPollInterval{1};
+        // From 1900, where NTP time starts, to 1970.
+        constexpr uint64_t kNtpEpochOffset = 2208988800ull;
+        constexpr char kTypeTags[] = ",iifiit";
+
+        size_t Padded(size_t bytes)
+        {
+            return (bytes + 3) & ~size_t(3);
+        }
+    }
+
+    uint64_t OscTimetag(std::chrono::system_clock::time_point time)
+    {
+        const auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        const uint64_t seconds = static_cast<uint64_t>(sinceEpoch / 1000000000) + kNtpEpochOffset;
+        const uint64_t nanoseconds = static_cast<uint64_t>(sinceEpoch % 1000000000);
+        return seconds << 32 | (nanoseconds << 32) / 1000000000;
+    }
+
+    OscBeatMessage::OscBeatMessage(const std::string &address)
+    {
+        if (address.empty() || address[0] != '/' || address.size() > kMaxOscAddress)
+        {
+            throw std::invalid_argument("An OSC address starts with '/' and has at most " +
+                                        std::to_string(kMaxOscAddress) + " characters");
+        }
+        std::memcpy(buffer, "#bundle", 8);
+        size_t offset = 20;
+        std::memcpy(buffer + offset, address.data(), address.size());
+        offset += Padded(address.size() + 1);
+        std::memcpy(buffer + offset, kTypeTags, sizeof(kTypeTags));
+        offset += Padded(sizeof(kTypeTags));
+        arguments = offset;
+        size = arguments + 28;
+        // The message is all of the bundle after its size.
+        PutInt32(16, static_cast<uint32_t>(size - 20));
+    }
+
+    void OscBeatMessage::Set(const TickEvent &tick, int64_t bar, double bpm, uint64_t timetag)
+    {
+        float tempo = static_cast<float>(bpm);
+        uint32_t tempoBits = 0;
+        std::memcpy(&tempoBits, &tempo, sizeof(tempoBits));
+        PutInt64(8, timetag);
+        PutInt32(arguments, static_cast<uint32_t>(tick.beat + 1));
+        PutInt32(arguments + 4, static_cast<uint32_t>(bar));
+        PutInt32(arguments + 8, tempoBits);
+        PutInt32(arguments + 12, static_cast<uint32_t>(tick.accent));
+        PutInt32(arguments + 16, tick.muted ? 1u : 0u);
+        PutInt64(arguments + 20, timetag);
+    }
+
+    void OscBeatMessage::PutInt32(size_t offset, uint32_t value)
+    {
+        for (int byte = 0; byte < 4; byte++)
+        {
+            buffer[offset + byte] = static_cast<uint8_t>(value >> (24 - 8 * byte));
+        }
+    }
+
+    void OscBeatMessage::PutInt64(size_t offset, uint64_t value)
+    {
+        PutInt32(offset, static_cast<uint32_t>(value >> 32));
+        PutInt32(offset + 4, static_cast<uint32_t>(value));
+    }
+
+    OscBeatPublisher::OscBeatPublisher(ClickEngine &engine, std::function<int64_t()> playedPosition, OscConfig config)
+        : engine(engine), playedPosition(std::move(playedPosition)), config(std::move(config)),
+          now(&std::chrono::system_clock::now), message(this->config.address)
+    {
+        if (this->config.port < 1 || this->config.port > 65535)
+        {
+            throw std::invalid_argument("OSC port must be 1 to 65535");
+        }
+        socket = std::make_unique<UdpSocket>(this->config.host, this->config.port);
+        // Beats from before this are not for us.
+        TickEvent stale;
+        while (engine.PopTappedTick(stale))
+        {
+        }
+        engine.SetTickTap(true);
+    }
+
+    OscBeatPublisher::~OscBeatPublisher()
+    {
+        Stop();
+        engine.SetTickTap(false);
+    }
+
+    void OscBeatPublisher::SetClock(std::function<std::chrono::system_clock::time_point()> now)
+    {
+        this->now = std::move(now);
+    }
+
+    void OscBeatPublisher::Start()
+    {
+        Stop();
+        running.store(true, std::memory_order_release);
+        thread = std::thread(&OscBeatPublisher::Run, this);
+    }
+
+    void OscBeatPublisher::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    void OscBeatPublisher::Run()
+    {
+        METRONOME_TRACE_THREAD_NAME("osc");
+        try
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            while (!wake.wait_for(lock, kPollInterval, [this]
+                                  { return !running.load(std::memory_order_acquire); }))
+            {
+                lock.unlock();
+                Pump();
+                lock.lock();
+            }
+        }
+        catch (const std::exception &e)
+        {
+            Log(LogLevel::Error, "osc", "OSC sender stopped: %s", e.what());
+        }
+    }
+
+    size_t OscBeatPublisher::Pump()
+    {
+        const int64_t played = playedPosition();
+        const std::chrono::system_clock::time_point wall = now();
+        const double sampleRate = engine.SampleRate();
+        const double lookAheadFrames = config.lookAhead.count() * sampleRate / 1000.0;
+        const double bpm = engine.Clock().bpm;
+        size_t count = 0;
+        while (hasPendingTick || engine.PopTappedTick(pendingTick))
+        {
+            const int64_t ahead = pendingTick.frame - played;
+            if (static_cast<double>(ahead) > lookAheadFrames)
+            {
+                hasPendingTick = true;
+                break;
+            }
+            hasPendingTick = false;
+            if (pendingTick.beat == 0 || bar == 0)
+            {
+                bar++;
+            }
+            const std::chrono::system_clock::time_point soundsAt =
+                wall + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                           std::chrono::duration<double>(ahead / sampleRate));
+            message.Set(pendingTick, bar, bpm, OscTimetag(soundsAt));
+            METRONOME_TRACE_INSTANT("osc_beat", pendingTick.beat);
+            if (socket->Send(message.Data(), message.Size()))
+            {
+                sent.fetch_add(1, std::memory_order_relaxed);
+                count++;
+                if (failing)
+                {
+                    Log(LogLevel::Info, "osc", "Sending OSC to %s:%d again", config.host.c_str(), config.port);
+                    failing = false;
+                }
+            }
+            else
+            {
+                failed.fetch_add(1, std::memory_order_relaxed);
+                // Once per run of failures, not once per beat.
+                if (!failing)
+                {
+                    Log(LogLevel::Warning, "osc", "Failed to send OSC to %s:%d", config.host.c_str(), config.port);
+                    failing = true;
+                }
+            }
+        }
+        return count;
+    }
+
+    OscStats OscBeatPublisher::Stats() const
+    {
+        OscStats stats;
+        stats.sent = sent.load(std::memory_order_relaxed);
+        stats.failed = failed.load(std::memory_order_relaxed);
+        return stats;
+    }
+}
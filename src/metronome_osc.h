@@ -0,0 +1,136 @@
+#ifndef METRONOME_OSC_H_
+#define METRONOME_OSC_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "metronome_engine.h"
+#include "metronome_udp.h"
+
+namespace metronome
+{
+    // Longest OSC address a beat message takes, without its terminator.
+    constexpr size_t kMaxOscAddress = 63;
+
+    // The NTP timetag OSC uses for a wall-clock time: seconds since 1900 in
+    // the high 32 bits, the fraction of a second in the low 32.
+    uint64_t OscTimetag(std::chrono::system_clock::time_point time);
+
+    // One beat as an OSC 1.0 packet, laid out once so that each beat only
+    // overwrites its arguments in place: a bundle timetagged with when the
+    // click sounds, holding the message
+    //
+    //   <address> ,iifiit  beat, bar, bpm, accent, muted, time
+    //
+    // beat and bar count from 1, accent is the BeatAccent value, muted is
+    // 1 in a gap-click bar, and time repeats the bundle's timetag for
+    // receivers that ignore bundle times. Everything is big-endian, as OSC
+    // requires.
+    class OscBeatMessage
+    {
+    public:
+        // Throws std::invalid_argument unless address starts with '/' and
+        // is at most kMaxOscAddress characters.
+        explicit OscBeatMessage(const std::string &address = "/metronome/beat");
+
+        void Set(const TickEvent &tick, int64_t bar, double bpm, uint64_t timetag);
+
+        const uint8_t *Data() const { return buffer; }
+        size_t Size() const { return size; }
+
+    private:
+        void PutInt32(size_t offset, uint32_t value);
+        void PutInt64(size_t offset, uint64_t value);
+
+        // Bundle header and element size, address, type tags, arguments.
+        uint8_t buffer[16 + 4 + kMaxOscAddress + 1 + 8 + 28] = {};
+        size_t size = 0;
+        // Where the message's arguments start.
+        size_t arguments = 0;
+    };
+
+    struct OscConfig
+    {
+        // Name or numeric address of the receiver, IPv4 or IPv6.
+        std::string host = "127.0.0.1";
+        int port = 9000;
+        std::string address = "/metronome/beat";
+        // How long before the click sounds each beat is sent; beats are
+        // never sent before they are rendered, so the device buffer (or
+        // the render-ahead watermark) bounds it.
+        std::chrono::milliseconds lookAhead{0};
+    };
+
+    struct OscStats
+    {
+        uint64_t sent = 0;
+        // Datagrams the socket refused, e.g. with no route to the host.
+        uint64_t failed = 0;
+    };
+
+    // Broadcasts the beat of a ClickEngine as OSC over UDP, for lighting
+    // desks and video software on the local network, from a sender thread
+    // of its own fed by the engine's tick tap. Each beat is a
+    // pre-encoded OscBeatMessage sent config.lookAhead before its click
+    // reaches the device, timetagged with when that is; nothing is
+    // allocated per beat.
+    class OscBeatPublisher
+    {
+    public:
+        // playedPosition gives the engine frame at the device output, e.g.
+        // AudioStream::PlayedPosition, and is read from the sender thread.
+        // Turns the engine's tick tap on until destroyed. The engine must
+        // outlive this. Throws std::invalid_argument for a bad port or
+        // address, and std::runtime_error if the host can't be resolved or
+        // no socket opened.
+        OscBeatPublisher(ClickEngine &engine, std::function<int64_t()> playedPosition, OscConfig config);
+        ~OscBeatPublisher();
+
+        OscBeatPublisher(const OscBeatPublisher &) = delete;
+        OscBeatPublisher &operator=(const OscBeatPublisher &) = delete;
+
+        void Start();
+        void Stop();
+        // Sends every beat that is due and returns how many; the sender
+        // thread's loop, or callers driving it themselves.
+        size_t Pump();
+        // Replaces the wall clock beats are timetagged with; call it before
+        // Start.
+        void SetClock(std::function<std::chrono::system_clock::time_point()> now);
+
+        OscStats Stats() const;
+
+    private:
+        void Run();
+
+        ClickEngine &engine;
+        const std::function<int64_t()> playedPosition;
+        const OscConfig config;
+        std::function<std::chrono::system_clock::time_point()> now;
+        std::unique_ptr<UdpSocket> socket;
+
+        // Only touched by whoever calls Pump.
+        OscBeatMessage message;
+        TickEvent pendingTick;
+        bool hasPendingTick = false;
+        int64_t bar = 0;
+        bool failing = false;
+
+        std::atomic<bool> running{false};
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::thread thread;
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> failed{0};
+    };
+}
+
+#endif // METRONOME_OSC_H_
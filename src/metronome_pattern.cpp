@@ -0,0 +1,234 @@
+#include "metronome_pattern.h"
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr uint8_t kHitVelocity = 100;
+        constexpr uint8_t kAccentVelocity = 127;
+
+        // Where a hit falls in its beat: member of member count within
+        // slot, until the beat ends and its slot count is known.
+        struct PatternHit
+        {
+            int lane = 0;
+            int beat = 0;
+            int slot = 0;
+            int member = 0;
+            int members = 1;
+            // Of the beat, once it has ended.
+            int position = 0;
+            int division = 1;
+            GridCell cell;
+        };
+
+        [[noreturn]] void Fail(size_t column, const std::string &what)
+        {
+            throw std::invalid_argument("Pattern column " + std::to_string(column + 1) + ": " + what);
+        }
+
+        // Reads the digits from column on, moving column past them.
+        int ReadNumber(const std::string &notation, size_t &column, int limit, const char *what)
+        {
+            const size_t start = column;
+            int value = 0;
+            while (column < notation.size() && notation[column] >= '0' && notation[column] <= '9')
+            {
+                value = value * 10 + (notation[column] - '0');
+                if (value > limit)
+                {
+                    Fail(start, std::string(what) + " is over " + std::to_string(limit));
+                }
+                column++;
+            }
+            if (column == start)
+            {
+                Fail(start, std::string("expected ") + what);
+            }
+            return value;
+        }
+    }
+
+    StepGrid CompilePattern(const std::string &notation)
+    {
+        StepGrid grid;
+        if (notation.find_first_not_of(" \t\r\n") == std::string::npos)
+        {
+            return grid;
+        }
+
+        std::vector<PatternHit> hits;
+        int lane = 0;
+        int beat = 0;
+        // Beats in the first lane, which the others must match.
+        int beats = 0;
+        int slots = 0;
+        size_t beatHits = 0;
+        int tupletSlot = 0;
+        int tupletSize = 0;
+        int tupletLeft = 0;
+        // Steps per beat: the least common multiple of every division.
+        int division = 1;
+
+        for (size_t column = 0; column <= notation.size(); column++)
+        {
+            const char symbol = column < notation.size() ? notation[column] : ';';
+            if (symbol == ' ' || symbol == '\t' || symbol == '\r' || symbol == '\n')
+            {
+                continue;
+            }
+            if (symbol == 'X' || symbol == 'x' || symbol == '.')
+            {
+                PatternHit hit;
+                if (tupletLeft > 0)
+                {
+                    hit.slot = tupletSlot;
+                    hit.member = tupletSize - tupletLeft;
+                    hit.members = tupletSize;
+                    tupletLeft--;
+                }
+                else
+                {
+                    hit.slot = slots++;
+                }
+                if (symbol == '.')
+                {
+                    continue;
+                }
+                hit.lane = lane;
+                hit.beat = beat;
+                hit.cell.sample = symbol == 'X' ? 1 : 0;
+                hit.cell.velocity = symbol == 'X' ? kAccentVelocity : kHitVelocity;
+                if (column + 1 < notation.size() && notation[column + 1] >= '0' && notation[column + 1] <= '9')
+                {
+                    column++;
+                    hit.cell.sample = static_cast<uint8_t>(ReadNumber(notation, column, 255, "a sample index"));
+                    column--;
+                }
+                hits.push_back(hit);
+            }
+            else if (symbol == '(')
+            {
+                if (tupletLeft > 0)
+                {
+                    Fail(column, "tuplets don't nest");
+                }
+                column++;
+                tupletSize = ReadNumber(notation, column, kMaxGridSteps, "a tuplet size");
+                if (tupletSize < 1 || column >= notation.size() || notation[column] != ')')
+                {
+                    Fail(column, "expected a tuplet size of 1 or more and ')'");
+                }
+                tupletLeft = tupletSize;
+                tupletSlot = slots++;
+            }
+            else if (symbol == '|' || symbol == ';')
+            {
+                if (tupletLeft > 0)
+                {
+                    Fail(column, "the tuplet is " + std::to_string(tupletLeft) + " short");
+                }
+                if (slots == 0)
+                {
+                    Fail(column, "a beat needs at least one hit or rest");
+                }
+                for (size_t index = beatHits; index < hits.size(); index++)
+                {
+                    PatternHit &hit = hits[index];
+                    hit.division = slots * hit.members;
+                    hit.position = hit.slot * hit.members + hit.member;
+                    division = std::lcm(division, hit.division);
+                    if (division > kMaxGridSteps)
+                    {
+                        Fail(column, "the bar needs more than " + std::to_string(kMaxGridSteps) + " steps");
+                    }
+                }
+                beatHits = hits.size();
+                slots = 0;
+                beat++;
+                if (symbol == ';')
+                {
+                    if (lane == 0)
+                    {
+                        beats = beat;
+                    }
+                    else if (beat != beats)
+                    {
+                        Fail(column, "lane " + std::to_string(lane + 1) + " has " + std::to_string(beat) +
+                                         " beats, the first " + std::to_string(beats));
+                    }
+                    if (column < notation.size() && ++lane == kGridLanes)
+                    {
+                        Fail(column, "a grid has at most " + std::to_string(kGridLanes) + " lanes");
+                    }
+                    beat = 0;
+                }
+            }
+            else
+            {
+                Fail(column, std::string("unexpected '") + symbol + "'");
+            }
+        }
+
+        if (beats * division > kMaxGridSteps)
+        {
+            Fail(notation.size(), "the bar needs more than " + std::to_string(kMaxGridSteps) + " steps");
+        }
+        grid.steps = beats * division;
+        for (const PatternHit &hit : hits)
+        {
+            const int step = hit.beat * division + hit.position * (division / hit.division);
+            grid.cells[step][hit.lane] = hit.cell;
+        }
+        return grid;
+    }
+
+    PatternCache::PatternCache(size_t capacity) : capacity(capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::invalid_argument("A pattern cache holds at least one pattern");
+        }
+    }
+
+    std::shared_ptr<const StepGrid> PatternCache::Compile(const std::string &notation)
+    {
+        const size_t key = std::hash<std::string>()(notation);
+        uses++;
+        auto found = entries.find(key);
+        if (found != entries.end() && found->second.notation == notation)
+        {
+            hits++;
+            found->second.lastUsed = uses;
+            return found->second.grid;
+        }
+        auto grid = std::make_shared<const StepGrid>(CompilePattern(notation));
+        misses++;
+        if (found == entries.end() && entries.size() >= capacity)
+        {
+            entries.erase(std::min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b)
+                                           { return a.second.lastUsed < b.second.lastUsed; }));
+        }
+        // A pattern with the same hash is replaced.
+        Entry &entry = entries[key];
+        entry.notation = notation;
+        entry.grid = grid;
+        entry.lastUsed = uses;
+        return grid;
+    }
+
+    PatternCacheStats PatternCache::Stats() const
+    {
+        PatternCacheStats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.size = entries.size();
+        return stats;
+    }
+}
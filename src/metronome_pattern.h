@@ -0,0 +1,73 @@
+#ifndef METRONOME_PATTERN_H_
+#define METRONOME_PATTERN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "metronome_engine.h"
+
+namespace metronome
+{
+    // Compiles one bar written as text into the step grid that plays it,
+    // e.g. "X.x.|x.x.|(3)xxx|x..." for four beats of sixteenths with a
+    // triplet on the third:
+    //
+    //   |       ends a beat; a beat is split evenly between its slots
+    //   X       an accented hit: the accent sound at velocity 127
+    //   x       a hit: the main sound at velocity 100
+    //   .       a rest
+    //   (n)     the next n hits and rests share one slot, as an n-tuplet
+    //   digits  straight after a hit, the Kit::Sample it plays instead
+    //   ;       starts the next lane, up to kGridLanes
+    //
+    // Spaces are ignored and every lane must have the same number of
+    // beats, which the meter should match. The grid gets the fewest steps
+    // that put every hit exactly on one: the beats times the least common
+    // multiple of the beats' subdivisions. Parsed in a single pass. Throws
+    // std::invalid_argument, naming the column, for anything else or a bar
+    // that needs more than kMaxGridSteps steps.
+    StepGrid CompilePattern(const std::string &notation);
+
+    struct PatternCacheStats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t size = 0;
+    };
+
+    // Compiled patterns by the hash of their text, so going back to a
+    // pattern already played is a lookup; ClickEngine::SetGrid then only
+    // queues the cells that differ. Keeps the capacity most recently used.
+    // One control thread.
+    class PatternCache
+    {
+    public:
+        explicit PatternCache(size_t capacity = 64);
+
+        // notation compiled, from the cache when it is there. Throws as
+        // CompilePattern does, caching nothing.
+        std::shared_ptr<const StepGrid> Compile(const std::string &notation);
+
+        PatternCacheStats Stats() const;
+
+    private:
+        struct Entry
+        {
+            // Told apart from another pattern with the same hash.
+            std::string notation;
+            std::shared_ptr<const StepGrid> grid;
+            uint64_t lastUsed = 0;
+        };
+
+        const size_t capacity;
+        std::unordered_map<size_t, Entry> entries;
+        uint64_t uses = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+}
+
+#endif // METRONOME_PATTERN_H_
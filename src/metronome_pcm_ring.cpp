@@ -0,0 +1,78 @@
+#include "metronome_pcm_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace metronome
+{
+    PcmRing::PcmRing(size_t capacityFrames, int channels, MemoryBudget *budget)
+        : capacity(capacityFrames), channels(channels)
+    {
+        if (capacityFrames == 0 || channels <= 0)
+        {
+            throw std::invalid_argument("A PCM ring needs room for at least one frame of one channel");
+        }
+        memory = Reserve(budget, MemoryComponent::Rings, capacityFrames * static_cast<size_t>(channels) * sizeof(int16_t));
+        samples.assign(capacityFrames * static_cast<size_t>(channels), 0);
+    }
+
+    template <typename Copy>
+    void PcmRing::Span(size_t from, size_t frames, Copy copy) const
+    {
+        const size_t first = std::min(frames, capacity - from);
+        const size_t stride = static_cast<size_t>(channels);
+        copy(from * stride, 0, first * stride);
+        if (first < frames)
+        {
+            copy(0, first * stride, (frames - first) * stride);
+        }
+    }
+
+    size_t PcmRing::Write(const int16_t *pcm, size_t frames)
+    {
+        const uint64_t tail = written.load(std::memory_order_relaxed);
+        frames = std::min<size_t>(frames, capacity - static_cast<size_t>(tail - read.load(std::memory_order_acquire)));
+        int16_t *ring = samples.data();
+        Span(static_cast<size_t>(tail % capacity), frames, [&](size_t at, size_t offset, size_t count)
+             { std::memcpy(ring + at, pcm + offset, count * sizeof(int16_t)); });
+        written.store(tail + frames, std::memory_order_release);
+        return frames;
+    }
+
+    size_t PcmRing::WriteSilence(size_t frames)
+    {
+        const uint64_t tail = written.load(std::memory_order_relaxed);
+        frames = std::min<size_t>(frames, capacity - static_cast<size_t>(tail - read.load(std::memory_order_acquire)));
+        int16_t *ring = samples.data();
+        Span(static_cast<size_t>(tail % capacity), frames, [&](size_t at, size_t, size_t count)
+             { std::memset(ring + at, 0, count * sizeof(int16_t)); });
+        written.store(tail + frames, std::memory_order_release);
+        return frames;
+    }
+
+    size_t PcmRing::Read(int16_t *pcm, size_t frames)
+    {
+        const uint64_t head = read.load(std::memory_order_relaxed);
+        frames = std::min<size_t>(frames, static_cast<size_t>(written.load(std::memory_order_acquire) - head));
+        const int16_t *ring = samples.data();
+        Span(static_cast<size_t>(head % capacity), frames, [&](size_t at, size_t offset, size_t count)
+             { std::memcpy(pcm + offset, ring + at, count * sizeof(int16_t)); });
+        read.store(head + frames, std::memory_order_release);
+        return frames;
+    }
+
+    size_t PcmRing::Discard(size_t frames)
+    {
+        const uint64_t head = read.load(std::memory_order_relaxed);
+        frames = std::min<size_t>(frames, static_cast<size_t>(written.load(std::memory_order_acquire) - head));
+        read.store(head + frames, std::memory_order_release);
+        return frames;
+    }
+
+    size_t PcmRing::Available() const
+    {
+        const uint64_t head = read.load(std::memory_order_acquire);
+        return static_cast<size_t>(written.load(std::memory_order_acquire) - head);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef METRONOME_PCM_RING_H_
+#define METRONOME_PCM_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "metronome_memory_budget.h"
+
+namespace metronome
+{
+    // Single-producer single-consumer ring of interleaved 16-bit frames.
+    // Storage is allocated up front and transfers are bulk copies, so both
+    // ends can run on audio threads. Writes that don't fit are cut short
+    // rather than overwriting unread frames.
+    class PcmRing
+    {
+    public:
+        // Throws std::invalid_argument unless both are positive, and
+        // std::runtime_error if budget has no room for the storage.
+        PcmRing(size_t capacityFrames, int channels, MemoryBudget *budget = nullptr);
+
+        PcmRing(const PcmRing &) = delete;
+        PcmRing &operator=(const PcmRing &) = delete;
+
+        // Producer. Each returns the frames that fit.
+        size_t Write(const int16_t *pcm, size_t frames);
+        size_t WriteSilence(size_t frames);
+
+        // Consumer. Each returns the frames there were.
+        size_t Read(int16_t *pcm, size_t frames);
+        size_t Discard(size_t frames);
+
+        // Frames written and not yet read; exact for the consumer, a lower
+        // bound for anyone else.
+        size_t Available() const;
+        // Frames ever written and read; each only read by the other side.
+        uint64_t TotalWritten() const { return written.load(std::memory_order_acquire); }
+        uint64_t TotalRead() const { return read.load(std::memory_order_acquire); }
+        size_t CapacityFrames() const { return capacity; }
+        int Channels() const { return channels; }
+
+    private:
+        // Copies frames in or out at frame index from, wrapping at the end.
+        template <typename Copy>
+        void Span(size_t from, size_t frames, Copy copy) const;
+
+        const size_t capacity;
+        const int channels;
+        MemoryReservation memory;
+        std::vector<int16_t> samples;
+        // Frames written and read so far; they only ever grow.
+        alignas(64) std::atomic<uint64_t> written{0};
+        alignas(64) std::atomic<uint64_t> read{0};
+    };
+}
+
+#endif // METRONOME_PCM_RING_H_
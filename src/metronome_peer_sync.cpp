@@ -0,0 +1,414 @@
+#include "metronome_peer_sync.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "metronome_log.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace
+    {
+        // How often the sync thread looks for messages.
+        constexpr std::chrono::milliseconds kPollInterval{2};
+        constexpr char kMagic[4] = {'M', 'T', 'P', 'S'};
+        constexpr uint8_t kProtocolVersion = 1;
+        constexpr size_t kHeaderBytes = 16;
+        // Longest message: a timeline.
+        constexpr size_t kMaxMessage = kHeaderBytes + 32;
+        // Round trips kept per peer to pick the fastest from.
+        constexpr size_t kOffsetSamples = 8;
+        // Weight of each correction in the mean phase error.
+        constexpr double kMeanWeight = 0.05;
+        // Longest the engine frame at the output is run on by the host
+        // clock between device periods.
+        constexpr int64_t kMaxExtrapolationNs = 50000000;
+        constexpr double kNsPerMinute = 60e9;
+
+        enum MessageType : uint8_t
+        {
+            kTimeline = 1,
+            kPing = 2,
+            kPong = 3,
+        };
+
+        void PutUint64(uint8_t *data, uint64_t value)
+        {
+            for (int byte = 0; byte < 8; byte++)
+            {
+                data[byte] = static_cast<uint8_t>(value >> (56 - 8 * byte));
+            }
+        }
+
+        uint64_t GetUint64(const uint8_t *data)
+        {
+            uint64_t value = 0;
+            for (int byte = 0; byte < 8; byte++)
+            {
+                value = value << 8 | data[byte];
+            }
+            return value;
+        }
+
+        void PutDouble(uint8_t *data, double value)
+        {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(bits));
+            PutUint64(data, bits);
+        }
+
+        double GetDouble(const uint8_t *data)
+        {
+            const uint64_t bits = GetUint64(data);
+            double value = 0.0;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        size_t PutHeader(uint8_t *data, MessageType type, uint64_t sender)
+        {
+            std::memcpy(data, kMagic, sizeof(kMagic));
+            data[4] = kProtocolVersion;
+            data[5] = type;
+            data[6] = 0;
+            data[7] = 0;
+            PutUint64(data + 8, sender);
+            return kHeaderBytes;
+        }
+
+        uint64_t RandomId()
+        {
+            std::random_device device;
+            std::mt19937_64 generator((static_cast<uint64_t>(device()) << 32) ^ device() ^
+                                      static_cast<uint64_t>(PeerSync::Clock::now().time_since_epoch().count()));
+            uint64_t id = 0;
+            while (id == 0)
+            {
+                id = generator();
+            }
+            return id;
+        }
+    }
+
+    double SessionTimeline::BeatAt(int64_t hostNs) const
+    {
+        return static_cast<double>(hostNs - originNs) * bpm / kNsPerMinute;
+    }
+
+    int64_t SessionTimeline::TimeAt(double beat) const
+    {
+        return originNs + static_cast<int64_t>(std::llround(beat * kNsPerMinute / bpm));
+    }
+
+    SessionTimeline SessionTimeline::WithTempo(double newBpm, int64_t hostNs) const
+    {
+        SessionTimeline changed = *this;
+        changed.bpm = newBpm;
+        changed.originNs = hostNs - static_cast<int64_t>(std::llround(BeatAt(hostNs) * kNsPerMinute / newBpm));
+        return changed;
+    }
+
+    bool SessionTimeline::Supersedes(const SessionTimeline &other) const
+    {
+        return version > other.version || (version == other.version && author < other.author);
+    }
+
+    PeerSync::PeerSync(ClickEngine &engine, std::function<int64_t()> playedPosition, PeerSyncConfig config)
+        : engine(engine), playedPosition(std::move(playedPosition)), config(std::move(config)), id(RandomId()),
+          now(&Clock::now)
+    {
+        const PeerSyncConfig &checked = this->config;
+        if (checked.port < 1 || checked.port > 65535)
+        {
+            throw std::invalid_argument("Peer sync port must be 1 to 65535");
+        }
+        if (!(checked.quantum > 0.0) || !(checked.catchUpBeats > 0.0))
+        {
+            throw std::invalid_argument("Peer sync quantum and catch-up must be greater than 0");
+        }
+        if (!(checked.maxNudge >= 0.0 && checked.maxNudge <= 0.5))
+        {
+            throw std::invalid_argument("Peer sync nudge must be 0 to 0.5");
+        }
+        if (checked.interval.count() <= 0 || checked.peerTimeout <= checked.interval)
+        {
+            throw std::invalid_argument("Peer sync interval must be greater than 0 and less than the peer timeout");
+        }
+        socket = UdpSocket::JoinGroup(checked.group, checked.port, checked.interfaceAddress);
+    }
+
+    PeerSync::~PeerSync()
+    {
+        Stop();
+    }
+
+    void PeerSync::SetClock(std::function<Clock::time_point()> now)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->now = std::move(now);
+        started = false;
+    }
+
+    void PeerSync::Start()
+    {
+        Stop();
+        running.store(true, std::memory_order_release);
+        thread = std::thread(&PeerSync::Run, this);
+    }
+
+    void PeerSync::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    void PeerSync::Run()
+    {
+        METRONOME_TRACE_THREAD_NAME("peer_sync");
+        try
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            while (!wake.wait_for(lock, kPollInterval, [this]
+                                  { return !running.load(std::memory_order_acquire); }))
+            {
+                lock.unlock();
+                Pump();
+                lock.lock();
+            }
+        }
+        catch (const std::exception &e)
+        {
+            Log(LogLevel::Error, "peer_sync", "Peer sync stopped: %s", e.what());
+        }
+    }
+
+    void PeerSync::SetBpm(double bpm)
+    {
+        if (!(bpm >= kMinBpm && bpm <= kMaxBpm))
+        {
+            throw std::invalid_argument("BPM must be between 1 and 1000");
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        const int64_t nowNs = NowNs();
+        Begin(nowNs);
+        timeline = timeline.WithTempo(bpm, nowNs);
+        timeline.version++;
+        timeline.author = id;
+        uncertaintyNs = 0;
+        // Peers hear of it now rather than at the next interval.
+        nextSendNs = nowNs;
+    }
+
+    SessionTimeline PeerSync::Timeline() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return timeline;
+    }
+
+    PeerSyncStats PeerSync::Stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    int64_t PeerSync::NowNs() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now().time_since_epoch()).count();
+    }
+
+    double PeerSync::EngineBeat(int64_t nowNs)
+    {
+        const int64_t played = playedPosition();
+        if (played != lastPlayed)
+        {
+            lastPlayed = played;
+            playedChangedNs = nowNs;
+        }
+        const int64_t sincePlayed = std::min(nowNs - playedChangedNs, kMaxExtrapolationNs);
+        const double frame =
+            static_cast<double>(played) + static_cast<double>(sincePlayed) * engine.SampleRate() / 1e9;
+        return engine.Clock().QuarterAt(frame, engine.SampleRate());
+    }
+
+    void PeerSync::Begin(int64_t nowNs)
+    {
+        if (started)
+        {
+            return;
+        }
+        // A lone peer keeps playing as it was.
+        const double bpm = engine.Clock().bpm;
+        timeline = SessionTimeline();
+        timeline.bpm = bpm;
+        timeline.originNs = nowNs - static_cast<int64_t>(std::llround(EngineBeat(nowNs) * kNsPerMinute / bpm));
+        timeline.author = id;
+        uncertaintyNs = 0;
+        engineBpm = bpm;
+        started = true;
+    }
+
+    void PeerSync::Pump()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const int64_t nowNs = NowNs();
+        Begin(nowNs);
+        Receive(nowNs);
+        const int64_t silentSince = nowNs - std::chrono::duration_cast<std::chrono::nanoseconds>(config.peerTimeout).count();
+        peers.erase(std::remove_if(peers.begin(), peers.end(), [silentSince](const Peer &peer)
+                                   { return peer.heardNs < silentSince; }),
+                    peers.end());
+        if (nowNs >= nextSendNs)
+        {
+            Send(nowNs);
+            nextSendNs = nowNs + std::chrono::duration_cast<std::chrono::nanoseconds>(config.interval).count();
+        }
+        Correct(nowNs);
+    }
+
+    PeerSync::Peer &PeerSync::PeerFor(uint64_t peerId, int64_t nowNs)
+    {
+        auto found = std::find_if(peers.begin(), peers.end(), [peerId](const Peer &peer)
+                                  { return peer.id == peerId; });
+        if (found == peers.end())
+        {
+            Log(LogLevel::Info, "peer_sync", "Peer %016llx joined", static_cast<unsigned long long>(peerId));
+            peers.emplace_back();
+            found = peers.end() - 1;
+            found->id = peerId;
+        }
+        found->heardNs = nowNs;
+        return *found;
+    }
+
+    void PeerSync::Receive(int64_t nowNs)
+    {
+        uint8_t data[kMaxMessage];
+        size_t bytes = 0;
+        while ((bytes = socket->Receive(data, sizeof(data))) > 0)
+        {
+            if (bytes < kHeaderBytes || std::memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+                data[4] != kProtocolVersion)
+            {
+                continue;
+            }
+            const uint64_t sender = GetUint64(data + 8);
+            const uint8_t *body = data + kHeaderBytes;
+            if (sender == id)
+            {
+                continue;
+            }
+            if (data[5] == kTimeline && bytes >= kHeaderBytes + 32)
+            {
+                const Peer &peer = PeerFor(sender, nowNs);
+                SessionTimeline theirs;
+                theirs.bpm = GetDouble(body);
+                theirs.originNs = static_cast<int64_t>(GetUint64(body + 8)) - peer.offsetNs;
+                theirs.version = GetUint64(body + 16);
+                theirs.author = GetUint64(body + 24);
+                // Until the clocks are compared the origin means nothing here.
+                // A tempo the engine would refuse is dropped with the rest of
+                // the message.
+                if (peer.measured && theirs.bpm >= kMinBpm && theirs.bpm <= kMaxBpm && theirs.Supersedes(timeline))
+                {
+                    Log(LogLevel::Info, "peer_sync", "Following %.2f BPM from peer %016llx", theirs.bpm,
+                        static_cast<unsigned long long>(theirs.author));
+                    timeline = theirs;
+                    uncertaintyNs = peer.roundTripNs / 2;
+                }
+            }
+            else if (data[5] == kPing && bytes >= kHeaderBytes + 8)
+            {
+                PeerFor(sender, nowNs);
+                uint8_t pong[kMaxMessage];
+                PutHeader(pong, kPong, id);
+                PutUint64(pong + kHeaderBytes, sender);
+                std::memcpy(pong + kHeaderBytes + 8, body, 8);
+                PutUint64(pong + kHeaderBytes + 16, static_cast<uint64_t>(nowNs));
+                socket->Send(pong, kHeaderBytes + 24);
+            }
+            else if (data[5] == kPong && bytes >= kHeaderBytes + 24 && GetUint64(body) == id)
+            {
+                Peer &peer = PeerFor(sender, nowNs);
+                const int64_t sent = static_cast<int64_t>(GetUint64(body + 8));
+                const int64_t answered = static_cast<int64_t>(GetUint64(body + 16));
+                const int64_t roundTrip = nowNs - sent;
+                if (roundTrip < 0)
+                {
+                    continue;
+                }
+                // The answer is taken to have been made halfway round.
+                if (peer.samples.size() == kOffsetSamples)
+                {
+                    peer.samples.erase(peer.samples.begin());
+                }
+                peer.samples.emplace_back(roundTrip, answered - (sent + roundTrip / 2));
+                const auto fastest = std::min_element(peer.samples.begin(), peer.samples.end());
+                peer.roundTripNs = fastest->first;
+                peer.offsetNs = fastest->second;
+                peer.measured = true;
+            }
+        }
+    }
+
+    void PeerSync::Send(int64_t nowNs)
+    {
+        uint8_t message[kMaxMessage];
+        size_t bytes = PutHeader(message, kTimeline, id);
+        PutDouble(message + bytes, timeline.bpm);
+        PutUint64(message + bytes + 8, static_cast<uint64_t>(timeline.originNs));
+        PutUint64(message + bytes + 16, timeline.version);
+        PutUint64(message + bytes + 24, timeline.author);
+        bool sent = socket->Send(message, bytes + 32);
+
+        bytes = PutHeader(message, kPing, id);
+        PutUint64(message + bytes, static_cast<uint64_t>(nowNs));
+        sent = socket->Send(message, bytes + 8) && sent;
+        // Once per run of failures, not once per interval.
+        if (sent == failing)
+        {
+            failing = !sent;
+            Log(failing ? LogLevel::Warning : LogLevel::Info, "peer_sync",
+                failing ? "Failed to send to %s:%d" : "Sending to %s:%d again", config.group.c_str(), config.port);
+        }
+    }
+
+    void PeerSync::Correct(int64_t nowNs)
+    {
+        // Behind is positive, and wrapped to the nearest session downbeat.
+        const double error = std::remainder(timeline.BeatAt(nowNs) - EngineBeat(nowNs), config.quantum);
+        const double nudge = std::max(-config.maxNudge, std::min(config.maxNudge, error / config.catchUpBeats));
+        const double bpm = std::max(kMinBpm, std::min(kMaxBpm, timeline.bpm * (1.0 + nudge)));
+        // Most passes change nothing that can be heard.
+        if (std::fabs(bpm - engineBpm) > 1e-3)
+        {
+            try
+            {
+                engine.SetBpm(bpm);
+                engineBpm = bpm;
+            }
+            catch (const std::runtime_error &)
+            {
+                // The command queue is full; the next pass tries again.
+            }
+        }
+        stats.peers = static_cast<int>(peers.size());
+        stats.bpm = timeline.bpm;
+        stats.phaseErrorMs = -error * 60000.0 / timeline.bpm;
+        stats.meanPhaseErrorMs += (std::fabs(stats.phaseErrorMs) - stats.meanPhaseErrorMs) * kMeanWeight;
+        stats.offsetUncertaintyMs = static_cast<double>(uncertaintyNs) / 1e6;
+        METRONOME_TRACE_INSTANT("peer_phase_error_us", stats.phaseErrorMs * 1000.0);
+    }
+}
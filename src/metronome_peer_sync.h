@@ -0,0 +1,176 @@
+#ifndef METRONOME_PEER_SYNC_H_
+#define METRONOME_PEER_SYNC_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "metronome_engine.h"
+#include "metronome_udp.h"
+
+namespace metronome
+{
+    // The tempo and beat phase a group of peers shares: quarter note b
+    // falls at host time originNs + b * 60 / bpm seconds, in nanoseconds
+    // on the holder's own steady clock.
+    struct SessionTimeline
+    {
+        double bpm = 120.0;
+        int64_t originNs = 0;
+        // Counts tempo changes. Peers keep the timeline with the highest
+        // version, and of equal versions the one whose author has the
+        // lower peer id.
+        uint64_t version = 0;
+        uint64_t author = 0;
+
+        double BeatAt(int64_t hostNs) const;
+        int64_t TimeAt(double beat) const;
+        // This timeline at a new tempo from hostNs on, with the beat at
+        // hostNs where it was.
+        SessionTimeline WithTempo(double newBpm, int64_t hostNs) const;
+        bool Supersedes(const SessionTimeline &other) const;
+    };
+
+    struct PeerSyncConfig
+    {
+        std::string group = "239.255.77.77";
+        int port = 20909;
+        // Address of the interface to join the group on; "127.0.0.1" keeps
+        // the session to this machine.
+        std::string interfaceAddress = "0.0.0.0";
+        // Quarter notes whose phase peers line up: a bar of 4/4 by default,
+        // so their downbeats fall together.
+        double quantum = 4.0;
+        // A phase error is closed over this many beats, by playing up to
+        // maxNudge faster or slower than the session.
+        double catchUpBeats = 2.0;
+        double maxNudge = 0.1;
+        // How often the timeline and a clock ping are sent.
+        std::chrono::milliseconds interval{20};
+        // A peer not heard from for this long has left.
+        std::chrono::milliseconds peerTimeout{1000};
+    };
+
+    struct PeerSyncStats
+    {
+        // Peers heard from, not counting this one.
+        int peers = 0;
+        double bpm = 0.0;
+        // The engine's beat at the output less the session's, at the last
+        // correction, and its running mean magnitude.
+        double phaseErrorMs = 0.0;
+        double meanPhaseErrorMs = 0.0;
+        // Half the round trip of the clock measurement the session's
+        // origin was carried across by; the error peers see between each
+        // other is within this of the sum of their own.
+        double offsetUncertaintyMs = 0.0;
+    };
+
+    // Keeps a ClickEngine on a tempo and bar phase shared with peers in
+    // other processes or on other machines, over UDP multicast on the local
+    // network. Peers announce their SessionTimeline and ping each other,
+    // working out each pair's clock offset from the fastest round trip, so
+    // a timeline arriving in another peer's host time can be carried into
+    // this one's. The engine is never jumped: each pass its tempo is set a
+    // little off the session's until its phase at the output matches.
+    //
+    // Messages are "MTPS", a version byte, a type byte, two reserved bytes
+    // and the sender's u64 id, then for a timeline f64 bpm, i64 origin, u64
+    // version and author; for a ping the sender's i64 time; and for a pong
+    // the u64 id of who pinged, their time and the answerer's. Everything
+    // is big-endian.
+    class PeerSync
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // playedPosition gives the engine frame at the device output, e.g.
+        // AudioStream::PlayedPosition, and is read from the sync thread.
+        // Starts from the engine's own tempo and phase until a peer's
+        // timeline supersedes it. The engine must outlive this. Throws
+        // std::invalid_argument for a bad config, and std::runtime_error
+        // if the group can't be joined.
+        PeerSync(ClickEngine &engine, std::function<int64_t()> playedPosition, PeerSyncConfig config);
+        ~PeerSync();
+
+        PeerSync(const PeerSync &) = delete;
+        PeerSync &operator=(const PeerSync &) = delete;
+
+        void Start();
+        void Stop();
+        // Reads what peers sent, answers it, sends what is due and corrects
+        // the engine; the sync thread's loop, or callers driving it
+        // themselves.
+        void Pump();
+        // Replaces the host clock; call it before Start.
+        void SetClock(std::function<Clock::time_point()> now);
+
+        // Changes the session's tempo for every peer, keeping its phase.
+        // Throws std::invalid_argument outside ClickEngine's range.
+        void SetBpm(double bpm);
+
+        uint64_t Id() const { return id; }
+        SessionTimeline Timeline() const;
+        PeerSyncStats Stats() const;
+
+    private:
+        struct Peer
+        {
+            uint64_t id = 0;
+            // Their clock less ours, from the ping with the shortest round
+            // trip of the last few.
+            int64_t offsetNs = 0;
+            int64_t roundTripNs = 0;
+            bool measured = false;
+            int64_t heardNs = 0;
+            std::vector<std::pair<int64_t, int64_t>> samples;
+        };
+
+        void Run();
+        int64_t NowNs() const;
+        // The engine's quarter note count at the output now.
+        double EngineBeat(int64_t nowNs);
+        // Takes the engine's tempo and phase as the session's, once.
+        void Begin(int64_t nowNs);
+        void Receive(int64_t nowNs);
+        void Send(int64_t nowNs);
+        void Correct(int64_t nowNs);
+        Peer &PeerFor(uint64_t peerId, int64_t nowNs);
+
+        ClickEngine &engine;
+        const std::function<int64_t()> playedPosition;
+        const PeerSyncConfig config;
+        const uint64_t id;
+        std::function<Clock::time_point()> now;
+        std::unique_ptr<UdpSocket> socket;
+
+        // Pump holds mutex throughout, so Timeline, Stats and SetBpm see a
+        // whole pass or none of it.
+        mutable std::mutex mutex;
+        std::vector<Peer> peers;
+        int64_t nextSendNs = 0;
+        double engineBpm = 0.0;
+        int64_t lastPlayed = -1;
+        int64_t playedChangedNs = 0;
+        bool failing = false;
+        SessionTimeline timeline;
+        int64_t uncertaintyNs = 0;
+        bool started = false;
+        PeerSyncStats stats;
+
+        std::atomic<bool> running{false};
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::thread thread;
+    };
+}
+
+#endif // METRONOME_PEER_SYNC_H_
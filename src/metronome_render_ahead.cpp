@@ -0,0 +1,190 @@
+#include "metronome_render_ahead.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#include "metronome_log.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    RenderAhead::RenderAhead(ClickEngine &engine, size_t watermarkFrames, size_t blockFrames, MemoryBudget *budget)
+        : engine(engine), watermark(watermarkFrames), block(blockFrames),
+          ring(std::max<size_t>(1, watermarkFrames + blockFrames), engine.Channels(), budget),
+          position(engine.Position())
+    {
+        if (watermarkFrames == 0 || blockFrames == 0)
+        {
+            throw std::invalid_argument("Rendering ahead needs a watermark and block of at least one frame");
+        }
+        scratch.assign(blockFrames * static_cast<size_t>(engine.Channels()), 0);
+    }
+
+    RenderAhead::~RenderAhead()
+    {
+        Stop();
+    }
+
+    void RenderAhead::Start()
+    {
+        Stop();
+        // A device starts by filling its whole buffer at once.
+        Pump();
+        running.store(true, std::memory_order_release);
+        thread = std::thread(&RenderAhead::Run, this);
+    }
+
+    void RenderAhead::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    void RenderAhead::Reset()
+    {
+        ring.Discard(ring.Available());
+        owed.store(0);
+        position = engine.Position();
+    }
+
+    void RenderAhead::Run()
+    {
+        METRONOME_TRACE_THREAD_NAME("render");
+        // Sleeps a block at most, in case a wakeup slipped in before the wait.
+        const auto idle = std::chrono::microseconds(
+            std::max<int64_t>(1000, static_cast<int64_t>(block) * 1000000 / engine.SampleRate()));
+        try
+        {
+            while (running.load(std::memory_order_acquire))
+            {
+                Pump();
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait_for(lock, idle, [this]
+                              { return !running.load(std::memory_order_acquire) || ring.Available() < watermark; });
+            }
+        }
+        catch (const std::exception &e)
+        {
+            Log(LogLevel::Error, "render", "Rendering stopped: %s", e.what());
+        }
+    }
+
+    size_t RenderAhead::Pump()
+    {
+        size_t rendered = 0;
+        while (ring.Available() < watermark)
+        {
+            SkipOwed();
+            const auto started = std::chrono::steady_clock::now();
+            engine.Render(scratch.data(), block);
+            const int64_t took = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - started)
+                                     .count();
+            if (took > maxRenderNs.load(std::memory_order_relaxed))
+            {
+                maxRenderNs.store(took, std::memory_order_relaxed);
+            }
+            // Below the watermark there is always room for a block.
+            ring.Write(scratch.data(), block);
+            rendered += block;
+            blocks.fetch_add(1, std::memory_order_relaxed);
+        }
+        return rendered;
+    }
+
+    void RenderAhead::SkipOwed()
+    {
+        // Read before owed: frames the device side drops are claimed from
+        // owed first, so this errs towards skipping too little, and the
+        // device side drops the rest once they are rendered.
+        const uint64_t read = ring.TotalRead();
+        int64_t current = owed.load();
+        while (true)
+        {
+            const int64_t skip = current - static_cast<int64_t>(ring.TotalWritten() - read);
+            if (skip <= 0)
+            {
+                return;
+            }
+            if (owed.compare_exchange_weak(current, current - skip))
+            {
+                engine.Skip(static_cast<size_t>(skip));
+                return;
+            }
+        }
+    }
+
+    bool RenderAhead::DropOwed()
+    {
+        int64_t current = owed.load();
+        while (current > 0)
+        {
+            const int64_t drop = std::min<int64_t>(current, static_cast<int64_t>(ring.Available()));
+            if (drop == 0)
+            {
+                return false;
+            }
+            if (owed.compare_exchange_weak(current, current - drop))
+            {
+                ring.Discard(static_cast<size_t>(drop));
+                return drop == current;
+            }
+        }
+        return true;
+    }
+
+    void RenderAhead::Pass(size_t frames)
+    {
+        // Until what is owed is settled, the ring's frames are older still.
+        if (DropOwed())
+        {
+            frames -= ring.Discard(frames);
+        }
+        if (frames > 0)
+        {
+            owed.fetch_add(static_cast<int64_t>(frames));
+        }
+    }
+
+    void RenderAhead::Read(int16_t *pcm, size_t frames)
+    {
+        const size_t got = DropOwed() ? ring.Read(pcm, frames) : 0;
+        if (got < frames)
+        {
+            // The timeline moves on regardless; what was missed is skipped.
+            const size_t channels = static_cast<size_t>(engine.Channels());
+            std::memset(pcm + got * channels, 0, (frames - got) * channels * sizeof(int16_t));
+            owed.fetch_add(static_cast<int64_t>(frames - got));
+            lateFrames.fetch_add(static_cast<int64_t>(frames - got), std::memory_order_relaxed);
+            METRONOME_TRACE_INSTANT("render_late", static_cast<int64_t>(frames - got));
+        }
+        position += static_cast<int64_t>(frames);
+        wake.notify_one();
+    }
+
+    void RenderAhead::Skip(size_t frames)
+    {
+        position += static_cast<int64_t>(frames);
+        Pass(frames);
+        wake.notify_one();
+    }
+
+    RenderAheadStats RenderAhead::Stats() const
+    {
+        RenderAheadStats stats;
+        stats.lateFrames = lateFrames.load(std::memory_order_relaxed);
+        stats.blocks = blocks.load(std::memory_order_relaxed);
+        stats.maxRenderUs = maxRenderNs.load(std::memory_order_relaxed) / 1000.0;
+        return stats;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef METRONOME_RENDER_AHEAD_H_
+#define METRONOME_RENDER_AHEAD_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "metronome_engine.h"
+#include "metronome_pcm_ring.h"
+
+namespace metronome
+{
+    struct RenderAheadStats
+    {
+        // Frames the device side played as silence because nothing was
+        // rendered for them in time.
+        int64_t lateFrames = 0;
+        uint64_t blocks = 0;
+        // Longest single block render, in microseconds.
+        double maxRenderUs = 0.0;
+    };
+
+    // Renders an engine on a thread of its own, keeping a PcmRing topped up
+    // to a watermark, so whoever feeds the device only copies frames out.
+    // Rendering cost then shows up as ring fill, not as late submissions.
+    //
+    // The engine is only touched by the render thread while it runs; the
+    // other members are for the device side, which never locks. The device
+    // side keeps its own timeline: frames it reads or skips move Position()
+    // on whether or not they were rendered yet. Frames it fell behind on
+    // are owed: the render thread skips the engine past them before its
+    // next block, the way AudioStream skips after an xrun, and any it
+    // rendered meanwhile are dropped from the ring unplayed.
+    class RenderAhead
+    {
+    public:
+        // Keeps watermarkFrames rendered, in renders of blockFrames; make
+        // it at least the device's buffer, which Start renders up front. The
+        // engine must outlive this. Throws std::invalid_argument unless
+        // both are positive, and std::runtime_error if budget has no room
+        // for the ring.
+        RenderAhead(ClickEngine &engine, size_t watermarkFrames, size_t blockFrames, MemoryBudget *budget = nullptr);
+        ~RenderAhead();
+
+        RenderAhead(const RenderAhead &) = delete;
+        RenderAhead &operator=(const RenderAhead &) = delete;
+
+        void Start();
+        void Stop();
+        // Renders until the ring is at the watermark and returns the frames
+        // rendered; the render thread's loop, or callers driving it
+        // themselves.
+        size_t Pump();
+        // While stopped: forgets what is rendered and not yet read, and
+        // picks up the timeline where the engine is, as after a restart.
+        void Reset();
+
+        // Device side. Copies the next frames out, silence where they
+        // aren't rendered yet.
+        void Read(int16_t *pcm, size_t frames);
+        // Moves the timeline on without playing.
+        void Skip(size_t frames);
+        // The engine frame Read returns next.
+        int64_t Position() const { return position; }
+
+        const ClickEngine &Engine() const { return engine; }
+        size_t WatermarkFrames() const { return watermark; }
+        RenderAheadStats Stats() const;
+
+    private:
+        void Run();
+        // Device side. Moves frames past the ring's oldest frame, owing any
+        // not rendered yet.
+        void Pass(size_t frames);
+        // Device side. Drops owed frames that have since been rendered;
+        // false while some are still owed.
+        bool DropOwed();
+        // Render side. Skips the engine past owed frames not in the ring.
+        void SkipOwed();
+
+        ClickEngine &engine;
+        const size_t watermark;
+        const size_t block;
+        PcmRing ring;
+        std::vector<int16_t> scratch;
+        std::atomic<bool> running{false};
+        std::thread thread;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+
+        int64_t position = 0;
+        // Frames the device side has passed that were never in the ring.
+        // Each is settled once: skipped by the render thread, or rendered
+        // and then dropped by the device side.
+        std::atomic<int64_t> owed{0};
+
+        std::atomic<int64_t> lateFrames{0};
+        std::atomic<uint64_t> blocks{0};
+        std::atomic<int64_t> maxRenderNs{0};
+    };
+}
+
+#endif // METRONOME_RENDER_AHEAD_H_
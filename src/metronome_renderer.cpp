@@ -0,0 +1,102 @@
+#include "metronome_renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "metronome_loudness.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    OfflineRenderer::OfflineRenderer(Timeline timeline, Kit kit, double volume)
+        : timeline(std::move(timeline)), kit(std::move(kit)), volume(volume)
+    {
+        if (volume < 0.0 || volume > 1.0)
+        {
+            throw std::invalid_argument("Volume must be between 0.0 and 1.0");
+        }
+        if (this->kit.mainSound.empty())
+        {
+            throw std::invalid_argument("Main sound file cannot be empty");
+        }
+        if (this->kit.accentedSound.empty())
+        {
+            this->kit.accentedSound = this->kit.mainSound;
+        }
+        if (this->kit.matchLoudness)
+        {
+            MatchKitLoudness(this->kit, this->timeline.sampleRate);
+        }
+    }
+
+    OfflineRenderer::OfflineRenderer(const Song &song)
+        : OfflineRenderer(CompileTimeline(song), song.kit, song.volume)
+    {
+    }
+
+    size_t OfflineRenderer::Render(int16_t *out, size_t frames)
+    {
+        METRONOME_TRACE_SCOPE("render_block");
+        const int64_t end = std::min<int64_t>(timeline.length, position + static_cast<int64_t>(frames));
+        if (end <= position)
+        {
+            return 0;
+        }
+
+        const size_t count = static_cast<size_t>(end - position);
+        std::memset(out, 0, count * sizeof(int16_t));
+
+        int64_t cursor = position;
+        while (cursor < end)
+        {
+            int64_t segmentEnd = end;
+            if (nextEvent < timeline.events.size())
+            {
+                segmentEnd = std::min(segmentEnd, timeline.events[nextEvent].frame);
+            }
+            Mix(out + (cursor - position), cursor, segmentEnd);
+            cursor = segmentEnd;
+
+            if (nextEvent < timeline.events.size() && timeline.events[nextEvent].frame == cursor)
+            {
+                const BeatAccent accent = timeline.events[nextEvent].accent;
+                voice = &SoundFor(accent);
+                voiceGain = accent == BeatAccent::Group ? volume * kGroupAccentGain : volume;
+                voiceGain *= kit.Trim(voice == &kit.mainSound ? 0 : 1);
+                voiceStart = cursor;
+                nextEvent++;
+            }
+        }
+
+        position = end;
+        return count;
+    }
+
+    void OfflineRenderer::Mix(int16_t *out, int64_t from, int64_t to)
+    {
+        if (voice == nullptr || from >= to)
+        {
+            return;
+        }
+
+        const int64_t voiceEnd = voiceStart + static_cast<int64_t>(voice->size());
+        const int64_t stop = std::min(to, voiceEnd);
+        const int16_t *source = voice->data() + (from - voiceStart);
+        for (int64_t i = 0; i < stop - from; i++)
+        {
+            out[i] = static_cast<int16_t>(std::lround(source[i] * voiceGain));
+        }
+        if (stop >= voiceEnd)
+        {
+            voice = nullptr;
+        }
+    }
+
+    const std::vector<int16_t> &OfflineRenderer::SoundFor(BeatAccent accent) const
+    {
+        return accent == BeatAccent::Accented || accent == BeatAccent::Group ? kit.accentedSound : kit.mainSound;
+    }
+}
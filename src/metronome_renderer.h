@@ -0,0 +1,47 @@
+#ifndef METRONOME_RENDERER_H_
+#define METRONOME_RENDERER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "metronome_song.h"
+#include "metronome_timeline.h"
+
+namespace metronome
+{
+    // Renders a compiled timeline to mono 16-bit PCM as fast as the caller
+    // pulls blocks, without touching an audio device. Like the realtime
+    // plugin, a click is cut off by the next one rather than overlapping it.
+    class OfflineRenderer
+    {
+    public:
+        OfflineRenderer(Timeline timeline, Kit kit, double volume);
+        explicit OfflineRenderer(const Song &song);
+
+        // Writes up to frames samples into out and returns how many were
+        // written; 0 once the end of the timeline has been reached.
+        size_t Render(int16_t *out, size_t frames);
+
+        int64_t Position() const { return position; }
+        int64_t Length() const { return timeline.length; }
+        int SampleRate() const { return timeline.sampleRate; }
+        bool Finished() const { return position >= timeline.length; }
+
+    private:
+        void Mix(int16_t *out, int64_t from, int64_t to);
+        const std::vector<int16_t> &SoundFor(BeatAccent accent) const;
+
+        Timeline timeline;
+        Kit kit;
+        double volume;
+        int64_t position = 0;
+        size_t nextEvent = 0;
+        const std::vector<int16_t> *voice = nullptr;
+        // volume, scaled down for group accents and by the sound's trim.
+        double voiceGain = 1.0;
+        int64_t voiceStart = 0;
+    };
+}
+
+#endif // METRONOME_RENDERER_H_
@@ -0,0 +1,85 @@
+#ifndef METRONOME_SEQLOCK_H_
+#define METRONOME_SEQLOCK_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace metronome
+{
+    // Publishes a small trivially copyable value from one writer to any
+    // number of readers. Store never blocks or allocates, so the audio thread
+    // can publish every block; Load retries while a store is in progress and
+    // always returns a value that was stored whole. The value is kept in
+    // relaxed atomic words, so a torn read is discarded, never undefined.
+    template <typename T>
+    class Seqlock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied bytewise");
+
+    public:
+        Seqlock() { Store(T()); }
+
+        Seqlock(const Seqlock &) = delete;
+        Seqlock &operator=(const Seqlock &) = delete;
+
+        // Single writer.
+        void Store(const T &value)
+        {
+            uint64_t buffer[kWords] = {};
+            std::memcpy(buffer, &value, sizeof(T));
+            const uint32_t begin = sequence.load(std::memory_order_relaxed) + 1;
+            sequence.store(begin, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < kWords; i++)
+            {
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+            sequence.store(begin + 1, std::memory_order_release);
+        }
+
+        // Any thread.
+        T Load() const
+        {
+            T value;
+            while (!TryLoad(value))
+            {
+            }
+            return value;
+        }
+
+        // One attempt at Load: false, leaving value alone, if a store was in
+        // progress. For readers that must not wait on a writer that may
+        // have died mid-store, such as one in another process.
+        bool TryLoad(T &value) const
+        {
+            uint64_t buffer[kWords];
+            const uint32_t before = sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < kWords; i++)
+            {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint32_t after = sequence.load(std::memory_order_relaxed);
+            if ((before & 1) != 0 || before != after)
+            {
+                return false;
+            }
+            std::memcpy(&value, buffer, sizeof(T));
+            return true;
+        }
+
+        // Stores so far; lets a poller tell whether anything changed.
+        uint32_t Version() const { return sequence.load(std::memory_order_acquire) / 2; }
+
+    private:
+        static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<uint64_t> words[kWords] = {};
+    };
+}
+
+#endif // METRONOME_SEQLOCK_H_
@@ -0,0 +1,70 @@
+#ifndef METRONOME_SINK_H_
+#define METRONOME_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace metronome
+{
+    struct SinkConfig
+    {
+        int sampleRate = 44100;
+        // Interleaved 16-bit samples per frame.
+        int channels = 1;
+        // The unit the stream renders in and the sink wakes up for.
+        int periodFrames = 441;
+        // Periods in the device buffer; together with periodFrames this sets
+        // the output latency.
+        int periods = 4;
+
+        size_t BufferFrames() const { return static_cast<size_t>(periodFrames) * periods; }
+    };
+
+    enum class SinkStatus
+    {
+        Ok,
+        // The device ran dry and stopped; call Recover before writing again.
+        Xrun,
+        // The device is gone; the stream closes the sink and keeps reopening
+        // it until a device comes back.
+        Lost,
+    };
+
+    // A 16-bit interleaved output device driven by AudioStream. Writes go straight
+    // into the device buffer where the backend allows it: Begin exposes a
+    // region, the caller renders into it, and Commit hands it over.
+    //
+    // Only the stream thread calls these, apart from Open and Close which
+    // the stream calls while its thread is not running. Failures that retrying
+    // cannot fix throw std::runtime_error.
+    class AudioSink
+    {
+    public:
+        virtual ~AudioSink() = default;
+
+        // Returns the configuration the device granted, which may differ from
+        // requested in everything but the sample rate and channels.
+        virtual SinkConfig Open(const SinkConfig &requested) = 0;
+        virtual void Close() = 0;
+
+        // Blocks until at least one period can be written or timeoutMs has
+        // passed, and sets writable to the frames that fit.
+        virtual SinkStatus Wait(int timeoutMs, size_t &writable) = 0;
+        // Exposes up to frames contiguous writable frames, channels samples
+        // each; granted may come back smaller at the end of the device ring.
+        virtual SinkStatus Begin(size_t frames, int16_t *&area, size_t &granted) = 0;
+        virtual SinkStatus Commit(size_t frames) = 0;
+        // Rearms the device after an xrun. lostFrames is set to the time it
+        // spent stopped, in frames, so the caller can keep its timeline in
+        // step with the wall clock.
+        virtual SinkStatus Recover(int64_t &lostFrames) = 0;
+        // Stops at once, discarding queued frames.
+        virtual void Drop() = 0;
+        // True when the sink would now open a different device than the one
+        // it has open, e.g. after the system default output changed. The
+        // stream then moves over as if the device had been lost.
+        virtual bool DeviceChanged() { return false; }
+    };
+}
+
+#endif // METRONOME_SINK_H_
@@ -0,0 +1,473 @@
+#include "metronome_snapshot.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr char kMagic[4] = {'M', 'T', 'S', '1'};
+        constexpr uint32_t kByteOrderMark = 0x01020304;
+        constexpr uint32_t kMatchLoudness = 1;
+
+        struct SnapshotHeader
+        {
+            char magic[4];
+            uint32_t version;
+            uint32_t byteOrder;
+            uint32_t sampleRate;
+            uint32_t channels;
+            uint32_t flags;
+            uint32_t commandCount;
+            uint32_t soundCount;
+            uint64_t commandsOffset;
+            uint64_t soundsOffset;
+            uint64_t fileBytes;
+            uint8_t reserved[8];
+        };
+
+        struct SnapshotCommand
+        {
+            uint8_t type;
+            uint8_t reserved[7];
+            double value;
+        };
+
+        struct SnapshotSound
+        {
+            uint64_t offset;
+            uint64_t samples;
+            float trim;
+            uint32_t analysed;
+            float peak;
+            float rms;
+            float lufs;
+            uint8_t reserved[4];
+        };
+
+        static_assert(sizeof(SnapshotHeader) == 64, "snapshot header layout");
+        static_assert(sizeof(SnapshotCommand) == 16, "snapshot command layout");
+        static_assert(sizeof(SnapshotSound) == 40, "snapshot sound layout");
+
+        size_t Align(size_t offset)
+        {
+            return (offset + 7) & ~size_t(7);
+        }
+
+        // The types State() emits, apart from SetKit, which the loader
+        // answers by building the engine with the saved kit.
+        bool Restorable(uint8_t type)
+        {
+            return (type >= static_cast<uint8_t>(CommandType::SetBpm) &&
+                    type <= static_cast<uint8_t>(CommandType::SetVolume)) ||
+                   (type >= static_cast<uint8_t>(CommandType::SetMeter) &&
+                    type <= static_cast<uint8_t>(CommandType::SetRoute)) ||
+                   (type >= static_cast<uint8_t>(CommandType::SyncBeat) &&
+                    type <= static_cast<uint8_t>(CommandType::SyncLaneVoice)) ||
+                   type == static_cast<uint8_t>(CommandType::SyncGapBar);
+        }
+
+        // A whole number from low to high; false for NaN.
+        bool Whole(double value, double low, double high)
+        {
+            return value >= low && value <= high && value == std::floor(value);
+        }
+
+        // A packed meter as ClickEngine::SetMeter would have sent it: the
+        // same meter checks, on the fields ClickEngine::Meter::Pack lays out.
+        void CheckMeter(double value)
+        {
+            if (!Whole(value, 0.0, static_cast<double>((uint64_t(1) << 52) - 1)))
+            {
+                throw std::invalid_argument("Snapshot holds a corrupt meter");
+            }
+            const uint64_t packed = static_cast<uint64_t>(value);
+            const int numerator = static_cast<int>(packed & 0xFFFF);
+            const int denominator = 1 << (packed >> 16 & 7);
+            const uint32_t groupStarts = static_cast<uint32_t>(packed >> 20);
+            std::vector<int> grouping;
+            if (groupStarts != 1)
+            {
+                if ((groupStarts & 1) == 0 || numerator > kMaxGroupedBeats ||
+                    (numerator < 32 && (groupStarts >> numerator) != 0))
+                {
+                    throw std::invalid_argument("Snapshot holds a corrupt meter grouping");
+                }
+                int start = 0;
+                for (int beat = 1; beat <= numerator; beat++)
+                {
+                    if (beat == numerator || (groupStarts >> beat & 1) != 0)
+                    {
+                        grouping.push_back(beat - start);
+                        start = beat;
+                    }
+                }
+            }
+            ValidateMeter(numerator, denominator, grouping);
+        }
+
+        // Rejects values the engine's setters would have refused, or that
+        // no engine state produces, before the engine applies them.
+        void CheckCommand(const SnapshotCommand &record, int channels)
+        {
+            const double value = record.value;
+            if (!std::isfinite(value))
+            {
+                throw std::invalid_argument("Snapshot holds a command value that is not finite");
+            }
+            // Frame offsets convert to int64_t.
+            constexpr double kMaxFrames = 9007199254740992.0;
+            bool valid = true;
+            switch (static_cast<CommandType>(record.type))
+            {
+            case CommandType::SetBpm:
+                valid = value >= kMinBpm && value <= kMaxBpm;
+                break;
+            case CommandType::SetVolume:
+                valid = value >= 0.0 && value <= 1.0;
+                break;
+            case CommandType::SetTimeSignature:
+            case CommandType::SyncStepBeats:
+                valid = Whole(value, 1.0, 0xFFFF);
+                break;
+            case CommandType::SetMeter:
+            case CommandType::SyncMeter:
+                CheckMeter(value);
+                break;
+            case CommandType::SetGridSteps:
+                valid = Whole(value, 0.0, kMaxGridSteps);
+                break;
+            case CommandType::SetGridCell:
+                valid = Whole(value, 0.0, (1 << 24) - 1);
+                break;
+            case CommandType::SetGapClick:
+            {
+                // An engine that never had gap click set saves 0 bars to play.
+                valid = Whole(value, 0.0, static_cast<double>((uint64_t(1) << 48) - 1));
+                const uint64_t packed = valid ? static_cast<uint64_t>(value) : 0;
+                valid = valid && ((packed & 0xFF) != 0 || (packed >> 8 & 0xFF) == 0);
+                break;
+            }
+            case CommandType::SetRoute:
+            {
+                valid = Whole(value, 0.0, (1 << 23) - 1);
+                const int packed = valid ? static_cast<int>(value) : 0;
+                valid = valid && (packed & 0xF) < kRouteLayers && (packed >> 4 & 7) < channels &&
+                        (packed >> 7) <= 2 * 32767;
+                break;
+            }
+            case CommandType::SyncBeat:
+                valid = Whole(value, 0.0, 0xFFFF - 1);
+                break;
+            case CommandType::SyncLastClick:
+            case CommandType::SyncNextClick:
+            case CommandType::SyncGridLastStep:
+            case CommandType::SyncGridNextStep:
+                valid = Whole(value, -kMaxFrames, kMaxFrames);
+                break;
+            case CommandType::SyncLastClickFraction:
+            case CommandType::SyncNextClickFraction:
+            case CommandType::SyncGridLastStepFraction:
+            case CommandType::SyncGridNextStepFraction:
+                valid = value >= 0.0 && value < 1.0;
+                break;
+            case CommandType::SyncVoice:
+                valid = Whole(value, -1.0, kMaxFrames);
+                break;
+            case CommandType::SyncVoiceAccent:
+                valid = Whole(value, 0.0, static_cast<double>(BeatAccent::Group));
+                break;
+            case CommandType::SyncGridStep:
+                valid = Whole(value, 0.0, 0xFFFF) && (static_cast<int>(value) & 0xFF) < kMaxGridSteps &&
+                        (static_cast<int>(value) >> 8) <= kMaxGridSteps;
+                break;
+            case CommandType::SyncLaneVoice:
+                valid = Whole(value, 0.0, static_cast<double>((uint64_t(1) << 50) - 1));
+                break;
+            case CommandType::SyncGapBar:
+                valid = Whole(value, 0.0, 0x1FF);
+                break;
+            default:
+                break;
+            }
+            if (!valid)
+            {
+                throw std::invalid_argument("Snapshot holds an out-of-range value for command " +
+                                            std::to_string(record.type));
+            }
+        }
+
+        // A file mapped read-only for as long as this lives.
+        class MappedFile
+        {
+        public:
+            explicit MappedFile(const std::string &path)
+            {
+#if defined(_WIN32)
+                file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL, nullptr);
+                LARGE_INTEGER fileSize = {};
+                if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+                {
+                    Release();
+                    throw std::runtime_error("Failed to open " + path);
+                }
+                size = static_cast<size_t>(fileSize.QuadPart);
+                if (size > 0)
+                {
+                    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                    data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+                    if (data == nullptr)
+                    {
+                        Release();
+                        throw std::runtime_error("Failed to map " + path);
+                    }
+                }
+#else
+                const int fd = open(path.c_str(), O_RDONLY);
+                struct stat info = {};
+                if (fd < 0 || fstat(fd, &info) != 0)
+                {
+                    if (fd >= 0)
+                    {
+                        close(fd);
+                    }
+                    throw std::runtime_error("Failed to open " + path);
+                }
+                size = static_cast<size_t>(info.st_size);
+                if (size > 0)
+                {
+                    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                }
+                close(fd);
+                if (data == MAP_FAILED)
+                {
+                    data = nullptr;
+                    throw std::runtime_error("Failed to map " + path);
+                }
+#endif
+            }
+
+            ~MappedFile()
+            {
+                Release();
+            }
+
+            MappedFile(const MappedFile &) = delete;
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            const uint8_t *Data() const { return static_cast<const uint8_t *>(data); }
+            size_t Size() const { return size; }
+
+        private:
+            void Release()
+            {
+#if defined(_WIN32)
+                if (data != nullptr)
+                {
+                    UnmapViewOfFile(data);
+                }
+                if (mapping != nullptr)
+                {
+                    CloseHandle(mapping);
+                }
+                if (file != INVALID_HANDLE_VALUE)
+                {
+                    CloseHandle(file);
+                }
+                mapping = nullptr;
+                file = INVALID_HANDLE_VALUE;
+#else
+                if (data != nullptr)
+                {
+                    munmap(data, size);
+                }
+#endif
+                data = nullptr;
+            }
+
+#if defined(_WIN32)
+            HANDLE file = INVALID_HANDLE_VALUE;
+            HANDLE mapping = nullptr;
+#endif
+            void *data = nullptr;
+            size_t size = 0;
+        };
+
+        // Checks that count records of record bytes at offset lie in the
+        // file, aligned.
+        void CheckTable(const MappedFile &file, uint64_t offset, uint64_t count, size_t record, const char *what)
+        {
+            if (offset % 8 != 0 || offset > file.Size() || count > (file.Size() - offset) / record)
+            {
+                throw std::invalid_argument(std::string("Snapshot ") + what + " run past the end of the file");
+            }
+        }
+    }
+
+    void WriteSnapshot(ClickEngine &engine, const std::string &path)
+    {
+        engine.ApplyPending();
+        const std::vector<EngineCommand> state = engine.State();
+        const Kit &kit = engine.PlayingKit();
+
+        std::vector<SnapshotCommand> commands;
+        for (const EngineCommand &command : state)
+        {
+            if (command.type == CommandType::SetKit)
+            {
+                continue;
+            }
+            SnapshotCommand record = {};
+            record.type = static_cast<uint8_t>(command.type);
+            record.value = command.value;
+            commands.push_back(record);
+        }
+
+        SnapshotHeader header = {};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kSnapshotVersion;
+        header.byteOrder = kByteOrderMark;
+        header.sampleRate = static_cast<uint32_t>(engine.SampleRate());
+        header.channels = static_cast<uint32_t>(engine.Channels());
+        header.flags = kit.matchLoudness ? kMatchLoudness : 0;
+        header.commandCount = static_cast<uint32_t>(commands.size());
+        header.soundCount = static_cast<uint32_t>(kit.SampleCount());
+        header.commandsOffset = sizeof(SnapshotHeader);
+        header.soundsOffset = Align(header.commandsOffset + commands.size() * sizeof(SnapshotCommand));
+
+        std::vector<SnapshotSound> sounds(kit.SampleCount());
+        size_t offset = Align(header.soundsOffset + sounds.size() * sizeof(SnapshotSound));
+        for (size_t index = 0; index < sounds.size(); index++)
+        {
+            const std::vector<int16_t> &pcm = *kit.Sample(static_cast<int>(index));
+            const SampleLoudness loudness = index < kit.loudness.size() ? kit.loudness[index] : SampleLoudness();
+            SnapshotSound &sound = sounds[index];
+            sound.offset = offset;
+            sound.samples = pcm.size();
+            sound.trim = kit.Trim(static_cast<int>(index));
+            sound.analysed = loudness.analysed ? 1 : 0;
+            sound.peak = loudness.peak;
+            sound.rms = loudness.rms;
+            sound.lufs = loudness.lufs;
+            offset = Align(offset + pcm.size() * sizeof(int16_t));
+        }
+        header.fileBytes = offset;
+
+        std::vector<char> bytes(offset, 0);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::memcpy(bytes.data() + header.commandsOffset, commands.data(), commands.size() * sizeof(SnapshotCommand));
+        std::memcpy(bytes.data() + header.soundsOffset, sounds.data(), sounds.size() * sizeof(SnapshotSound));
+        for (size_t index = 0; index < sounds.size(); index++)
+        {
+            const std::vector<int16_t> &pcm = *kit.Sample(static_cast<int>(index));
+            std::memcpy(bytes.data() + sounds[index].offset, pcm.data(), pcm.size() * sizeof(int16_t));
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!file)
+        {
+            throw std::runtime_error("Failed to write " + path);
+        }
+    }
+
+    std::unique_ptr<ClickEngine> LoadSnapshot(const std::string &path, MemoryBudget *budget)
+    {
+        METRONOME_TRACE_SCOPE("snapshot_load");
+        const MappedFile file(path);
+        SnapshotHeader header = {};
+        if (file.Size() < sizeof(header))
+        {
+            throw std::invalid_argument("Not a snapshot: " + path);
+        }
+        std::memcpy(&header, file.Data(), sizeof(header));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+        {
+            throw std::invalid_argument("Not a snapshot: " + path);
+        }
+        if (header.version != kSnapshotVersion || header.byteOrder != kByteOrderMark)
+        {
+            throw std::invalid_argument("Snapshot version " + std::to_string(header.version) +
+                                        " or byte order is not supported");
+        }
+        if (header.fileBytes != file.Size())
+        {
+            throw std::invalid_argument("Snapshot is truncated: " + path);
+        }
+        if (header.soundCount < 2 || header.soundCount > 2 + 256)
+        {
+            throw std::invalid_argument("Snapshot kit has a bad number of sounds");
+        }
+        CheckTable(file, header.commandsOffset, header.commandCount, sizeof(SnapshotCommand), "commands");
+        CheckTable(file, header.soundsOffset, header.soundCount, sizeof(SnapshotSound), "sounds");
+
+        // The sounds are the only copy made; everything else is replayed
+        // from the map.
+        Kit kit;
+        kit.matchLoudness = (header.flags & kMatchLoudness) != 0;
+        kit.samples.resize(header.soundCount - 2);
+        kit.loudness.resize(header.soundCount);
+        kit.trims.resize(header.soundCount);
+        for (uint32_t index = 0; index < header.soundCount; index++)
+        {
+            SnapshotSound sound = {};
+            std::memcpy(&sound, file.Data() + header.soundsOffset + index * sizeof(SnapshotSound), sizeof(sound));
+            CheckTable(file, sound.offset, sound.samples, sizeof(int16_t), "sounds");
+            const int16_t *pcm = reinterpret_cast<const int16_t *>(file.Data() + sound.offset);
+            std::vector<int16_t> &target = index == 0   ? kit.mainSound
+                                           : index == 1 ? kit.accentedSound
+                                                        : kit.samples[index - 2];
+            target.assign(pcm, pcm + sound.samples);
+            // Trims scale every sample mixed, and matched trims are derived
+            // from the cached loudness.
+            if (!(sound.trim >= 0.0f && std::isfinite(sound.trim)) ||
+                (sound.analysed != 0 &&
+                 !(sound.peak >= 0.0f && sound.peak <= 1.0f && sound.rms >= 0.0f && std::isfinite(sound.rms) &&
+                   std::isfinite(sound.lufs))))
+            {
+                throw std::invalid_argument("Snapshot kit holds a corrupt trim or loudness");
+            }
+            kit.trims[index] = sound.trim;
+            kit.loudness[index].analysed = sound.analysed != 0;
+            kit.loudness[index].peak = sound.peak;
+            kit.loudness[index].rms = sound.rms;
+            kit.loudness[index].lufs = sound.lufs;
+        }
+
+        // Tempo, meter and the rest come from the commands.
+        auto engine = std::make_unique<ClickEngine>(std::move(kit), 120.0, 4, 1.0, static_cast<int>(header.sampleRate),
+                                                    static_cast<int>(header.channels), budget);
+        for (uint32_t index = 0; index < header.commandCount; index++)
+        {
+            SnapshotCommand record = {};
+            std::memcpy(&record, file.Data() + header.commandsOffset + index * sizeof(SnapshotCommand),
+                        sizeof(record));
+            if (!Restorable(record.type))
+            {
+                throw std::invalid_argument("Snapshot holds an unknown command");
+            }
+            CheckCommand(record, static_cast<int>(header.channels));
+            engine->Apply(EngineCommand{static_cast<CommandType>(record.type), record.value});
+        }
+        return engine;
+    }
+}
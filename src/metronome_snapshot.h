@@ -0,0 +1,41 @@
+#ifndef METRONOME_SNAPSHOT_H_
+#define METRONOME_SNAPSHOT_H_
+
+#include <memory>
+#include <string>
+
+#include "metronome_engine.h"
+#include "metronome_memory_budget.h"
+
+namespace metronome
+{
+    constexpr uint32_t kSnapshotVersion = 1;
+
+    // Saves everything a ClickEngine is playing to a file that loads back
+    // without decoding or analysis, for restoring a session at launch.
+    //
+    // The file is laid out to be read in place from a memory map, in the
+    // host's byte order (checked on load): a 64-byte header ("MTS1", u32
+    // version, u32 byte-order mark 0x01020304, u32 sample rate, u32
+    // channels, u32 flags, u32 command count, u32 sound count, u64 command
+    // and sound table offsets, u64 file size), then 16-byte commands (u8
+    // type, 7 bytes padding, f64 value) as ClickEngine::State gives them,
+    // then 40-byte sound records (u64 offset and sample count, f32 trim,
+    // u32 analysed, f32 peak, RMS and LUFS, 4 bytes padding) for each
+    // Kit::Sample index, then the 16-bit PCM they point at. Tables and
+    // sounds start on 8-byte boundaries. Flag 1 is Kit::matchLoudness.
+
+    // Writes engine's state to path, applying pending commands first. Call
+    // it from the audio side or while no stream runs. Throws
+    // std::runtime_error if the file can't be written.
+    void WriteSnapshot(ClickEngine &engine, const std::string &path);
+
+    // Maps path and builds an engine in the state it was saved in, at
+    // Position() 0, with its kit reserved against budget if given. Throws
+    // std::runtime_error if the file can't be read, and
+    // std::invalid_argument if it is not a snapshot of this version or
+    // holds a value the engine's setters would refuse.
+    std::unique_ptr<ClickEngine> LoadSnapshot(const std::string &path, MemoryBudget *budget = nullptr);
+}
+
+#endif // METRONOME_SNAPSHOT_H_
@@ -0,0 +1,101 @@
+#include "metronome_song.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace metronome
+{
+    const std::vector<int16_t> *Kit::Sample(int index) const
+    {
+        if (index == 0)
+        {
+            return &mainSound;
+        }
+        if (index == 1)
+        {
+            return &accentedSound;
+        }
+        if (index < 0 || static_cast<size_t>(index - 2) >= samples.size())
+        {
+            return nullptr;
+        }
+        return &samples[static_cast<size_t>(index - 2)];
+    }
+
+    float Kit::Trim(int index) const
+    {
+        return index >= 0 && static_cast<size_t>(index) < trims.size() ? trims[static_cast<size_t>(index)] : 1.0f;
+    }
+
+    void Kit::ForgetLoudness(int index)
+    {
+        if (index >= 0 && static_cast<size_t>(index) < loudness.size())
+        {
+            loudness[static_cast<size_t>(index)] = SampleLoudness();
+        }
+    }
+
+    size_t Kit::Bytes() const
+    {
+        size_t bytes = (mainSound.size() + accentedSound.size()) * sizeof(int16_t) +
+                       samples.size() * sizeof(std::vector<int16_t>) + loudness.size() * sizeof(SampleLoudness) +
+                       trims.size() * sizeof(float);
+        for (const std::vector<int16_t> &sample : samples)
+        {
+            bytes += sample.size() * sizeof(int16_t);
+        }
+        return bytes;
+    }
+
+    std::vector<int16_t> BytesToPcm16(const std::vector<uint8_t> &bytes)
+    {
+        if (bytes.size() % 2 != 0)
+        {
+            throw std::invalid_argument("Invalid byte array length for PCM_16BIT");
+        }
+
+        std::vector<int16_t> samples(bytes.size() / 2);
+        std::memcpy(samples.data(), bytes.data(), bytes.size());
+        return samples;
+    }
+
+    void ValidateMeter(int numerator, int denominator, const std::vector<int> &grouping)
+    {
+        if (numerator <= 0 || denominator <= 0 || (denominator & (denominator - 1)) != 0 || denominator > 64)
+        {
+            throw std::invalid_argument("Invalid time signature");
+        }
+        if (grouping.empty())
+        {
+            return;
+        }
+        int total = 0;
+        for (int group : grouping)
+        {
+            if (group <= 0)
+            {
+                throw std::invalid_argument("Beat groups must be at least one beat long");
+            }
+            total += group;
+        }
+        if (total != numerator)
+        {
+            throw std::invalid_argument("Beat groups must add up to the numerator");
+        }
+    }
+
+    uint64_t GroupStartMask(int numerator, const std::vector<int> &grouping)
+    {
+        uint64_t mask = 1;
+        int beat = 0;
+        for (size_t i = 0; i + 1 < grouping.size() && beat < numerator; i++)
+        {
+            beat += grouping[i];
+            if (beat < 64)
+            {
+                mask |= uint64_t(1) << beat;
+            }
+        }
+        return mask;
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef METRONOME_SONG_H_
+#define METRONOME_SONG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace metronome
+{
+    // A tempo change taking effect beatOffset beats into startBar. Tempo is
+    // in quarter notes per minute, which is also clicks per minute in any
+    // x/4 meter. When endBpm is non-zero the tempo ramps linearly, beat by
+    // beat, until the next segment (or the end of the song).
+    struct TempoSegment
+    {
+        int startBar = 0;
+        double bpm = 120.0;
+        double endBpm = 0.0;
+        double beatOffset = 0.0;
+    };
+
+    // A time signature taking effect at the start of startBar. The click
+    // falls on every 1/denominator note, or only on the first beat of each
+    // group when feltInGroups is set (6/8 felt in two).
+    struct MeterChange
+    {
+        int startBar = 0;
+        int numerator = 4;
+        int denominator = 4;
+        // Beats per group, summing to numerator: {2, 2, 3} for 7/8 or
+        // {3, 2} for 5/4. The first beat of every group after the first is
+        // clicked with BeatAccent::Group. Empty means one group per bar.
+        std::vector<int> grouping = {};
+        bool feltInGroups = false;
+    };
+
+    struct Marker
+    {
+        int bar = 0;
+        double beatOffset = 0.0;
+        std::string text;
+    };
+
+    enum class BeatAccent : uint8_t
+    {
+        Rest = 0,
+        Normal = 1,
+        Accented = 2,
+        // The start of a beat group other than the downbeat: the accented
+        // sound at kGroupAccentGain.
+        Group = 3,
+    };
+
+    constexpr double kGroupAccentGain = 0.6;
+
+    // Longest grouped bar the realtime engine takes.
+    constexpr int kMaxGroupedBeats = 32;
+
+    // How loud a sound is, as measured once when it is loaded; see
+    // metronome_loudness.h. Peak and RMS are relative to full scale.
+    struct SampleLoudness
+    {
+        bool analysed = false;
+        float peak = 0.0f;
+        float rms = 0.0f;
+        // Loudest 400 ms of K-weighted signal, in LUFS.
+        float lufs = -70.0f;
+    };
+
+    // Decoded 16-bit PCM for the two click voices, and any further sounds
+    // for step-grid lanes.
+    struct Kit
+    {
+        std::vector<int16_t> mainSound;
+        std::vector<int16_t> accentedSound;
+        std::vector<std::vector<int16_t>> samples = {};
+        // Analysis cached per Sample(index); entries may be missing or not
+        // yet analysed. Whoever replaces a sound calls ForgetLoudness.
+        std::vector<SampleLoudness> loudness = {};
+        // Gain applied per Sample(index) whenever it plays, on top of volume
+        // and velocity. Missing entries are 1.
+        std::vector<float> trims = {};
+        // Derive trims from loudness when the kit is loaded, so every sound
+        // plays as loud as mainSound; see MatchKitLoudness.
+        bool matchLoudness = false;
+
+        // Sample index as used by step grids: 0 is mainSound, 1 is
+        // accentedSound and 2 onwards are samples. Null past the end.
+        const std::vector<int16_t> *Sample(int index) const;
+        size_t SampleCount() const { return 2 + samples.size(); }
+        float Trim(int index) const;
+        void ForgetLoudness(int index);
+        // Heap bytes the sounds and tables take.
+        size_t Bytes() const;
+    };
+
+    // Everything the offline renderer needs to produce a click track. The
+    // defaults match the realtime plugin: 4/4, accent on the first beat.
+    struct Song
+    {
+        std::string name;
+        int sampleRate = 44100;
+        int bars = 1;
+        // Beats per bar when meterMap is empty, as in the realtime plugin.
+        int timeSignature = 4;
+        std::vector<MeterChange> meterMap;
+        std::vector<TempoSegment> tempoMap;
+        std::vector<Marker> markers;
+        // One entry per beat of the bar; empty means accent on beat one.
+        std::vector<BeatAccent> pattern;
+        Kit kit;
+        double volume = 1.0;
+    };
+
+    // Throws std::invalid_argument unless numerator is positive, denominator
+    // is a power of two up to 64, and grouping is empty or a list of
+    // positive group sizes summing to numerator.
+    void ValidateMeter(int numerator, int denominator, const std::vector<int> &grouping);
+    // A bit per beat of the bar, set where a group starts; beat 0 always
+    // does. Bars longer than 64 beats must be ungrouped.
+    uint64_t GroupStartMask(int numerator, const std::vector<int> &grouping);
+
+    // Reinterprets little-endian bytes as 16-bit PCM, as the platform
+    // implementations do for the bytes sent from Dart.
+    std::vector<int16_t> BytesToPcm16(const std::vector<uint8_t> &bytes);
+}
+
+#endif // METRONOME_SONG_H_
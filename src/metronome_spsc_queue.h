@@ -0,0 +1,83 @@
+#ifndef METRONOME_SPSC_QUEUE_H_
+#define METRONOME_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace metronome
+{
+    // Bounded single-producer single-consumer queue. All storage is
+    // allocated up front, so TryPush and TryPop never allocate, lock or
+    // block and are safe to call from an audio callback. T must be cheap to
+    // copy; a full queue rejects the push rather than overwriting.
+    template <typename T>
+    class SpscQueue
+    {
+    public:
+        explicit SpscQueue(size_t capacity) : slots(RoundUp(capacity)), mask(slots.size() - 1) {}
+
+        SpscQueue(const SpscQueue &) = delete;
+        SpscQueue &operator=(const SpscQueue &) = delete;
+
+        bool TryPush(const T &value)
+        {
+            const size_t tail = this->tail.load(std::memory_order_relaxed);
+            if (tail - head.load(std::memory_order_acquire) == slots.size())
+            {
+                return false;
+            }
+            slots[tail & mask] = value;
+            this->tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool TryPop(T &value)
+        {
+            const size_t head = this->head.load(std::memory_order_relaxed);
+            if (head == tail.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            value = slots[head & mask];
+            this->head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Looks at the oldest element without removing it. Consumer only.
+        const T *Peek() const
+        {
+            const size_t head = this->head.load(std::memory_order_relaxed);
+            return head == tail.load(std::memory_order_acquire) ? nullptr : &slots[head & mask];
+        }
+
+        size_t Size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+        size_t Capacity() const { return slots.size(); }
+
+        // Slots a queue of capacity holds: capacity rounded up to a power
+        // of two.
+        static size_t RoundUp(size_t capacity)
+        {
+            if (capacity == 0)
+            {
+                throw std::invalid_argument("Queue capacity must be greater than 0");
+            }
+            size_t size = 1;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            return size;
+        }
+
+    private:
+        std::vector<T> slots;
+        const size_t mask;
+        // Kept on separate cache lines so producer and consumer don't contend.
+        alignas(64) std::atomic<size_t> head{0};
+        alignas(64) std::atomic<size_t> tail{0};
+    };
+}
+
+#endif // METRONOME_SPSC_QUEUE_H_
@@ -0,0 +1,437 @@
+#include "metronome_stream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "metronome_log.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    AudioStream::AudioStream(ClickEngine &engine, AudioSink &sink, SinkConfig config)
+        : engine(engine), sink(sink), config(config), now(&Clock::now)
+    {
+        this->config.sampleRate = engine.SampleRate();
+        this->config.channels = engine.Channels();
+        if (config.periodFrames <= 0 || config.periods < 2)
+        {
+            throw std::invalid_argument("A stream needs at least two periods of one frame");
+        }
+    }
+
+    AudioStream::~AudioStream()
+    {
+        Stop();
+    }
+
+    void AudioStream::Open()
+    {
+        if (open)
+        {
+            return;
+        }
+        const SinkConfig granted = sink.Open(config);
+        if (granted.sampleRate != config.sampleRate)
+        {
+            sink.Close();
+            throw std::runtime_error("Sink does not support " + std::to_string(config.sampleRate) + " Hz");
+        }
+        if (granted.channels != config.channels)
+        {
+            sink.Close();
+            throw std::runtime_error("Sink does not support " + std::to_string(config.channels) + " channels");
+        }
+        config = granted;
+        open = true;
+        playedPosition.store(Position(), std::memory_order_release);
+        aliveAt = now();
+        alivePosition = Position();
+    }
+
+    void AudioStream::AddMirror(MirrorStream &mirror)
+    {
+        if (mirror.Config().sampleRate != config.sampleRate || mirror.Config().channels != config.channels)
+        {
+            throw std::invalid_argument("A mirror must play at the engine's sample rate and channels");
+        }
+        mirrors.push_back(&mirror);
+    }
+
+    void AudioStream::SetRenderAhead(RenderAhead &ahead)
+    {
+        if (&ahead.Engine() != &engine)
+        {
+            throw std::invalid_argument("Rendering ahead must be for the stream's engine");
+        }
+        this->ahead = &ahead;
+    }
+
+    void AudioStream::SetTransportPublisher(TransportPublisher &publisher)
+    {
+        transport = &publisher;
+    }
+
+    int64_t AudioStream::Position() const
+    {
+        return ahead ? ahead->Position() : engine.Position();
+    }
+
+    void AudioStream::Skip(size_t frames)
+    {
+        if (ahead)
+        {
+            ahead->Skip(frames);
+        }
+        else
+        {
+            engine.Skip(frames);
+        }
+        for (MirrorStream *mirror : mirrors)
+        {
+            mirror->FeedSilence(frames);
+        }
+    }
+
+    void AudioStream::SetClock(std::function<Clock::time_point()> now)
+    {
+        this->now = std::move(now);
+    }
+
+    void AudioStream::RestartStalled()
+    {
+        stalled.store(true, std::memory_order_release);
+    }
+
+    void AudioStream::Start()
+    {
+        Stop();
+        Open();
+        // Nothing consumed ticks while stopped; drop stale ones.
+        TickEvent tick;
+        while (engine.PopTick(tick))
+        {
+        }
+        hasPendingTick = false;
+        failing = false;
+        stalled.store(false, std::memory_order_relaxed);
+        padding = 0;
+        unheardFrom.store(0, std::memory_order_relaxed);
+        unheardTo.store(0, std::memory_order_release);
+        running.store(true, std::memory_order_release);
+        if (ahead)
+        {
+            ahead->Start();
+        }
+        for (MirrorStream *mirror : mirrors)
+        {
+            mirror->Start();
+        }
+        thread = std::thread(&AudioStream::Run, this);
+    }
+
+    void AudioStream::Stop()
+    {
+        running.store(false, std::memory_order_release);
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        if (ahead)
+        {
+            ahead->Stop();
+        }
+        for (MirrorStream *mirror : mirrors)
+        {
+            mirror->Stop();
+        }
+        if (transport)
+        {
+            transport->Publish(engine.Clock(), PlayedPosition(), now(), false);
+        }
+        if (open)
+        {
+            sink.Drop();
+            sink.Close();
+            open = false;
+        }
+        failing = false;
+    }
+
+    void AudioStream::Run()
+    {
+        METRONOME_TRACE_THREAD_NAME("stream");
+        // Long enough that a healthy device always wakes us first.
+        const int timeoutMs = std::max(10, 2 * config.periodFrames * 1000 / config.sampleRate);
+        // Between attempts to reopen a lost device; backs off to 500 ms.
+        int retryMs = 10;
+        try
+        {
+            while (running.load(std::memory_order_acquire))
+            {
+                if (Pump(timeoutMs))
+                {
+                    retryMs = 10;
+                    continue;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(retryMs));
+                retryMs = std::min(500, retryMs * 2);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            Log(LogLevel::Error, "stream", "Playback stopped: %s", e.what());
+        }
+        running.store(false, std::memory_order_release);
+    }
+
+    bool AudioStream::Pump(int timeoutMs)
+    {
+        if (failing)
+        {
+            // A stall reported meanwhile is this same outage.
+            stalled.store(false, std::memory_order_relaxed);
+            return Reopen();
+        }
+        if (stalled.exchange(false, std::memory_order_acq_rel))
+        {
+            Log(LogLevel::Warning, "stream", "Output stalled at frame %lld; reopening",
+                static_cast<long long>(alivePosition));
+            stalls.fetch_add(1, std::memory_order_relaxed);
+            return Failover();
+        }
+        if (sink.DeviceChanged())
+        {
+            Log(LogLevel::Info, "stream", "Output device changed; moving to the new one");
+            return Failover();
+        }
+        size_t writable = 0;
+        SinkStatus status = sink.Wait(timeoutMs, writable);
+        if (status == SinkStatus::Ok)
+        {
+            const size_t queued = config.BufferFrames() - std::min(writable, config.BufferFrames());
+            const Clock::time_point woke = now();
+            const int64_t played = Position() - static_cast<int64_t>(queued);
+            playedPosition.store(played, std::memory_order_release);
+            if (transport)
+            {
+                transport->Publish(engine.Clock(), played, woke, true);
+            }
+            // A stalled device still wakes us; only progress counts.
+            if (played != alivePosition)
+            {
+                aliveAt = woke;
+                alivePosition = played;
+            }
+            for (MirrorStream *mirror : mirrors)
+            {
+                mirror->MarkOutput(queued, woke);
+            }
+            status = Fill(writable);
+        }
+        if (status == SinkStatus::Xrun)
+        {
+            status = Recover();
+            // Refill at once: the device restarts when its buffer is full.
+            if (status == SinkStatus::Ok)
+            {
+                status = sink.Wait(0, writable);
+            }
+            if (status == SinkStatus::Ok)
+            {
+                status = Fill(writable);
+            }
+        }
+        if (status == SinkStatus::Lost)
+        {
+            Log(LogLevel::Warning, "stream", "Output device lost at frame %lld; reopening",
+                static_cast<long long>(alivePosition));
+            return Failover();
+        }
+        return true;
+    }
+
+    bool AudioStream::Failover()
+    {
+        METRONOME_TRACE_INSTANT("device_lost", alivePosition);
+        failing = true;
+        failedAt = now();
+        // Everything past the last confirmed frame may not have been heard.
+        unheardFrom.store(alivePosition, std::memory_order_relaxed);
+        unheardTo.store(Position(), std::memory_order_release);
+        sink.Drop();
+        sink.Close();
+        open = false;
+        return Reopen();
+    }
+
+    bool AudioStream::Reopen()
+    {
+        // Open() resets these for a fresh start.
+        const Clock::time_point lastAlive = aliveAt;
+        const int64_t lastPosition = alivePosition;
+        try
+        {
+            Open();
+        }
+        catch (const std::runtime_error &e)
+        {
+            Log(LogLevel::Debug, "stream", "Reopening the output failed: %s", e.what());
+            return false;
+        }
+        failing = false;
+
+        // Pick up the timeline where it would be had the click kept playing
+        // since the old device last reported progress.
+        const Clock::time_point reopened = now();
+        const int64_t resumeAt = lastPosition + static_cast<int64_t>(std::llround(
+                                                    std::chrono::duration<double>(reopened - lastAlive).count() * config.sampleRate));
+        if (resumeAt > Position())
+        {
+            Skip(static_cast<size_t>(resumeAt - Position()));
+        }
+        else
+        {
+            // The engine ran ahead into the old device's buffer; hold it back
+            // with silence where those frames would have played.
+            padding = static_cast<size_t>(Position() - resumeAt);
+        }
+        discarded = 0;
+        alivePosition = Position() - static_cast<int64_t>(padding);
+        aliveAt = reopened;
+        playedPosition.store(alivePosition, std::memory_order_release);
+
+        const int64_t failoverUs = std::chrono::duration_cast<std::chrono::microseconds>(reopened - failedAt).count();
+        failovers.fetch_add(1, std::memory_order_relaxed);
+        lastFailoverUs.store(failoverUs, std::memory_order_relaxed);
+        if (failoverUs > maxFailoverUs.load(std::memory_order_relaxed))
+        {
+            maxFailoverUs.store(failoverUs, std::memory_order_relaxed);
+        }
+        METRONOME_TRACE_INSTANT("device_reopened", failoverUs);
+        Log(LogLevel::Info, "stream", "Output reopened after %.1f ms; resuming at frame %lld", failoverUs / 1000.0,
+            static_cast<long long>(Position()));
+
+        // Start the new device straight away rather than a timeout later.
+        size_t writable = 0;
+        SinkStatus status = sink.Wait(0, writable);
+        if (status == SinkStatus::Ok)
+        {
+            status = Fill(writable);
+        }
+        if (status == SinkStatus::Lost)
+        {
+            // Gone again already; the next attempt starts from scratch.
+            sink.Close();
+            open = false;
+            failing = true;
+            return false;
+        }
+        return true;
+    }
+
+    SinkStatus AudioStream::Recover()
+    {
+        int64_t lost = 0;
+        const SinkStatus status = sink.Recover(lost);
+        if (status != SinkStatus::Ok)
+        {
+            return status;
+        }
+        METRONOME_TRACE_INSTANT("xrun", lost);
+        Log(LogLevel::Warning, "stream", "Xrun at frame %lld; skipped %lld frames",
+            static_cast<long long>(Position()), static_cast<long long>(lost));
+        // Frames rendered but refused by the device were never heard; the
+        // engine is already that far along.
+        const size_t skipped = static_cast<size_t>(std::max<int64_t>(0, lost - static_cast<int64_t>(discarded)));
+        Skip(skipped);
+        discarded = 0;
+        xruns.fetch_add(1, std::memory_order_relaxed);
+        lostFrames.fetch_add(lost, std::memory_order_relaxed);
+        playedPosition.store(Position(), std::memory_order_release);
+        return SinkStatus::Ok;
+    }
+
+    SinkStatus AudioStream::Fill(size_t writable)
+    {
+        const size_t period = static_cast<size_t>(config.periodFrames);
+        for (; writable >= period; writable -= period)
+        {
+            size_t remaining = period;
+            while (remaining > 0)
+            {
+                int16_t *area = nullptr;
+                size_t granted = 0;
+                SinkStatus status = sink.Begin(remaining, area, granted);
+                if (status != SinkStatus::Ok || granted == 0)
+                {
+                    return status;
+                }
+                const size_t silent = std::min(padding, granted);
+                const size_t channels = static_cast<size_t>(config.channels);
+                std::fill(area, area + silent * channels, int16_t(0));
+                padding -= silent;
+                if (ahead)
+                {
+                    ahead->Read(area + silent * channels, granted - silent);
+                }
+                else
+                {
+                    engine.Render(area + silent * channels, granted - silent);
+                }
+                for (MirrorStream *mirror : mirrors)
+                {
+                    mirror->Feed(area, granted);
+                }
+                METRONOME_TRACE_BEGIN("sink_submit");
+                status = sink.Commit(granted);
+                METRONOME_TRACE_END("sink_submit");
+                if (status != SinkStatus::Ok)
+                {
+                    discarded += granted;
+                    return status;
+                }
+                remaining -= granted;
+            }
+            periods.fetch_add(1, std::memory_order_relaxed);
+        }
+        return SinkStatus::Ok;
+    }
+
+    bool AudioStream::PopPlayedTick(TickEvent &tick)
+    {
+        do
+        {
+            if (!hasPendingTick && !engine.PopTick(pendingTick))
+            {
+                return false;
+            }
+            hasPendingTick = false;
+        } while (pendingTick.frame < unheardTo.load(std::memory_order_acquire) &&
+                 pendingTick.frame >= unheardFrom.load(std::memory_order_relaxed));
+        if (pendingTick.frame > PlayedPosition())
+        {
+            hasPendingTick = true;
+            return false;
+        }
+        hasPendingTick = false;
+        tick = pendingTick;
+        return true;
+    }
+
+    StreamStats AudioStream::Stats() const
+    {
+        StreamStats stats;
+        stats.periods = periods.load(std::memory_order_relaxed);
+        stats.xruns = xruns.load(std::memory_order_relaxed);
+        stats.lostFrames = lostFrames.load(std::memory_order_relaxed);
+        stats.failovers = failovers.load(std::memory_order_relaxed);
+        stats.lastFailoverMs = lastFailoverUs.load(std::memory_order_relaxed) / 1000.0;
+        stats.maxFailoverMs = maxFailoverUs.load(std::memory_order_relaxed) / 1000.0;
+        stats.stalls = stalls.load(std::memory_order_relaxed);
+        return stats;
+    }
+}
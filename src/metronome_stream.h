@@ -0,0 +1,165 @@
+#ifndef METRONOME_STREAM_H_
+#define METRONOME_STREAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "metronome_engine.h"
+#include "metronome_mirror_stream.h"
+#include "metronome_render_ahead.h"
+#include "metronome_sink.h"
+#include "metronome_transport_publisher.h"
+
+namespace metronome
+{
+    struct StreamStats
+    {
+        uint64_t periods = 0;
+        uint64_t xruns = 0;
+        // Frames the engine skipped to stay on the beat grid after xruns.
+        int64_t lostFrames = 0;
+        // Times the device was lost or replaced and the sink reopened.
+        uint64_t failovers = 0;
+        // From noticing the loss to audio flowing again, in milliseconds.
+        double lastFailoverMs = 0.0;
+        double maxFailoverMs = 0.0;
+        // Failovers asked for by RestartStalled because the device stopped
+        // playing without an error; counted in failovers too.
+        uint64_t stalls = 0;
+    };
+
+    // Drives a ClickEngine into an AudioSink, one period at a time, on a
+    // thread of its own. After an xrun the engine skips the frames the
+    // device was stopped for, so clicks stay where they would have been had
+    // playback never stalled.
+    //
+    // When the device is lost, or the sink reports that its device changed,
+    // the stream closes the sink and keeps reopening it in the background.
+    // Playback then resumes where the timeline would be had the click never
+    // stopped, on whatever device the sink opens.
+    class AudioStream
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // Both must outlive the stream. config.sampleRate is taken from the
+        // engine.
+        AudioStream(ClickEngine &engine, AudioSink &sink, SinkConfig config = SinkConfig());
+        ~AudioStream();
+
+        AudioStream(const AudioStream &) = delete;
+        AudioStream &operator=(const AudioStream &) = delete;
+
+        // Opens the sink and starts the stream thread, dropping ticks left
+        // over from before. Throws std::runtime_error if the sink can't be
+        // opened.
+        void Start();
+        // Joins the stream thread and closes the sink.
+        void Stop();
+        // False once stopped, or after the stream thread failed. Stays true
+        // while a lost device is being reopened.
+        bool Running() const { return running.load(std::memory_order_acquire); }
+
+        // Opens the sink without starting the thread, for callers that drive
+        // Pump themselves. Start() calls it when needed.
+        void Open();
+        // One pass of the stream loop: waits for the sink and fills every
+        // free period, reopening it first if it was lost. Returns false
+        // while the device is gone and could not be reopened yet.
+        bool Pump(int timeoutMs);
+        // Also plays everything the stream plays on mirror, which must
+        // outlive the stream; call before Start. Start and Stop start and
+        // stop attached mirrors too.
+        void AddMirror(MirrorStream &mirror);
+        // Copies the engine's output out of ahead, which renders it on a
+        // thread of its own, instead of rendering into the device buffer;
+        // ahead must be for this stream's engine and outlive the stream.
+        // Call before Start, which starts and stops it too. Callers driving
+        // Pump themselves pump ahead as well.
+        void SetRenderAhead(RenderAhead &ahead);
+        // Publishes where the output is to publisher every period, from the
+        // stream thread, and that it stopped on Stop; publisher must be for
+        // this stream's engine and outlive the stream. Call before Start.
+        void SetTransportPublisher(TransportPublisher &publisher);
+        // Reopens the sink at the stream thread's next pass, as if the
+        // device had been lost, resuming where the timeline would be had it
+        // kept playing since it last made progress. For a StallWatchdog;
+        // safe to call from any thread.
+        void RestartStalled();
+        // Replaces the clock failovers and mirror marks are timed with.
+        // Tests drive it from a simulated device; call it before Start.
+        void SetClock(std::function<Clock::time_point()> now);
+
+        // The configuration the sink granted.
+        const SinkConfig &Config() const { return config; }
+        // The engine frame at the device output right now, give or take a
+        // period.
+        int64_t PlayedPosition() const { return playedPosition.load(std::memory_order_acquire); }
+        // Ticks whose click has reached the device output, oldest first.
+        // Single consumer; replaces ClickEngine::PopTick for the engine's
+        // owner while a stream runs.
+        bool PopPlayedTick(TickEvent &tick);
+        StreamStats Stats() const;
+
+    private:
+        void Run();
+        SinkStatus Fill(size_t writable);
+        SinkStatus Recover();
+        // Closes the lost sink and tries to reopen it once.
+        bool Failover();
+        bool Reopen();
+
+        // The engine frame the device is given next.
+        int64_t Position() const;
+        // Moves the timeline past frames the device never played; mirrors
+        // stay silent for as long.
+        void Skip(size_t frames);
+
+        ClickEngine &engine;
+        AudioSink &sink;
+        SinkConfig config;
+        std::vector<MirrorStream *> mirrors;
+        RenderAhead *ahead = nullptr;
+        TransportPublisher *transport = nullptr;
+        std::atomic<bool> running{false};
+        bool open = false;
+        std::thread thread;
+        std::atomic<int64_t> playedPosition{0};
+        TickEvent pendingTick;
+        bool hasPendingTick = false;
+        // Frames rendered into the sink but refused by Commit since the last
+        // xrun recovery.
+        size_t discarded = 0;
+
+        std::function<Clock::time_point()> now;
+        // When the device last played further, and the frame it was
+        // playing then; a failover resumes the timeline from there.
+        Clock::time_point aliveAt;
+        int64_t alivePosition = 0;
+        bool failing = false;
+        std::atomic<bool> stalled{false};
+        Clock::time_point failedAt;
+        // Silent frames to write before the engine's, so a reopened device
+        // starts in step with the timeline.
+        size_t padding = 0;
+        // Ticks rendered in [unheardFrom, unheardTo) went down with the
+        // device and are never reported.
+        std::atomic<int64_t> unheardFrom{0};
+        std::atomic<int64_t> unheardTo{0};
+
+        std::atomic<uint64_t> periods{0};
+        std::atomic<uint64_t> xruns{0};
+        std::atomic<int64_t> lostFrames{0};
+        std::atomic<uint64_t> failovers{0};
+        std::atomic<uint64_t> stalls{0};
+        std::atomic<int64_t> lastFailoverUs{0};
+        std::atomic<int64_t> maxFailoverUs{0};
+    };
+}
+
+#endif // METRONOME_STREAM_H_
@@ -0,0 +1,202 @@
+#include "metronome_timeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace metronome
+{
+    namespace
+    {
+        BeatAccent AccentFor(const Song &song, const MeterChange &meter, uint64_t groupStarts, int beat)
+        {
+            const bool groupStart = beat < 64 && (groupStarts >> beat & 1) != 0;
+            if (meter.feltInGroups && !groupStart)
+            {
+                return BeatAccent::Rest;
+            }
+            if (meter.numerator < 2)
+            {
+                return BeatAccent::Normal;
+            }
+            if (!song.pattern.empty())
+            {
+                return song.pattern[beat % song.pattern.size()];
+            }
+            if (beat == 0)
+            {
+                return BeatAccent::Accented;
+            }
+            return groupStart ? BeatAccent::Group : BeatAccent::Normal;
+        }
+
+        // Integrates the tempo steps; positions must be queried in order.
+        class TempoCursor
+        {
+        public:
+            explicit TempoCursor(const std::vector<BeatGrid::TempoStep> &steps) : steps(steps) {}
+
+            double SecondsAt(double quarter)
+            {
+                while (step + 1 < steps.size() && steps[step + 1].quarter <= quarter)
+                {
+                    seconds += (steps[step + 1].quarter - position) * 60.0 / steps[step].bpm;
+                    position = steps[step + 1].quarter;
+                    step++;
+                }
+                return seconds + (quarter - position) * 60.0 / steps[step].bpm;
+            }
+
+        private:
+            const std::vector<BeatGrid::TempoStep> &steps;
+            size_t step = 0;
+            double position = 0.0;
+            double seconds = 0.0;
+        };
+    }
+
+    BeatGrid BuildBeatGrid(const Song &song)
+    {
+        if (song.bars <= 0)
+        {
+            throw std::invalid_argument("bars must be greater than 0");
+        }
+
+        BeatGrid grid;
+        grid.meters = song.meterMap;
+        if (grid.meters.empty())
+        {
+            grid.meters.push_back(MeterChange{0, std::max(1, song.timeSignature), 4});
+        }
+        std::stable_sort(grid.meters.begin(), grid.meters.end(),
+                         [](const MeterChange &a, const MeterChange &b)
+                         { return a.startBar < b.startBar; });
+        for (const MeterChange &meter : grid.meters)
+        {
+            ValidateMeter(meter.numerator, meter.denominator, meter.grouping);
+        }
+
+        std::vector<double> beatQuarters(song.bars);
+        grid.barStarts.resize(static_cast<size_t>(song.bars) + 1, 0.0);
+        size_t meterIndex = 0;
+        for (int bar = 0; bar < song.bars; bar++)
+        {
+            while (meterIndex + 1 < grid.meters.size() && grid.meters[meterIndex + 1].startBar <= bar)
+            {
+                meterIndex++;
+            }
+            const MeterChange &meter = grid.meters[meterIndex];
+            const uint64_t groupStarts = GroupStartMask(meter.numerator, meter.grouping);
+            beatQuarters[bar] = 4.0 / meter.denominator;
+            for (int beat = 0; beat < meter.numerator; beat++)
+            {
+                BeatGrid::Beat entry;
+                entry.quarter = grid.barStarts[bar] + beat * beatQuarters[bar];
+                entry.bar = bar;
+                entry.beat = static_cast<int16_t>(beat);
+                entry.accent = AccentFor(song, meter, groupStarts, beat);
+                grid.beats.push_back(entry);
+            }
+            grid.barStarts[bar + 1] = grid.barStarts[bar] + meter.numerator * beatQuarters[bar];
+        }
+        const double end = grid.barStarts.back();
+
+        auto quarterAt = [&](int bar, double beatOffset)
+        {
+            bar = std::clamp(bar, 0, song.bars);
+            return grid.barStarts[bar] + beatOffset * beatQuarters[std::min(bar, song.bars - 1)];
+        };
+
+        std::vector<std::pair<double, TempoSegment>> segments;
+        for (const TempoSegment &segment : song.tempoMap)
+        {
+            if (segment.bpm <= 0.0 || segment.endBpm < 0.0)
+            {
+                throw std::invalid_argument("BPM must be greater than 0");
+            }
+            segments.emplace_back(quarterAt(segment.startBar, segment.beatOffset), segment);
+        }
+        if (segments.empty())
+        {
+            segments.emplace_back(0.0, TempoSegment{});
+        }
+        std::stable_sort(segments.begin(), segments.end(),
+                         [](const auto &a, const auto &b)
+                         { return a.first < b.first; });
+
+        for (size_t s = 0; s < segments.size(); s++)
+        {
+            // The first segment also covers anything before it.
+            const double from = s == 0 ? 0.0 : segments[s].first;
+            const double to = s + 1 < segments.size() ? segments[s + 1].first : end;
+            const TempoSegment &segment = segments[s].second;
+            if (to <= from && !grid.tempo.empty())
+            {
+                continue;
+            }
+
+            if (segment.endBpm <= 0.0 || segment.endBpm == segment.bpm)
+            {
+                grid.tempo.push_back(BeatGrid::TempoStep{from, segment.bpm});
+                continue;
+            }
+
+            std::vector<double> steps{from};
+            auto beat = std::upper_bound(grid.beats.begin(), grid.beats.end(), from,
+                                         [](double quarter, const BeatGrid::Beat &b)
+                                         { return quarter < b.quarter; });
+            for (; beat != grid.beats.end() && beat->quarter < to; ++beat)
+            {
+                steps.push_back(beat->quarter);
+            }
+            for (size_t k = 0; k < steps.size(); k++)
+            {
+                const double bpm = segment.bpm + (segment.endBpm - segment.bpm) * k / steps.size();
+                grid.tempo.push_back(BeatGrid::TempoStep{steps[k], bpm});
+            }
+        }
+
+        for (const Marker &marker : song.markers)
+        {
+            grid.markers.push_back(BeatGrid::GridMarker{quarterAt(marker.bar, marker.beatOffset), marker.text});
+        }
+        std::stable_sort(grid.markers.begin(), grid.markers.end(),
+                         [](const BeatGrid::GridMarker &a, const BeatGrid::GridMarker &b)
+                         { return a.quarter < b.quarter; });
+
+        return grid;
+    }
+
+    Timeline CompileTimeline(const Song &song)
+    {
+        if (song.sampleRate <= 0)
+        {
+            throw std::invalid_argument("sampleRate must be greater than 0");
+        }
+
+        const BeatGrid grid = BuildBeatGrid(song);
+        Timeline timeline;
+        timeline.sampleRate = song.sampleRate;
+        timeline.events.reserve(grid.beats.size());
+
+        TempoCursor cursor(grid.tempo);
+        for (const BeatGrid::Beat &beat : grid.beats)
+        {
+            const int64_t frame = std::llround(cursor.SecondsAt(beat.quarter) * song.sampleRate);
+            if (beat.accent != BeatAccent::Rest)
+            {
+                timeline.events.push_back(ClickEvent{frame, beat.bar, beat.beat, beat.accent});
+            }
+        }
+        timeline.length = std::llround(cursor.SecondsAt(grid.barStarts.back()) * song.sampleRate);
+
+        TempoCursor markerCursor(grid.tempo);
+        for (const BeatGrid::GridMarker &marker : grid.markers)
+        {
+            timeline.markers.push_back(TimelineMarker{
+                std::llround(markerCursor.SecondsAt(marker.quarter) * song.sampleRate), marker.text});
+        }
+
+        return timeline;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef METRONOME_TIMELINE_H_
+#define METRONOME_TIMELINE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "metronome_song.h"
+
+namespace metronome
+{
+    struct ClickEvent
+    {
+        int64_t frame = 0;
+        int32_t bar = 0;
+        int16_t beat = 0;
+        BeatAccent accent = BeatAccent::Normal;
+    };
+
+    struct TimelineMarker
+    {
+        int64_t frame = 0;
+        std::string text;
+    };
+
+    // A song compiled to sample-accurate click positions. Beat boundaries are
+    // accumulated in double precision and rounded per event, so long songs do
+    // not drift the way summing truncated beat lengths would.
+    struct Timeline
+    {
+        int sampleRate = 44100;
+        int64_t length = 0;
+        std::vector<ClickEvent> events;
+        std::vector<TimelineMarker> markers;
+    };
+
+    // The song laid out in musical time, before tempo is applied. Positions
+    // are in quarter notes from the start of the song; rests are kept so
+    // that the grid can also be written out as notation.
+    struct BeatGrid
+    {
+        struct Beat
+        {
+            double quarter = 0.0;
+            int32_t bar = 0;
+            int16_t beat = 0;
+            BeatAccent accent = BeatAccent::Normal;
+        };
+
+        // Tempo is constant from quarter until the next step.
+        struct TempoStep
+        {
+            double quarter = 0.0;
+            double bpm = 120.0;
+        };
+
+        struct GridMarker
+        {
+            double quarter = 0.0;
+            std::string text;
+        };
+
+        std::vector<Beat> beats;
+        std::vector<TempoStep> tempo;
+        std::vector<GridMarker> markers;
+        // Start of every bar, plus the end of the song as the last entry.
+        std::vector<double> barStarts;
+        std::vector<MeterChange> meters;
+    };
+
+    BeatGrid BuildBeatGrid(const Song &song);
+    Timeline CompileTimeline(const Song &song);
+}
+
+#endif // METRONOME_TIMELINE_H_
@@ -0,0 +1,361 @@
+#include "metronome_trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace metronome
+{
+    namespace
+    {
+        constexpr size_t kTraceCapacity = 8192;
+        constexpr size_t kMaxTraceBuffers = 16;
+
+        // Every field is a relaxed atomic so that a concurrent snapshot can
+        // never observe a torn value, only a stale one, which it discards.
+        struct TraceSlot
+        {
+            std::atomic<uint64_t> timestamp{0};
+            std::atomic<const char *> name{nullptr};
+            std::atomic<int64_t> value{0};
+            std::atomic<TracePhase> phase{TracePhase::Instant};
+        };
+
+        struct TraceBuffer
+        {
+            std::array<TraceSlot, kTraceCapacity> slots;
+            std::atomic<uint64_t> head{0};
+            std::atomic<bool> inUse{true};
+            uint32_t threadId = 0;
+            std::string threadName;
+        };
+
+        struct TraceEntry
+        {
+            uint64_t timestamp;
+            const char *name;
+            int64_t value;
+            TracePhase phase;
+        };
+
+        struct ThreadSnapshot
+        {
+            uint32_t threadId;
+            std::string threadName;
+            std::vector<TraceEntry> entries;
+        };
+
+        class TraceRegistry
+        {
+        public:
+            static TraceRegistry &Instance()
+            {
+                static TraceRegistry registry;
+                return registry;
+            }
+
+            // Buffers of exited threads are kept so their records can still be
+            // dumped, and recycled once kMaxTraceBuffers exist, so a thread
+            // started for every play does not grow memory without bound.
+            TraceBuffer *Acquire()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                TraceBuffer *buffer = nullptr;
+                for (auto &candidate : buffers)
+                {
+                    const bool empty = candidate->head.load() == 0;
+                    if (!candidate->inUse.load() && (empty || buffers.size() >= kMaxTraceBuffers))
+                    {
+                        buffer = candidate.get();
+                        buffer->head.store(0);
+                        buffer->threadName.clear();
+                        buffer->inUse.store(true);
+                        break;
+                    }
+                }
+                if (buffer == nullptr)
+                {
+                    buffers.push_back(std::make_unique<TraceBuffer>());
+                    buffer = buffers.back().get();
+                }
+                buffer->threadId = nextThreadId++;
+                return buffer;
+            }
+
+            void SetThreadName(TraceBuffer *buffer, const char *name)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                buffer->threadName = name;
+            }
+
+            std::vector<ThreadSnapshot> Snapshot()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::vector<ThreadSnapshot> snapshots;
+                for (auto &buffer : buffers)
+                {
+                    ThreadSnapshot snapshot{buffer->threadId, buffer->threadName, {}};
+                    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+                    const uint64_t first = head > kTraceCapacity ? head - kTraceCapacity : 0;
+                    for (uint64_t i = first; i < head; i++)
+                    {
+                        const TraceSlot &slot = buffer->slots[i % kTraceCapacity];
+                        snapshot.entries.push_back(TraceEntry{
+                            slot.timestamp.load(std::memory_order_relaxed),
+                            slot.name.load(std::memory_order_relaxed),
+                            slot.value.load(std::memory_order_relaxed),
+                            slot.phase.load(std::memory_order_relaxed)});
+                    }
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    const uint64_t after = buffer->head.load(std::memory_order_acquire);
+                    // The writer may be part way through record after, which
+                    // overwrites the slot of record after - kTraceCapacity.
+                    const uint64_t overwritten = after + 1 > kTraceCapacity ? after + 1 - kTraceCapacity : 0;
+                    if (overwritten > first)
+                    {
+                        snapshot.entries.erase(snapshot.entries.begin(),
+                                               snapshot.entries.begin() + std::min<uint64_t>(overwritten - first, snapshot.entries.size()));
+                    }
+                    snapshots.push_back(std::move(snapshot));
+                }
+                return snapshots;
+            }
+
+            void Clear()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &buffer : buffers)
+                {
+                    buffer->head.store(0);
+                }
+            }
+
+        private:
+            std::mutex mutex;
+            std::vector<std::unique_ptr<TraceBuffer>> buffers;
+            uint32_t nextThreadId = 1;
+        };
+
+        struct ThreadTrace
+        {
+            TraceBuffer *buffer = nullptr;
+
+            ~ThreadTrace()
+            {
+                if (buffer != nullptr)
+                {
+                    buffer->inUse.store(false);
+                }
+            }
+
+            TraceBuffer *Get()
+            {
+                if (buffer == nullptr)
+                {
+                    buffer = TraceRegistry::Instance().Acquire();
+                }
+                return buffer;
+            }
+        };
+
+        thread_local ThreadTrace threadTrace;
+
+        uint64_t NowNanoseconds()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+        }
+
+        void WriteJsonString(std::ostream &out, const std::string &text)
+        {
+            out << '"';
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out << '\\' << c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    out << ' ';
+                }
+                else
+                {
+                    out << c;
+                }
+            }
+            out << '"';
+        }
+
+        class ProtoWriter
+        {
+        public:
+            void VarInt(uint64_t value)
+            {
+                while (value >= 0x80)
+                {
+                    bytes.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                    value >>= 7;
+                }
+                bytes.push_back(static_cast<char>(value));
+            }
+
+            void Field(uint32_t field, uint64_t value)
+            {
+                VarInt(field << 3);
+                VarInt(value);
+            }
+
+            void Bytes(uint32_t field, const std::string &value)
+            {
+                VarInt((field << 3) | 2);
+                VarInt(value.size());
+                bytes += value;
+            }
+
+            std::string bytes;
+        };
+    }
+
+    void TraceRecord(TracePhase phase, const char *name, int64_t value)
+    {
+        TraceBuffer *buffer = threadTrace.Get();
+        const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+        TraceSlot &slot = buffer->slots[head % kTraceCapacity];
+        // A snapshot that sees any of these stores also sees head, and so
+        // knows this slot may be half written.
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp.store(NowNanoseconds(), std::memory_order_relaxed);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.phase.store(phase, std::memory_order_relaxed);
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+
+    void TraceSetThreadName(const char *name)
+    {
+        TraceRegistry::Instance().SetThreadName(threadTrace.Get(), name);
+    }
+
+    void WriteChromeTrace(std::ostream &out)
+    {
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (const ThreadSnapshot &thread : TraceRegistry::Instance().Snapshot())
+        {
+            if (!thread.threadName.empty())
+            {
+                out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.threadId
+                    << ",\"args\":{\"name\":";
+                WriteJsonString(out, thread.threadName);
+                out << "}}";
+                first = false;
+            }
+            for (const TraceEntry &entry : thread.entries)
+            {
+                const char *phase = entry.phase == TracePhase::Begin ? "B" : entry.phase == TracePhase::End ? "E"
+                                                                                                             : "i";
+                out << (first ? "" : ",") << "\n{\"name\":";
+                WriteJsonString(out, entry.name ? entry.name : "");
+                out << ",\"ph\":\"" << phase << "\",\"ts\":" << entry.timestamp / 1000 << '.'
+                    << (entry.timestamp % 1000) / 100 << (entry.timestamp % 100) / 10 << entry.timestamp % 10
+                    << ",\"pid\":1,\"tid\":" << thread.threadId;
+                if (entry.phase == TracePhase::Instant)
+                {
+                    out << ",\"s\":\"t\",\"args\":{\"value\":" << entry.value << "}";
+                }
+                out << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    void WritePerfettoTrace(std::ostream &out)
+    {
+        // Field numbers from perfetto/protos/perfetto/trace/*.proto.
+        constexpr uint32_t kTracePacket = 1;
+        constexpr uint32_t kPacketTimestamp = 8;
+        constexpr uint32_t kPacketSequenceId = 10;
+        constexpr uint32_t kPacketTrackEvent = 11;
+        constexpr uint32_t kPacketTrackDescriptor = 60;
+        constexpr uint32_t kDescriptorUuid = 1;
+        constexpr uint32_t kDescriptorName = 2;
+        constexpr uint32_t kDescriptorThread = 4;
+        constexpr uint32_t kThreadPid = 1;
+        constexpr uint32_t kThreadTid = 2;
+        constexpr uint32_t kThreadName = 5;
+        constexpr uint32_t kEventDebugAnnotations = 4;
+        constexpr uint32_t kEventType = 9;
+        constexpr uint32_t kEventTrackUuid = 11;
+        constexpr uint32_t kEventName = 23;
+        constexpr uint32_t kAnnotationIntValue = 4;
+        constexpr uint32_t kAnnotationName = 10;
+        constexpr uint32_t kSequenceId = 1;
+
+        auto writePacket = [&](const ProtoWriter &packet)
+        {
+            ProtoWriter wrapper;
+            wrapper.Bytes(kTracePacket, packet.bytes);
+            out.write(wrapper.bytes.data(), static_cast<std::streamsize>(wrapper.bytes.size()));
+        };
+
+        for (const ThreadSnapshot &thread : TraceRegistry::Instance().Snapshot())
+        {
+            const uint64_t uuid = 0x6D6574726F000000ull | thread.threadId;
+            ProtoWriter threadDescriptor;
+            threadDescriptor.Field(kThreadPid, 1);
+            threadDescriptor.Field(kThreadTid, thread.threadId);
+            if (!thread.threadName.empty())
+            {
+                threadDescriptor.Bytes(kThreadName, thread.threadName);
+            }
+            ProtoWriter descriptor;
+            descriptor.Field(kDescriptorUuid, uuid);
+            if (!thread.threadName.empty())
+            {
+                descriptor.Bytes(kDescriptorName, thread.threadName);
+            }
+            descriptor.Bytes(kDescriptorThread, threadDescriptor.bytes);
+            ProtoWriter packet;
+            packet.Field(kPacketSequenceId, kSequenceId);
+            packet.Bytes(kPacketTrackDescriptor, descriptor.bytes);
+            writePacket(packet);
+
+            for (const TraceEntry &entry : thread.entries)
+            {
+                ProtoWriter event;
+                event.Field(kEventType, entry.phase == TracePhase::Begin ? 1 : entry.phase == TracePhase::End ? 2
+                                                                                                             : 3);
+                event.Field(kEventTrackUuid, uuid);
+                if (entry.phase != TracePhase::End && entry.name != nullptr)
+                {
+                    event.Bytes(kEventName, entry.name);
+                }
+                if (entry.phase == TracePhase::Instant)
+                {
+                    ProtoWriter annotation;
+                    annotation.Bytes(kAnnotationName, "value");
+                    annotation.Field(kAnnotationIntValue, static_cast<uint64_t>(entry.value));
+                    event.Bytes(kEventDebugAnnotations, annotation.bytes);
+                }
+                ProtoWriter eventPacket;
+                eventPacket.Field(kPacketTimestamp, entry.timestamp);
+                eventPacket.Field(kPacketSequenceId, kSequenceId);
+                eventPacket.Bytes(kPacketTrackEvent, event.bytes);
+                writePacket(eventPacket);
+            }
+        }
+    }
+
+    void ClearTrace()
+    {
+        TraceRegistry::Instance().Clear();
+    }
+}
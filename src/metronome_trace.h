@@ -0,0 +1,74 @@
+#ifndef METRONOME_TRACE_H_
+#define METRONOME_TRACE_H_
+
+#include <cstdint>
+#include <ostream>
+
+// Trace points are compiled in only when METRONOME_TRACING is defined to a
+// non-zero value (see METRONOME_ENABLE_TRACING in CMakeLists.txt). Otherwise
+// every METRONOME_TRACE_* macro expands to nothing and its arguments are not
+// evaluated, so instrumented code compiles exactly as if it were not there.
+//
+// Names must be string literals: only the pointer is stored.
+#if defined(METRONOME_TRACING) && METRONOME_TRACING
+#define METRONOME_TRACE_CONCAT_(a, b) a##b
+#define METRONOME_TRACE_CONCAT(a, b) METRONOME_TRACE_CONCAT_(a, b)
+#define METRONOME_TRACE_BEGIN(name) ::metronome::TraceRecord(::metronome::TracePhase::Begin, name, 0)
+#define METRONOME_TRACE_END(name) ::metronome::TraceRecord(::metronome::TracePhase::End, name, 0)
+#define METRONOME_TRACE_INSTANT(name, value) ::metronome::TraceRecord(::metronome::TracePhase::Instant, name, static_cast<int64_t>(value))
+#define METRONOME_TRACE_SCOPE(name) ::metronome::TraceScope METRONOME_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define METRONOME_TRACE_THREAD_NAME(name) ::metronome::TraceSetThreadName(name)
+#else
+#define METRONOME_TRACE_BEGIN(name) ((void)0)
+#define METRONOME_TRACE_END(name) ((void)0)
+#define METRONOME_TRACE_INSTANT(name, value) ((void)0)
+#define METRONOME_TRACE_SCOPE(name) ((void)0)
+#define METRONOME_TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+namespace metronome
+{
+#if defined(METRONOME_TRACING) && METRONOME_TRACING
+    constexpr bool kTracingEnabled = true;
+#else
+    constexpr bool kTracingEnabled = false;
+#endif
+
+    enum class TracePhase : uint8_t
+    {
+        Begin,
+        End,
+        Instant,
+    };
+
+    // Appends to the calling thread's ring buffer, overwriting the oldest
+    // records when it is full. Wait-free once the thread has a buffer; until
+    // then the first record takes a lock and may allocate one.
+    void TraceRecord(TracePhase phase, const char *name, int64_t value);
+    // Names the calling thread in dumps and gives it its buffer. Threads
+    // that trace from a realtime path call this first thing, so that none
+    // of their records waits on the lock.
+    void TraceSetThreadName(const char *name);
+
+    class TraceScope
+    {
+    public:
+        explicit TraceScope(const char *name) : name(name) { TraceRecord(TracePhase::Begin, name, 0); }
+        ~TraceScope() { TraceRecord(TracePhase::End, name, 0); }
+        TraceScope(const TraceScope &) = delete;
+        TraceScope &operator=(const TraceScope &) = delete;
+
+    private:
+        const char *name;
+    };
+
+    // Snapshot every thread's buffer, oldest records first. Safe to call
+    // while trace points are being hit; records overwritten during the copy
+    // are dropped rather than torn.
+    void WriteChromeTrace(std::ostream &out);
+    // The same events as a binary Perfetto trace (perfetto.protos.Trace).
+    void WritePerfettoTrace(std::ostream &out);
+    void ClearTrace();
+}
+
+#endif // METRONOME_TRACE_H_
@@ -0,0 +1,159 @@
+#include "metronome_transport.h"
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace metronome
+{
+    namespace
+    {
+        // A store takes well under a microsecond, so this many attempts all
+        // failing means the writer stopped in the middle of one.
+        constexpr int kReadAttempts = 10000;
+
+        std::string SegmentPath(const std::string &name)
+        {
+            if (name.empty() || name.size() > kMaxTransportName || name.find_first_of("/\\") != std::string::npos)
+            {
+                throw std::invalid_argument("A transport name has 1 to " + std::to_string(kMaxTransportName) +
+                                            " characters and no slashes");
+            }
+#if defined(_WIN32)
+            return "Local\\" + name;
+#else
+            return "/" + name;
+#endif
+        }
+    }
+
+    std::unique_ptr<SharedSegment> SharedSegment::Create(const std::string &name, size_t bytes)
+    {
+        std::unique_ptr<SharedSegment> segment(new SharedSegment());
+        segment->path = SegmentPath(name);
+        segment->size = bytes;
+#if defined(_WIN32)
+        segment->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                              static_cast<DWORD>(bytes), segment->path.c_str());
+        if (segment->mapping == nullptr)
+        {
+            throw std::runtime_error("Failed to create shared memory " + segment->path);
+        }
+        segment->data = MapViewOfFile(segment->mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+#else
+        // A segment left by a writer that died is replaced, not reused.
+        shm_unlink(segment->path.c_str());
+        const int fd = shm_open(segment->path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to create shared memory " + segment->path);
+        }
+        segment->owner = true;
+        if (ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+        {
+            void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            segment->data = mapped == MAP_FAILED ? nullptr : mapped;
+        }
+        close(fd);
+#endif
+        if (segment->data == nullptr)
+        {
+            throw std::runtime_error("Failed to map shared memory " + segment->path);
+        }
+        return segment;
+    }
+
+    std::unique_ptr<SharedSegment> SharedSegment::Open(const std::string &name, size_t bytes)
+    {
+        std::unique_ptr<SharedSegment> segment(new SharedSegment());
+        segment->path = SegmentPath(name);
+        segment->size = bytes;
+#if defined(_WIN32)
+        segment->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, segment->path.c_str());
+        if (segment->mapping == nullptr)
+        {
+            throw std::runtime_error("Nothing is published as " + name);
+        }
+        segment->data = MapViewOfFile(segment->mapping, FILE_MAP_READ, 0, 0, bytes);
+#else
+        const int fd = shm_open(segment->path.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Nothing is published as " + name);
+        }
+        struct stat info = {};
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < bytes)
+        {
+            close(fd);
+            throw std::runtime_error("Shared memory " + segment->path + " is too small");
+        }
+        void *mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        segment->data = mapped == MAP_FAILED ? nullptr : mapped;
+        close(fd);
+#endif
+        if (segment->data == nullptr)
+        {
+            throw std::runtime_error("Failed to map shared memory " + segment->path);
+        }
+        return segment;
+    }
+
+    SharedSegment::~SharedSegment()
+    {
+#if defined(_WIN32)
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+#else
+        if (data != nullptr)
+        {
+            munmap(data, size);
+        }
+        if (owner)
+        {
+            shm_unlink(path.c_str());
+        }
+#endif
+    }
+
+    TransportReader::TransportReader(const std::string &name)
+        : shared(SharedSegment::Open(name, sizeof(TransportSegment)))
+    {
+        if (Segment().magic.load(std::memory_order_acquire) != kTransportMagic)
+        {
+            throw std::invalid_argument(name + " is not a metronome transport");
+        }
+        if (Segment().version != kTransportVersion)
+        {
+            throw std::invalid_argument("Transport version " + std::to_string(Segment().version) +
+                                        " is not supported");
+        }
+    }
+
+    bool TransportReader::Read(TransportState &state) const
+    {
+        for (int attempt = 0; attempt < kReadAttempts; attempt++)
+        {
+            if (Segment().state.TryLoad(state))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
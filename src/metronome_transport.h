@@ -0,0 +1,120 @@
+#ifndef METRONOME_TRANSPORT_H_
+#define METRONOME_TRANSPORT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "metronome_seqlock.h"
+
+// The transport a playing engine publishes into shared memory, and the
+// reader for other processes on the same machine (recorders, DAW bridges,
+// visualisers) to follow it without a round trip. The reader needs nothing
+// else from the engine core: link metronome_transport alone.
+
+namespace metronome
+{
+    // "MTTR" read as a little-endian u32; only ever compared on the machine
+    // that wrote it.
+    constexpr uint32_t kTransportMagic = 0x5254544D;
+    constexpr uint32_t kTransportVersion = 1;
+    // Longest segment name; macOS allows no more.
+    constexpr size_t kMaxTransportName = 30;
+
+    // Where the output is, as of hostTimeNs. hostTimeNs is on
+    // std::chrono::steady_clock (CLOCK_MONOTONIC on Linux,
+    // QueryPerformanceCounter on Windows), which all processes share, so a
+    // reader runs the frame on by its own steady clock's distance from it.
+    struct TransportState
+    {
+        double bpm = 0.0;
+        // Bars since playback started, from 1; 0 before the first downbeat.
+        int64_t bar = 0;
+        // The beat of the bar sounding, from 0, and how far the output is
+        // through it, from 0 to 1.
+        int32_t beat = 0;
+        int32_t playing = 0;
+        double phase = 0.0;
+        // Engine frame at the device output.
+        int64_t frame = 0;
+        int64_t hostTimeNs = 0;
+    };
+
+    // The whole segment: a 16-byte header (magic "MTTR", u32 version, u32
+    // sample rate, 4 bytes padding), then a Seqlock<TransportState>: a u32
+    // sequence, 4 bytes padding and the state as relaxed u64 words. Host
+    // byte order and layout, as only processes on one machine share it.
+    struct TransportSegment
+    {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t sampleRate;
+        uint32_t reserved;
+        Seqlock<TransportState> state;
+    };
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+                  "Only lock-free atomics work across processes");
+
+    // A named shared-memory segment mapped into this process: a POSIX shared
+    // memory object "/name", or a Windows file mapping "Local\name".
+    class SharedSegment
+    {
+    public:
+        // Creates the segment writable, replacing one left behind by a
+        // writer that died; the name is removed again when this is
+        // destroyed. Throws std::invalid_argument for an empty name, one
+        // with a slash or longer than kMaxTransportName, and
+        // std::runtime_error if the OS refuses.
+        static std::unique_ptr<SharedSegment> Create(const std::string &name, size_t bytes);
+        // Maps an existing segment read-only. Throws as Create does,
+        // std::runtime_error also if there is none or it is smaller than
+        // bytes.
+        static std::unique_ptr<SharedSegment> Open(const std::string &name, size_t bytes);
+        ~SharedSegment();
+
+        SharedSegment(const SharedSegment &) = delete;
+        SharedSegment &operator=(const SharedSegment &) = delete;
+
+        void *Data() const { return data; }
+
+    private:
+        SharedSegment() = default;
+
+        void *data = nullptr;
+        size_t size = 0;
+        std::string path;
+        bool owner = false;
+#if defined(_WIN32)
+        void *mapping = nullptr;
+#endif
+    };
+
+    // Follows the transport an engine publishes under a name, e.g. with
+    // metronome_cli play --transport NAME.
+    class TransportReader
+    {
+    public:
+        // Throws std::runtime_error if nothing is published under name, and
+        // std::invalid_argument if what is there isn't a transport of this
+        // version.
+        explicit TransportReader(const std::string &name);
+
+        // The latest state, without blocking or locking out the writer.
+        // False, leaving state alone, if every attempt met a store in
+        // progress, as it would if the writer died in the middle of one.
+        bool Read(TransportState &state) const;
+        // Stores so far; a poller reads again only when this has moved.
+        uint32_t Version() const { return Segment().state.Version(); }
+        int SampleRate() const { return static_cast<int>(Segment().sampleRate); }
+
+    private:
+        const TransportSegment &Segment() const { return *static_cast<const TransportSegment *>(shared->Data()); }
+
+        std::unique_ptr<SharedSegment> shared;
+    };
+}
+
+#endif // METRONOME_TRANSPORT_H_
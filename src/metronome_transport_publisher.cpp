@@ -0,0 +1,62 @@
+#include "metronome_transport_publisher.h"
+
+#include <algorithm>
+#include <new>
+
+namespace metronome
+{
+    TransportPublisher::TransportPublisher(const std::string &name, int sampleRate)
+        : shared(SharedSegment::Create(name, sizeof(TransportSegment)))
+    {
+        segment = new (shared->Data()) TransportSegment();
+        segment->version = kTransportVersion;
+        segment->sampleRate = static_cast<uint32_t>(sampleRate);
+        // Readers check this last, so they never see a header half written.
+        segment->magic.store(kTransportMagic, std::memory_order_release);
+    }
+
+    void TransportPublisher::Publish(const BeatClock &clock, int64_t frame, std::chrono::steady_clock::time_point at,
+                                     bool playing)
+    {
+        if (!hasLast || clock.epoch != last.epoch)
+        {
+            hasPrevious = false;
+        }
+        else if (clock.lastFrame != last.lastFrame)
+        {
+            previousFrame = last.lastFrame;
+            previousBeat = last.beat;
+            previousBar = last.bar;
+            hasPrevious = last.bar > 0;
+        }
+        last = clock;
+        hasLast = true;
+
+        TransportState state;
+        state.bpm = clock.bpm;
+        state.frame = frame;
+        state.hostTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+        state.playing = playing ? 1 : 0;
+        const double position = static_cast<double>(frame);
+        double from = clock.lastFrame;
+        double to = clock.nextFrame;
+        if (clock.bar > 0 && (position >= clock.lastFrame || !hasPrevious))
+        {
+            state.bar = clock.bar;
+            state.beat = clock.beat;
+        }
+        else if (clock.bar > 0)
+        {
+            // The device hasn't played the clock's last click yet.
+            state.bar = previousBar;
+            state.beat = previousBeat;
+            from = previousFrame;
+            to = clock.lastFrame;
+        }
+        if (state.bar > 0 && to > from)
+        {
+            state.phase = std::min(1.0, std::max(0.0, (position - from) / (to - from)));
+        }
+        segment->state.Store(state);
+    }
+}
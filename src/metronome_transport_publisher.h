@@ -0,0 +1,49 @@
+#ifndef METRONOME_TRANSPORT_PUBLISHER_H_
+#define METRONOME_TRANSPORT_PUBLISHER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "metronome_engine.h"
+#include "metronome_transport.h"
+
+namespace metronome
+{
+    // Publishes where an engine's output is into a TransportSegment that
+    // TransportReaders in other processes map. Publishing is a seqlock
+    // store of a few words: wait-free and allocation-free, for the audio
+    // thread. An AudioStream given one publishes every period.
+    class TransportPublisher
+    {
+    public:
+        // Creates the segment under name for an engine running at
+        // sampleRate; throws as SharedSegment::Create does. Readers see the
+        // transport stopped until the first Publish.
+        TransportPublisher(const std::string &name, int sampleRate);
+
+        TransportPublisher(const TransportPublisher &) = delete;
+        TransportPublisher &operator=(const TransportPublisher &) = delete;
+
+        // frame reached the device output at time at, and clock is the
+        // engine's as of the last block rendered, which may be a little
+        // past it. One thread at a time.
+        void Publish(const BeatClock &clock, int64_t frame, std::chrono::steady_clock::time_point at, bool playing);
+
+    private:
+        std::unique_ptr<SharedSegment> shared;
+        TransportSegment *segment = nullptr;
+
+        // The click before the clock's last one, for a frame still in the
+        // device buffer from before it.
+        BeatClock last;
+        bool hasLast = false;
+        double previousFrame = 0.0;
+        int previousBeat = 0;
+        int64_t previousBar = 0;
+        bool hasPrevious = false;
+    };
+}
+
+#endif // METRONOME_TRANSPORT_PUBLISHER_H_
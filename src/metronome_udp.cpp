@@ -0,0 +1,202 @@
+#include "metronome_udp.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace metronome
+{
+    struct UdpSocket::Handle
+    {
+        Handle()
+        {
+#if defined(_WIN32)
+            WSADATA data;
+            if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+            {
+                throw std::runtime_error("Failed to start Winsock");
+            }
+#endif
+        }
+
+        ~Handle()
+        {
+#if defined(_WIN32)
+            if (socket != INVALID_SOCKET)
+            {
+                closesocket(socket);
+            }
+            WSACleanup();
+#else
+            if (socket >= 0)
+            {
+                close(socket);
+            }
+#endif
+        }
+
+        Handle(const Handle &) = delete;
+        Handle &operator=(const Handle &) = delete;
+
+        void Open(int family, int type, int protocol, const std::string &what)
+        {
+            socket = ::socket(family, type, protocol);
+#if defined(_WIN32)
+            const bool opened = socket != INVALID_SOCKET;
+#else
+            const bool opened = socket >= 0;
+#endif
+            if (!opened)
+            {
+                throw std::runtime_error("Failed to open a UDP socket for " + what);
+            }
+        }
+
+        void Option(int level, int name, int value, const char *what)
+        {
+            if (setsockopt(socket, level, name, reinterpret_cast<const char *>(&value), sizeof(value)) != 0)
+            {
+                throw std::runtime_error(std::string("Failed to set ") + what + " on a UDP socket");
+            }
+        }
+
+#if defined(_WIN32)
+        SOCKET socket = INVALID_SOCKET;
+        int targetLength = 0;
+#else
+        int socket = -1;
+        socklen_t targetLength = 0;
+#endif
+        sockaddr_storage target = {};
+    };
+
+    UdpSocket::UdpSocket() : handle(std::make_unique<Handle>())
+    {
+    }
+
+    UdpSocket::UdpSocket(const std::string &host, int port) : UdpSocket()
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo *found = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || found == nullptr)
+        {
+            throw std::runtime_error("Failed to resolve host " + host);
+        }
+        std::memcpy(&handle->target, found->ai_addr, found->ai_addrlen);
+        handle->targetLength = static_cast<decltype(handle->targetLength)>(found->ai_addrlen);
+        const int family = found->ai_family;
+        const int type = found->ai_socktype;
+        const int protocol = found->ai_protocol;
+        freeaddrinfo(found);
+        handle->Open(family, type, protocol, host);
+    }
+
+    UdpSocket::~UdpSocket() = default;
+
+    std::unique_ptr<UdpSocket> UdpSocket::JoinGroup(const std::string &group, int port,
+                                                    const std::string &interfaceAddress)
+    {
+        std::unique_ptr<UdpSocket> udp(new UdpSocket());
+        Handle &handle = *udp->handle;
+        in_addr groupAddress = {};
+        in_addr localAddress = {};
+        if (inet_pton(AF_INET, group.c_str(), &groupAddress) != 1 || (ntohl(groupAddress.s_addr) >> 28) != 0xE)
+        {
+            throw std::runtime_error(group + " is not an IPv4 multicast group");
+        }
+        if (inet_pton(AF_INET, interfaceAddress.c_str(), &localAddress) != 1)
+        {
+            throw std::runtime_error(interfaceAddress + " is not an IPv4 interface address");
+        }
+        handle.Open(AF_INET, SOCK_DGRAM, IPPROTO_UDP, group);
+        handle.Option(SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+#if defined(SO_REUSEPORT)
+        handle.Option(SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+#endif
+
+        sockaddr_in bound = {};
+        bound.sin_family = AF_INET;
+        bound.sin_port = htons(static_cast<uint16_t>(port));
+        bound.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(handle.socket, reinterpret_cast<const sockaddr *>(&bound), sizeof(bound)) != 0)
+        {
+            throw std::runtime_error("Failed to bind UDP port " + std::to_string(port));
+        }
+        ip_mreq membership = {};
+        membership.imr_multiaddr = groupAddress;
+        membership.imr_interface = localAddress;
+        if (setsockopt(handle.socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<const char *>(&membership),
+                       sizeof(membership)) != 0)
+        {
+            throw std::runtime_error("Failed to join multicast group " + group);
+        }
+        if (setsockopt(handle.socket, IPPROTO_IP, IP_MULTICAST_IF, reinterpret_cast<const char *>(&localAddress),
+                       sizeof(localAddress)) != 0)
+        {
+            throw std::runtime_error("Failed to send multicast through " + interfaceAddress);
+        }
+        handle.Option(IPPROTO_IP, IP_MULTICAST_LOOP, 1, "IP_MULTICAST_LOOP");
+        handle.Option(IPPROTO_IP, IP_MULTICAST_TTL, 1, "IP_MULTICAST_TTL");
+
+#if defined(_WIN32)
+        u_long nonBlocking = 1;
+        const bool polled = ioctlsocket(handle.socket, FIONBIO, &nonBlocking) == 0;
+#else
+        const int flags = fcntl(handle.socket, F_GETFL, 0);
+        const bool polled = flags >= 0 && fcntl(handle.socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+        if (!polled)
+        {
+            throw std::runtime_error("Failed to make a UDP socket non-blocking");
+        }
+
+        sockaddr_in target = bound;
+        target.sin_addr = groupAddress;
+        std::memcpy(&handle.target, &target, sizeof(target));
+        handle.targetLength = sizeof(target);
+        return udp;
+    }
+
+    bool UdpSocket::Send(const uint8_t *data, size_t bytes)
+    {
+#if defined(_WIN32)
+        return sendto(handle->socket, reinterpret_cast<const char *>(data), static_cast<int>(bytes), 0,
+                      reinterpret_cast<const sockaddr *>(&handle->target),
+                      handle->targetLength) == static_cast<int>(bytes);
+#else
+        return sendto(handle->socket, data, bytes, 0, reinterpret_cast<const sockaddr *>(&handle->target),
+                      handle->targetLength) == static_cast<ssize_t>(bytes);
+#endif
+    }
+
+    size_t UdpSocket::Receive(uint8_t *data, size_t capacity)
+    {
+#if defined(_WIN32)
+        const int received = recv(handle->socket, reinterpret_cast<char *>(data), static_cast<int>(capacity), 0);
+        if (received == SOCKET_ERROR && WSAGetLastError() == WSAEMSGSIZE)
+        {
+            return capacity;
+        }
+#else
+        const ssize_t received = recv(handle->socket, data, capacity, MSG_DONTWAIT);
+#endif
+        return received > 0 ? static_cast<size_t>(received) : 0;
+    }
+}
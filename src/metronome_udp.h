@@ -0,0 +1,50 @@
+#ifndef METRONOME_UDP_H_
+#define METRONOME_UDP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace metronome
+{
+    // A UDP socket with one fixed destination, for the beat and sync
+    // messages the engine sends on the local network. Receiving never
+    // blocks.
+    class UdpSocket
+    {
+    public:
+        // Aimed at host:port, by name or numeric address, IPv4 or IPv6.
+        // Throws std::runtime_error if the host can't be resolved or no
+        // socket opened.
+        UdpSocket(const std::string &host, int port);
+        ~UdpSocket();
+
+        UdpSocket(const UdpSocket &) = delete;
+        UdpSocket &operator=(const UdpSocket &) = delete;
+
+        // Bound to port and joined to the IPv4 multicast group through the
+        // interface with address interfaceAddress ("0.0.0.0" lets the
+        // system pick), and aimed at the group. Other sockets may bind the
+        // same port and what is sent loops back, so peers in one process
+        // or on one machine hear each other; datagrams don't leave the
+        // local network. Throws std::runtime_error if the OS refuses.
+        static std::unique_ptr<UdpSocket> JoinGroup(const std::string &group, int port,
+                                                    const std::string &interfaceAddress);
+
+        bool Send(const uint8_t *data, size_t bytes);
+        // Copies the next datagram waiting into data and returns its size,
+        // or 0 if none is waiting. A datagram longer than capacity is cut
+        // short.
+        size_t Receive(uint8_t *data, size_t capacity);
+
+    private:
+        struct Handle;
+
+        UdpSocket();
+
+        std::unique_ptr<Handle> handle;
+    };
+}
+
+#endif // METRONOME_UDP_H_
@@ -0,0 +1,126 @@
+#include "metronome_watchdog.h"
+
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+#include "metronome_log.h"
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace
+    {
+        // Checks per stallAfter, so a stall is reported within a quarter
+        // of it past the limit.
+        constexpr int kChecksPerStall = 4;
+
+        // Best effort; a watchdog at normal priority still works.
+        void LowerThreadPriority()
+        {
+#if defined(_WIN32)
+            SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+            // Linux keeps nice values per thread; 0 is the calling one.
+            setpriority(PRIO_PROCESS, 0, 10);
+#endif
+        }
+    }
+
+    StallWatchdog::StallWatchdog(std::function<int64_t()> position, std::function<void()> onStall,
+                                 std::chrono::milliseconds stallAfter)
+        : position(std::move(position)), onStall(std::move(onStall)), stallAfter(stallAfter), now(&Clock::now)
+    {
+        if (stallAfter.count() <= 0)
+        {
+            throw std::invalid_argument("A watchdog needs a stall time of at least a millisecond");
+        }
+    }
+
+    StallWatchdog::~StallWatchdog()
+    {
+        Stop();
+    }
+
+    void StallWatchdog::SetClock(std::function<Clock::time_point()> now)
+    {
+        this->now = std::move(now);
+    }
+
+    void StallWatchdog::Start()
+    {
+        Stop();
+        watching = false;
+        running.store(true, std::memory_order_release);
+        thread = std::thread(&StallWatchdog::Run, this);
+    }
+
+    void StallWatchdog::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    void StallWatchdog::Run()
+    {
+        METRONOME_TRACE_THREAD_NAME("watchdog");
+        LowerThreadPriority();
+        const Clock::duration interval = stallAfter / kChecksPerStall;
+        try
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            while (!wake.wait_for(lock, interval, [this]
+                                  { return !running.load(std::memory_order_acquire); }))
+            {
+                lock.unlock();
+                Check();
+                lock.lock();
+            }
+        }
+        catch (const std::exception &e)
+        {
+            Log(LogLevel::Error, "watchdog", "Watchdog stopped: %s", e.what());
+        }
+    }
+
+    bool StallWatchdog::Check()
+    {
+        const Clock::time_point at = now();
+        const int64_t played = position();
+        if (!watching || played != lastPosition)
+        {
+            watching = true;
+            lastPosition = played;
+            movedAt = at;
+            return false;
+        }
+        if (at - movedAt < stallAfter)
+        {
+            return false;
+        }
+        const double stalledMs = std::chrono::duration<double, std::milli>(at - movedAt).count();
+        METRONOME_TRACE_INSTANT("device_stalled", played);
+        Log(LogLevel::Warning, "watchdog", "Output stalled at frame %lld for %.0f ms; restarting",
+            static_cast<long long>(played), stalledMs);
+        stalls.fetch_add(1, std::memory_order_relaxed);
+        movedAt = at;
+        onStall();
+        return true;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef METRONOME_WATCHDOG_H_
+#define METRONOME_WATCHDOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace metronome
+{
+    // Watches a device's played position against wall time from a low
+    // priority thread of its own, and calls onStall when it has not moved
+    // for stallAfter: a device that stopped taking audio without reporting
+    // an error or running dry, such as a waveOut queue that no longer
+    // returns blocks. The stream thread the device belongs to does the
+    // restarting; onStall runs on the watchdog thread and only asks it to,
+    // e.g. through AudioStream::RestartStalled.
+    //
+    // After a stall is reported the position gets stallAfter again to move
+    // before the next report, so a device that takes a while to reopen is
+    // not reported over and over.
+    class StallWatchdog
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // position is read from the watchdog thread. Throws
+        // std::invalid_argument unless stallAfter is positive.
+        StallWatchdog(std::function<int64_t()> position, std::function<void()> onStall,
+                      std::chrono::milliseconds stallAfter);
+        ~StallWatchdog();
+
+        StallWatchdog(const StallWatchdog &) = delete;
+        StallWatchdog &operator=(const StallWatchdog &) = delete;
+
+        // Watches from now on, checking a few times per stallAfter. Start
+        // it once the device is playing and stop it before it stops.
+        void Start();
+        void Stop();
+        // One check; the thread's loop, or tests driving it themselves.
+        // Returns true if it reported a stall.
+        bool Check();
+        // Replaces the clock stalls are timed with; call it before Start.
+        void SetClock(std::function<Clock::time_point()> now);
+
+        // Stalls reported since construction.
+        uint64_t Stalls() const { return stalls.load(std::memory_order_relaxed); }
+
+    private:
+        void Run();
+
+        const std::function<int64_t()> position;
+        const std::function<void()> onStall;
+        const Clock::duration stallAfter;
+        std::function<Clock::time_point()> now;
+
+        // Only touched by whoever calls Check.
+        bool watching = false;
+        int64_t lastPosition = 0;
+        Clock::time_point movedAt;
+
+        std::atomic<bool> running{false};
+        std::thread thread;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::atomic<uint64_t> stalls{0};
+    };
+}
+
+#endif // METRONOME_WATCHDOG_H_
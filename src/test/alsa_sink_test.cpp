@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metronome_alsa_sink.h"
+#include "metronome_engine.h"
+#include "metronome_stream.h"
+
+// Built only with ALSA. The null and file PCMs need no sound card, so these
+// run on CI machines.
+namespace metronome
+{
+    namespace test
+    {
+        TEST(AlsaSinkTest, StreamsToNullDevice)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, 48000);
+            AlsaSink sink("null");
+            SinkConfig requested;
+            requested.periodFrames = 256;
+            requested.periods = 3;
+            AudioStream stream(engine, sink, requested);
+            stream.Start();
+            EXPECT_EQ(stream.Config().sampleRate, 48000);
+            EXPECT_GE(stream.Config().periods, 2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            EXPECT_TRUE(stream.Running());
+            stream.Stop();
+            EXPECT_GT(stream.Stats().periods, 0u);
+            EXPECT_GT(engine.Position(), 0);
+        }
+
+        TEST(AlsaSinkTest, FileDeviceReceivesEngineOutput)
+        {
+            const std::string path = testing::TempDir() + "alsa_sink.raw";
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, 8000);
+            AlsaSink sink("file:FILE=" + path + ",FORMAT=raw");
+            SinkConfig requested;
+            requested.periodFrames = 200;
+            requested.periods = 4;
+            {
+                AudioStream stream(engine, sink, requested);
+                stream.Open();
+                for (int i = 0; i < 1000 && engine.Position() < 12000; i++)
+                {
+                    ASSERT_TRUE(stream.Pump(20));
+                }
+            }
+
+            std::ifstream file(path, std::ios::binary);
+            const std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            ASSERT_GE(bytes.size(), 2u * 8001);
+            auto sample = [&](size_t frame)
+            {
+                return static_cast<int16_t>(static_cast<uint8_t>(bytes[2 * frame]) |
+                                            static_cast<uint8_t>(bytes[2 * frame + 1]) << 8);
+            };
+            EXPECT_EQ(sample(0), 2000);
+            EXPECT_EQ(sample(1), 0);
+            EXPECT_EQ(sample(4000), 1000);
+            EXPECT_EQ(sample(8000), 1000);
+            std::remove(path.c_str());
+        }
+    }
+}
@@ -0,0 +1,485 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_audio_file.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            std::vector<uint8_t> ReadFile(const std::string &path)
+            {
+                std::ifstream file(path, std::ios::binary);
+                return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+
+            class BitReader
+            {
+            public:
+                BitReader(const std::vector<uint8_t> &bytes, size_t offset) : bytes(bytes), bit(offset * 8) {}
+
+                uint32_t Get(int bits)
+                {
+                    uint32_t value = 0;
+                    for (int i = 0; i < bits; i++, bit++)
+                    {
+                        if (bit / 8 >= bytes.size())
+                        {
+                            throw std::runtime_error("FLAC stream ends mid-frame");
+                        }
+                        value = (value << 1) | ((bytes[bit / 8] >> (7 - bit % 8)) & 1);
+                    }
+                    return value;
+                }
+
+                int32_t GetSigned(int bits)
+                {
+                    const uint32_t value = Get(bits);
+                    return (value & (1u << (bits - 1))) ? static_cast<int32_t>(value) - (1 << bits)
+                                                        : static_cast<int32_t>(value);
+                }
+
+                uint32_t GetUnary()
+                {
+                    uint32_t zeros = 0;
+                    while (Get(1) == 0)
+                    {
+                        zeros++;
+                    }
+                    return zeros;
+                }
+
+                void Align() { bit = (bit + 7) / 8 * 8; }
+                size_t Offset() const { return bit / 8; }
+
+            private:
+                const std::vector<uint8_t> &bytes;
+                size_t bit;
+            };
+
+            // The checksums as the FLAC format defines them, written out
+            // here so the writer is not checked against its own code.
+            uint8_t FlacCrc8(const uint8_t *data, size_t size)
+            {
+                uint8_t crc = 0;
+                for (size_t i = 0; i < size; i++)
+                {
+                    crc ^= data[i];
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+                    }
+                }
+                return crc;
+            }
+
+            uint16_t FlacCrc16(const uint8_t *data, size_t size)
+            {
+                uint16_t crc = 0;
+                for (size_t i = 0; i < size; i++)
+                {
+                    crc ^= static_cast<uint16_t>(data[i] << 8);
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+                    }
+                }
+                return crc;
+            }
+
+            struct FlacStream
+            {
+                int minBlockSize = 0;
+                int maxBlockSize = 0;
+                uint32_t minFrameBytes = 0;
+                uint32_t maxFrameBytes = 0;
+                int sampleRate = 0;
+                int channels = 0;
+                int bitsPerSample = 0;
+                uint64_t totalFrames = 0;
+                int frames = 0;
+                // Subframes of each type seen, fixed ones by predictor order.
+                int constantSubframes = 0;
+                int verbatimSubframes = 0;
+                int fixedSubframes[5] = {};
+                std::vector<int16_t> pcm;
+            };
+
+            void DecodeResidual(BitReader &bits, int blockSize, int order, std::vector<int32_t> &out)
+            {
+                const uint32_t method = bits.Get(2);
+                if (method > 1)
+                {
+                    throw std::runtime_error("Reserved residual coding method");
+                }
+                const int paramBits = method == 0 ? 4 : 5;
+                const uint32_t escape = method == 0 ? 15 : 31;
+                const int partitions = 1 << bits.Get(4);
+                for (int p = 0; p < partitions; p++)
+                {
+                    const int count = blockSize / partitions - (p == 0 ? order : 0);
+                    const uint32_t rice = bits.Get(paramBits);
+                    for (int i = 0; i < count; i++)
+                    {
+                        if (rice == escape)
+                        {
+                            throw std::runtime_error("Escaped partitions are not expected");
+                        }
+                        const uint32_t folded = (bits.GetUnary() << rice) | (rice > 0 ? bits.Get(static_cast<int>(rice)) : 0);
+                        out.push_back((folded & 1) ? -static_cast<int32_t>(folded >> 1) - 1
+                                                   : static_cast<int32_t>(folded >> 1));
+                    }
+                }
+            }
+
+            std::vector<int32_t> DecodeSubframe(BitReader &bits, int blockSize, FlacStream &stream)
+            {
+                if (bits.Get(1) != 0)
+                {
+                    throw std::runtime_error("Subframe padding bit set");
+                }
+                const uint32_t type = bits.Get(6);
+                if (bits.Get(1) != 0)
+                {
+                    throw std::runtime_error("Wasted bits are not expected");
+                }
+                std::vector<int32_t> x;
+                if (type == 0)
+                {
+                    stream.constantSubframes++;
+                    x.assign(static_cast<size_t>(blockSize), bits.GetSigned(stream.bitsPerSample));
+                }
+                else if (type == 1)
+                {
+                    stream.verbatimSubframes++;
+                    for (int i = 0; i < blockSize; i++)
+                    {
+                        x.push_back(bits.GetSigned(stream.bitsPerSample));
+                    }
+                }
+                else if (type >= 8 && type <= 12)
+                {
+                    const int order = static_cast<int>(type) - 8;
+                    stream.fixedSubframes[order]++;
+                    for (int i = 0; i < order; i++)
+                    {
+                        x.push_back(bits.GetSigned(stream.bitsPerSample));
+                    }
+                    std::vector<int32_t> residual;
+                    DecodeResidual(bits, blockSize, order, residual);
+                    for (int32_t r : residual)
+                    {
+                        const size_t n = x.size();
+                        int32_t prediction = 0;
+                        switch (order)
+                        {
+                        case 1:
+                            prediction = x[n - 1];
+                            break;
+                        case 2:
+                            prediction = 2 * x[n - 1] - x[n - 2];
+                            break;
+                        case 3:
+                            prediction = 3 * x[n - 1] - 3 * x[n - 2] + x[n - 3];
+                            break;
+                        case 4:
+                            prediction = 4 * x[n - 1] - 6 * x[n - 2] + 4 * x[n - 3] - x[n - 4];
+                            break;
+                        }
+                        x.push_back(prediction + r);
+                    }
+                }
+                else
+                {
+                    throw std::runtime_error("Unexpected subframe type " + std::to_string(type));
+                }
+                return x;
+            }
+
+            // Decodes the subset of FLAC a fixed-predictor encoder can
+            // produce, checking every header field and checksum on the way.
+            FlacStream DecodeFlac(const std::vector<uint8_t> &bytes)
+            {
+                if (bytes.size() < 42 || std::string(bytes.begin(), bytes.begin() + 4) != "fLaC")
+                {
+                    throw std::runtime_error("Not a FLAC stream");
+                }
+                FlacStream stream;
+                BitReader info(bytes, 4);
+                if (info.Get(1) != 1 || info.Get(7) != 0 || info.Get(24) != 34)
+                {
+                    throw std::runtime_error("Expected STREAMINFO as the only metadata block");
+                }
+                stream.minBlockSize = static_cast<int>(info.Get(16));
+                stream.maxBlockSize = static_cast<int>(info.Get(16));
+                stream.minFrameBytes = info.Get(24);
+                stream.maxFrameBytes = info.Get(24);
+                stream.sampleRate = static_cast<int>(info.Get(20));
+                stream.channels = static_cast<int>(info.Get(3)) + 1;
+                stream.bitsPerSample = static_cast<int>(info.Get(5)) + 1;
+                stream.totalFrames = static_cast<uint64_t>(info.Get(4)) << 32;
+                stream.totalFrames |= info.Get(32);
+
+                size_t offset = 42;
+                while (offset < bytes.size())
+                {
+                    BitReader bits(bytes, offset);
+                    if (bits.Get(14) != 0x3FFE || bits.Get(1) != 0 || bits.Get(1) != 0)
+                    {
+                        throw std::runtime_error("Bad frame sync");
+                    }
+                    const uint32_t blockSizeCode = bits.Get(4);
+                    if (bits.Get(4) != 0)
+                    {
+                        throw std::runtime_error("Expected the sample rate from STREAMINFO");
+                    }
+                    if (static_cast<int>(bits.Get(4)) != stream.channels - 1)
+                    {
+                        throw std::runtime_error("Expected independent channels");
+                    }
+                    if (bits.Get(3) != 0x4 || bits.Get(1) != 0)
+                    {
+                        throw std::runtime_error("Expected 16-bit samples");
+                    }
+
+                    uint32_t number = bits.Get(8);
+                    int continuation = 0;
+                    while (number & (0x80 >> continuation))
+                    {
+                        continuation++;
+                    }
+                    if (continuation == 1 || continuation > 6)
+                    {
+                        throw std::runtime_error("Bad frame number");
+                    }
+                    number &= 0x7F >> continuation;
+                    for (int i = 1; i < continuation; i++)
+                    {
+                        const uint32_t next = bits.Get(8);
+                        if ((next & 0xC0) != 0x80)
+                        {
+                            throw std::runtime_error("Bad frame number");
+                        }
+                        number = (number << 6) | (next & 0x3F);
+                    }
+                    if (number != static_cast<uint32_t>(stream.frames))
+                    {
+                        throw std::runtime_error("Frames out of order");
+                    }
+
+                    int blockSize;
+                    if (blockSizeCode == 6)
+                    {
+                        blockSize = static_cast<int>(bits.Get(8)) + 1;
+                    }
+                    else if (blockSizeCode == 7)
+                    {
+                        blockSize = static_cast<int>(bits.Get(16)) + 1;
+                    }
+                    else
+                    {
+                        throw std::runtime_error("Expected the block size at the end of the header");
+                    }
+                    const size_t headerEnd = bits.Offset();
+                    if (bits.Get(8) != FlacCrc8(&bytes[offset], headerEnd - offset))
+                    {
+                        throw std::runtime_error("Frame header CRC-8 mismatch");
+                    }
+
+                    std::vector<std::vector<int32_t>> channels;
+                    for (int c = 0; c < stream.channels; c++)
+                    {
+                        channels.push_back(DecodeSubframe(bits, blockSize, stream));
+                    }
+                    bits.Align();
+                    const size_t footer = bits.Offset();
+                    if (bits.Get(16) != FlacCrc16(&bytes[offset], footer - offset))
+                    {
+                        throw std::runtime_error("Frame CRC-16 mismatch");
+                    }
+                    for (int i = 0; i < blockSize; i++)
+                    {
+                        for (int c = 0; c < stream.channels; c++)
+                        {
+                            stream.pcm.push_back(static_cast<int16_t>(channels[c][i]));
+                        }
+                    }
+                    const uint32_t frameBytes = static_cast<uint32_t>(bits.Offset() - offset);
+                    EXPECT_GE(frameBytes, stream.minFrameBytes);
+                    EXPECT_LE(frameBytes, stream.maxFrameBytes);
+                    EXPECT_LE(blockSize, stream.maxBlockSize);
+                    stream.frames++;
+                    offset = bits.Offset();
+                }
+                return stream;
+            }
+
+            // Silence, a decaying tone, a ramp, full-scale noise, a clipped
+            // click and quiet noise: every kind of subframe and predictor,
+            // and a final partial block.
+            std::vector<int16_t> ClickTrack(int channels)
+            {
+                const size_t frames = 5 * FlacWriter::kBlockSize + 1234;
+                std::vector<int16_t> pcm(frames * channels, 0);
+                std::mt19937 random(7);
+                std::uniform_int_distribution<int> noise(-32768, 32767);
+                for (size_t i = 0; i < frames; i++)
+                {
+                    for (int c = 0; c < channels; c++)
+                    {
+                        int16_t sample = 0;
+                        if (i >= 4096 && i < 8192)
+                        {
+                            const double t = static_cast<double>(i - 4096);
+                            sample = static_cast<int16_t>(
+                                std::lround((30000 - 5000 * c) * std::exp(-t / 900.0) * std::sin(t * 0.07 * (c + 1))));
+                        }
+                        else if (i >= 2 * 4096 && i < 3 * 4096)
+                        {
+                            sample = static_cast<int16_t>(-20000 + 9 * static_cast<int>(i - 2 * 4096) - 700 * c);
+                        }
+                        else if (i >= 3 * 4096 && i < 4 * 4096)
+                        {
+                            sample = static_cast<int16_t>(noise(random));
+                        }
+                        else if (i >= 4 * 4096 && i < 4 * 4096 + 10)
+                        {
+                            sample = c == 0 ? 32767 : -32768;
+                        }
+                        else if (i >= 5 * 4096)
+                        {
+                            sample = static_cast<int16_t>(noise(random) / 1000);
+                        }
+                        pcm[i * channels + c] = sample;
+                    }
+                }
+                return pcm;
+            }
+        }
+
+        TEST(FlacWriterTest, DecodesToTheSamplesWritten)
+        {
+            int fixedSubframes[5] = {};
+            for (int channels : {1, 2, 3})
+            {
+                const std::vector<int16_t> pcm = ClickTrack(channels);
+                const size_t frames = pcm.size() / channels;
+                const std::string path = TempPath("roundtrip.flac");
+                FlacWriter writer(path, 48000, channels);
+                // Uneven writes that straddle block boundaries.
+                size_t written = 0;
+                for (size_t chunk = 1; written < frames; chunk = chunk * 3 + 1)
+                {
+                    const size_t take = std::min(chunk, frames - written);
+                    writer.Write(pcm.data() + written * channels, take);
+                    written += take;
+                }
+                writer.Close();
+
+                const FlacStream stream = DecodeFlac(ReadFile(path));
+                EXPECT_EQ(stream.sampleRate, 48000);
+                EXPECT_EQ(stream.channels, channels);
+                EXPECT_EQ(stream.bitsPerSample, 16);
+                EXPECT_EQ(stream.minBlockSize, FlacWriter::kBlockSize);
+                EXPECT_EQ(stream.maxBlockSize, FlacWriter::kBlockSize);
+                EXPECT_EQ(stream.totalFrames, frames);
+                EXPECT_EQ(stream.frames, 6);
+                EXPECT_GT(stream.constantSubframes, 0);
+                EXPECT_GT(stream.verbatimSubframes, 0);
+                for (int order = 0; order <= 4; order++)
+                {
+                    fixedSubframes[order] += stream.fixedSubframes[order];
+                }
+                EXPECT_EQ(stream.pcm, pcm) << channels << " channels";
+                std::remove(path.c_str());
+            }
+            for (int order = 0; order <= 4; order++)
+            {
+                EXPECT_GT(fixedSubframes[order], 0) << "order " << order;
+            }
+        }
+
+        TEST(FlacWriterTest, SilenceBecomesConstantSubframes)
+        {
+            const std::string path = TempPath("silence.flac");
+            FlacWriter writer(path, 44100, 1);
+            const std::vector<int16_t> silence(10 * FlacWriter::kBlockSize, 0);
+            writer.Write(silence.data(), silence.size());
+            writer.Close();
+
+            const std::vector<uint8_t> bytes = ReadFile(path);
+            const FlacStream stream = DecodeFlac(bytes);
+            EXPECT_EQ(stream.constantSubframes, 10);
+            EXPECT_EQ(stream.pcm, silence);
+            EXPECT_LT(bytes.size(), 42u + 10 * 16);
+            std::remove(path.c_str());
+        }
+
+        TEST(FlacWriterTest, EmptyStreamIsValid)
+        {
+            const std::string path = TempPath("empty.flac");
+            FlacWriter writer(path, 44100, 2);
+            writer.Close();
+
+            const FlacStream stream = DecodeFlac(ReadFile(path));
+            EXPECT_EQ(stream.totalFrames, 0u);
+            EXPECT_EQ(stream.frames, 0);
+            std::remove(path.c_str());
+        }
+
+        TEST(FlacWriterTest, RejectsUnsupportedChannelCounts)
+        {
+            const std::string path = TempPath("channels.flac");
+            EXPECT_THROW(FlacWriter(path, 44100, 0), std::invalid_argument);
+            EXPECT_THROW(FlacWriter(path, 44100, 9), std::invalid_argument);
+            std::remove(path.c_str());
+        }
+
+        TEST(WavWriterTest, HeaderDescribesTheSamplesWritten)
+        {
+            const std::string path = TempPath("header.wav");
+            const std::vector<int16_t> pcm = ClickTrack(2);
+            WavWriter writer(path, 22050, 2);
+            writer.Write(pcm.data(), pcm.size() / 2);
+            writer.Close();
+
+            const std::vector<uint8_t> bytes = ReadFile(path);
+            ASSERT_EQ(bytes.size(), 44 + pcm.size() * 2);
+            auto le = [&](size_t at, int size)
+            {
+                uint32_t value = 0;
+                for (int i = size - 1; i >= 0; i--)
+                {
+                    value = (value << 8) | bytes[at + i];
+                }
+                return value;
+            };
+            EXPECT_EQ(std::string(bytes.begin(), bytes.begin() + 4), "RIFF");
+            EXPECT_EQ(le(4, 4), bytes.size() - 8);
+            EXPECT_EQ(le(22, 2), 2u);
+            EXPECT_EQ(le(24, 4), 22050u);
+            EXPECT_EQ(le(34, 2), 16u);
+            EXPECT_EQ(le(40, 4), pcm.size() * 2);
+            std::vector<int16_t> decoded(pcm.size());
+            for (size_t i = 0; i < decoded.size(); i++)
+            {
+                decoded[i] = static_cast<int16_t>(le(44 + 2 * i, 2));
+            }
+            EXPECT_EQ(decoded, pcm);
+            std::remove(path.c_str());
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef METRONOME_TEST_ENGINE_FIXTURES_H_
+#define METRONOME_TEST_ENGINE_FIXTURES_H_
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        // Main and accented clicks of length frames, each held at one level
+        // so that any output sample tells which click made it.
+        inline Kit FlatKit(int length, int16_t main, int16_t accented)
+        {
+            return Kit{std::vector<int16_t>(length, main), std::vector<int16_t>(length, accented)};
+        }
+
+        // Flat clicks of 1000 and 2000, then grid samples 2 at 300 and 3
+        // at -500.
+        inline Kit GridKit(int length)
+        {
+            Kit kit = FlatKit(length, 1000, 2000);
+            kit.samples = {std::vector<int16_t>(length, 300), std::vector<int16_t>(length, -500)};
+            return kit;
+        }
+
+        // Short clicks and grid samples of different shapes, for comparing
+        // two ways of producing the same output.
+        inline Kit GrooveKit()
+        {
+            Kit kit{{12000, -9000, 6000, -3000}, {20000, -16000, 8000}};
+            kit.samples = {{15000, 15000, -15000}, {-7000, 4000}};
+            return kit;
+        }
+
+        // Moves the ticks the engine has reported onto the end of ticks.
+        inline void DrainTicks(ClickEngine &engine, std::vector<TickEvent> &ticks)
+        {
+            TickEvent tick;
+            while (engine.PopTick(tick))
+            {
+                ticks.push_back(tick);
+            }
+        }
+
+        // The engine's next frames, interleaved with its channels.
+        inline std::vector<int16_t> Render(ClickEngine &engine, size_t frames)
+        {
+            std::vector<int16_t> pcm(frames * static_cast<size_t>(engine.Channels()));
+            engine.Render(pcm.data(), frames);
+            return pcm;
+        }
+
+        inline std::vector<int16_t> Render(ClickEngine &engine, size_t frames, std::vector<TickEvent> &ticks)
+        {
+            std::vector<int16_t> pcm = Render(engine, frames);
+            DrainTicks(engine, ticks);
+            return pcm;
+        }
+
+        // One channel of interleaved pcm.
+        inline std::vector<int16_t> Channel(const std::vector<int16_t> &pcm, int channels, int channel)
+        {
+            std::vector<int16_t> result;
+            for (size_t i = static_cast<size_t>(channel); i < pcm.size(); i += static_cast<size_t>(channels))
+            {
+                result.push_back(pcm[i]);
+            }
+            return result;
+        }
+
+        inline std::string TempPath(const char *name)
+        {
+            return testing::TempDir() + name;
+        }
+
+        // Stops recording after what the engine has rendered and closes the
+        // journal there, the way a stream ends a recording.
+        inline void FinishJournal(ClickEngine &engine, CommandJournal &journal)
+        {
+            engine.SetJournal(nullptr);
+            engine.ApplyPending();
+            journal.Close(engine.Position());
+        }
+    }
+}
+
+#endif // METRONOME_TEST_ENGINE_FIXTURES_H_
@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/resource.h>
+#endif
+
+#include "engine_fixtures.h"
+#include "metronome_export.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            Song ExportSong(int bars)
+            {
+                Song song;
+                song.sampleRate = 22050;
+                song.bars = bars;
+                song.tempoMap = {{0, 150.0}};
+                song.kit = FlatKit(200, 4000, 9000);
+                return song;
+            }
+
+            bool Exists(const std::string &path)
+            {
+                return static_cast<bool>(std::ifstream(path));
+            }
+
+            // Every report, grouped by job in the order they arrived.
+            class ProgressLog
+            {
+            public:
+                void Add(const ExportProgress &progress)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    reports[progress.jobId].push_back(progress);
+                    threads[progress.jobId].push_back(std::this_thread::get_id());
+                }
+
+                std::vector<ExportProgress> For(int jobId)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return reports[jobId];
+                }
+
+                std::vector<std::thread::id> ThreadsFor(int jobId)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return threads[jobId];
+                }
+
+            private:
+                std::mutex mutex;
+                std::map<int, std::vector<ExportProgress>> reports;
+                std::map<int, std::vector<std::thread::id>> threads;
+            };
+
+            std::vector<ExportState> States(const std::vector<ExportProgress> &reports)
+            {
+                std::vector<ExportState> states;
+                for (const ExportProgress &report : reports)
+                {
+                    states.push_back(report.state);
+                }
+                return states;
+            }
+        }
+
+        TEST(BatchExporterTest, ReportsEachJobInOrder)
+        {
+            ProgressLog log;
+            std::vector<int> ids;
+            std::vector<std::string> paths;
+            {
+                BatchExporter exporter([&](const ExportProgress &progress)
+                                       { log.Add(progress); },
+                                       3);
+                for (int i = 0; i < 6; i++)
+                {
+                    paths.push_back(TempPath(("order" + std::to_string(i) + (i % 2 ? ".flac" : ".wav")).c_str()));
+                    ids.push_back(exporter.Submit(
+                        ExportJob{ExportSong(20 + 10 * i), paths.back(), i % 2 ? AudioFileFormat::Flac : AudioFileFormat::Wav}));
+                }
+                exporter.Wait();
+            }
+
+            for (size_t i = 0; i < ids.size(); i++)
+            {
+                const std::vector<ExportProgress> reports = log.For(ids[i]);
+                ASSERT_GE(reports.size(), 3u);
+                EXPECT_EQ(reports.front().state, ExportState::Queued);
+                EXPECT_EQ(reports[1].state, ExportState::Running);
+                EXPECT_EQ(reports[1].progress, 0.0);
+                // Queued comes from Submit's caller, the rest from a worker.
+                EXPECT_EQ(log.ThreadsFor(ids[i]).front(), std::this_thread::get_id());
+                EXPECT_NE(log.ThreadsFor(ids[i])[1], std::this_thread::get_id());
+                for (size_t r = 2; r + 1 < reports.size(); r++)
+                {
+                    EXPECT_EQ(reports[r].state, ExportState::Running);
+                    EXPECT_GT(reports[r].progress, reports[r - 1].progress);
+                    EXPECT_LT(reports[r].progress, 1.0);
+                }
+                EXPECT_EQ(reports.back().state, ExportState::Done);
+                EXPECT_EQ(reports.back().progress, 1.0);
+                EXPECT_TRUE(reports.back().error.empty());
+                EXPECT_TRUE(Exists(paths[i]));
+                std::remove(paths[i].c_str());
+            }
+        }
+
+        TEST(BatchExporterTest, CancelsQueuedJobsWithoutCreatingFiles)
+        {
+            ProgressLog log;
+            const std::string path = TempPath("cancel_queued.wav");
+            std::remove(path.c_str());
+            BatchExporter *self = nullptr;
+            // Cancels from the Queued report, which comes before any worker
+            // can take the job.
+            BatchExporter exporter([&](const ExportProgress &progress)
+                                   {
+                                       log.Add(progress);
+                                       if (progress.state == ExportState::Queued)
+                                       {
+                                           self->Cancel(progress.jobId);
+                                       } },
+                                   1);
+            self = &exporter;
+            const int id = exporter.Submit(ExportJob{ExportSong(8), path, AudioFileFormat::Wav});
+            exporter.Wait();
+
+            EXPECT_EQ(States(log.For(id)), (std::vector<ExportState>{ExportState::Queued, ExportState::Cancelled}));
+            EXPECT_FALSE(Exists(path));
+        }
+
+        TEST(BatchExporterTest, CancellingARunningJobRemovesItsFile)
+        {
+            ProgressLog log;
+            const std::string path = TempPath("cancel_running.flac");
+            BatchExporter *self = nullptr;
+            // Cancels from the first progress report, so the job is known
+            // to be mid-render and to have created its file.
+            BatchExporter exporter([&](const ExportProgress &progress)
+                                   {
+                                       log.Add(progress);
+                                       if (progress.state == ExportState::Running && progress.progress > 0.0)
+                                       {
+                                           self->Cancel(progress.jobId);
+                                       } },
+                                   2);
+            self = &exporter;
+            const int cancelled = exporter.Submit(ExportJob{ExportSong(200), path, AudioFileFormat::Flac});
+            exporter.Wait();
+
+            const std::vector<ExportProgress> reports = log.For(cancelled);
+            EXPECT_EQ(States(reports),
+                      (std::vector<ExportState>{ExportState::Queued, ExportState::Running, ExportState::Running,
+                                                ExportState::Cancelled}));
+            EXPECT_FALSE(Exists(path));
+        }
+
+        TEST(BatchExporterTest, CancelAllStopsEveryJob)
+        {
+            ProgressLog log;
+            std::vector<int> ids;
+            std::vector<std::string> paths;
+            {
+                BatchExporter exporter([&](const ExportProgress &progress)
+                                       { log.Add(progress); },
+                                       2);
+                for (int i = 0; i < 5; i++)
+                {
+                    paths.push_back(TempPath(("cancel_all" + std::to_string(i) + ".wav").c_str()));
+                    ids.push_back(exporter.Submit(ExportJob{ExportSong(1000), paths.back(), AudioFileFormat::Wav}));
+                }
+                exporter.CancelAll();
+                exporter.Wait();
+            }
+            for (size_t i = 0; i < ids.size(); i++)
+            {
+                EXPECT_EQ(log.For(ids[i]).back().state, ExportState::Cancelled);
+                EXPECT_FALSE(Exists(paths[i]));
+            }
+        }
+
+        TEST(BatchExporterTest, FailedJobLeavesOtherFilesAlone)
+        {
+            ProgressLog log;
+            const std::string path = TempPath("failed_song.wav");
+            std::ofstream(path) << "keep";
+            Song broken = ExportSong(4);
+            broken.kit.mainSound.clear();
+            {
+                BatchExporter exporter([&](const ExportProgress &progress)
+                                       { log.Add(progress); },
+                                       1);
+                const int id = exporter.Submit(ExportJob{broken, path, AudioFileFormat::Wav});
+                exporter.Wait();
+
+                const std::vector<ExportProgress> reports = log.For(id);
+                EXPECT_EQ(States(reports), (std::vector<ExportState>{ExportState::Queued, ExportState::Failed}));
+                EXPECT_FALSE(reports.back().error.empty());
+            }
+            // The song was refused before the job opened anything, so a
+            // file already at the path is not the job's to remove.
+            std::string contents;
+            std::ifstream(path) >> contents;
+            EXPECT_EQ(contents, "keep");
+            std::remove(path.c_str());
+        }
+
+#ifndef _WIN32
+        TEST(BatchExporterTest, FailedWriteRemovesThePartialFile)
+        {
+            ProgressLog log;
+            const std::string path = TempPath("failed_write.wav");
+            // Caps the size of any file this process writes, so the export
+            // fails part way with EFBIG instead of a signal.
+            rlimit saved;
+            ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &saved), 0);
+            void (*handler)(int) = std::signal(SIGXFSZ, SIG_IGN);
+            rlimit capped = saved;
+            capped.rlim_cur = 64 * 1024;
+            ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &capped), 0);
+            {
+                BatchExporter exporter([&](const ExportProgress &progress)
+                                       { log.Add(progress); },
+                                       1);
+                const int id = exporter.Submit(ExportJob{ExportSong(100), path, AudioFileFormat::Wav});
+                exporter.Wait();
+
+                const std::vector<ExportProgress> reports = log.For(id);
+                ASSERT_GE(reports.size(), 3u);
+                EXPECT_EQ(reports[1].state, ExportState::Running);
+                EXPECT_EQ(reports.back().state, ExportState::Failed);
+                EXPECT_FALSE(reports.back().error.empty());
+            }
+            setrlimit(RLIMIT_FSIZE, &saved);
+            std::signal(SIGXFSZ, handler);
+            EXPECT_FALSE(Exists(path));
+        }
+#endif
+    }
+}
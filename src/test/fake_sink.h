@@ -0,0 +1,188 @@
+#ifndef METRONOME_TEST_FAKE_SINK_H_
+#define METRONOME_TEST_FAKE_SINK_H_
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include "metronome_sink.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        // A device simulated in frames instead of time. The test moves its
+        // clock with Play(); while running it consumes one queued frame per
+        // clock frame, stops with an xrun when the queue runs dry, and
+        // records what came out at every clock frame, interleaved like the
+        // stream wrote it.
+        //
+        // Faults are injected by the test: Unplug() loses the device,
+        // Stall() stops it without a word, failOpens makes the next opens
+        // fail as if no device were there, and deviceChanged reports a new
+        // default device.
+        class FakeSink : public AudioSink
+        {
+        public:
+            SinkConfig Open(const SinkConfig &requested) override
+            {
+                if (failOpens > 0)
+                {
+                    failOpens--;
+                    throw std::runtime_error("No output device");
+                }
+                deviceChanged = false;
+                config = requested;
+                queue.clear();
+                state = State::Prepared;
+                opened++;
+                return config;
+            }
+
+            void Close() override
+            {
+                state = State::Closed;
+            }
+
+            SinkStatus Wait(int, size_t &writable) override
+            {
+                writable = 0;
+                if (state == State::Gone)
+                {
+                    return SinkStatus::Lost;
+                }
+                if (state == State::Stopped)
+                {
+                    return SinkStatus::Xrun;
+                }
+                writable = config.BufferFrames() - QueuedFrames();
+                return SinkStatus::Ok;
+            }
+
+            SinkStatus Begin(size_t frames, int16_t *&area, size_t &granted) override
+            {
+                if (state == State::Gone)
+                {
+                    return SinkStatus::Lost;
+                }
+                staging.resize(frames * Channels());
+                area = staging.data();
+                granted = frames;
+                return SinkStatus::Ok;
+            }
+
+            SinkStatus Commit(size_t frames) override
+            {
+                if (state == State::Gone)
+                {
+                    return SinkStatus::Lost;
+                }
+                if (state == State::Stopped)
+                {
+                    return SinkStatus::Xrun;
+                }
+                queue.insert(queue.end(), staging.begin(), staging.begin() + frames * Channels());
+                if (state == State::Prepared && QueuedFrames() + static_cast<size_t>(config.periodFrames) > config.BufferFrames())
+                {
+                    state = State::Running;
+                }
+                return SinkStatus::Ok;
+            }
+
+            SinkStatus Recover(int64_t &lostFrames) override
+            {
+                if (state == State::Gone)
+                {
+                    return SinkStatus::Lost;
+                }
+                lostFrames = clock - stoppedAt;
+                state = State::Prepared;
+                return SinkStatus::Ok;
+            }
+
+            void Drop() override
+            {
+                queue.clear();
+                if (state != State::Gone)
+                {
+                    state = State::Prepared;
+                }
+            }
+
+            bool DeviceChanged() override { return deviceChanged; }
+
+            void Play(size_t frames)
+            {
+                for (size_t i = 0; i < frames; i++, clock++)
+                {
+                    if (state == State::Running && queue.empty())
+                    {
+                        state = State::Stopped;
+                        stoppedAt = clock;
+                    }
+                    if (state != State::Running)
+                    {
+                        output.insert(output.end(), Channels(), 0);
+                        continue;
+                    }
+                    for (size_t channel = 0; channel < Channels(); channel++)
+                    {
+                        output.push_back(queue.front());
+                        queue.pop_front();
+                    }
+                }
+            }
+
+            // The device disappears; it stays silent until reopened.
+            void Unplug()
+            {
+                queue.clear();
+                state = State::Gone;
+            }
+
+            // The device stops taking frames but reports nothing wrong, like
+            // a waveOut queue whose blocks stop coming back; it stays silent
+            // with its queue full until reopened.
+            void Stall()
+            {
+                if (state != State::Gone)
+                {
+                    state = State::Stalled;
+                }
+            }
+
+            bool Running() const { return state == State::Running; }
+            int64_t Clock() const { return clock; }
+
+            // What the device played at each clock frame.
+            std::vector<int16_t> output;
+            int opened = 0;
+            int failOpens = 0;
+            bool deviceChanged = false;
+
+        private:
+            size_t Channels() const { return static_cast<size_t>(config.channels); }
+            size_t QueuedFrames() const { return queue.size() / Channels(); }
+
+            enum class State
+            {
+                Closed,
+                Prepared,
+                Running,
+                Stopped,
+                Stalled,
+                Gone,
+            };
+
+            SinkConfig config;
+            State state = State::Closed;
+            std::deque<int16_t> queue;
+            std::vector<int16_t> staging;
+            int64_t clock = 0;
+            int64_t stoppedAt = 0;
+        };
+    }
+}
+
+#endif // METRONOME_TEST_FAKE_SINK_H_
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // 120 BPM at 8 kHz: a 4/4 bar is 16000 frames.
+            constexpr int kSampleRate = 8000;
+            constexpr int kBar = 16000;
+
+            // Whether each bar's downbeat was heard, checking that its ticks
+            // agree.
+            std::vector<bool> HeardBars(ClickEngine &engine, int bars)
+            {
+                const int64_t start = engine.Position();
+                std::vector<TickEvent> ticks;
+                const std::vector<int16_t> pcm = Render(engine, static_cast<size_t>(bars) * kBar, ticks);
+                std::vector<bool> heard;
+                for (int bar = 0; bar < bars; bar++)
+                {
+                    heard.push_back(pcm[static_cast<size_t>(bar) * kBar] != 0);
+                }
+                EXPECT_EQ(ticks.size(), static_cast<size_t>(bars) * 4);
+                for (const TickEvent &tick : ticks)
+                {
+                    const size_t offset = static_cast<size_t>(tick.frame - start);
+                    EXPECT_EQ(tick.muted, !heard[offset / kBar]) << tick.frame;
+                    EXPECT_EQ(pcm[offset] == 0, tick.muted) << tick.frame;
+                }
+                return heard;
+            }
+        }
+
+        TEST(GapClickTest, PlaysThenMutesFromTheNextBar)
+        {
+            ClickEngine engine(FlatKit(100, 1000, 2000), 120.0, 4, 1.0, kSampleRate);
+            std::vector<TickEvent> ticks;
+            Render(engine, 5000, ticks);
+            engine.SetGapClick(2, 1);
+            Render(engine, kBar - 5000, ticks);
+            EXPECT_FALSE(ticks.back().muted);
+
+            const std::vector<bool> heard = HeardBars(engine, 7);
+            EXPECT_EQ(heard, (std::vector<bool>{true, true, false, true, true, false, true}));
+
+            // Off again from the next bar line.
+            engine.SetGapClick(1, 0);
+            EXPECT_EQ(HeardBars(engine, 3), (std::vector<bool>{true, true, true}));
+        }
+
+        TEST(GapClickTest, RandomisedBarsFollowTheSeed)
+        {
+            ClickEngine a(FlatKit(100, 1000, 2000), 120.0, 4, 1.0, kSampleRate);
+            ClickEngine b(FlatKit(100, 1000, 2000), 120.0, 4, 1.0, kSampleRate);
+            a.SetGapClick(1, 1, true, 1234);
+            b.SetGapClick(1, 1, true, 1234);
+            const std::vector<bool> heard = HeardBars(a, 64);
+            EXPECT_EQ(HeardBars(b, 64), heard);
+
+            int muted = 0;
+            for (bool bar : heard)
+            {
+                muted += bar ? 0 : 1;
+            }
+            EXPECT_GT(muted, 16);
+            EXPECT_LT(muted, 48);
+        }
+
+        TEST(GapClickTest, MutesTheGridToo)
+        {
+            Kit kit = FlatKit(100, 1000, 2000);
+            kit.samples.push_back(std::vector<int16_t>(100, 300));
+            ClickEngine engine(kit, 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(4);
+            engine.SetGridCell(1, 0, 2, 127);
+            engine.SetGapClick(1, 1);
+            std::vector<TickEvent> ticks;
+            const std::vector<int16_t> pcm = Render(engine, 2 * kBar, ticks);
+            EXPECT_EQ(pcm[4000], 300);
+            EXPECT_EQ(pcm[kBar + 4000], 0);
+        }
+
+        TEST(GapClickTest, RejectsBadCounts)
+        {
+            ClickEngine engine(FlatKit(100, 1000, 2000), 120.0, 4, 1.0, kSampleRate);
+            EXPECT_THROW(engine.SetGapClick(0, 2), std::invalid_argument);
+            EXPECT_THROW(engine.SetGapClick(4, 256), std::invalid_argument);
+            EXPECT_THROW(engine.SetGapClick(4, -1), std::invalid_argument);
+        }
+
+        // Recording starts inside a muted bar of a randomised cycle.
+        TEST(GapClickTest, JournalReplaysMutedBars)
+        {
+            const std::string path = TempPath("gap.mtj");
+            ClickEngine engine(FlatKit(100, 1000, 2000), 131.0, 3, 1.0, 44100);
+            engine.SetGapClick(2, 2, true, 99);
+            std::vector<TickEvent> ticks;
+            while (ticks.empty() || !ticks.back().muted)
+            {
+                Render(engine, 4410, ticks);
+            }
+
+            std::vector<int16_t> recorded;
+            {
+                CommandJournal journal(path, 44100);
+                engine.SetJournal(&journal);
+                for (int block = 0; block < 200; block++)
+                {
+                    if (block == 120)
+                    {
+                        engine.SetGapClick(3, 1);
+                    }
+                    const std::vector<int16_t> pcm = Render(engine, 1001, ticks);
+                    recorded.insert(recorded.end(), pcm.begin(), pcm.end());
+                }
+                FinishJournal(engine, journal);
+            }
+            EXPECT_EQ(RenderJournal(ReadJournal(path)), recorded);
+            std::remove(path.c_str());
+        }
+    }
+}
@@ -0,0 +1,226 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // 120 BPM at 8 kHz: a 4/4 bar is 16000 frames, an eighth 2000.
+            constexpr int kSampleRate = 8000;
+
+            int16_t Scaled(int sample, int velocity)
+            {
+                return static_cast<int16_t>(std::lround(sample * (velocity / 127.0)));
+            }
+        }
+
+        TEST(StepGridTest, StepsSplitTheBarAndReplaceTheClick)
+        {
+            ClickEngine engine(GridKit(100), 120.0, 4, 1.0, kSampleRate);
+            StepGrid grid;
+            grid.steps = 8;
+            for (int step = 0; step < 8; step += 2)
+            {
+                grid.cells[step][0] = GridCell{2, 127};
+            }
+            grid.cells[3][1] = GridCell{3, 64};
+            engine.SetGrid(grid);
+
+            const std::vector<int16_t> pcm = Render(engine, 32000);
+            for (int bar = 0; bar < 2; bar++)
+            {
+                const size_t start = static_cast<size_t>(bar) * 16000;
+                EXPECT_EQ(pcm[start], 300);
+                EXPECT_EQ(pcm[start + 2000], 0) << "an empty step stays silent";
+                EXPECT_EQ(pcm[start + 4000], 300);
+                EXPECT_EQ(pcm[start + 6000], Scaled(-500, 64));
+                EXPECT_EQ(pcm[start + 12000], 300);
+            }
+
+            // Beats are still reported for the UI.
+            std::vector<TickEvent> ticks;
+            DrainTicks(engine, ticks);
+            ASSERT_EQ(ticks.size(), 8u);
+            for (size_t i = 0; i < ticks.size(); i++)
+            {
+                EXPECT_EQ(ticks[i].frame, static_cast<int64_t>(i) * 4000);
+            }
+        }
+
+        TEST(StepGridTest, LanesMixAndClip)
+        {
+            Kit kit = GridKit(100);
+            kit.samples[0].assign(100, 30000);
+            ClickEngine engine(kit, 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(4);
+            engine.SetGridCell(0, 0, 2, 127);
+            engine.SetGridCell(0, 1, 3, 127);
+            engine.SetGridCell(1, 0, 2, 127);
+            engine.SetGridCell(1, 5, 2, 127);
+            const std::vector<int16_t> pcm = Render(engine, 16000);
+            EXPECT_EQ(pcm[0], 29500);
+            EXPECT_EQ(pcm[4000], 32767);
+            EXPECT_EQ(pcm[4100], 0);
+        }
+
+        TEST(StepGridTest, LaneChokesItsPreviousSample)
+        {
+            ClickEngine engine(GridKit(5000), 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(8);
+            engine.SetGridCell(0, 0, 2, 127);
+            engine.SetGridCell(1, 0, 3, 127);
+            engine.SetGridCell(1, 1, 2, 127);
+            const std::vector<int16_t> pcm = Render(engine, 8000);
+            EXPECT_EQ(pcm[1999], 300);
+            // Lane 0 switched to the hat; lane 1 plays the kick over it.
+            EXPECT_EQ(pcm[2000], -500 + 300);
+            EXPECT_EQ(pcm[6999], -500 + 300);
+            EXPECT_EQ(pcm[7000], 0);
+        }
+
+        TEST(StepGridTest, EditsAreHeardLive)
+        {
+            ClickEngine engine(GridKit(100), 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(4);
+            engine.SetGridCell(2, 0, 2, 127);
+            std::vector<int16_t> pcm = Render(engine, 7000);
+            EXPECT_EQ(pcm[0], 0);
+
+            // Step 2 at frame 8000 is still to come in this bar.
+            engine.SetGridCell(2, 0, 3, 100);
+            engine.SetGridCell(3, 4, 2, 127);
+            pcm = Render(engine, 9000);
+            EXPECT_EQ(pcm[1000], Scaled(-500, 100));
+            EXPECT_EQ(pcm[5000], 300);
+
+            engine.SetGridCell(2, 0, 3, 0);
+            pcm = Render(engine, 16000);
+            EXPECT_EQ(pcm[8000], 0);
+        }
+
+        TEST(StepGridTest, StepCountChangesAtTheBarLine)
+        {
+            ClickEngine engine(GridKit(100), 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(2);
+            engine.SetGridCell(1, 0, 2, 127);
+            engine.SetGridCell(3, 0, 3, 127);
+            std::vector<int16_t> pcm = Render(engine, 5000);
+            EXPECT_EQ(pcm[0], 0);
+            EXPECT_EQ(pcm[4000], 0);
+
+            engine.SetGridSteps(4);
+            pcm = Render(engine, 11000);
+            EXPECT_EQ(pcm[3000], 300) << "the bar keeps its two steps";
+            EXPECT_EQ(pcm[7000], 0) << "so there is no step 3 yet";
+
+            pcm = Render(engine, 16000);
+            EXPECT_EQ(pcm[4000], 300);
+            EXPECT_EQ(pcm[12000], -500);
+
+            // Back to the click from the next bar.
+            engine.SetGridSteps(0);
+            pcm = Render(engine, 16000);
+            EXPECT_EQ(pcm[0], 2000);
+            EXPECT_EQ(pcm[4000], 1000);
+        }
+
+        TEST(StepGridTest, SetGridQueuesOnlyChanges)
+        {
+            ClickEngine engine(GridKit(100), 120.0, 4, 1.0, kSampleRate);
+            StepGrid grid;
+            grid.steps = kMaxGridSteps;
+            for (auto &lanes : grid.cells)
+            {
+                for (GridCell &cell : lanes)
+                {
+                    cell = GridCell{2, 90};
+                }
+            }
+            // Each resend would overflow the command queue if it were sent
+            // whole.
+            for (int i = 0; i < 8; i++)
+            {
+                grid.cells[i][i % kGridLanes].velocity = static_cast<uint8_t>(10 + i);
+                ASSERT_NO_THROW(engine.SetGrid(grid)) << i;
+            }
+
+            grid.cells[0][0].velocity = 200;
+            EXPECT_THROW(engine.SetGrid(grid), std::invalid_argument);
+            EXPECT_THROW(engine.SetGridCell(kMaxGridSteps, 0, 2, 100), std::invalid_argument);
+            EXPECT_THROW(engine.SetGridCell(0, kGridLanes, 2, 100), std::invalid_argument);
+            EXPECT_THROW(engine.SetGridSteps(kMaxGridSteps + 1), std::invalid_argument);
+        }
+
+        TEST(StepGridTest, TempoChangeStretchesTheStep)
+        {
+            ClickEngine engine(GridKit(100), 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(8);
+            engine.SetGridCell(1, 0, 2, 127);
+            engine.SetGridCell(2, 0, 2, 127);
+            Render(engine, 1000);
+            engine.SetBpm(60.0);
+            const std::vector<int16_t> pcm = Render(engine, 8000);
+            // The step in progress becomes 4000 frames long, the next too.
+            EXPECT_EQ(pcm[1000], 0);
+            EXPECT_EQ(pcm[3000], 300);
+            EXPECT_EQ(pcm[7000], 300);
+        }
+
+        // A grid with lanes still sounding when recording starts, edited
+        // while recording, replays exactly.
+        TEST(StepGridTest, JournalReplaysGridSession)
+        {
+            const std::string path = TempPath("grid.mtj");
+            ClickEngine engine(GridKit(3000), 97.0, 4, 0.8, 44100);
+            engine.SetGridSteps(16);
+            for (int step = 0; step < 16; step++)
+            {
+                engine.SetGridCell(step, step % 3, step % 4, 40 + step * 5);
+            }
+            Render(engine, 8000);
+
+            std::vector<int16_t> recorded;
+            {
+                CommandJournal journal(path, 44100);
+                engine.SetJournal(&journal);
+                const size_t sizes[] = {512, 441, 1024, 97, 2048};
+                for (size_t block = 0; block < 120; block++)
+                {
+                    if (block == 20)
+                    {
+                        engine.SetGridCell(5, 7, 3, 127);
+                        engine.SetBpm(133.0);
+                    }
+                    if (block == 50)
+                    {
+                        Kit kit = GridKit(900);
+                        kit.samples.push_back(std::vector<int16_t>(400, 7000));
+                        engine.SetKit(kit);
+                        engine.SetGridCell(0, 6, 4, 100);
+                    }
+                    if (block == 80)
+                    {
+                        engine.SetGridSteps(12);
+                        engine.SetMeter(7, 8, {2, 2, 3});
+                    }
+                    const std::vector<int16_t> pcm = Render(engine, sizes[block % 5]);
+                    recorded.insert(recorded.end(), pcm.begin(), pcm.end());
+                }
+                FinishJournal(engine, journal);
+            }
+            EXPECT_EQ(RenderJournal(ReadJournal(path)), recorded);
+            std::remove(path.c_str());
+        }
+    }
+}
@@ -0,0 +1,230 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // Renders blocks of varying size, issuing control commands between
+            // some of them the way a UI thread would.
+            std::vector<int16_t> RunSession(ClickEngine &engine, size_t blocks)
+            {
+                std::vector<int16_t> pcm;
+                const size_t sizes[] = {512, 441, 1024, 97, 2048};
+                for (size_t block = 0; block < blocks; block++)
+                {
+                    switch (block)
+                    {
+                    case 10:
+                        engine.SetBpm(133.7);
+                        break;
+                    case 15:
+                        engine.SetMeter(7, 8, {2, 2, 3});
+                        break;
+                    case 25:
+                        engine.SetTimeSignature(3);
+                        engine.SetVolume(0.6);
+                        break;
+                    case 40:
+                        engine.SetKit(FlatKit(900, 5000, -7000));
+                        break;
+                    case 55:
+                        engine.Restart();
+                        engine.SetBpm(71.0);
+                        break;
+                    case 62:
+                        engine.SetMeter(12, 8, {3, 3, 3, 3}, true);
+                        break;
+                    case 70:
+                        engine.SetTimeSignature(7);
+                        break;
+                    }
+                    const size_t size = sizes[block % 5];
+                    const size_t offset = pcm.size();
+                    pcm.resize(offset + size);
+                    engine.Render(pcm.data() + offset, size);
+                }
+                return pcm;
+            }
+        }
+
+        TEST(ClickEngineTest, OutputIndependentOfBlockSize)
+        {
+            ClickEngine a(FlatKit(300, 1000, 2000), 120.0, 4, 1.0, 44100);
+            ClickEngine b(FlatKit(300, 1000, 2000), 120.0, 4, 1.0, 44100);
+            std::vector<int16_t> pcmA(100000), pcmB(100000);
+            a.Render(pcmA.data(), pcmA.size());
+            for (size_t offset = 0; offset < pcmB.size(); offset += 333)
+            {
+                b.Render(pcmB.data() + offset, std::min<size_t>(333, pcmB.size() - offset));
+            }
+            EXPECT_EQ(pcmA, pcmB);
+        }
+
+        TEST(ClickEngineTest, ReportsTicksWithAccents)
+        {
+            ClickEngine engine(FlatKit(10, 1000, 2000), 120.0, 3, 1.0, 48000);
+            std::vector<int16_t> pcm(48000 * 2);
+            engine.Render(pcm.data(), pcm.size());
+            std::vector<TickEvent> ticks;
+            DrainTicks(engine, ticks);
+            ASSERT_EQ(ticks.size(), 4u);
+            for (size_t i = 0; i < ticks.size(); i++)
+            {
+                EXPECT_EQ(ticks[i].frame, static_cast<int64_t>(i) * 24000);
+                EXPECT_EQ(ticks[i].beat, static_cast<int>(i % 3));
+                EXPECT_EQ(ticks[i].accent, i % 3 == 0 ? BeatAccent::Accented : BeatAccent::Normal);
+            }
+            EXPECT_EQ(pcm[24000], 1000);
+            EXPECT_EQ(pcm[0], 2000);
+        }
+
+        TEST(ClickEngineTest, SkipKeepsBeatGrid)
+        {
+            ClickEngine straight(FlatKit(3000, 1000, 2000), 113.0, 4, 1.0, 44100);
+            ClickEngine skipping(FlatKit(3000, 1000, 2000), 113.0, 4, 1.0, 44100);
+            std::vector<int16_t> expected(200000), pcm(200000);
+            straight.Render(expected.data(), expected.size());
+            skipping.Render(pcm.data(), 50000);
+            skipping.Skip(70000);
+            skipping.Render(pcm.data() + 50000, 80000);
+            EXPECT_TRUE(std::equal(pcm.begin(), pcm.begin() + 50000, expected.begin()));
+            EXPECT_TRUE(std::equal(pcm.begin() + 50000, pcm.begin() + 130000, expected.begin() + 120000));
+
+            // Clicks inside the gap were never heard, so they are not ticks.
+            TickEvent tick;
+            while (skipping.PopTick(tick))
+            {
+                EXPECT_TRUE(tick.frame < 50000 || tick.frame >= 120000) << tick.frame;
+            }
+        }
+
+        TEST(CommandJournalTest, ReplayReproducesSession)
+        {
+            const std::string path = TempPath("session.mtj");
+            ClickEngine engine(FlatKit(2000, 3000, 9000), 100.0, 4, 0.9, 44100);
+            std::vector<int16_t> recorded;
+            {
+                CommandJournal journal(path, 44100);
+                engine.SetJournal(&journal);
+                recorded = RunSession(engine, 90);
+                engine.SetJournal(nullptr);
+                std::vector<int16_t> block(64);
+                engine.Render(block.data(), block.size());
+                ASSERT_EQ(engine.ActiveJournal(), nullptr);
+                journal.Close(engine.Position() - 64);
+                EXPECT_EQ(journal.Dropped(), 0u);
+            }
+
+            const Journal journal = ReadJournal(path);
+            EXPECT_EQ(journal.sampleRate, 44100);
+            EXPECT_EQ(journal.kits.size(), 2u);
+            EXPECT_EQ(RenderJournal(journal), recorded);
+            std::remove(path.c_str());
+        }
+
+        // Recording can start mid-beat, with a click still sounding.
+        TEST(CommandJournalTest, ReplayFromMidStream)
+        {
+            const std::string path = TempPath("midstream.mtj");
+            ClickEngine engine(FlatKit(30000, 3000, 9000), 97.0, 5, 1.0, 48000);
+            std::vector<int16_t> warmup(12345);
+            engine.Render(warmup.data(), warmup.size());
+            engine.SetBpm(151.0);
+            // Recording starts with a meter felt in groups and another one
+            // waiting for the bar line.
+            engine.SetMeter(6, 8, {3, 3}, true);
+            engine.Render(warmup.data(), warmup.size());
+            engine.Render(warmup.data(), warmup.size());
+            engine.SetMeter(5, 4, {3, 2});
+            engine.Render(warmup.data(), 777);
+
+            std::vector<int16_t> recorded;
+            {
+                CommandJournal journal(path, 48000);
+                engine.SetJournal(&journal);
+                recorded = RunSession(engine, 80);
+                FinishJournal(engine, journal);
+            }
+            EXPECT_EQ(RenderJournal(ReadJournal(path)), recorded);
+            std::remove(path.c_str());
+        }
+
+        TEST(CommandJournalTest, ReplayRendersSkipsAsSilence)
+        {
+            const std::string path = TempPath("skip.mtj");
+            ClickEngine engine(FlatKit(5000, 3000, 9000), 140.0, 3, 1.0, 44100);
+            std::vector<int16_t> recorded(30000);
+            {
+                CommandJournal journal(path, 44100);
+                engine.SetJournal(&journal);
+                engine.Render(recorded.data(), 10000);
+                engine.Skip(12345);
+                engine.Render(recorded.data() + 10000, 20000);
+                journal.Close(engine.Position());
+            }
+            recorded.insert(recorded.begin() + 10000, 12345, 0);
+            EXPECT_EQ(RenderJournal(ReadJournal(path)), recorded);
+            std::remove(path.c_str());
+        }
+
+        // The master's clock is not in the journal, so its replay would
+        // click at the follower's own tempo.
+        TEST(CommandJournalTest, RefusesToReplayAFollower)
+        {
+            const std::string path = TempPath("follower.mtj");
+            ClickEngine master(FlatKit(500, 3000, 9000), 100.0, 4, 1.0, 44100);
+            ClickEngine follower(FlatKit(500, 1000, 2000), 120.0, 3, 1.0, 44100);
+            std::vector<int16_t> pcm(4096);
+            for (bool linkedFirst : {false, true})
+            {
+                if (linkedFirst)
+                {
+                    follower.Follow(&master, 1.5);
+                    master.Render(pcm.data(), pcm.size());
+                    follower.Render(pcm.data(), pcm.size());
+                }
+                {
+                    CommandJournal journal(path, 44100);
+                    follower.SetJournal(&journal);
+                    master.Render(pcm.data(), pcm.size());
+                    follower.Render(pcm.data(), pcm.size());
+                    if (!linkedFirst)
+                    {
+                        follower.Follow(&master, 2.0);
+                    }
+                    master.Render(pcm.data(), pcm.size());
+                    follower.Render(pcm.data(), pcm.size());
+                    follower.Follow(nullptr, 0.0);
+                    FinishJournal(follower, journal);
+                }
+                EXPECT_THROW(RenderJournal(ReadJournal(path)), std::invalid_argument) << linkedFirst;
+            }
+            std::remove(path.c_str());
+        }
+
+        TEST(CommandJournalTest, RejectsForeignFiles)
+        {
+            const std::string path = TempPath("foreign.mtj");
+            {
+                std::FILE *file = std::fopen(path.c_str(), "wb");
+                std::fputs("RIFF....", file);
+                std::fclose(file);
+            }
+            EXPECT_THROW(ReadJournal(path), std::invalid_argument);
+            std::remove(path.c_str());
+        }
+    }
+}
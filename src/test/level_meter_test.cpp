@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_seqlock.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // 120 BPM at 8 kHz: a 4/4 bar is 16000 frames, a beat 4000.
+            constexpr int kSampleRate = 8000;
+
+            float Full(int sample) { return sample / 32768.0f; }
+
+            // Words that must always be read as a set.
+            struct Stamp
+            {
+                uint64_t words[6];
+            };
+        }
+
+        TEST(LevelMeterTest, SeqlockNeverReturnsATornValue)
+        {
+            Seqlock<Stamp> stamps;
+            std::atomic<bool> done{false};
+            std::thread writer([&] {
+                for (uint64_t i = 1; i <= 200000; i++)
+                {
+                    Stamp stamp;
+                    for (uint64_t &word : stamp.words)
+                    {
+                        word = i;
+                    }
+                    stamps.Store(stamp);
+                }
+                done.store(true);
+            });
+            uint64_t last = 0;
+            while (!done.load())
+            {
+                const Stamp stamp = stamps.Load();
+                for (uint64_t word : stamp.words)
+                {
+                    ASSERT_EQ(word, stamp.words[0]);
+                }
+                EXPECT_GE(stamp.words[0], last);
+                last = stamp.words[0];
+            }
+            writer.join();
+            EXPECT_EQ(stamps.Load().words[0], 200000u);
+            EXPECT_EQ(stamps.Version(), 200001u);
+        }
+
+        TEST(LevelMeterTest, ClickBlockLevels)
+        {
+            Kit kit = FlatKit(100, 1000, 2000);
+            ClickEngine engine(kit, 120.0, 4, 0.5, kSampleRate);
+            Render(engine, 400);
+
+            const BlockLevels levels = engine.Levels();
+            EXPECT_EQ(levels.frame, 400);
+            EXPECT_EQ(levels.frames, 400);
+            EXPECT_FLOAT_EQ(levels.output.peak, Full(1000));
+            // A quarter of the block at 1000.
+            EXPECT_FLOAT_EQ(levels.output.rms, Full(500));
+            EXPECT_FLOAT_EQ(levels.click.peak, levels.output.peak);
+            EXPECT_FLOAT_EQ(levels.click.rms, levels.output.rms);
+            EXPECT_EQ(levels.lanes[0].peak, 0.0f);
+        }
+
+        TEST(LevelMeterTest, LanesAreMeteredApartFromTheMix)
+        {
+            Kit kit = FlatKit(100, 1000, 2000);
+            kit.samples = {std::vector<int16_t>(100, 20000), std::vector<int16_t>(100, -20000)};
+            ClickEngine engine(kit, 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(4);
+            engine.SetGridCell(0, 0, 2, 127);
+            engine.SetGridCell(0, 3, 3, 127);
+            engine.SetGridCell(0, 5, 2, 127);
+            Render(engine, 100);
+
+            const BlockLevels levels = engine.Levels();
+            EXPECT_FLOAT_EQ(levels.lanes[0].peak, Full(20000));
+            EXPECT_FLOAT_EQ(levels.lanes[0].rms, Full(20000));
+            EXPECT_FLOAT_EQ(levels.lanes[3].peak, Full(20000));
+            EXPECT_FLOAT_EQ(levels.lanes[5].rms, Full(20000));
+            EXPECT_EQ(levels.lanes[1].peak, 0.0f);
+            EXPECT_EQ(levels.click.peak, 0.0f);
+            // 20000 - 20000 + 20000, measured after mixing.
+            EXPECT_FLOAT_EQ(levels.output.peak, Full(20000));
+            EXPECT_FLOAT_EQ(levels.output.rms, Full(20000));
+        }
+
+        TEST(LevelMeterTest, ClippedMixIsMeteredAsHeard)
+        {
+            Kit kit = FlatKit(100, 1000, 2000);
+            kit.samples = {std::vector<int16_t>(100, 30000)};
+            ClickEngine engine(kit, 120.0, 4, 1.0, kSampleRate);
+            engine.SetGridSteps(4);
+            engine.SetGridCell(0, 0, 2, 127);
+            engine.SetGridCell(0, 1, 2, 127);
+            Render(engine, 100);
+
+            const BlockLevels levels = engine.Levels();
+            EXPECT_FLOAT_EQ(levels.output.peak, Full(32767));
+            EXPECT_FLOAT_EQ(levels.lanes[1].peak, Full(30000));
+        }
+
+        TEST(LevelMeterTest, SilentBlocksArePublishedOnce)
+        {
+            Kit kit = FlatKit(100, 1000, 2000);
+            ClickEngine engine(kit, 120.0, 4, 1.0, kSampleRate);
+            Render(engine, 100);
+            const uint32_t sounding = engine.LevelsVersion();
+            Render(engine, 100);
+            EXPECT_EQ(engine.LevelsVersion(), sounding + 1);
+            EXPECT_EQ(engine.Levels().output.peak, 0.0f);
+
+            for (int block = 0; block < 30; block++)
+            {
+                Render(engine, 100);
+            }
+            EXPECT_EQ(engine.LevelsVersion(), sounding + 1);
+
+            // The next beat at frame 4000 publishes again.
+            Render(engine, 900);
+            EXPECT_EQ(engine.LevelsVersion(), sounding + 2);
+            EXPECT_FLOAT_EQ(engine.Levels().output.peak, Full(1000));
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+#include "metronome_loudness.h"
+#include "metronome_renderer.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr double kPi = 3.14159265358979323846;
+
+            std::vector<int16_t> Sine(int sampleRate, double seconds, double frequency, double amplitude)
+            {
+                std::vector<int16_t> pcm(static_cast<size_t>(sampleRate * seconds));
+                for (size_t i = 0; i < pcm.size(); i++)
+                {
+                    pcm[i] = static_cast<int16_t>(
+                        std::lround(amplitude * std::sin(2.0 * kPi * frequency * static_cast<double>(i) / sampleRate)));
+                }
+                return pcm;
+            }
+
+            // Main at 8000, the accent twice as loud, a quiet grid sample and
+            // a silent one.
+            Kit UnevenKit(int sampleRate)
+            {
+                Kit kit{Sine(sampleRate, 0.5, 1000.0, 8000.0), Sine(sampleRate, 0.5, 1000.0, 16000.0)};
+                kit.samples = {Sine(sampleRate, 0.5, 1000.0, 2000.0), std::vector<int16_t>(100, 0)};
+                return kit;
+            }
+        }
+
+        // BS.1770 reads a full-scale 1 kHz sine as -3.01 LUFS at any rate.
+        TEST(LoudnessTest, FullScaleSineReadsMinusThree)
+        {
+            for (int sampleRate : {44100, 48000, 96000})
+            {
+                const SampleLoudness loudness = AnalyseLoudness(Sine(sampleRate, 1.0, 1000.0, 32767.0), sampleRate);
+                EXPECT_TRUE(loudness.analysed);
+                EXPECT_NEAR(loudness.peak, 1.0f, 1e-3f) << sampleRate;
+                EXPECT_NEAR(loudness.rms, 0.7071f, 1e-3f) << sampleRate;
+                EXPECT_NEAR(loudness.lufs, -3.01f, 0.05f) << sampleRate;
+            }
+        }
+
+        TEST(LoudnessTest, ShortSoundsAndSilence)
+        {
+            const SampleLoudness full = AnalyseLoudness(Sine(48000, 1.0, 1000.0, 16000.0), 48000);
+            // A tenth of a 400 ms window: 10 dB quieter.
+            const SampleLoudness click = AnalyseLoudness(Sine(48000, 0.04, 1000.0, 16000.0), 48000);
+            EXPECT_NEAR(click.lufs, full.lufs - 10.0f, 0.2f);
+            EXPECT_FLOAT_EQ(click.peak, full.peak);
+
+            const SampleLoudness silent = AnalyseLoudness(std::vector<int16_t>(1000, 0), 48000);
+            EXPECT_EQ(silent.lufs, kSilentLufs);
+            EXPECT_EQ(silent.peak, 0.0f);
+            EXPECT_THROW(AnalyseLoudness(std::vector<int16_t>(4, 1), 0), std::invalid_argument);
+        }
+
+        TEST(LoudnessTest, TrimsMatchTheMainSound)
+        {
+            Kit kit = UnevenKit(44100);
+            MatchKitLoudness(kit, 44100);
+            ASSERT_EQ(kit.trims.size(), 4u);
+            EXPECT_FLOAT_EQ(kit.Trim(0), 1.0f);
+            EXPECT_NEAR(kit.Trim(1), 0.5f, 0.01f);
+            EXPECT_NEAR(kit.Trim(2), 4.0f, 0.05f);
+            EXPECT_FLOAT_EQ(kit.Trim(3), 1.0f) << "silence is left alone";
+            EXPECT_FLOAT_EQ(kit.Trim(4), 1.0f) << "past the end";
+        }
+
+        TEST(LoudnessTest, BoostStopsShortOfClipping)
+        {
+            Kit kit{Sine(48000, 1.0, 1000.0, 20000.0), Sine(48000, 0.01, 1000.0, 20000.0)};
+            MatchKitLoudness(kit, 48000);
+            EXPECT_GT(kit.Trim(1), 1.0f);
+            EXPECT_LE(kit.Trim(1) * kit.loudness[1].peak, 1.0f);
+            EXPECT_NEAR(kit.Trim(1) * kit.loudness[1].peak, 1.0f, 1e-3f);
+        }
+
+        TEST(LoudnessTest, CachedResultsAreReused)
+        {
+            Kit kit = UnevenKit(8000);
+            AnalyseKit(kit, 8000);
+            kit.loudness[2].lufs = -20.0f;
+            kit.mainSound = Sine(8000, 0.5, 1000.0, 4000.0);
+            kit.ForgetLoudness(0);
+            AnalyseKit(kit, 8000);
+            EXPECT_EQ(kit.loudness[2].lufs, -20.0f);
+            EXPECT_NEAR(kit.loudness[0].peak, 4000.0f / 32768.0f, 1e-4f);
+        }
+
+        TEST(LoudnessTest, EngineAndRendererApplyTrims)
+        {
+            Kit kit = UnevenKit(8000);
+            kit.matchLoudness = true;
+            Kit trimmed = kit;
+            MatchKitLoudness(trimmed, 8000);
+
+            // The downbeat is accented.
+            ClickEngine engine(kit, 120.0, 4, 1.0, 8000);
+            std::vector<int16_t> pcm(8000);
+            engine.Render(pcm.data(), pcm.size());
+            EXPECT_EQ(pcm[2], static_cast<int16_t>(std::lround(kit.accentedSound[2] * trimmed.Trim(1))));
+            EXPECT_EQ(pcm[4000 + 2], kit.mainSound[2]);
+
+            // Grid steps are 4000 frames long.
+            engine.SetGridSteps(4);
+            engine.SetGridCell(1, 0, 2, 127);
+            engine.Render(pcm.data(), pcm.size());
+            engine.Render(pcm.data(), pcm.size());
+            EXPECT_EQ(pcm[4000 + 2], static_cast<int16_t>(std::lround(kit.samples[0][2] * trimmed.Trim(2))));
+
+            Song song;
+            song.sampleRate = 8000;
+            song.kit = kit;
+            OfflineRenderer renderer(song);
+            renderer.Render(pcm.data(), pcm.size());
+            EXPECT_EQ(pcm[2], static_cast<int16_t>(std::lround(kit.accentedSound[2] * trimmed.Trim(1))));
+            EXPECT_EQ(pcm[4000 + 2], kit.mainSound[2]);
+        }
+
+        TEST(LoudnessTest, JournalKeepsTheTrims)
+        {
+            const std::string path = TempPath("loudness.mtj");
+            ClickEngine engine(UnevenKit(8000), 97.0, 4, 0.8, 8000);
+            engine.SetGridSteps(8);
+            engine.SetGridCell(3, 0, 2, 100);
+            std::vector<int16_t> recorded(20000);
+            {
+                CommandJournal journal(path, 8000);
+                engine.SetJournal(&journal);
+                Kit kit = UnevenKit(8000);
+                kit.matchLoudness = true;
+                engine.SetKit(kit);
+                engine.Render(recorded.data(), recorded.size());
+                FinishJournal(engine, journal);
+            }
+            const Journal journal = ReadJournal(path);
+            bool trimmed = false;
+            for (const auto &entry : journal.kits)
+            {
+                trimmed = trimmed || !entry.second.trims.empty();
+            }
+            EXPECT_TRUE(trimmed);
+            EXPECT_EQ(RenderJournal(journal), recorded);
+            std::remove(path.c_str());
+        }
+    }
+}
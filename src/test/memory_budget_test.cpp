@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+#include "metronome_memory_budget.h"
+#include "metronome_pcm_ring.h"
+#include "metronome_render_ahead.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+
+            // 400 bytes once registered.
+            Kit BudgetKit(int16_t level)
+            {
+                return FlatKit(100, level, level);
+            }
+        }
+
+        TEST(MemoryBudgetTest, CountsReservationsPerComponent)
+        {
+            MemoryBudget budget(1000);
+            MemoryReservation kits = budget.Reserve(MemoryComponent::Kits, 300);
+            {
+                MemoryReservation rings = budget.Reserve(MemoryComponent::Rings, 500);
+                EXPECT_EQ(budget.Usage().used, 800u);
+                EXPECT_EQ(budget.Usage().Component(MemoryComponent::Rings), 500u);
+            }
+            MemoryReservation moved = std::move(kits);
+            EXPECT_EQ(kits.Bytes(), 0u);
+            const MemoryUsage usage = budget.Usage();
+            EXPECT_EQ(usage.limit, 1000u);
+            EXPECT_EQ(usage.used, 300u);
+            EXPECT_EQ(usage.Component(MemoryComponent::Kits), 300u);
+            EXPECT_EQ(usage.Component(MemoryComponent::Rings), 0u);
+            moved = MemoryReservation();
+            EXPECT_EQ(budget.Usage().used, 0u);
+        }
+
+        TEST(MemoryBudgetTest, RefusesWhatDoesNotFitEveryTime)
+        {
+            MemoryBudget budget(1000);
+            MemoryReservation held = budget.Reserve(MemoryComponent::Journal, 600);
+            for (int attempt = 0; attempt < 3; attempt++)
+            {
+                EXPECT_THROW(budget.Reserve(MemoryComponent::Rings, 401), std::runtime_error);
+            }
+            EXPECT_EQ(budget.Usage().refusals, 3u);
+            EXPECT_EQ(budget.Usage().used, 600u);
+            MemoryReservation rest = budget.Reserve(MemoryComponent::Rings, 400);
+            EXPECT_EQ(budget.Usage().used, 1000u);
+        }
+
+        TEST(MemoryBudgetTest, ZeroLimitOnlyKeepsCount)
+        {
+            MemoryBudget budget(0);
+            MemoryReservation big = budget.Reserve(MemoryComponent::Kits, size_t(1) << 40);
+            EXPECT_EQ(budget.Usage().used, size_t(1) << 40);
+            EXPECT_EQ(budget.Usage().refusals, 0u);
+            EXPECT_EQ(Reserve(nullptr, MemoryComponent::Kits, 123).Bytes(), 0u);
+        }
+
+        // A kit swap holds two kits until the audio thread lets go of the
+        // old one; a third only fits once it has.
+        TEST(MemoryBudgetTest, EngineFreesSupersededKitsBeforeRefusing)
+        {
+            MemoryBudget budget(800);
+            ClickEngine engine(BudgetKit(1000), 120.0, 4, 1.0, kSampleRate, 1, &budget);
+            EXPECT_EQ(budget.Usage().Component(MemoryComponent::Kits), 400u);
+            engine.SetKit(BudgetKit(2000));
+            EXPECT_EQ(budget.Usage().used, 800u);
+            EXPECT_THROW(engine.SetKit(BudgetKit(3000)), std::runtime_error) << "the first kit may still be playing";
+            EXPECT_EQ(budget.Usage().used, 800u);
+
+            Render(engine, 64);
+            engine.SetKit(BudgetKit(3000));
+            EXPECT_EQ(budget.Usage().used, 800u);
+            EXPECT_EQ(budget.Usage().refusals, 1u);
+
+            EXPECT_THROW(ClickEngine(BudgetKit(1), 120.0, 4, 1.0, kSampleRate, 1, &budget), std::runtime_error);
+        }
+
+        TEST(MemoryBudgetTest, RingsAndJournalsReserveTheirStorage)
+        {
+            MemoryBudget budget(1 << 16);
+            ClickEngine engine(BudgetKit(1000), 120.0, 4, 1.0, kSampleRate, 2, &budget);
+            {
+                PcmRing ring(1000, 2, &budget);
+                RenderAhead ahead(engine, 300, 100, &budget);
+                EXPECT_EQ(budget.Usage().Component(MemoryComponent::Rings), 1000u * 4 + 400u * 4);
+            }
+            EXPECT_EQ(budget.Usage().Component(MemoryComponent::Rings), 0u);
+            EXPECT_THROW(PcmRing(1 << 15, 2, &budget), std::runtime_error);
+
+            const std::string path = TempPath("budget.mtj");
+            {
+                CommandJournal journal(path, kSampleRate, 100, &budget);
+                EXPECT_EQ(budget.Usage().Component(MemoryComponent::Journal), 128 * sizeof(JournalEntry));
+            }
+            std::remove(path.c_str());
+            EXPECT_THROW(CommandJournal(path, kSampleRate, 1 << 16, &budget), std::runtime_error);
+            EXPECT_FALSE(std::ifstream(path).good()) << "a refused journal leaves no file";
+            EXPECT_EQ(budget.Usage().Component(MemoryComponent::Journal), 0u);
+        }
+    }
+}
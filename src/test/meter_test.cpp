@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_renderer.h"
+#include "metronome_timeline.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // 120 BPM at 8 kHz: a quarter is 4000 frames, an eighth 2000.
+            constexpr int kSampleRate = 8000;
+
+            Song GroupedSong(std::vector<MeterChange> meters, int bars)
+            {
+                Song song;
+                song.sampleRate = kSampleRate;
+                song.bars = bars;
+                song.meterMap = std::move(meters);
+                song.tempoMap.push_back(TempoSegment{0, 120.0});
+                song.kit = Kit{{1000}, {2000}};
+                return song;
+            }
+        }
+
+        TEST(MeterTest, GroupsAccentSevenEight)
+        {
+            const Timeline timeline = CompileTimeline(GroupedSong({{0, 7, 8, {2, 2, 3}}}, 1));
+            const BeatAccent expected[] = {BeatAccent::Accented, BeatAccent::Normal, BeatAccent::Group,
+                                           BeatAccent::Normal, BeatAccent::Group, BeatAccent::Normal,
+                                           BeatAccent::Normal};
+            ASSERT_EQ(timeline.events.size(), 7u);
+            for (size_t i = 0; i < timeline.events.size(); i++)
+            {
+                EXPECT_EQ(timeline.events[i].frame, static_cast<int64_t>(i) * 2000);
+                EXPECT_EQ(timeline.events[i].accent, expected[i]) << i;
+            }
+            EXPECT_EQ(timeline.length, 14000);
+        }
+
+        TEST(MeterTest, FeltInGroupsClicksGroupStartsOnly)
+        {
+            MeterChange sixEight{0, 6, 8, {3, 3}, true};
+            const Timeline timeline = CompileTimeline(GroupedSong({sixEight}, 2));
+            ASSERT_EQ(timeline.events.size(), 4u);
+            EXPECT_EQ(timeline.events[1].frame, 6000);
+            EXPECT_EQ(timeline.events[1].beat, 3);
+            EXPECT_EQ(timeline.events[1].accent, BeatAccent::Group);
+            EXPECT_EQ(timeline.events[2].frame, 12000);
+            EXPECT_EQ(timeline.events[2].accent, BeatAccent::Accented);
+        }
+
+        TEST(MeterTest, GroupAccentsPlayAccentedSoundSofter)
+        {
+            Song song = GroupedSong({{0, 5, 4, {3, 2}}}, 1);
+            OfflineRenderer renderer(song);
+            std::vector<int16_t> pcm(static_cast<size_t>(renderer.Length()));
+            renderer.Render(pcm.data(), pcm.size());
+            EXPECT_EQ(pcm[0], 2000);
+            EXPECT_EQ(pcm[4000], 1000);
+            EXPECT_EQ(pcm[12000], static_cast<int16_t>(2000 * kGroupAccentGain));
+        }
+
+        TEST(MeterTest, RejectsGroupsNotAddingUp)
+        {
+            EXPECT_THROW(CompileTimeline(GroupedSong({{0, 7, 8, {2, 2, 2}}}, 1)), std::invalid_argument);
+            EXPECT_THROW(CompileTimeline(GroupedSong({{0, 7, 6}}, 1)), std::invalid_argument);
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            EXPECT_THROW(engine.SetMeter(4, 4, {3, 0, 1}), std::invalid_argument);
+            EXPECT_THROW(engine.SetMeter(33, 16, std::vector<int>(33, 1)), std::invalid_argument);
+        }
+
+        // A meter change asked for mid-bar waits for the bar line, and the
+        // live engine then clicks exactly where the compiled song does.
+        TEST(MeterTest, EngineSwitchesAtBarLineLikeTimeline)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            std::vector<TickEvent> ticks;
+            Render(engine, 5000, ticks);
+            engine.SetMeter(7, 8, {2, 2, 3});
+            Render(engine, 16000 + 2 * 14000 - 5000, ticks);
+
+            const Timeline timeline = CompileTimeline(GroupedSong({{0, 4, 4}, {1, 7, 8, {2, 2, 3}}}, 3));
+            ASSERT_EQ(ticks.size(), timeline.events.size());
+            for (size_t i = 0; i < ticks.size(); i++)
+            {
+                EXPECT_EQ(ticks[i].frame, timeline.events[i].frame) << i;
+                EXPECT_EQ(ticks[i].beat, timeline.events[i].beat) << i;
+                EXPECT_EQ(ticks[i].accent, timeline.events[i].accent) << i;
+            }
+        }
+
+        TEST(MeterTest, EngineFeltInGroupsKeepsTempoChangesInStep)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            engine.SetMeter(6, 8, {3, 3}, true);
+            std::vector<TickEvent> ticks;
+            Render(engine, 13000, ticks);
+            ASSERT_EQ(ticks.size(), 3u);
+            EXPECT_EQ(ticks[1].frame, 6000);
+            EXPECT_EQ(ticks[1].beat, 3);
+            EXPECT_EQ(ticks[2].frame, 12000);
+            // Halving the tempo mid-group stretches the whole group.
+            engine.SetBpm(60.0);
+            ticks.clear();
+            Render(engine, 12000, ticks);
+            ASSERT_EQ(ticks.size(), 1u);
+            EXPECT_EQ(ticks[0].frame, 24000);
+            EXPECT_EQ(ticks[0].accent, BeatAccent::Group);
+        }
+    }
+}
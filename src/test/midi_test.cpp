@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "metronome_midi.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr uint32_t kDivision = 480;
+
+            struct Meta
+            {
+                uint32_t delta;
+                uint8_t type;
+                std::vector<uint8_t> data;
+            };
+
+            void PutBigEndian(std::vector<uint8_t> &out, uint32_t value, int bytes)
+            {
+                while (bytes-- > 0)
+                {
+                    out.push_back(static_cast<uint8_t>((value >> (8 * bytes)) & 0xFF));
+                }
+            }
+
+            // A type 0 file of meta-events, each delta under 16384 ticks.
+            std::vector<uint8_t> MidiFile(const std::vector<Meta> &events)
+            {
+                std::vector<uint8_t> track;
+                for (const Meta &event : events)
+                {
+                    if (event.delta >= 0x80)
+                    {
+                        track.push_back(static_cast<uint8_t>(0x80 | (event.delta >> 7)));
+                    }
+                    track.push_back(static_cast<uint8_t>(event.delta & 0x7F));
+                    track.push_back(0xFF);
+                    track.push_back(event.type);
+                    track.push_back(static_cast<uint8_t>(event.data.size()));
+                    track.insert(track.end(), event.data.begin(), event.data.end());
+                }
+                std::vector<uint8_t> file{'M', 'T', 'h', 'd'};
+                PutBigEndian(file, 6, 4);
+                PutBigEndian(file, 0, 2);
+                PutBigEndian(file, 1, 2);
+                PutBigEndian(file, kDivision, 2);
+                file.insert(file.end(), {'M', 'T', 'r', 'k'});
+                PutBigEndian(file, static_cast<uint32_t>(track.size()), 4);
+                file.insert(file.end(), track.begin(), track.end());
+                return file;
+            }
+
+            Meta TimeSignature(uint32_t delta, uint8_t numerator)
+            {
+                return Meta{delta, 0x58, {numerator, 2, 24, 8}};
+            }
+
+            Meta Marker(uint32_t delta, const std::string &text)
+            {
+                return Meta{delta, 0x06, std::vector<uint8_t>(text.begin(), text.end())};
+            }
+        }
+
+        // 3/4 from half way through the first 4/4 bar: it starts at the
+        // second bar line, and the bars after are counted from there.
+        TEST(MidiTest, MeterChangeOffTheBarLineCountsFromTheNextOne)
+        {
+            const Song song = ReadMidiFile(MidiFile({
+                TimeSignature(0, 4),
+                TimeSignature(2 * kDivision, 3),
+                Marker(kDivision, "in the first bar"),
+                Marker(2 * kDivision, "second bar, beat two"),
+                Meta{3 * kDivision, 0x51, {0x07, 0xA1, 0x20}},
+                Meta{2 * kDivision, 0x2F, {}},
+            }));
+
+            ASSERT_EQ(song.meterMap.size(), 2u);
+            EXPECT_EQ(song.meterMap[1].startBar, 1);
+            EXPECT_EQ(song.meterMap[1].numerator, 3);
+
+            ASSERT_EQ(song.markers.size(), 2u);
+            EXPECT_EQ(song.markers[0].bar, 0);
+            EXPECT_DOUBLE_EQ(song.markers[0].beatOffset, 3.0);
+            EXPECT_EQ(song.markers[1].bar, 1);
+            EXPECT_DOUBLE_EQ(song.markers[1].beatOffset, 1.0);
+
+            ASSERT_EQ(song.tempoMap.size(), 2u);
+            EXPECT_EQ(song.tempoMap[1].startBar, 2);
+            EXPECT_DOUBLE_EQ(song.tempoMap[1].beatOffset, 1.0);
+            EXPECT_DOUBLE_EQ(song.tempoMap[1].bpm, 120.0);
+            EXPECT_EQ(song.bars, 3);
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "fake_sink.h"
+#include "metronome_engine.h"
+#include "metronome_mirror_stream.h"
+#include "metronome_pcm_ring.h"
+#include "metronome_stream.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+            // 120 BPM at 8 kHz.
+            constexpr int64_t kBeatFrames = 4000;
+
+            SinkConfig TestConfig(int channels = 1)
+            {
+                SinkConfig config;
+                config.sampleRate = kSampleRate;
+                config.channels = channels;
+                config.periodFrames = 80;
+                config.periods = 4;
+                return config;
+            }
+
+            // Attaches mirror to stream and opens both, with main's frames
+            // as the clock they share.
+            void Attach(AudioStream &stream, FakeSink &main, MirrorStream &mirror)
+            {
+                auto clock = [&main]
+                { return AudioStream::Clock::time_point(std::chrono::nanoseconds(main.Clock() * 1000000000 / kSampleRate)); };
+                stream.SetClock(clock);
+                mirror.SetClock(clock);
+                stream.AddMirror(mirror);
+                stream.Open();
+                mirror.Open();
+            }
+
+            // Runs a stream and its mirror for seconds of the main device's
+            // time, with the mirror's clock skewPpm faster.
+            void PlayBoth(AudioStream &stream, FakeSink &main, MirrorStream &mirror, FakeSink &second, double seconds,
+                          double skewPpm)
+            {
+                const double secondRate = 1.0 + skewPpm * 1e-6;
+                double secondClock = static_cast<double>(second.Clock());
+                const int64_t end = main.Clock() + static_cast<int64_t>(seconds * kSampleRate);
+                while (main.Clock() < end)
+                {
+                    ASSERT_TRUE(stream.Pump(0));
+                    ASSERT_TRUE(mirror.Pump(0));
+                    main.Play(40);
+                    secondClock += 40 * secondRate;
+                    second.Play(static_cast<size_t>(std::llround(secondClock)) - static_cast<size_t>(second.Clock()));
+                }
+            }
+
+            // Where each click starts in output, from frame from on.
+            std::vector<int64_t> ClickStarts(const std::vector<int16_t> &output, size_t from)
+            {
+                std::vector<int64_t> starts;
+                for (size_t frame = from; frame < output.size(); frame++)
+                {
+                    if (std::abs(output[frame]) >= 500 && (starts.empty() || static_cast<int64_t>(frame) - starts.back() > 1000))
+                    {
+                        starts.push_back(static_cast<int64_t>(frame));
+                    }
+                }
+                return starts;
+            }
+
+            // A few milliseconds of tone, so clicks survive interpolation.
+            Kit ToneKit()
+            {
+                std::vector<int16_t> tone(40);
+                for (size_t i = 0; i < tone.size(); i++)
+                {
+                    tone[i] = static_cast<int16_t>(std::lround(12000.0 * std::sin(0.3 * static_cast<double>(i))));
+                }
+                return Kit{tone, tone};
+            }
+        }
+
+        TEST(PcmRingTest, WrapsAndCutsShortWhenFull)
+        {
+            PcmRing ring(5, 2);
+            const int16_t in[] = {1, 2, 3, 4, 5, 6, 7, 8};
+            EXPECT_EQ(ring.Write(in, 4), 4u);
+            int16_t out[8] = {};
+            EXPECT_EQ(ring.Read(out, 3), 3u);
+            EXPECT_EQ(out[4], 5);
+            EXPECT_EQ(ring.Write(in, 4), 4u);
+            EXPECT_EQ(ring.WriteSilence(3), 0u) << "the ring is full";
+            EXPECT_EQ(ring.Available(), 5u);
+            EXPECT_EQ(ring.Discard(1), 1u);
+            EXPECT_EQ(ring.Read(out, 8), 4u);
+            EXPECT_EQ(std::vector<int16_t>(out, out + 8), (std::vector<int16_t>{1, 2, 3, 4, 5, 6, 7, 8}));
+        }
+
+        // With both clocks in step the mirror is a delayed copy.
+        TEST(MirrorStreamTest, MatchedClocksPlayAnExactCopy)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink main;
+            FakeSink second;
+            AudioStream stream(engine, main, TestConfig());
+            MirrorStream mirror(second, TestConfig());
+            Attach(stream, main, mirror);
+            PlayBoth(stream, main, mirror, second, 5.0, 0.0);
+
+            const std::vector<int64_t> played = ClickStarts(main.output, 0);
+            const std::vector<int64_t> mirrored = ClickStarts(second.output, 0);
+            ASSERT_GE(mirrored.size(), 8u);
+            const int64_t delay = mirrored[0] - played[0];
+            for (size_t i = 0; i < mirrored.size(); i++)
+            {
+                EXPECT_EQ(mirrored[i] - played[i], delay) << i;
+                EXPECT_EQ(second.output[static_cast<size_t>(mirrored[i])], main.output[static_cast<size_t>(played[i])]);
+            }
+            EXPECT_EQ(mirror.Stats().driftPpm, 0.0);
+            EXPECT_EQ(mirror.Stats().starvedFrames, 0);
+        }
+
+        // A mirror whose clock runs fast or slow locks onto the main one:
+        // the drift is measured, and its clicks keep a fixed delay behind
+        // the main device's, in time, rather than wandering off.
+        TEST(MirrorStreamTest, SkewedClocksStayPhaseLocked)
+        {
+            for (double skewPpm : {250.0, -400.0})
+            {
+                ClickEngine engine(ToneKit(), 120.0, 4, 1.0, kSampleRate, 2);
+                FakeSink main;
+                FakeSink second;
+                AudioStream stream(engine, main, TestConfig(2));
+                MirrorStream mirror(second, TestConfig(2));
+                Attach(stream, main, mirror);
+                PlayBoth(stream, main, mirror, second, 60.0, skewPpm);
+
+                const MirrorStats stats = mirror.Stats();
+                EXPECT_NEAR(stats.driftPpm, -skewPpm, 5.0) << skewPpm;
+                EXPECT_NEAR(stats.delayError, 0.0, 1.0) << skewPpm;
+                EXPECT_EQ(stats.starvedFrames, 0) << skewPpm;
+                EXPECT_EQ(stats.droppedFrames, 0) << skewPpm;
+
+                // Left channel of the last half minute. A click at main
+                // frame f plays at second-clock frame (f + delay) * rate.
+                std::vector<int16_t> left;
+                for (size_t i = 0; i < second.output.size(); i += 2)
+                {
+                    left.push_back(second.output[i]);
+                }
+                const double rate = 1.0 + skewPpm * 1e-6;
+                const std::vector<int64_t> starts = ClickStarts(left, left.size() / 2);
+                ASSERT_GE(starts.size(), 50u);
+                double lowest = 1e9;
+                double highest = -1e9;
+                for (int64_t start : starts)
+                {
+                    const double mainTime = start / rate;
+                    const double delay = mainTime - std::round(mainTime / kBeatFrames) * kBeatFrames;
+                    lowest = std::min(lowest, delay);
+                    highest = std::max(highest, delay);
+                }
+                EXPECT_LT(highest - lowest, 3.0) << skewPpm;
+            }
+        }
+
+        TEST(MirrorStreamTest, SkipsWithTheMainStream)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink main;
+            FakeSink second;
+            AudioStream stream(engine, main, TestConfig());
+            MirrorStream mirror(second, TestConfig());
+            Attach(stream, main, mirror);
+            PlayBoth(stream, main, mirror, second, 1.0, 0.0);
+            // Both devices stall for 1000 frames. The main stream feeds the
+            // mirror silence for what it skipped, more than the ring has
+            // room for; the mirror skips what it missed and jumps back onto
+            // its delay.
+            main.Play(1000);
+            second.Play(1000);
+            PlayBoth(stream, main, mirror, second, 3.0, 0.0);
+            EXPECT_EQ(stream.Stats().xruns, 1u);
+            EXPECT_EQ(mirror.Stats().xruns, 1u);
+            EXPECT_GT(mirror.Stats().droppedFrames, 0);
+
+            // Clicks due while the mirror itself was stalled are gone; every
+            // other one keeps its delay.
+            const std::vector<int64_t> played = ClickStarts(main.output, 0);
+            const std::vector<int64_t> mirrored = ClickStarts(second.output, 0);
+            ASSERT_EQ(mirrored.size(), played.size() - 1);
+            const int64_t delay = mirrored[0] - played[0];
+            for (int64_t start : mirrored)
+            {
+                EXPECT_NE(std::find(played.begin(), played.end(), start - delay), played.end()) << start;
+            }
+            EXPECT_EQ(mirror.Stats().starvedFrames, 0);
+        }
+
+        TEST(MirrorStreamTest, RejectsMismatchedLayouts)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate, 2);
+            FakeSink main;
+            FakeSink second;
+            AudioStream stream(engine, main, TestConfig(2));
+            MirrorStream mono(second, TestConfig(1));
+            EXPECT_THROW(stream.AddMirror(mono), std::invalid_argument);
+            SinkConfig shallow = TestConfig(2);
+            shallow.periods = 1;
+            EXPECT_THROW(MirrorStream(second, shallow), std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_osc.h"
+
+// Built everywhere but Windows; the receiver below is plain BSD sockets.
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+
+            // A UDP socket on a free loopback port.
+            class LoopbackReceiver
+            {
+            public:
+                LoopbackReceiver()
+                {
+                    handle = socket(AF_INET, SOCK_DGRAM, 0);
+                    sockaddr_in address = {};
+                    address.sin_family = AF_INET;
+                    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                    socklen_t length = sizeof(address);
+                    if (handle < 0 || bind(handle, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+                        getsockname(handle, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+                    {
+                        throw std::runtime_error("no loopback socket");
+                    }
+                    port = ntohs(address.sin_port);
+                    timeval timeout = {2, 0};
+                    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                }
+
+                ~LoopbackReceiver() { close(handle); }
+
+                // The next datagram, or nothing after two seconds.
+                std::vector<uint8_t> Receive()
+                {
+                    std::vector<uint8_t> datagram(1024);
+                    const ssize_t bytes = recv(handle, datagram.data(), datagram.size(), 0);
+                    datagram.resize(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+                    return datagram;
+                }
+
+                int port = 0;
+
+            private:
+                int handle = -1;
+            };
+
+            uint32_t Int32At(const std::vector<uint8_t> &bytes, size_t offset)
+            {
+                return static_cast<uint32_t>(bytes[offset]) << 24 | static_cast<uint32_t>(bytes[offset + 1]) << 16 |
+                       static_cast<uint32_t>(bytes[offset + 2]) << 8 | bytes[offset + 3];
+            }
+
+            uint64_t Int64At(const std::vector<uint8_t> &bytes, size_t offset)
+            {
+                return static_cast<uint64_t>(Int32At(bytes, offset)) << 32 | Int32At(bytes, offset + 4);
+            }
+
+            // The beat and bar of a packet with the default address.
+            struct Beat
+            {
+                uint32_t beat = 0;
+                uint32_t bar = 0;
+                uint64_t timetag = 0;
+            };
+
+            Beat Parse(const std::vector<uint8_t> &packet)
+            {
+                EXPECT_EQ(packet.size(), 72u);
+                if (packet.size() != 72u)
+                {
+                    return Beat();
+                }
+                // 20 bytes of bundle, 16 of address, 8 of type tags.
+                return Beat{Int32At(packet, 44), Int32At(packet, 48), Int64At(packet, 8)};
+            }
+        }
+
+        TEST(OscTest, EncodesABeatAsATimetaggedBundle)
+        {
+            OscBeatMessage message("/beat");
+            message.Set(TickEvent{1234, 2, BeatAccent::Group, true}, 7, 120.0, 0x0102030405060708ull);
+            const std::vector<uint8_t> bytes(message.Data(), message.Data() + message.Size());
+
+            const std::vector<uint8_t> expected = {
+                '#', 'b', 'u', 'n', 'd', 'l', 'e', 0,                                          // bundle
+                1, 2, 3, 4, 5, 6, 7, 8,                                                        // timetag
+                0, 0, 0, 44,                                                                   // element size
+                '/', 'b', 'e', 'a', 't', 0, 0, 0,                                              // address
+                ',', 'i', 'i', 'f', 'i', 'i', 't', 0,                                          // type tags
+                0, 0, 0, 3, 0, 0, 0, 7, 0x42, 0xF0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 1,             // beat .. muted
+                1, 2, 3, 4, 5, 6, 7, 8,                                                        // time
+            };
+            EXPECT_EQ(bytes, expected);
+
+            EXPECT_EQ(OscTimetag(std::chrono::system_clock::time_point()), 2208988800ull << 32);
+            EXPECT_EQ(OscTimetag(std::chrono::system_clock::time_point(std::chrono::milliseconds(1500))),
+                      (2208988801ull << 32) + 0x80000000ull);
+            EXPECT_THROW(OscBeatMessage("beat"), std::invalid_argument);
+            EXPECT_THROW(OscBeatMessage("/" + std::string(kMaxOscAddress, 'a')), std::invalid_argument);
+        }
+
+        TEST(OscTest, SendsEachBeatALookAheadBeforeItSounds)
+        {
+            LoopbackReceiver receiver;
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            std::atomic<int64_t> played{0};
+            OscConfig config;
+            config.port = receiver.port;
+            config.lookAhead = std::chrono::milliseconds(100);
+            OscBeatPublisher publisher(engine, [&played]
+                                       { return played.load(); }, config);
+            const std::chrono::system_clock::time_point wall(std::chrono::seconds(1000));
+            publisher.SetClock([wall]
+                               { return wall; });
+            std::vector<int16_t> pcm(20000);
+            // Beats at 0, 4000, ... 16000.
+            engine.Render(pcm.data(), pcm.size());
+
+            EXPECT_EQ(publisher.Pump(), 1u);
+            Beat first = Parse(receiver.Receive());
+            EXPECT_EQ(first.beat, 1u);
+            EXPECT_EQ(first.bar, 1u);
+            EXPECT_EQ(first.timetag, OscTimetag(wall));
+
+            // 100 ms, 800 frames, before the beat at 4000.
+            played = 3199;
+            EXPECT_EQ(publisher.Pump(), 0u);
+            played = 3200;
+            EXPECT_EQ(publisher.Pump(), 1u);
+            Beat second = Parse(receiver.Receive());
+            EXPECT_EQ(second.beat, 2u);
+            EXPECT_EQ(second.timetag, OscTimetag(wall + std::chrono::milliseconds(100)));
+
+            // The sender thread picks up the rest, into the next bar.
+            played = 16000;
+            publisher.Start();
+            std::vector<Beat> rest;
+            for (int i = 0; i < 3; i++)
+            {
+                rest.push_back(Parse(receiver.Receive()));
+            }
+            publisher.Stop();
+            EXPECT_EQ(rest[0].beat, 3u);
+            EXPECT_EQ(rest[1].beat, 4u);
+            EXPECT_EQ(rest[2].beat, 1u);
+            EXPECT_EQ(rest[2].bar, 2u);
+            EXPECT_EQ(publisher.Stats().sent, 5u);
+            EXPECT_EQ(publisher.Stats().failed, 0u);
+
+            // Ticks still reach their usual consumer.
+            std::vector<TickEvent> ticks;
+            DrainTicks(engine, ticks);
+            EXPECT_EQ(ticks.size(), 5u);
+        }
+
+        TEST(OscTest, RejectsABadPort)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            OscConfig config;
+            config.port = 0;
+            EXPECT_THROW(OscBeatPublisher(engine, []
+                                          { return int64_t(0); }, config),
+                         std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_pattern.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // 120 BPM at 8 kHz: a 4/4 bar is 16000 frames.
+            constexpr int kSampleRate = 8000;
+
+            void ExpectCell(const StepGrid &grid, int step, int lane, int sample, int velocity)
+            {
+                EXPECT_EQ(grid.cells[step][lane].sample, sample) << "step " << step << " lane " << lane;
+                EXPECT_EQ(grid.cells[step][lane].velocity, velocity) << "step " << step << " lane " << lane;
+            }
+
+            int Hits(const StepGrid &grid)
+            {
+                int hits = 0;
+                for (int step = 0; step < grid.steps; step++)
+                {
+                    for (int lane = 0; lane < kGridLanes; lane++)
+                    {
+                        hits += grid.cells[step][lane].velocity > 0 ? 1 : 0;
+                    }
+                }
+                return hits;
+            }
+        }
+
+        TEST(PatternTest, CompilesBeatsAndTupletsOntoTheFewestSteps)
+        {
+            // Sixteenths and a triplet: twelve steps a beat.
+            const StepGrid grid = CompilePattern("X.x.|x.x.|(3)xxx|x...");
+            EXPECT_EQ(grid.steps, 48);
+            ExpectCell(grid, 0, 0, 1, 127);
+            ExpectCell(grid, 6, 0, 0, 100);
+            ExpectCell(grid, 12, 0, 0, 100);
+            ExpectCell(grid, 18, 0, 0, 100);
+            ExpectCell(grid, 24, 0, 0, 100);
+            ExpectCell(grid, 28, 0, 0, 100);
+            ExpectCell(grid, 32, 0, 0, 100);
+            ExpectCell(grid, 36, 0, 0, 100);
+            EXPECT_EQ(Hits(grid), 8);
+
+            // A tuplet in the second of two slots, and a rest inside one.
+            const StepGrid swung = CompilePattern("x(3)x.x");
+            EXPECT_EQ(swung.steps, 6);
+            ExpectCell(swung, 0, 0, 0, 100);
+            ExpectCell(swung, 3, 0, 0, 100);
+            ExpectCell(swung, 5, 0, 0, 100);
+            EXPECT_EQ(Hits(swung), 3);
+
+            EXPECT_EQ(CompilePattern("x|x|x|x").steps, 4);
+            EXPECT_EQ(CompilePattern("").steps, 0) << "no pattern is the plain click";
+        }
+
+        TEST(PatternTest, SamplesAndLanes)
+        {
+            const StepGrid grid = CompilePattern("X2 . x3 . | x2 ; x4 | . x12 .");
+            EXPECT_EQ(grid.steps, 24);
+            ExpectCell(grid, 0, 0, 2, 127);
+            ExpectCell(grid, 6, 0, 3, 100);
+            ExpectCell(grid, 12, 0, 2, 100);
+            ExpectCell(grid, 0, 1, 4, 100);
+            ExpectCell(grid, 16, 1, 12, 100);
+            EXPECT_EQ(Hits(grid), 5);
+
+            std::string lanes;
+            for (int lane = 0; lane < kGridLanes; lane++)
+            {
+                lanes += lane == 0 ? "x" : ";x";
+            }
+            EXPECT_EQ(Hits(CompilePattern(lanes)), kGridLanes);
+            EXPECT_THROW(CompilePattern(lanes + ";x"), std::invalid_argument);
+        }
+
+        TEST(PatternTest, RejectsMalformedNotation)
+        {
+            for (const char *notation : {"x|", "|x", "x||x", "xo", "(3)xx", "(3)x(2)xx", "(0)", "(3xxx", "x256",
+                                         "x.|x;x", "x;x|x", "(65)"})
+            {
+                EXPECT_THROW(CompilePattern(notation), std::invalid_argument) << notation;
+            }
+            // Five beats of thirteen: 65 steps.
+            EXPECT_THROW(CompilePattern("(13)xxxxxxxxxxxxx|x|x|x|x"), std::invalid_argument);
+            EXPECT_NO_THROW(CompilePattern("(16)xxxxxxxxxxxxxxxx|x|x|x"));
+
+            try
+            {
+                CompilePattern("x.x.|x?x.");
+                FAIL() << "expected invalid_argument";
+            }
+            catch (const std::invalid_argument &e)
+            {
+                EXPECT_EQ(std::string(e.what()), "Pattern column 7: unexpected '?'");
+            }
+        }
+
+        TEST(PatternTest, CacheLooksUpPatternsAlreadyCompiled)
+        {
+            PatternCache cache(2);
+            const auto first = cache.Compile("x.x.|x.x.");
+            EXPECT_EQ(cache.Compile("x.x.|x.x."), first);
+            EXPECT_EQ(cache.Stats().hits, 1u);
+            EXPECT_EQ(cache.Stats().misses, 1u);
+
+            const auto second = cache.Compile("X|x|x|x");
+            EXPECT_THROW(cache.Compile("x|"), std::invalid_argument);
+            EXPECT_EQ(cache.Stats().size, 2u) << "a failed pattern is not cached";
+            EXPECT_EQ(cache.Compile("x.x.|x.x."), first);
+
+            // The least recently used goes to make room.
+            cache.Compile("(3)xxx");
+            EXPECT_EQ(cache.Stats().size, 2u);
+            EXPECT_EQ(cache.Compile("x.x.|x.x."), first);
+            EXPECT_NE(cache.Compile("X|x|x|x"), second);
+            EXPECT_EQ(cache.Stats().hits, 3u);
+            EXPECT_EQ(cache.Stats().misses, 4u);
+
+            EXPECT_THROW(PatternCache(0), std::invalid_argument);
+        }
+
+        TEST(PatternTest, EnginePlaysACompiledPattern)
+        {
+            ClickEngine engine(GridKit(100), 120.0, 4, 1.0, kSampleRate);
+            PatternCache cache;
+            engine.SetGrid(*cache.Compile("X.|x2|.x3|."));
+
+            const std::vector<int16_t> pcm = Render(engine, 16000);
+            EXPECT_EQ(pcm[0], 2000);
+            EXPECT_EQ(pcm[2000], 0);
+            EXPECT_EQ(pcm[4000], static_cast<int16_t>(std::lround(300 * (100 / 127.0))));
+            EXPECT_EQ(pcm[8000], 0);
+            EXPECT_EQ(pcm[10000], static_cast<int16_t>(std::lround(-500 * (100 / 127.0))));
+            EXPECT_EQ(pcm[12000], 0);
+        }
+    }
+}
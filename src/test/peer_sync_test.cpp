@@ -0,0 +1,305 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_peer_sync.h"
+#include "metronome_udp.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+            // 10 ms blocks.
+            constexpr size_t kBlock = 80;
+            constexpr int64_t kBlockNs = 10000000;
+
+            // A port of its own, so runs side by side don't hear each other.
+            PeerSyncConfig LoopbackConfig()
+            {
+                PeerSyncConfig config;
+                config.port = 40000 + static_cast<int>(std::random_device()() % 20000);
+                config.interfaceAddress = "127.0.0.1";
+                config.maxNudge = 0.25;
+                return config;
+            }
+
+            // An engine with a host clock of its own, offset from the
+            // simulated time all peers share, as another machine's would be.
+            struct SimulatedPeer
+            {
+                SimulatedPeer(double bpm, int64_t clockOffsetNs, const int64_t &simulatedNs, const PeerSyncConfig &config)
+                    : engine(Kit{{1000}, {2000}}, bpm, 4, 1.0, kSampleRate)
+                {
+                    sync = std::make_unique<PeerSync>(engine, [this]
+                                                      { return engine.Position(); },
+                                                      config);
+                    sync->SetClock([&simulatedNs, clockOffsetNs]
+                                   { return PeerSync::Clock::time_point(std::chrono::nanoseconds(simulatedNs + clockOffsetNs)); });
+                }
+
+                void Render()
+                {
+                    test::Render(engine, kBlock, ticks);
+                }
+
+                ClickEngine engine;
+                std::unique_ptr<PeerSync> sync;
+                std::vector<TickEvent> ticks;
+            };
+
+            // Pumps each peer in turn, twice, giving loopback a moment to
+            // deliver, so a ping is answered within the same simulated
+            // instant.
+            void Exchange(const std::vector<SimulatedPeer *> &peers)
+            {
+                for (int round = 0; round < 2; round++)
+                {
+                    for (SimulatedPeer *peer : peers)
+                    {
+                        peer->sync->Pump();
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    }
+                }
+            }
+
+            // Another process on the group speaking the wire format by
+            // hand: it answers pings, so its clock counts as measured, and
+            // announces whatever tempo the test gives it.
+            class RoguePeer
+            {
+            public:
+                explicit RoguePeer(const PeerSyncConfig &config)
+                    : socket(UdpSocket::JoinGroup(config.group, config.port, config.interfaceAddress))
+                {
+                }
+
+                void Answer()
+                {
+                    uint8_t data[64];
+                    size_t bytes;
+                    while ((bytes = socket->Receive(data, sizeof(data))) > 0)
+                    {
+                        if (bytes >= 24 && data[5] == 2)
+                        {
+                            uint8_t pong[40];
+                            Header(pong, 3);
+                            std::memcpy(pong + 16, data + 8, 8);
+                            std::memcpy(pong + 24, data + 16, 8);
+                            std::memcpy(pong + 32, data + 16, 8);
+                            socket->Send(pong, sizeof(pong));
+                        }
+                    }
+                }
+
+                void Announce(double bpm, uint64_t version)
+                {
+                    uint8_t message[48];
+                    Header(message, 1);
+                    uint64_t bits = 0;
+                    std::memcpy(&bits, &bpm, sizeof(bits));
+                    Put(message + 16, bits);
+                    Put(message + 24, 0);
+                    Put(message + 32, version);
+                    Put(message + 40, kId);
+                    socket->Send(message, sizeof(message));
+                }
+
+            private:
+                static constexpr uint64_t kId = 0x0123456789abcdefull;
+
+                static void Put(uint8_t *data, uint64_t value)
+                {
+                    for (int byte = 0; byte < 8; byte++)
+                    {
+                        data[byte] = static_cast<uint8_t>(value >> (56 - 8 * byte));
+                    }
+                }
+
+                static void Header(uint8_t *data, uint8_t type)
+                {
+                    std::memcpy(data, "MTPS", 4);
+                    data[4] = 1;
+                    data[5] = type;
+                    data[6] = 0;
+                    data[7] = 0;
+                    Put(data + 8, kId);
+                }
+
+                std::unique_ptr<UdpSocket> socket;
+            };
+        }
+
+        TEST(PeerSyncTest, TimelineKeepsPhaseThroughTempoChanges)
+        {
+            SessionTimeline timeline;
+            timeline.bpm = 120.0;
+            timeline.originNs = 1000000000;
+            EXPECT_DOUBLE_EQ(timeline.BeatAt(2000000000), 2.0);
+            EXPECT_EQ(timeline.TimeAt(3.0), 2500000000);
+
+            const SessionTimeline faster = timeline.WithTempo(150.0, 2000000000);
+            EXPECT_NEAR(faster.BeatAt(2000000000), 2.0, 1e-9);
+            EXPECT_NEAR(faster.BeatAt(2400000000), 3.0, 1e-9);
+
+            SessionTimeline changed = faster;
+            changed.version = 1;
+            changed.author = 9;
+            timeline.author = 3;
+            EXPECT_TRUE(changed.Supersedes(timeline));
+            EXPECT_FALSE(timeline.Supersedes(changed));
+            changed.version = 0;
+            EXPECT_TRUE(timeline.Supersedes(changed)) << "the lower author breaks a tie";
+            EXPECT_FALSE(timeline.Supersedes(timeline));
+        }
+
+        TEST(PeerSyncTest, EnginesLockTempoAndPhaseOverLoopback)
+        {
+            const PeerSyncConfig config = LoopbackConfig();
+            int64_t simulatedNs = 0;
+            SimulatedPeer first(120.0, 0, simulatedNs, config);
+            SimulatedPeer second(90.0, 5300000000, simulatedNs, config);
+            SimulatedPeer third(100.0, -870000000, simulatedNs, config);
+            const std::vector<SimulatedPeer *> peers = {&first, &second, &third};
+
+            constexpr int kBlocks = 3000;
+            for (int block = 0; block < kBlocks; block++)
+            {
+                for (SimulatedPeer *peer : peers)
+                {
+                    peer->Render();
+                }
+                simulatedNs += kBlockNs;
+                Exchange(peers);
+                if (block == 300)
+                {
+                    second.sync->SetBpm(132.0);
+                }
+            }
+
+            for (SimulatedPeer *peer : peers)
+            {
+                const PeerSyncStats stats = peer->sync->Stats();
+                EXPECT_EQ(stats.peers, 2);
+                EXPECT_DOUBLE_EQ(stats.bpm, 132.0);
+                EXPECT_LT(std::fabs(stats.phaseErrorMs), 1.0);
+                EXPECT_LT(stats.meanPhaseErrorMs, 1.0);
+                EXPECT_NEAR(peer->engine.Clock().bpm, 132.0, 0.5);
+                EXPECT_EQ(peer->sync->Timeline().author, second.sync->Id());
+            }
+
+            // Over the last five seconds every click, downbeats included,
+            // lands within a millisecond of the others'.
+            const int64_t from = static_cast<int64_t>(kBlocks - 500) * static_cast<int64_t>(kBlock);
+            size_t compared = 0;
+            for (const TickEvent &tick : second.ticks)
+            {
+                if (tick.frame < from)
+                {
+                    continue;
+                }
+                for (const SimulatedPeer *other : {&first, &third})
+                {
+                    bool matched = false;
+                    for (const TickEvent &theirs : other->ticks)
+                    {
+                        if (std::llabs(theirs.frame - tick.frame) <= kSampleRate / 1000)
+                        {
+                            EXPECT_EQ(theirs.beat, tick.beat) << tick.frame;
+                            matched = true;
+                        }
+                    }
+                    EXPECT_TRUE(matched) << tick.frame;
+                    compared++;
+                }
+            }
+            EXPECT_GT(compared, 20u);
+
+            // A peer that goes quiet is dropped after the timeout.
+            second.sync.reset();
+            for (int block = 0; block < 150; block++)
+            {
+                simulatedNs += kBlockNs;
+                Exchange({&first, &third});
+            }
+            EXPECT_EQ(first.sync->Stats().peers, 1);
+            EXPECT_EQ(third.sync->Stats().peers, 1);
+        }
+
+        // Anything on the group can send a timeline, so a tempo the engine
+        // can't play is dropped rather than followed.
+        TEST(PeerSyncTest, IgnoresTemposOutsideTheEngineRange)
+        {
+            const PeerSyncConfig config = LoopbackConfig();
+            int64_t simulatedNs = 0;
+            SimulatedPeer peer(120.0, 0, simulatedNs, config);
+            RoguePeer rogue(config);
+            auto exchange = [&]
+            {
+                for (int round = 0; round < 20; round++)
+                {
+                    peer.Render();
+                    simulatedNs += kBlockNs;
+                    peer.sync->Pump();
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    rogue.Answer();
+                }
+            };
+            exchange();
+
+            uint64_t version = 100;
+            for (double bpm : {std::numeric_limits<double>::infinity(), 1e300, 1e-300,
+                               std::numeric_limits<double>::quiet_NaN(), -60.0, 1000.5})
+            {
+                rogue.Announce(bpm, version++);
+                exchange();
+                EXPECT_DOUBLE_EQ(peer.sync->Timeline().bpm, 120.0) << bpm;
+                EXPECT_TRUE(std::isfinite(peer.sync->Stats().phaseErrorMs)) << bpm;
+            }
+            EXPECT_DOUBLE_EQ(peer.engine.Clock().bpm, 120.0);
+
+            // The same peer is heard once its tempo is one to play.
+            rogue.Announce(140.0, version++);
+            exchange();
+            EXPECT_DOUBLE_EQ(peer.sync->Timeline().bpm, 140.0);
+        }
+
+        TEST(PeerSyncTest, RejectsBadConfig)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            const auto position = []
+            { return int64_t(0); };
+            PeerSyncConfig config = LoopbackConfig();
+            config.quantum = 0.0;
+            EXPECT_THROW(PeerSync(engine, position, config), std::invalid_argument);
+            config = LoopbackConfig();
+            config.maxNudge = 0.9;
+            EXPECT_THROW(PeerSync(engine, position, config), std::invalid_argument);
+            config = LoopbackConfig();
+            config.port = 0;
+            EXPECT_THROW(PeerSync(engine, position, config), std::invalid_argument);
+            config = LoopbackConfig();
+            config.group = "10.0.0.1";
+            EXPECT_THROW(PeerSync(engine, position, config), std::runtime_error);
+
+            PeerSync sync(engine, position, LoopbackConfig());
+            EXPECT_THROW(sync.SetBpm(0.0), std::invalid_argument);
+            EXPECT_THROW(sync.SetBpm(std::numeric_limits<double>::infinity()), std::invalid_argument);
+            EXPECT_THROW(sync.SetBpm(kMaxBpm * 2.0), std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "fake_sink.h"
+#include "metronome_engine.h"
+#include "metronome_render_ahead.h"
+#include "metronome_stream.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+
+            // Keeps every lane busy.
+            void AddGrid(ClickEngine &engine)
+            {
+                engine.SetGridSteps(16);
+                for (int step = 0; step < 16; step++)
+                {
+                    engine.SetGridCell(step, step % 3, 2 + step % 2, 90);
+                }
+                engine.ApplyPending();
+            }
+
+            // Stereo frames from to from + frames of the engine rendering
+            // straight through.
+            std::vector<int16_t> Direct(size_t from, size_t frames)
+            {
+                ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+                AddGrid(engine);
+                std::vector<int16_t> pcm(2 * from);
+                engine.Render(pcm.data(), from);
+                pcm.assign(2 * frames, 0);
+                engine.Render(pcm.data(), frames);
+                return pcm;
+            }
+        }
+
+        TEST(RenderAheadTest, CopiesWhatTheEngineRenders)
+        {
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            RenderAhead ahead(engine, 300, 128);
+            std::vector<int16_t> pcm;
+            for (size_t frames : {100, 37, 300, 1, 250, 290, 99})
+            {
+                ahead.Pump();
+                std::vector<int16_t> block(2 * frames);
+                ahead.Read(block.data(), frames);
+                pcm.insert(pcm.end(), block.begin(), block.end());
+            }
+            EXPECT_EQ(pcm, Direct(0, pcm.size() / 2));
+            EXPECT_EQ(ahead.Position(), static_cast<int64_t>(pcm.size() / 2));
+            EXPECT_EQ(ahead.Stats().lateFrames, 0);
+        }
+
+        TEST(RenderAheadTest, RendersUpToTheWatermark)
+        {
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            RenderAhead ahead(engine, 300, 128);
+            EXPECT_EQ(ahead.Pump(), 384u);
+            EXPECT_EQ(ahead.Pump(), 0u) << "already at the watermark";
+            std::vector<int16_t> pcm(2 * 200);
+            ahead.Read(pcm.data(), 200);
+            EXPECT_EQ(ahead.Pump(), 128u);
+            EXPECT_EQ(ahead.Stats().blocks, 4u);
+            EXPECT_EQ(ahead.Stats().lateFrames, 0);
+        }
+
+        // The device side keeps time: what wasn't rendered in time plays as
+        // silence, and the engine's output stays where it belongs.
+        TEST(RenderAheadTest, LateFramesAreSkippedNotDelayed)
+        {
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            RenderAhead ahead(engine, 300, 128);
+            std::vector<int16_t> pcm(2 * 250, 1);
+            ahead.Read(pcm.data(), 250);
+            EXPECT_EQ(pcm, std::vector<int16_t>(2 * 250, 0));
+            EXPECT_EQ(ahead.Stats().lateFrames, 250);
+            EXPECT_EQ(engine.Position(), 0) << "the render side skips the engine, not the device side";
+
+            ahead.Pump();
+            ahead.Read(pcm.data(), 250);
+            EXPECT_EQ(pcm, Direct(250, 250));
+        }
+
+        TEST(RenderAheadTest, SkipsPastWhatIsRendered)
+        {
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            RenderAhead ahead(engine, 300, 128);
+            ahead.Pump();
+            std::vector<int16_t> pcm(2 * 100);
+            ahead.Skip(50);
+            ahead.Read(pcm.data(), 100);
+            EXPECT_EQ(pcm, Direct(50, 100));
+            ahead.Skip(1000);
+            EXPECT_EQ(ahead.Position(), 1150);
+            ahead.Pump();
+            ahead.Read(pcm.data(), 100);
+            EXPECT_EQ(pcm, Direct(1150, 100));
+            EXPECT_EQ(ahead.Stats().lateFrames, 0);
+
+            ahead.Reset();
+            EXPECT_EQ(ahead.Position(), engine.Position());
+        }
+
+        // Skips race the render thread, which may land a block the device
+        // side already passed; every frame read is still the engine's frame
+        // for that position, or silence from there on when it is late.
+        TEST(RenderAheadTest, SkipsRacingTheRenderThreadKeepTime)
+        {
+            constexpr size_t kRead = 64;
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            RenderAhead ahead(engine, 256, 32);
+            const std::vector<int16_t> direct = Direct(0, 400000);
+            ahead.Start();
+            std::vector<int16_t> pcm(2 * kRead);
+            int onTime = 0;
+            for (int i = 0; i < 1000; i++)
+            {
+                ahead.Skip(static_cast<size_t>(i * 37 % 300));
+                const size_t from = static_cast<size_t>(ahead.Position());
+                ASSERT_LE(2 * (from + kRead), direct.size());
+                ahead.Read(pcm.data(), kRead);
+                size_t matched = 0;
+                while (matched < 2 * kRead && pcm[matched] == direct[2 * from + matched])
+                {
+                    matched++;
+                }
+                for (size_t sample = matched; sample < 2 * kRead; sample++)
+                {
+                    ASSERT_EQ(pcm[sample], 0) << "read " << i << " at frame " << from;
+                }
+                onTime += matched == 2 * kRead ? 1 : 0;
+            }
+            ahead.Stop();
+            EXPECT_GT(onTime, 0);
+        }
+
+        TEST(RenderAheadTest, StreamPlaysTheSameAsRenderingInline)
+        {
+            SinkConfig config;
+            config.periodFrames = 80;
+            config.periods = 4;
+            ClickEngine inlineEngine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(inlineEngine);
+            FakeSink inlineSink;
+            AudioStream inlineStream(inlineEngine, inlineSink, config);
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            FakeSink sink;
+            AudioStream stream(engine, sink, config);
+            // Enough for the device to start with its buffer full.
+            RenderAhead ahead(engine, 320, 64);
+            stream.SetRenderAhead(ahead);
+            inlineStream.Open();
+            stream.Open();
+            for (int period = 0; period < 200; period++)
+            {
+                ASSERT_TRUE(inlineStream.Pump(0));
+                ahead.Pump();
+                ASSERT_TRUE(stream.Pump(0));
+                inlineSink.Play(80);
+                sink.Play(80);
+            }
+            EXPECT_EQ(sink.output, inlineSink.output);
+            EXPECT_EQ(stream.PlayedPosition(), inlineStream.PlayedPosition());
+            EXPECT_EQ(ahead.Stats().lateFrames, 0);
+        }
+
+        TEST(RenderAheadTest, RejectsBadSizesAndOtherEngines)
+        {
+            ClickEngine engine(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(engine);
+            EXPECT_THROW(RenderAhead(engine, 0, 64), std::invalid_argument);
+            EXPECT_THROW(RenderAhead(engine, 64, 0), std::invalid_argument);
+            ClickEngine other(GrooveKit(), 151.0, 4, 0.9, kSampleRate, 2);
+            RenderAhead ahead(other, 64, 64);
+            FakeSink sink;
+            SinkConfig config;
+            AudioStream stream(engine, sink, config);
+            EXPECT_THROW(stream.SetRenderAhead(ahead), std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,452 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "metronome_engine.h"
+#include "metronome_renderer.h"
+#include "metronome_song.h"
+
+// Renders canonical songs through the offline renderer, and canonical
+// sessions through the live ClickEngine, and compares the PCM with the
+// hashes in golden/render.txt. The whole render path is integer or
+// IEEE double arithmetic, so the output must match bit for bit; any change
+// to scheduling, mixing or rounding that moves a single sample fails here.
+//
+// After an intentional change in output, regenerate the file with
+//   METRONOME_UPDATE_GOLDEN=1 ctest --test-dir build
+// and review the diff of golden/render.txt like any other change.
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr const char *kGoldenPath = METRONOME_GOLDEN_DIR "/render.txt";
+
+            // A decaying square wave built with integer arithmetic only, so
+            // the kits themselves are identical on every platform.
+            std::vector<int16_t> Click(int length, int period, int amplitude)
+            {
+                std::vector<int16_t> sound(length);
+                for (int i = 0; i < length; i++)
+                {
+                    const int64_t level = static_cast<int64_t>(amplitude) * (length - i) / length;
+                    sound[i] = static_cast<int16_t>((i / period) % 2 == 0 ? level : -level);
+                }
+                return sound;
+            }
+
+            Kit ShortKit() { return Kit{Click(441, 20, 20000), Click(441, 10, 28000)}; }
+            // Longer than a beat at most tempos, so every click is cut off.
+            Kit LongKit() { return Kit{Click(30000, 50, 16000), Click(30000, 25, 24000)}; }
+            Kit MainOnlyKit() { return Kit{Click(600, 15, 22000), {}}; }
+            Kit ImpulseKit() { return Kit{{32767}, {-32768}}; }
+            // Short clicks and two grid samples.
+            Kit LaneKit()
+            {
+                Kit kit = ShortKit();
+                kit.samples = {Click(700, 35, 18000), Click(300, 6, 25000)};
+                return kit;
+            }
+
+            Song MakeSong(int sampleRate, int bars, std::vector<MeterChange> meters,
+                          std::vector<TempoSegment> tempo, Kit kit)
+            {
+                Song song;
+                song.sampleRate = sampleRate;
+                song.bars = bars;
+                song.meterMap = std::move(meters);
+                song.tempoMap = std::move(tempo);
+                song.kit = std::move(kit);
+                return song;
+            }
+
+            struct GoldenCase
+            {
+                std::string name;
+                Song song;
+            };
+
+            // Keeps ctest's listing readable; gtest would dump the bytes.
+            void PrintTo(const GoldenCase &golden, std::ostream *out)
+            {
+                *out << golden.name;
+            }
+
+            std::vector<GoldenCase> GoldenCases()
+            {
+                const BeatAccent R = BeatAccent::Rest;
+                const BeatAccent N = BeatAccent::Normal;
+                const BeatAccent A = BeatAccent::Accented;
+                std::vector<GoldenCase> cases;
+
+                // Tempos, including ones whose beat is not a whole number of frames.
+                const std::pair<const char *, double> tempos[] = {
+                    {"40", 40.0}, {"60", 60.0}, {"97_5", 97.5}, {"120", 120.0},
+                    {"133_33", 133.33}, {"200", 200.0}, {"300", 300.0}};
+                for (const auto &tempo : tempos)
+                {
+                    cases.push_back({std::string("tempo_") + tempo.first,
+                                     MakeSong(44100, 3, {{0, 4, 4}}, {{0, tempo.second}}, ShortKit())});
+                }
+
+                // Meters; the click falls on every 1/denominator note.
+                const MeterChange meters[] = {
+                    {0, 1, 4}, {0, 2, 4}, {0, 3, 4}, {0, 5, 4}, {0, 6, 8},
+                    {0, 7, 8}, {0, 9, 8}, {0, 12, 16}, {0, 3, 2}};
+                for (const MeterChange &meter : meters)
+                {
+                    cases.push_back({"meter_" + std::to_string(meter.numerator) + "_" + std::to_string(meter.denominator),
+                                     MakeSong(44100, 4, {meter}, {{0, 112.0}}, ShortKit())});
+                }
+                cases.push_back({"meter_map",
+                                 MakeSong(44100, 6, {{0, 4, 4}, {2, 7, 8}, {3, 5, 16}, {5, 3, 4}}, {{0, 126.0}}, ShortKit())});
+                {
+                    Song legacy = MakeSong(44100, 2, {}, {{0, 120.0}}, ShortKit());
+                    legacy.timeSignature = 3;
+                    cases.push_back({"legacy_time_signature", legacy});
+                }
+
+                // Subdivisions, written as patterns over a finer meter.
+                {
+                    Song eighths = MakeSong(44100, 2, {{0, 8, 8}}, {{0, 90.0}}, ShortKit());
+                    eighths.pattern = {A, R, N, R, N, R, N, R};
+                    cases.push_back({"subdivision_eighths", eighths});
+                    Song triplets = MakeSong(44100, 2, {{0, 12, 8}}, {{0, 80.0}}, ShortKit());
+                    triplets.pattern = {A, N, N, N, N, N, N, N, N, N, N, N};
+                    cases.push_back({"subdivision_triplets", triplets});
+                    Song sixteenths = MakeSong(48000, 2, {{0, 16, 16}}, {{0, 100.0}}, ShortKit());
+                    sixteenths.pattern = {A, N, N, N, N, N, N, N, A, N, N, N, N, N, N, N};
+                    cases.push_back({"subdivision_sixteenths", sixteenths});
+                }
+
+                // Tempo ramps and changes.
+                cases.push_back({"ramp_up", MakeSong(44100, 8, {{0, 4, 4}}, {{0, 60.0, 180.0}}, ShortKit())});
+                cases.push_back({"ramp_down", MakeSong(44100, 8, {{0, 3, 4}}, {{0, 200.0, 80.0}}, ShortKit())});
+                cases.push_back({"ramp_then_step",
+                                 MakeSong(44100, 8, {{0, 4, 4}}, {{0, 100.0, 140.0}, {4, 90.0}}, ShortKit())});
+                cases.push_back({"tempo_change_mid_bar",
+                                 MakeSong(44100, 4, {{0, 4, 4}}, {{0, 120.0}, {1, 150.0, 0.0, 2.0}}, ShortKit())});
+                cases.push_back({"ramp_across_meters",
+                                 MakeSong(44100, 6, {{0, 4, 4}, {3, 6, 8}}, {{0, 72.0, 144.0}}, ShortKit())});
+
+                // Kits.
+                cases.push_back({"kit_long", MakeSong(44100, 3, {{0, 4, 4}}, {{0, 150.0}}, LongKit())});
+                cases.push_back({"kit_main_only", MakeSong(44100, 3, {{0, 4, 4}}, {{0, 120.0}}, MainOnlyKit())});
+                cases.push_back({"kit_impulse", MakeSong(44100, 3, {{0, 5, 8}}, {{0, 133.0}}, ImpulseKit())});
+
+                // Sample rates.
+                for (int sampleRate : {8000, 22050, 48000, 96000})
+                {
+                    cases.push_back({"rate_" + std::to_string(sampleRate),
+                                     MakeSong(sampleRate, 3, {{0, 4, 4}}, {{0, 117.0}}, ShortKit())});
+                    cases.push_back({"rate_" + std::to_string(sampleRate) + "_ramp",
+                                     MakeSong(sampleRate, 4, {{0, 7, 8}}, {{0, 90.0, 170.0}}, LongKit())});
+                }
+
+                // Accent patterns and volume.
+                {
+                    Song pattern = MakeSong(44100, 3, {{0, 4, 4}}, {{0, 120.0}}, ShortKit());
+                    pattern.pattern = {A, R, N, A};
+                    cases.push_back({"pattern_rests", pattern});
+                    Song silent = pattern;
+                    silent.pattern = {R};
+                    cases.push_back({"pattern_all_rests", silent});
+                    Song half = MakeSong(44100, 2, {{0, 4, 4}}, {{0, 120.0}}, LongKit());
+                    half.volume = 0.5;
+                    cases.push_back({"volume_half", half});
+                    Song odd = half;
+                    odd.volume = 0.37;
+                    cases.push_back({"volume_odd", odd});
+                    Song mute = half;
+                    mute.volume = 0.0;
+                    cases.push_back({"volume_zero", mute});
+                }
+                return cases;
+            }
+
+            uint64_t Fnv1a(const std::vector<int16_t> &pcm)
+            {
+                uint64_t hash = 14695981039346656037ull;
+                for (int16_t sample : pcm)
+                {
+                    const uint16_t bits = static_cast<uint16_t>(sample);
+                    for (uint8_t byte : {static_cast<uint8_t>(bits & 0xFF), static_cast<uint8_t>(bits >> 8)})
+                    {
+                        hash ^= byte;
+                        hash *= 1099511628211ull;
+                    }
+                }
+                return hash;
+            }
+
+            std::vector<int16_t> RenderAll(const Song &song, size_t blockFrames)
+            {
+                OfflineRenderer renderer(song);
+                std::vector<int16_t> pcm(static_cast<size_t>(renderer.Length()));
+                size_t written = 0;
+                size_t rendered;
+                while ((rendered = renderer.Render(pcm.data() + written, std::min(blockFrames, pcm.size() - written))) > 0)
+                {
+                    written += rendered;
+                }
+                EXPECT_EQ(written, pcm.size());
+                EXPECT_TRUE(renderer.Finished());
+                return pcm;
+            }
+
+            // A live engine session: the engine as constructed, then setUp's
+            // commands, all applied before the first frame.
+            struct EngineCase
+            {
+                std::string name;
+                Kit kit;
+                double bpm = 120.0;
+                int timeSignature = 4;
+                double volume = 1.0;
+                int channels = 1;
+                std::function<void(ClickEngine &)> setUp = [](ClickEngine &) {};
+            };
+
+            void PrintTo(const EngineCase &golden, std::ostream *out)
+            {
+                *out << golden.name;
+            }
+
+            constexpr int kEngineRate = 44100;
+            constexpr size_t kEngineFrames = 3 * kEngineRate;
+
+            void AddLanes(ClickEngine &engine)
+            {
+                engine.SetGridSteps(12);
+                for (int step = 0; step < 12; step++)
+                {
+                    engine.SetGridCell(step, step % 3, 2 + step % 2, 37 + step * 7);
+                    if (step % 4 == 0)
+                    {
+                        engine.SetGridCell(step, 5, 3, 127);
+                    }
+                }
+            }
+
+            // Covers the engine's mixer at gains that don't scale samples
+            // to whole numbers, mono and interleaved.
+            std::vector<EngineCase> EngineCases()
+            {
+                std::vector<EngineCase> cases;
+                cases.push_back({"engine_click", ShortKit(), 133.0, 4, 0.77});
+                // Long sounds at a fast tempo overlap and clip.
+                cases.push_back({"engine_overlap", LongKit(), 260.0, 3, 1.0});
+                {
+                    Kit trimmed = LaneKit();
+                    trimmed.matchLoudness = true;
+                    cases.push_back({"engine_trimmed", trimmed, 121.0, 4, 0.9, 1, AddLanes});
+                }
+                cases.push_back({"engine_grid", LaneKit(), 97.0, 4, 0.83, 1, AddLanes});
+                cases.push_back({"engine_meter_gap", ShortKit(), 150.0, 4, 0.6, 1, [](ClickEngine &engine)
+                                 {
+                                     engine.SetMeter(7, 8, {2, 2, 3});
+                                     engine.SetGapClick(1, 1);
+                                 }});
+                cases.push_back({"engine_stereo_pan", LaneKit(), 112.0, 4, 0.71, 2, [](ClickEngine &engine)
+                                 {
+                                     AddLanes(engine);
+                                     engine.SetRoute(0, 0, -0.3);
+                                     engine.SetRoute(1, 0, 0.6);
+                                     engine.SetRoute(2, 0, 1.0);
+                                     engine.SetRoute(3, 0, -0.45);
+                                 }});
+                cases.push_back({"engine_route_4ch", LaneKit(), 128.0, 3, 0.93, 4, [](ClickEngine &engine)
+                                 {
+                                     AddLanes(engine);
+                                     engine.SetRoute(0, 1, 0.2);
+                                     engine.SetRoute(1, 2, -0.7);
+                                     engine.SetRoute(2, 3, 0.0);
+                                     engine.SetRoute(3, 0, 0.35);
+                                     engine.SetRoute(7, 2, 1.0);
+                                 }});
+                return cases;
+            }
+
+            std::vector<int16_t> RenderEngine(const EngineCase &golden, size_t blockFrames)
+            {
+                ClickEngine engine(golden.kit, golden.bpm, golden.timeSignature, golden.volume, kEngineRate,
+                                   golden.channels);
+                golden.setUp(engine);
+                const size_t channels = static_cast<size_t>(golden.channels);
+                std::vector<int16_t> pcm(kEngineFrames * channels);
+                for (size_t frame = 0; frame < kEngineFrames; frame += blockFrames)
+                {
+                    engine.Render(pcm.data() + frame * channels, std::min(blockFrames, kEngineFrames - frame));
+                }
+                return pcm;
+            }
+
+            struct GoldenEntry
+            {
+                uint64_t frames = 0;
+                uint64_t hash = 0;
+            };
+
+            class GoldenFile
+            {
+            public:
+                static GoldenFile &Instance()
+                {
+                    static GoldenFile file;
+                    return file;
+                }
+
+                bool Updating() const { return updating; }
+
+                const GoldenEntry *Find(const std::string &name) const
+                {
+                    auto it = entries.find(name);
+                    return it == entries.end() ? nullptr : &it->second;
+                }
+
+                void Record(const std::string &name, GoldenEntry entry) { entries[name] = entry; }
+
+                void Save() const
+                {
+                    std::ofstream out(kGoldenPath, std::ios::trunc);
+                    out << "# case frames fnv1a64(pcm16le); regenerate with METRONOME_UPDATE_GOLDEN=1\n";
+                    for (const auto &entry : entries)
+                    {
+                        char hash[17];
+                        std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(entry.second.hash));
+                        out << entry.first << ' ' << entry.second.frames << ' ' << hash << '\n';
+                    }
+                }
+
+            private:
+                GoldenFile()
+                {
+                    const char *update = std::getenv("METRONOME_UPDATE_GOLDEN");
+                    updating = update != nullptr && std::string(update) != "0";
+                    std::ifstream in(kGoldenPath);
+                    std::string line;
+                    while (std::getline(in, line))
+                    {
+                        if (line.empty() || line[0] == '#')
+                        {
+                            continue;
+                        }
+                        std::istringstream fields(line);
+                        std::string name;
+                        GoldenEntry entry;
+                        fields >> name >> entry.frames >> std::hex >> entry.hash;
+                        entries[name] = entry;
+                    }
+                }
+
+                bool updating = false;
+                std::map<std::string, GoldenEntry> entries;
+            };
+
+            class GoldenEnvironment : public ::testing::Environment
+            {
+            public:
+                void TearDown() override
+                {
+                    if (GoldenFile::Instance().Updating())
+                    {
+                        GoldenFile::Instance().Save();
+                    }
+                }
+            };
+
+            ::testing::Environment *const goldenEnvironment =
+                ::testing::AddGlobalTestEnvironment(new GoldenEnvironment);
+        }
+
+        class RenderGoldenTest : public ::testing::TestWithParam<GoldenCase>
+        {
+        };
+
+        TEST_P(RenderGoldenTest, MatchesGoldenHash)
+        {
+            const GoldenCase &golden = GetParam();
+            const std::vector<int16_t> pcm = RenderAll(golden.song, 4096);
+            const GoldenEntry actual{pcm.size(), Fnv1a(pcm)};
+
+            GoldenFile &file = GoldenFile::Instance();
+            if (file.Updating())
+            {
+                file.Record(golden.name, actual);
+                return;
+            }
+            const GoldenEntry *expected = file.Find(golden.name);
+            ASSERT_NE(expected, nullptr) << "No golden entry for " << golden.name
+                                         << "; run with METRONOME_UPDATE_GOLDEN=1 to add it";
+            EXPECT_EQ(actual.frames, expected->frames);
+            EXPECT_EQ(actual.hash, expected->hash) << "PCM of " << golden.name << " differs from golden output";
+        }
+
+        // The output must not depend on how the caller slices it into blocks.
+        TEST_P(RenderGoldenTest, IndependentOfBlockSize)
+        {
+            const GoldenCase &golden = GetParam();
+            const std::vector<int16_t> reference = RenderAll(golden.song, 4096);
+            for (size_t blockFrames : {1u, 127u, 1000u})
+            {
+                const std::vector<int16_t> pcm = RenderAll(golden.song, blockFrames);
+                ASSERT_EQ(pcm.size(), reference.size());
+                for (size_t i = 0; i < pcm.size(); i++)
+                {
+                    ASSERT_EQ(pcm[i], reference[i]) << "block size " << blockFrames << ", frame " << i;
+                }
+            }
+        }
+
+        INSTANTIATE_TEST_SUITE_P(Canonical, RenderGoldenTest, ::testing::ValuesIn(GoldenCases()),
+                                 [](const ::testing::TestParamInfo<GoldenCase> &info)
+                                 { return info.param.name; });
+
+        class EngineGoldenTest : public ::testing::TestWithParam<EngineCase>
+        {
+        };
+
+        TEST_P(EngineGoldenTest, MatchesGoldenHash)
+        {
+            const EngineCase &golden = GetParam();
+            const std::vector<int16_t> pcm = RenderEngine(golden, 4096);
+            const GoldenEntry actual{kEngineFrames, Fnv1a(pcm)};
+
+            GoldenFile &file = GoldenFile::Instance();
+            if (file.Updating())
+            {
+                file.Record(golden.name, actual);
+                return;
+            }
+            const GoldenEntry *expected = file.Find(golden.name);
+            ASSERT_NE(expected, nullptr) << "No golden entry for " << golden.name
+                                         << "; run with METRONOME_UPDATE_GOLDEN=1 to add it";
+            EXPECT_EQ(actual.frames, expected->frames);
+            EXPECT_EQ(actual.hash, expected->hash) << "PCM of " << golden.name << " differs from golden output";
+        }
+
+        TEST_P(EngineGoldenTest, IndependentOfBlockSize)
+        {
+            const EngineCase &golden = GetParam();
+            const std::vector<int16_t> reference = RenderEngine(golden, 4096);
+            for (size_t blockFrames : {1u, 127u, 1000u})
+            {
+                EXPECT_EQ(RenderEngine(golden, blockFrames), reference) << "block size " << blockFrames;
+            }
+        }
+
+        INSTANTIATE_TEST_SUITE_P(Canonical, EngineGoldenTest, ::testing::ValuesIn(EngineCases()),
+                                 [](const ::testing::TestParamInfo<EngineCase> &info)
+                                 { return info.param.name; });
+    }
+}
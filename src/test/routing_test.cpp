@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "fake_sink.h"
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+#include "metronome_stream.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            // 120 BPM at 8 kHz: a beat every 4000 frames, the first accented.
+            constexpr int kSampleRate = 8000;
+            constexpr int64_t kBeatFrames = 4000;
+
+            // The grid overlaps the click on every beat.
+            void AddGrid(ClickEngine &engine)
+            {
+                engine.SetGridSteps(8);
+                for (int step = 0; step < 8; step++)
+                {
+                    engine.SetGridCell(step, 0, 2, 110);
+                    engine.SetGridCell(step, 1, step % 2 == 0 ? 3 : 0, 70);
+                }
+            }
+        }
+
+        // Centred layers are dual mono at full gain, identical to a mono
+        // render on every channel.
+        TEST(RoutingTest, CentredStereoMatchesMono)
+        {
+            ClickEngine mono(GrooveKit(), 97.0, 4, 0.9, kSampleRate);
+            ClickEngine stereo(GrooveKit(), 97.0, 4, 0.9, kSampleRate, 2);
+            AddGrid(mono);
+            AddGrid(stereo);
+            std::vector<int16_t> expected(30000);
+            std::vector<int16_t> pcm(expected.size() * 2);
+            mono.Render(expected.data(), expected.size());
+            stereo.Render(pcm.data(), expected.size());
+            EXPECT_EQ(Channel(pcm, 2, 0), expected);
+            EXPECT_EQ(Channel(pcm, 2, 1), expected);
+            EXPECT_EQ(stereo.Position(), mono.Position());
+        }
+
+        TEST(RoutingTest, PanBalancesBetweenTwoChannels)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate, 2);
+            engine.SetRoute(1, 0, 1.0);
+            engine.SetRoute(0, 0, -0.5);
+            std::vector<int16_t> pcm(2 * 2 * kBeatFrames);
+            engine.Render(pcm.data(), 2 * kBeatFrames);
+            EXPECT_EQ(pcm[0], 0) << "the accent is hard right";
+            EXPECT_EQ(pcm[1], 2000);
+            EXPECT_EQ(pcm[2 * kBeatFrames], 1000);
+            EXPECT_EQ(pcm[2 * kBeatFrames + 1], 500);
+        }
+
+        TEST(RoutingTest, RoutesAcrossFourChannels)
+        {
+            Kit kit{{1000}, {2000}};
+            kit.samples = {{3000}};
+            ClickEngine engine(kit, 120.0, 4, 1.0, kSampleRate, 4);
+            engine.SetRoute(0, 1, 0.0);
+            engine.SetRoute(1, 1, 0.0);
+            // The last channel has no neighbour, so the lane plays there alone.
+            engine.SetRoute(2, 3, -1.0);
+            std::vector<int16_t> pcm(4 * 4 * kBeatFrames);
+            engine.Render(pcm.data(), kBeatFrames);
+            EXPECT_EQ(std::vector<int16_t>(pcm.begin(), pcm.begin() + 4), (std::vector<int16_t>{0, 2000, 2000, 0}));
+            // From the next bar the grid plays lane 0 on its second step.
+            engine.SetGridSteps(4);
+            engine.SetGridCell(1, 0, 2, 127);
+            engine.Render(pcm.data(), 3 * kBeatFrames);
+            engine.Render(pcm.data(), 4 * kBeatFrames);
+            const size_t step = 4 * kBeatFrames;
+            EXPECT_EQ(std::vector<int16_t>(pcm.begin() + step, pcm.begin() + step + 4),
+                      (std::vector<int16_t>{0, 0, 0, 3000}));
+        }
+
+        TEST(RoutingTest, LayerLevelsAreTakenBeforePanning)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate, 2);
+            engine.SetRoute(1, 0, -1.0);
+            std::vector<int16_t> pcm(2 * 100);
+            engine.Render(pcm.data(), 100);
+            const BlockLevels levels = engine.Levels();
+            EXPECT_FLOAT_EQ(levels.click.peak, 2000.0f / 32768.0f);
+            EXPECT_FLOAT_EQ(levels.output.peak, 2000.0f / 32768.0f);
+            // One sample over both channels' 200.
+            EXPECT_NEAR(levels.output.rms, 2000.0f / 32768.0f / std::sqrt(200.0f), 1e-6f);
+            EXPECT_GT(levels.click.rms, levels.output.rms);
+        }
+
+        TEST(RoutingTest, JournalReplaysRoutedOutput)
+        {
+            const std::string path = TempPath("routing.mtj");
+            ClickEngine engine(GrooveKit(), 133.0, 3, 0.7, kSampleRate, 3);
+            AddGrid(engine);
+            engine.SetRoute(3, 2, 0.0);
+            std::vector<int16_t> warmup(3 * 5000);
+            engine.Render(warmup.data(), 5000);
+            std::vector<int16_t> recorded(3 * 20000);
+            {
+                CommandJournal journal(path, kSampleRate);
+                engine.SetJournal(&journal);
+                engine.SetRoute(0, 1, 0.25);
+                engine.Render(recorded.data(), 10000);
+                engine.SetRoute(2, 0, -0.75);
+                engine.Render(recorded.data() + 3 * 10000, 10000);
+                FinishJournal(engine, journal);
+            }
+            const Journal journal = ReadJournal(path);
+            EXPECT_EQ(journal.channels, 3);
+            EXPECT_EQ(RenderJournal(journal), recorded);
+            std::remove(path.c_str());
+        }
+
+        TEST(RoutingTest, StreamOpensTheSinkWithEngineChannels)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate, 2);
+            engine.SetRoute(0, 0, 1.0);
+            FakeSink sink;
+            SinkConfig config;
+            config.periodFrames = 100;
+            config.periods = 4;
+            AudioStream stream(engine, sink, config);
+            stream.Open();
+            for (int period = 0; period <= kBeatFrames / 100; period++)
+            {
+                ASSERT_TRUE(stream.Pump(0));
+                sink.Play(100);
+            }
+            ASSERT_EQ(sink.output.size(), 2 * static_cast<size_t>(kBeatFrames + 100));
+            EXPECT_EQ(sink.output[0], 2000);
+            EXPECT_EQ(sink.output[1], 2000);
+            EXPECT_EQ(sink.output[2 * kBeatFrames], 0);
+            EXPECT_EQ(sink.output[2 * kBeatFrames + 1], 1000);
+        }
+
+        TEST(RoutingTest, RejectsBadLayouts)
+        {
+            EXPECT_THROW(ClickEngine(Kit{{1}, {2}}, 120.0, 4, 1.0, kSampleRate, 0), std::invalid_argument);
+            EXPECT_THROW(ClickEngine(Kit{{1}, {2}}, 120.0, 4, 1.0, kSampleRate, kMaxOutputChannels + 1),
+                         std::invalid_argument);
+            ClickEngine engine(Kit{{1}, {2}}, 120.0, 4, 1.0, kSampleRate, 2);
+            EXPECT_THROW(engine.SetRoute(kRouteLayers, 0, 0.0), std::invalid_argument);
+            EXPECT_THROW(engine.SetRoute(0, 2, 0.0), std::invalid_argument);
+            EXPECT_THROW(engine.SetRoute(0, 0, 1.5), std::invalid_argument);
+            EXPECT_NO_THROW(engine.SetRoute(kRouteLayers - 1, 1, -1.0));
+
+            ClickEngine mono(Kit{{1}, {2}}, 120.0, 4, 1.0, kSampleRate);
+            EXPECT_THROW(mono.SetRoute(0, 1, 0.0), std::invalid_argument);
+            EXPECT_NO_THROW(mono.SetRoute(0, 0, 1.0));
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+#include "metronome_snapshot.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+
+            std::vector<int16_t> Tone(size_t length, double amplitude, double hz)
+            {
+                std::vector<int16_t> pcm(length);
+                for (size_t i = 0; i < length; i++)
+                {
+                    pcm[i] = static_cast<int16_t>(amplitude * std::sin(2.0 * 3.14159265358979 * hz * i / kSampleRate));
+                }
+                return pcm;
+            }
+
+            Kit LoudnessMatchedKit()
+            {
+                Kit kit{Tone(400, 9000, 1000), Tone(300, 20000, 1500)};
+                kit.samples = {Tone(200, 3000, 500), Tone(250, 15000, 2000)};
+                kit.matchLoudness = true;
+                return kit;
+            }
+
+            // Mid-bar, mid-click, with everything the engine can be told
+            // set to something other than its default.
+            void SetUpSession(ClickEngine &engine)
+            {
+                engine.SetBpm(137.0);
+                engine.SetMeter(7, 8, {2, 2, 3}, false);
+                engine.SetGapClick(2, 1);
+                engine.SetRoute(0, 0, -0.4);
+                engine.SetRoute(3, 1, 0.25);
+                engine.SetVolume(0.8);
+                std::vector<int16_t> pcm(static_cast<size_t>(engine.Channels()) * 5000);
+                engine.Render(pcm.data(), 5000);
+                engine.SetGridSteps(8);
+                for (int step = 0; step < 8; step++)
+                {
+                    engine.SetGridCell(step, step % 2, 2 + step % 2, 40 + step * 10);
+                }
+                engine.Render(pcm.data(), 3333);
+            }
+
+            void WriteBytes(const std::string &path, const std::vector<char> &bytes)
+            {
+                std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(),
+                                                                             static_cast<std::streamsize>(bytes.size()));
+            }
+
+            std::vector<char> ReadBytes(const std::string &path)
+            {
+                std::ifstream file(path, std::ios::binary);
+                return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+
+            // Overwrites the value of the first saved command of type.
+            void SetCommand(std::vector<char> &bytes, CommandType type, double value)
+            {
+                uint32_t count = 0;
+                std::memcpy(&count, bytes.data() + 24, sizeof(count));
+                for (uint32_t index = 0; index < count; index++)
+                {
+                    char *record = bytes.data() + 64 + 16 * index;
+                    if (static_cast<uint8_t>(record[0]) == static_cast<uint8_t>(type))
+                    {
+                        std::memcpy(record + 8, &value, sizeof(value));
+                        return;
+                    }
+                }
+                ADD_FAILURE() << "No command of type " << static_cast<int>(type);
+            }
+
+            // Overwrites a float of sound record index: 16 trim, 24 peak,
+            // 28 RMS, 32 LUFS.
+            void SetSoundField(std::vector<char> &bytes, int index, size_t field, float value)
+            {
+                uint64_t soundsOffset = 0;
+                std::memcpy(&soundsOffset, bytes.data() + 40, sizeof(soundsOffset));
+                std::memcpy(bytes.data() + soundsOffset + 40 * index + field, &value, sizeof(value));
+            }
+
+            double PackedMeter(uint64_t numerator, uint64_t log2Denominator, uint64_t groupStarts)
+            {
+                return static_cast<double>(numerator | log2Denominator << 16 | groupStarts << 20);
+            }
+        }
+
+        TEST(SnapshotTest, RestoredEngineContinuesExactly)
+        {
+            ClickEngine engine(LoudnessMatchedKit(), 120.0, 4, 1.0, kSampleRate, 3);
+            SetUpSession(engine);
+            const std::string path = TempPath("session.mts");
+            WriteSnapshot(engine, path);
+
+            std::unique_ptr<ClickEngine> restored = LoadSnapshot(path);
+            EXPECT_EQ(restored->SampleRate(), kSampleRate);
+            EXPECT_EQ(restored->Channels(), 3);
+            EXPECT_EQ(restored->Position(), 0);
+            const Kit &kit = restored->PlayingKit();
+            EXPECT_EQ(kit.samples.size(), 2u);
+            EXPECT_TRUE(kit.matchLoudness);
+            for (int index = 0; index < 4; index++)
+            {
+                EXPECT_FLOAT_EQ(kit.Trim(index), engine.PlayingKit().Trim(index)) << index;
+                EXPECT_TRUE(kit.loudness[static_cast<size_t>(index)].analysed) << index;
+            }
+            // Several bars, through gaps and grid steps.
+            EXPECT_EQ(Render(*restored, 40000), Render(engine, 40000));
+            std::remove(path.c_str());
+        }
+
+        TEST(SnapshotTest, PendingCommandsAreSaved)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            engine.SetBpm(90.0);
+            engine.SetKit(Kit{{300, 200}, {700}});
+            const std::string path = TempPath("pending.mts");
+            WriteSnapshot(engine, path);
+            std::unique_ptr<ClickEngine> restored = LoadSnapshot(path);
+            EXPECT_EQ(restored->PlayingKit().mainSound, (std::vector<int16_t>{300, 200}));
+            EXPECT_EQ(Render(*restored, 20000), Render(engine, 20000));
+            std::remove(path.c_str());
+        }
+
+        TEST(SnapshotTest, RejectsFilesThatAreNotSnapshots)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            const std::string path = TempPath("damaged.mts");
+            WriteSnapshot(engine, path);
+            const std::vector<char> good = ReadBytes(path);
+
+            std::vector<char> bytes = good;
+            bytes[4] = 2;
+            WriteBytes(path, bytes);
+            EXPECT_THROW(LoadSnapshot(path), std::invalid_argument) << "a later version";
+
+            bytes = good;
+            bytes.pop_back();
+            WriteBytes(path, bytes);
+            EXPECT_THROW(LoadSnapshot(path), std::invalid_argument) << "truncated";
+
+            bytes = good;
+            bytes[64] = 99;
+            WriteBytes(path, bytes);
+            EXPECT_THROW(LoadSnapshot(path), std::invalid_argument) << "an unknown command";
+
+            WriteBytes(path, std::vector<char>(good.begin(), good.begin() + 10));
+            EXPECT_THROW(LoadSnapshot(path), std::invalid_argument);
+            WriteBytes(path, {});
+            EXPECT_THROW(LoadSnapshot(path), std::invalid_argument);
+            std::remove(path.c_str());
+            EXPECT_THROW(LoadSnapshot(path), std::runtime_error);
+        }
+
+        TEST(SnapshotTest, RejectsValuesTheEngineWouldRefuse)
+        {
+            ClickEngine engine(LoudnessMatchedKit(), 120.0, 4, 1.0, kSampleRate, 3);
+            SetUpSession(engine);
+            const std::string path = TempPath("corrupt.mts");
+            WriteSnapshot(engine, path);
+            const std::vector<char> good = ReadBytes(path);
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+
+            const std::vector<std::pair<const char *, std::function<void(std::vector<char> &)>>> corruptions = {
+                {"zero BPM", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SetBpm, 0.0); }},
+                {"NaN BPM", [&](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SetBpm, nan); }},
+                {"BPM above the maximum", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SetBpm, kMaxBpm * 2); }},
+                {"NaN volume", [&](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SetVolume, nan); }},
+                {"volume above one", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SetVolume, 1.5); }},
+                {"negative beat", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncBeat, -1.0); }},
+                {"fractional beat", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncBeat, 1.5); }},
+                {"infinite click frame", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncNextClick, std::numeric_limits<double>::infinity()); }},
+                {"meter of zero beats", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncMeter, PackedMeter(0, 2, 1)); }},
+                {"meter in 128ths", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncMeter, PackedMeter(4, 7, 1)); }},
+                {"group past the bar", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncMeter, PackedMeter(4, 2, 0x21)); }},
+                {"grouped bar too long to play", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SyncMeter, PackedMeter(40, 2, 0x3)); }},
+                {"route to a missing channel", [](std::vector<char> &bytes)
+                 { SetCommand(bytes, CommandType::SetRoute, static_cast<double>(0 | 5 << 4 | 32767 << 7)); }},
+                {"NaN trim", [](std::vector<char> &bytes)
+                 { SetSoundField(bytes, 1, 16, std::numeric_limits<float>::quiet_NaN()); }},
+                {"negative trim", [](std::vector<char> &bytes)
+                 { SetSoundField(bytes, 2, 16, -1.0f); }},
+                {"NaN loudness", [](std::vector<char> &bytes)
+                 { SetSoundField(bytes, 0, 32, std::numeric_limits<float>::quiet_NaN()); }},
+            };
+            for (const auto &corruption : corruptions)
+            {
+                std::vector<char> bytes = good;
+                corruption.second(bytes);
+                WriteBytes(path, bytes);
+                EXPECT_THROW(LoadSnapshot(path), std::invalid_argument) << corruption.first;
+            }
+            WriteBytes(path, good);
+            EXPECT_NO_THROW(LoadSnapshot(path));
+            std::remove(path.c_str());
+        }
+    }
+}
@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "fake_sink.h"
+#include "metronome_engine.h"
+#include "metronome_stream.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+            // 120 BPM at 8 kHz.
+            constexpr int64_t kBeatFrames = 4000;
+
+            SinkConfig TestConfig()
+            {
+                SinkConfig config;
+                config.periodFrames = 100;
+                config.periods = 4;
+                return config;
+            }
+
+            // Times failovers by the simulated device's frame clock.
+            void UseSinkClock(AudioStream &stream, const FakeSink &sink)
+            {
+                stream.SetClock([&sink]
+                                { return AudioStream::Clock::time_point(
+                                      std::chrono::nanoseconds(sink.Clock() * 1000000000 / kSampleRate)); });
+            }
+
+            // Checks every click that was played lands on the original grid
+            // and returns how many there were.
+            int CountGridClicks(const std::vector<int16_t> &output)
+            {
+                int clicks = 0;
+                for (size_t frame = 0; frame < output.size(); frame++)
+                {
+                    if (output[frame] == 0)
+                    {
+                        continue;
+                    }
+                    clicks++;
+                    EXPECT_EQ(static_cast<int64_t>(frame) % kBeatFrames, 0) << frame;
+                    EXPECT_EQ(output[frame], (frame / kBeatFrames) % 4 == 0 ? 2000 : 1000) << frame;
+                }
+                return clicks;
+            }
+        }
+
+        // One-sample clicks make every click easy to find in the output.
+        TEST(AudioStreamTest, KeepsBufferFullAndTracksPlayback)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            AudioStream stream(engine, sink, TestConfig());
+            stream.Open();
+            ASSERT_TRUE(stream.Pump(0));
+            EXPECT_TRUE(sink.Running());
+            EXPECT_EQ(engine.Position(), 400);
+
+            sink.Play(250);
+            ASSERT_TRUE(stream.Pump(0));
+            EXPECT_EQ(stream.PlayedPosition(), 250);
+            // Only whole periods are rendered.
+            EXPECT_EQ(engine.Position(), 600);
+            EXPECT_EQ(stream.Stats().periods, 6u);
+        }
+
+        TEST(AudioStreamTest, XrunKeepsBeatGrid)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            AudioStream stream(engine, sink, TestConfig());
+            stream.Open();
+            for (int i = 0; i < 400; i++)
+            {
+                ASSERT_TRUE(stream.Pump(0));
+                // A stall several periods long, straddling the third click.
+                sink.Play(i == 70 ? 2345 : 100);
+            }
+
+            const StreamStats stats = stream.Stats();
+            EXPECT_EQ(stats.xruns, 1u);
+            EXPECT_EQ(stats.lostFrames, 2345 - 400);
+
+            // Eleven grid points were played through, less the one at 8000
+            // that fell in the stall.
+            EXPECT_EQ(sink.output.size(), 42245u);
+            EXPECT_EQ(CountGridClicks(sink.output), 10);
+        }
+
+        TEST(AudioStreamTest, ReopensLostDeviceOnBeatGrid)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            AudioStream stream(engine, sink, TestConfig());
+            UseSinkClock(stream, sink);
+            stream.Open();
+            int failedPumps = 0;
+            for (int i = 0; i < 400; i++)
+            {
+                failedPumps += stream.Pump(0) ? 0 : 1;
+                if (i == 78)
+                {
+                    // Gone at 7800, across the click at 8000, with no device
+                    // for the next three attempts to reopen.
+                    sink.Unplug();
+                    sink.failOpens = 3;
+                }
+                sink.Play(100);
+            }
+
+            EXPECT_EQ(failedPumps, 3);
+            EXPECT_EQ(sink.opened, 2);
+            const StreamStats stats = stream.Stats();
+            EXPECT_EQ(stats.failovers, 1u);
+            // Noticed at 7900, back at 8200.
+            EXPECT_DOUBLE_EQ(stats.lastFailoverMs, 37.5);
+            EXPECT_DOUBLE_EQ(stats.maxFailoverMs, 37.5);
+            EXPECT_EQ(stats.xruns, 0u);
+
+            // The click at 8000 fell in the gap; the rest carry on where they
+            // always would have been.
+            EXPECT_EQ(sink.output.size(), 40000u);
+            EXPECT_EQ(sink.output[4000], 1000);
+            EXPECT_EQ(sink.output[8000], 0);
+            EXPECT_EQ(CountGridClicks(sink.output), 9);
+        }
+
+        TEST(AudioStreamTest, FollowsDeviceChange)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            AudioStream stream(engine, sink, TestConfig());
+            UseSinkClock(stream, sink);
+            stream.Open();
+            TickEvent tick;
+            int ticks = 0;
+            for (int i = 0; i < 200; i++)
+            {
+                ASSERT_TRUE(stream.Pump(0));
+                sink.deviceChanged = i == 50;
+                sink.Play(100);
+                while (stream.PopPlayedTick(tick))
+                {
+                    EXPECT_EQ(tick.frame % kBeatFrames, 0);
+                    ticks++;
+                }
+            }
+
+            EXPECT_EQ(sink.opened, 2);
+            EXPECT_EQ(stream.Stats().failovers, 1u);
+            EXPECT_DOUBLE_EQ(stream.Stats().lastFailoverMs, 0.0);
+            EXPECT_EQ(CountGridClicks(sink.output), 5);
+            EXPECT_EQ(ticks, 5);
+        }
+
+        TEST(AudioStreamTest, ReportsTicksOncePlayed)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            AudioStream stream(engine, sink, TestConfig());
+            stream.Open();
+            TickEvent tick;
+            for (int i = 0; i < 38; i++)
+            {
+                ASSERT_TRUE(stream.Pump(0));
+                sink.Play(100);
+                while (stream.PopPlayedTick(tick))
+                {
+                    EXPECT_EQ(tick.beat, 0);
+                }
+            }
+            // The second click has been rendered but not played yet.
+            ASSERT_TRUE(stream.Pump(0));
+            EXPECT_GT(engine.Position(), kBeatFrames);
+            EXPECT_FALSE(stream.PopPlayedTick(tick));
+
+            sink.Play(300);
+            ASSERT_TRUE(stream.Pump(0));
+            ASSERT_TRUE(stream.PopPlayedTick(tick));
+            EXPECT_EQ(tick.frame, kBeatFrames);
+            EXPECT_EQ(tick.beat, 1);
+        }
+    }
+}
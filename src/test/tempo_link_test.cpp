@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "engine_fixtures.h"
+#include "metronome_engine.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+            constexpr size_t kBlock = 256;
+
+            struct LinkedRun
+            {
+                std::vector<TickEvent> master;
+                std::vector<TickEvent> follower;
+            };
+
+            // Renders both engines over the same frames, master first, and
+            // collects their ticks. between runs before each block.
+            template <typename Between>
+            void RenderLinked(ClickEngine &master, ClickEngine &follower, int blocks, LinkedRun &run, Between between)
+            {
+                for (int block = 0; block < blocks; block++)
+                {
+                    between(block);
+                    Render(master, kBlock, run.master);
+                    Render(follower, kBlock, run.follower);
+                }
+            }
+
+            // 100 BPM up to 160 by 1 BPM every other block.
+            void Ramp(ClickEngine &master, int block)
+            {
+                if (block % 2 == 0 && block / 2 <= 60)
+                {
+                    master.SetBpm(100.0 + block / 2);
+                }
+            }
+        }
+
+        TEST(TempoLinkTest, UnisonFollowerClicksWithMasterThroughARamp)
+        {
+            ClickEngine master(Kit{{1000}, {2000}}, 100.0, 4, 1.0, kSampleRate);
+            ClickEngine follower(Kit{{500}, {700}}, 97.0, 3, 1.0, kSampleRate);
+            follower.Follow(&master, 1.0);
+            LinkedRun run;
+            RenderLinked(master, follower, 2000, run, [&master](int block)
+                         { Ramp(master, block); });
+
+            ASSERT_GT(run.master.size(), 100u);
+            ASSERT_EQ(run.follower.size(), run.master.size());
+            for (size_t i = 0; i < run.master.size(); i++)
+            {
+                EXPECT_EQ(run.follower[i].frame, run.master[i].frame) << i;
+                // Bars of its own meter, from the first shared beat.
+                EXPECT_EQ(run.follower[i].beat, static_cast<int>(i % 3)) << i;
+            }
+        }
+
+        TEST(TempoLinkTest, ThreeAgainstTwoStaysPhaseLocked)
+        {
+            ClickEngine master(Kit{{1000}, {2000}}, 100.0, 4, 1.0, kSampleRate);
+            ClickEngine follower(Kit{{500}, {700}}, 120.0, 4, 1.0, kSampleRate);
+            follower.Follow(&master, 1.5);
+            LinkedRun run;
+            RenderLinked(master, follower, 2000, run, [&master, &follower](int block)
+                         {
+                             Ramp(master, block);
+                             // Ignored while linked.
+                             if (block == 100)
+                             {
+                                 follower.SetBpm(60.0);
+                             } });
+
+            ASSERT_GT(run.master.size(), 100u);
+            // Every second master beat is every third follower beat, and
+            // the two in between fall inside the master beats around them.
+            for (size_t j = 0; 2 * j + 2 < run.master.size() && 3 * j + 2 < run.follower.size(); j++)
+            {
+                EXPECT_LE(std::llabs(run.follower[3 * j].frame - run.master[2 * j].frame), 1) << j;
+                EXPECT_GT(run.follower[3 * j + 1].frame, run.master[2 * j].frame) << j;
+                EXPECT_LT(run.follower[3 * j + 1].frame, run.master[2 * j + 1].frame) << j;
+                EXPECT_GT(run.follower[3 * j + 2].frame, run.master[2 * j + 1].frame) << j;
+                EXPECT_LT(run.follower[3 * j + 2].frame, run.master[2 * j + 2].frame) << j;
+            }
+            EXPECT_NEAR(static_cast<double>(run.follower.size()), 1.5 * run.master.size(), 2.0);
+            EXPECT_DOUBLE_EQ(follower.Clock().bpm, 1.5 * master.Clock().bpm);
+        }
+
+        TEST(TempoLinkTest, FollowerStartsOverWhenMasterRestarts)
+        {
+            ClickEngine master(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            ClickEngine follower(Kit{{500}, {700}}, 120.0, 4, 1.0, kSampleRate);
+            LinkedRun run;
+            // Free running for a while, then linked mid-beat.
+            RenderLinked(master, follower, 10, run, [](int) {});
+            follower.Follow(&master, 2.0);
+            RenderLinked(master, follower, 60, run, [&master](int block)
+                         {
+                             if (block == 20)
+                             {
+                                 master.Restart();
+                             } });
+
+            const int64_t restart = 30 * static_cast<int64_t>(kBlock);
+            std::vector<int64_t> after;
+            for (const TickEvent &tick : run.follower)
+            {
+                if (tick.frame >= restart)
+                {
+                    after.push_back(tick.frame);
+                    if (after.size() == 1)
+                    {
+                        EXPECT_EQ(tick.beat, 0);
+                    }
+                }
+            }
+            // Eighth notes at 120 BPM from the master's restart.
+            ASSERT_GE(after.size(), 4u);
+            for (size_t i = 0; i < after.size(); i++)
+            {
+                EXPECT_EQ(after[i], restart + static_cast<int64_t>(i) * 2000) << i;
+            }
+
+            EXPECT_THROW(follower.Follow(&master, -1.0), std::invalid_argument);
+            EXPECT_THROW(follower.Follow(&follower, 1.0), std::invalid_argument);
+            ClickEngine other(Kit{{1000}, {2000}}, 120.0, 4, 1.0, 44100);
+            EXPECT_THROW(follower.Follow(&other, 1.0), std::invalid_argument);
+        }
+
+        TEST(TempoLinkTest, UnlinkedFollowerKeepsTheLinkedTempo)
+        {
+            ClickEngine master(Kit{{1000}, {2000}}, 150.0, 4, 1.0, kSampleRate);
+            ClickEngine follower(Kit{{500}, {700}}, 60.0, 4, 1.0, kSampleRate);
+            follower.Follow(&master, 1.0);
+            LinkedRun run;
+            RenderLinked(master, follower, 20, run, [](int) {});
+            follower.Follow(nullptr, 0.0);
+            master.SetBpm(90.0);
+            RenderLinked(master, follower, 60, run, [](int) {});
+            ASSERT_GE(run.follower.size(), 6u);
+            const size_t last = run.follower.size() - 1;
+            // 150 BPM at 8 kHz.
+            EXPECT_EQ(run.follower[last].frame - run.follower[last - 1].frame, 3200);
+        }
+
+        // Commands queued before a block each carry their own master.
+        TEST(TempoLinkTest, QueuedFollowsApplyTheirOwnMasters)
+        {
+            ClickEngine first(Kit{{1000}, {2000}}, 150.0, 4, 1.0, kSampleRate);
+            ClickEngine second(Kit{{1000}, {2000}}, 90.0, 4, 1.0, kSampleRate);
+            ClickEngine follower(Kit{{500}, {700}}, 60.0, 4, 1.0, kSampleRate);
+            follower.Follow(&first, 1.0);
+            follower.Follow(nullptr, 0.0);
+            Render(follower, kBlock);
+            EXPECT_DOUBLE_EQ(follower.Clock().bpm, 150.0);
+
+            follower.Follow(&first, 1.0);
+            follower.Follow(&second, 2.0);
+            follower.Follow(&first, 0.5);
+            Render(follower, kBlock);
+            EXPECT_DOUBLE_EQ(follower.Clock().bpm, 75.0);
+        }
+    }
+}
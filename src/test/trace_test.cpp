@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metronome_trace.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr const char *kSpinName = "trace_test_spin";
+
+            // The values of this test's instants, in the order written out.
+            std::vector<int64_t> SpinValues(const std::string &json)
+            {
+                std::vector<int64_t> values;
+                std::istringstream lines(json);
+                std::string line;
+                const std::string name = std::string("\"name\":\"") + kSpinName + "\"";
+                const std::string value = "\"value\":";
+                while (std::getline(lines, line))
+                {
+                    const size_t at = line.find(value);
+                    if (line.find(name) != std::string::npos && at != std::string::npos)
+                    {
+                        values.push_back(std::stoll(line.substr(at + value.size())));
+                    }
+                }
+                return values;
+            }
+        }
+
+        // Each record carries the next value, so a stale or half-written
+        // one shows up as a gap in the run.
+        TEST(TraceTest, SnapshotWhileWritingDropsRatherThanTears)
+        {
+            ClearTrace();
+            std::atomic<bool> stop{false};
+            std::atomic<int64_t> written{0};
+            std::thread writer([&]
+                               {
+                                   for (int64_t value = 0; !stop.load(std::memory_order_relaxed); value++)
+                                   {
+                                       TraceRecord(TracePhase::Instant, kSpinName, value);
+                                       written.store(value + 1, std::memory_order_relaxed);
+                                   } });
+            // Past one lap of the ring, so every snapshot races overwrites.
+            while (written.load() < 20000)
+            {
+                std::this_thread::yield();
+            }
+
+            // A writer that laps the ring during a copy leaves nothing.
+            int checked = 0;
+            for (int snapshot = 0; snapshot < 50; snapshot++)
+            {
+                std::ostringstream out;
+                WriteChromeTrace(out);
+                const std::vector<int64_t> values = SpinValues(out.str());
+                checked += values.empty() ? 0 : 1;
+                for (size_t i = 1; i < values.size(); i++)
+                {
+                    ASSERT_EQ(values[i], values[i - 1] + 1) << "snapshot " << snapshot << " record " << i;
+                }
+            }
+            stop.store(true);
+            writer.join();
+            EXPECT_GT(checked, 0);
+            ClearTrace();
+        }
+    }
+}
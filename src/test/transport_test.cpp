@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "fake_sink.h"
+#include "metronome_engine.h"
+#include "metronome_stream.h"
+#include "metronome_transport.h"
+#include "metronome_transport_publisher.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+            // 120 BPM at 8 kHz.
+            constexpr int64_t kBeatFrames = 4000;
+
+            // A name of its own, so runs side by side don't share a segment.
+            std::string UniqueName()
+            {
+                return "mt_test_" + std::to_string(std::random_device()() % 1000000000u);
+            }
+
+            TransportState ReadState(const TransportReader &reader)
+            {
+                TransportState state;
+                EXPECT_TRUE(reader.Read(state));
+                return state;
+            }
+        }
+
+        TEST(TransportTest, PublishesThePlayedBeatThroughAStream)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            const std::string name = UniqueName();
+            TransportPublisher publisher(name, kSampleRate);
+            SinkConfig config;
+            config.periodFrames = 100;
+            config.periods = 4;
+            AudioStream stream(engine, sink, config);
+            stream.SetClock([&sink]
+                            { return AudioStream::Clock::time_point(
+                                  std::chrono::nanoseconds(sink.Clock() * 1000000000 / kSampleRate)); });
+            stream.SetTransportPublisher(publisher);
+            const TransportReader reader(name);
+            EXPECT_EQ(reader.SampleRate(), kSampleRate);
+            EXPECT_EQ(ReadState(reader).playing, 0);
+
+            stream.Open();
+            for (int i = 0; i < 38; i++)
+            {
+                ASSERT_TRUE(stream.Pump(0));
+                sink.Play(100);
+            }
+            // The second click is in the device buffer, not yet played.
+            ASSERT_TRUE(stream.Pump(0));
+            ASSERT_GT(engine.Position(), kBeatFrames);
+            TransportState state = ReadState(reader);
+            EXPECT_EQ(state.playing, 1);
+            EXPECT_DOUBLE_EQ(state.bpm, 120.0);
+            EXPECT_EQ(state.frame, 3800);
+            EXPECT_EQ(state.hostTimeNs, 3800 * 1000000000LL / kSampleRate);
+            EXPECT_EQ(state.bar, 1);
+            EXPECT_EQ(state.beat, 0);
+            EXPECT_DOUBLE_EQ(state.phase, 0.95);
+
+            const uint32_t version = reader.Version();
+            sink.Play(300);
+            ASSERT_TRUE(stream.Pump(0));
+            EXPECT_GT(reader.Version(), version);
+            state = ReadState(reader);
+            EXPECT_EQ(state.frame, 4100);
+            EXPECT_EQ(state.bar, 1);
+            EXPECT_EQ(state.beat, 1);
+            EXPECT_DOUBLE_EQ(state.phase, 0.025);
+
+            while (stream.PlayedPosition() < 4 * kBeatFrames + 200)
+            {
+                sink.Play(100);
+                ASSERT_TRUE(stream.Pump(0));
+            }
+            state = ReadState(reader);
+            EXPECT_EQ(state.bar, 2);
+            EXPECT_EQ(state.beat, 0);
+            EXPECT_DOUBLE_EQ(state.phase, 0.05);
+
+            stream.Stop();
+            state = ReadState(reader);
+            EXPECT_EQ(state.playing, 0);
+            EXPECT_EQ(state.frame, 4 * kBeatFrames + 200);
+        }
+
+        TEST(TransportTest, ReaderFindsOnlyALiveTransport)
+        {
+            const std::string name = UniqueName();
+            EXPECT_THROW(TransportReader reader(name), std::runtime_error);
+            {
+                TransportPublisher publisher(name, kSampleRate);
+                EXPECT_NO_THROW(TransportReader reader(name));
+            }
+            EXPECT_THROW(TransportReader reader(name), std::runtime_error) << "the name goes with the publisher";
+
+            {
+                const auto foreign = SharedSegment::Create(name, sizeof(TransportSegment));
+                EXPECT_THROW(TransportReader reader(name), std::invalid_argument);
+            }
+
+            EXPECT_THROW(TransportPublisher("", kSampleRate), std::invalid_argument);
+            EXPECT_THROW(TransportPublisher("a/b", kSampleRate), std::invalid_argument);
+            EXPECT_THROW(TransportPublisher(std::string(kMaxTransportName + 1, 'x'), kSampleRate),
+                         std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "fake_sink.h"
+#include "metronome_engine.h"
+#include "metronome_stream.h"
+#include "metronome_watchdog.h"
+
+namespace metronome
+{
+    namespace test
+    {
+        namespace
+        {
+            constexpr int kSampleRate = 8000;
+            // 120 BPM at 8 kHz.
+            constexpr int64_t kBeatFrames = 4000;
+
+            StallWatchdog::Clock::time_point At(int64_t ms)
+            {
+                return StallWatchdog::Clock::time_point(std::chrono::milliseconds(ms));
+            }
+        }
+
+        TEST(StallWatchdogTest, ReportsAPositionThatStopsMoving)
+        {
+            int64_t position = 0;
+            int64_t ms = 0;
+            int reported = 0;
+            StallWatchdog watchdog([&]
+                                   { return position; }, [&]
+                                   { reported++; }, std::chrono::milliseconds(100));
+            watchdog.SetClock([&]
+                              { return At(ms); });
+            for (; ms < 1000; ms += 10)
+            {
+                position += 80;
+                EXPECT_FALSE(watchdog.Check());
+            }
+            // Stuck from 990 on: reported at 1090, then every 100 ms after.
+            for (; ms < 1300; ms += 10)
+            {
+                watchdog.Check();
+            }
+            EXPECT_EQ(reported, 3);
+            EXPECT_EQ(watchdog.Stalls(), 3u);
+            // Moving again resets the clock.
+            for (; ms < 2000; ms += 10)
+            {
+                position += 80;
+                EXPECT_FALSE(watchdog.Check());
+            }
+            EXPECT_EQ(reported, 3);
+            EXPECT_THROW(StallWatchdog([]
+                                       { return int64_t(0); }, [] {}, std::chrono::milliseconds(0)),
+                         std::invalid_argument);
+        }
+
+        TEST(StallWatchdogTest, WatchesFromItsOwnThread)
+        {
+            std::atomic<int> reported{0};
+            StallWatchdog watchdog([]
+                                   { return int64_t(42); }, [&]
+                                   { reported++; }, std::chrono::milliseconds(20));
+            watchdog.Start();
+            for (int wait = 0; wait < 500 && reported.load() == 0; wait++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+            watchdog.Stop();
+            EXPECT_GE(reported.load(), 1);
+        }
+
+        // The device stops returning blocks at 7800 without an error. The
+        // stream only finds out through the watchdog, and the click picks
+        // up where it would have been had the device kept playing.
+        TEST(StallWatchdogTest, StreamRestartsAStalledDeviceOnBeatGrid)
+        {
+            ClickEngine engine(Kit{{1000}, {2000}}, 120.0, 4, 1.0, kSampleRate);
+            FakeSink sink;
+            SinkConfig config;
+            config.periodFrames = 100;
+            config.periods = 4;
+            AudioStream stream(engine, sink, config);
+            const auto sinkClock = [&sink]
+            { return AudioStream::Clock::time_point(std::chrono::nanoseconds(sink.Clock() * 1000000000 / kSampleRate)); };
+            stream.SetClock(sinkClock);
+            StallWatchdog watchdog([&stream]
+                                   { return stream.PlayedPosition(); }, [&stream]
+                                   { stream.RestartStalled(); }, std::chrono::milliseconds(50));
+            watchdog.SetClock(sinkClock);
+            stream.Open();
+            for (int i = 0; i < 400; i++)
+            {
+                ASSERT_TRUE(stream.Pump(0));
+                watchdog.Check();
+                if (i == 78)
+                {
+                    sink.Stall();
+                }
+                sink.Play(100);
+            }
+
+            EXPECT_EQ(watchdog.Stalls(), 1u);
+            EXPECT_EQ(sink.opened, 2);
+            const StreamStats stats = stream.Stats();
+            EXPECT_EQ(stats.stalls, 1u);
+            EXPECT_EQ(stats.failovers, 1u);
+            EXPECT_EQ(stats.xruns, 0u);
+
+            // Silent from 7800 until reopened at 8300, losing the click at
+            // 8000; every other click stays on the grid.
+            ASSERT_EQ(sink.output.size(), 40000u);
+            EXPECT_EQ(sink.output[4000], 1000);
+            EXPECT_EQ(sink.output[8000], 0);
+            int clicks = 0;
+            for (size_t frame = 0; frame < sink.output.size(); frame++)
+            {
+                if (sink.output[frame] != 0)
+                {
+                    clicks++;
+                    EXPECT_EQ(static_cast<int64_t>(frame) % kBeatFrames, 0) << frame;
+                }
+            }
+            EXPECT_EQ(clicks, 9);
+        }
+    }
+}
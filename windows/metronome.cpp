@@ -1,6 +1,9 @@
 #include "metronome.h"
+#include "metronome_loudness.h"
+#include <mmreg.h>
+#include <ks.h>
+#include <ksmedia.h>
 #include <cmath>
-#include <iostream>
 #include <vector>
 #include <cstdint>
 #include <stdexcept>
@@ -9,22 +12,54 @@
 #include <atomic>
 #include <chrono>
 #include <string>
+#include <algorithm>
+
+#ifndef DRVM_MAPPER_PREFERRED_GET
+// From mmddk.h: asks the wave mapper which device it currently maps to.
+#define DRVM_MAPPER_PREFERRED_GET (0x2000 + 21)
+#endif
+
+namespace
+{
+    int64_t SteadyNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+}
 
 Metronome::Metronome(const std::vector<uint8_t> &mainFileBytes,
                      const std::vector<uint8_t> &accentedFileBytes,
-                     int bpm, int timeSignature, double volume, int sampleRate)
-    : audioBpm(bpm), audioTimeSignature(timeSignature), audioVolume(volume), sampleRate(sampleRate)
+                     int bpm, int timeSignature, double volume, int sampleRate, int channels,
+                     size_t memoryBudget)
+    : audioBpm(bpm), audioTimeSignature(timeSignature), budget(memoryBudget), sampleRate(sampleRate),
+      audioVolume(volume)
 {
     if (mainFileBytes.empty())
     {
         throw std::invalid_argument("Main sound file cannot be empty");
     }
 
-    mainSound = byteArrayToShortArray(mainFileBytes);
-    accentedSound = accentedFileBytes.empty() ? mainSound : byteArrayToShortArray(accentedFileBytes);
+    kit.mainSound = metronome::BytesToPcm16(mainFileBytes);
+    kit.accentedSound = accentedFileBytes.empty() ? kit.mainSound : metronome::BytesToPcm16(accentedFileBytes);
+    engine = std::make_unique<metronome::ClickEngine>(kit, bpm, timeSignature, volume, sampleRate, channels, &budget);
+    metronome::AnalyseKit(kit, sampleRate);
 
     InitializeAudio();
-    audioBuffer = generateBuffer();
+    renderAhead = std::make_unique<metronome::RenderAhead>(*engine, static_cast<size_t>(kRenderAheadBlocks * blockFrames),
+                                                           static_cast<size_t>(blockFrames), &budget);
+    watchdog = std::make_unique<metronome::StallWatchdog>([this]
+                                                          { return playedFrame.load(); },
+                                                          [this]
+                                                          {
+                                                              {
+                                                                  std::lock_guard<std::mutex> lock(bufferMutex);
+                                                                  stalled.store(true);
+                                                              }
+                                                              bufferCV.notify_all();
+                                                          },
+                                                          std::chrono::milliseconds(kStallMs));
 }
 
 Metronome::~Metronome()
@@ -34,66 +69,68 @@ Metronome::~Metronome()
 
 void Metronome::Play()
 {
-    if (!playing.exchange(true))
+    if (!playing.load())
     {
-        audioBuffer = generateBuffer();
+        Stop();
+        playing.store(true);
+        // Nothing consumes ticks while stopped; drop stale ones.
+        metronome::TickEvent tick;
+        while (engine->PopTick(tick))
+        {
+        }
+        hasPendingTick = false;
+        engine->Restart();
+        renderAhead->Reset();
+        padding = 0;
+        playedFrame.store(0);
+        playedAtNs.store(SteadyNanoseconds());
         if (hWaveOut)
         {
             waveOutRestart(hWaveOut);
         }
+        renderAhead->Start();
+        stalled.store(false);
         metronomeThread = std::thread(&Metronome::StartMetronome, this);
+        watchdog->Start();
     }
 }
 
 void Metronome::Pause()
 {
-    if (playing.exchange(false))
-    {
-        if (hWaveOut)
-        {
-            // waveOutPause(hWaveOut);
-            waveOutBreakLoop(hWaveOut);
-            // waveOutWrite(hWaveOut, nullptr, 0);
-        }
-        currentTick = 0;
-        writeCursor = playCursor = 0;
-        if (metronomeThread.joinable())
-        {
-            metronomeThread.join();
-        }
-    }
+    // The click restarts from beat one on the next Play, as before.
+    Stop();
 }
 
 void Metronome::Stop()
 {
-    if (playing.exchange(false))
+    if (watchdog)
     {
-        if (hWaveOut)
-        {
-            waveOutReset(hWaveOut);
-        }
-
-        if (metronomeThread.joinable())
-        {
-            metronomeThread.join();
-        }
+        watchdog->Stop();
+    }
+    // The stream thread may also have stopped itself after a device error.
+    bool wasPlaying = playing.exchange(false);
+    bufferCV.notify_all();
+    if (metronomeThread.joinable())
+    {
+        metronomeThread.join();
+    }
+    if (renderAhead)
+    {
+        renderAhead->Stop();
+    }
+    if (wasPlaying && hWaveOut)
+    {
+        waveOutReset(hWaveOut);
     }
 }
 void Metronome::SetBPM(int bpm)
 {
     if (audioBpm != bpm)
     {
-        bool wasPlaying = IsPlaying();
-        if (wasPlaying)
-        {
-            Pause();
-        }
+        engine->SetBpm(bpm);
         audioBpm = bpm;
-        if (wasPlaying)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            Play();
-        }
+        METRONOME_TRACE_INSTANT("set_bpm", bpm);
+        ApplyWhileStopped();
     }
 }
 void Metronome::SetTimeSignature(int timeSignature)
@@ -101,20 +138,69 @@ void Metronome::SetTimeSignature(int timeSignature)
 
     if (audioTimeSignature != timeSignature)
     {
-        bool wasPlaying = IsPlaying();
-        if (wasPlaying)
-        {
-            Pause();
-        }
+        engine->SetTimeSignature(timeSignature);
         audioTimeSignature = timeSignature;
-        if (wasPlaying)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            Play();
-        }
+        METRONOME_TRACE_INSTANT("set_time_signature", timeSignature);
+        ApplyWhileStopped();
     }
 }
 
+void Metronome::SetMeter(int numerator, int denominator, const std::vector<int> &grouping, bool feltInGroups)
+{
+    engine->SetMeter(numerator, denominator, grouping, feltInGroups);
+    audioTimeSignature = numerator;
+    METRONOME_TRACE_INSTANT("set_meter", numerator);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetGrid(const metronome::StepGrid &grid)
+{
+    engine->SetGrid(grid);
+    METRONOME_TRACE_INSTANT("set_grid", grid.steps);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetPattern(const std::string &notation)
+{
+    SetGrid(*patterns.Compile(notation));
+}
+
+void Metronome::SetGridSamples(const std::vector<std::vector<uint8_t>> &samples)
+{
+    kit.samples.clear();
+    for (const std::vector<uint8_t> &bytes : samples)
+    {
+        kit.samples.push_back(metronome::BytesToPcm16(bytes));
+    }
+    kit.loudness.resize(2);
+    metronome::AnalyseKit(kit, engine->SampleRate());
+    engine->SetKit(kit);
+    METRONOME_TRACE_INSTANT("set_grid_samples", static_cast<int>(samples.size()));
+    ApplyWhileStopped();
+}
+
+void Metronome::SetLoudnessMatching(bool enabled)
+{
+    kit.matchLoudness = enabled;
+    engine->SetKit(kit);
+    METRONOME_TRACE_INSTANT("set_loudness_matching", enabled ? 1 : 0);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetRoute(int layer, int channel, double pan)
+{
+    engine->SetRoute(layer, channel, pan);
+    METRONOME_TRACE_INSTANT("set_route", layer);
+    ApplyWhileStopped();
+}
+
+void Metronome::SetGapClick(int playBars, int muteBars, bool randomised)
+{
+    engine->SetGapClick(playBars, muteBars, randomised);
+    METRONOME_TRACE_INSTANT("set_gap_click", muteBars);
+    ApplyWhileStopped();
+}
+
 void Metronome::SetVolume(double volume)
 {
     if (volume < 0.0 || volume > 1.0)
@@ -122,12 +208,10 @@ void Metronome::SetVolume(double volume)
         throw std::invalid_argument("Volume must be between 0.0 and 1.0");
     }
 
+    engine->SetVolume(volume);
     audioVolume = volume;
-    if (hWaveOut)
-    {
-        DWORD vol = static_cast<DWORD>(0xFFFF * volume);
-        waveOutSetVolume(hWaveOut, vol | (vol << 16));
-    }
+    METRONOME_TRACE_INSTANT("set_volume", static_cast<int>(volume * 100));
+    ApplyWhileStopped();
 }
 
 void Metronome::SetAudioFile(const std::vector<uint8_t> &mainFileBytes,
@@ -136,31 +220,57 @@ void Metronome::SetAudioFile(const std::vector<uint8_t> &mainFileBytes,
 
     if (!mainFileBytes.empty() || !accentedFileBytes.empty())
     {
-        bool wasPlaying = IsPlaying();
-        if (wasPlaying)
-        {
-            Pause();
-        }
         if (!mainFileBytes.empty())
         {
-            mainSound = byteArrayToShortArray(mainFileBytes);
+            kit.mainSound = metronome::BytesToPcm16(mainFileBytes);
+            kit.ForgetLoudness(0);
         }
         if (!accentedFileBytes.empty())
         {
-            accentedSound = byteArrayToShortArray(accentedFileBytes);
-        }
-
-        if (wasPlaying)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            Play();
+            kit.accentedSound = metronome::BytesToPcm16(accentedFileBytes);
+            kit.ForgetLoudness(1);
         }
+        metronome::AnalyseKit(kit, engine->SampleRate());
+        engine->SetKit(kit);
+        METRONOME_TRACE_INSTANT("set_audio_file", kit.mainSound.size());
+        ApplyWhileStopped();
     }
 }
 int Metronome::GetVolume() const
 {
     return static_cast<int>(audioVolume * 100);
 }
+metronome::BlockLevels Metronome::GetLevels() const
+{
+    return engine->Levels();
+}
+metronome::MemoryUsage Metronome::GetMemoryUsage() const
+{
+    return budget.Usage();
+}
+
+metronome::StreamStats Metronome::GetStreamStats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+void Metronome::StartOscBroadcast(const std::string &host, int port, int lookAheadMs)
+{
+    // The old publisher turns the engine's tick tap off as it goes.
+    osc.reset();
+    metronome::OscConfig config;
+    config.host = host;
+    config.port = port;
+    config.lookAhead = std::chrono::milliseconds(std::max<int>(0, lookAheadMs));
+    osc = std::make_unique<metronome::OscBeatPublisher>(*engine, [this]
+                                                         { return playedFrame.load(); },
+                                                         config);
+    osc->Start();
+}
+void Metronome::StopOscBroadcast()
+{
+    osc.reset();
+}
 bool Metronome::IsPlaying() const
 {
     return playing.load();
@@ -169,55 +279,68 @@ void Metronome::EnableTickCallback(std::shared_ptr<flutter::EventSink<flutter::E
 {
     this->eventTickSink = eventSink;
 }
-std::vector<int16_t> Metronome::byteArrayToShortArray(const std::vector<uint8_t> &byteArray)
-{
-    if (byteArray.empty() || byteArray.size() % 2 != 0)
-    {
-        throw std::invalid_argument("Invalid byte array length for PCM_16BIT");
-    }
 
-    std::vector<int16_t> shortArray(byteArray.size() / 2);
-    std::memcpy(shortArray.data(), byteArray.data(), byteArray.size());
-    return shortArray;
+void Metronome::StartJournal(const std::string &path)
+{
+    StopJournal();
+    journal = std::make_unique<metronome::CommandJournal>(path, sampleRate, 4096, &budget);
+    engine->SetJournal(journal.get());
+    ApplyWhileStopped();
 }
 
-std::vector<int16_t> Metronome::generateBuffer()
+void Metronome::StopJournal()
 {
-    std::lock_guard<std::mutex>
-        lock(paramMutex);
-    int newBeatLength = static_cast<int>(sampleRate * 60.0 / audioBpm);
-    std::vector<int16_t> bufferBar;
-    if (audioTimeSignature < 2)
+    if (!journal)
     {
-        bufferBar.resize(newBeatLength, 0);
-        std::copy_n(mainSound.begin(), min(newBeatLength, static_cast<int>(mainSound.size())), bufferBar.begin());
+        return;
     }
-    else
+    engine->SetJournal(nullptr);
+    // The render thread lets go of the journal at its next block.
+    while (engine->ActiveJournal() == journal.get() && playing.load())
     {
-        int beats = max(1, audioTimeSignature);
-        bufferBar.resize(newBeatLength * beats, 0);
-        for (int i = 0; i < beats; i++)
-        {
-            const std::vector<int16_t> &sound = (i == 0) ? accentedSound : mainSound;
-            int copyLength = min(newBeatLength, static_cast<int>(sound.size()));
-            std::copy_n(sound.begin(), copyLength, bufferBar.begin() + i * newBeatLength);
-        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    ApplyWhileStopped();
+    journal->Close(engine->Position());
+    if (journal->Dropped() > 0)
+    {
+        metronome::Log(metronome::LogLevel::Warning, "metronome", "Journal dropped %llu commands",
+                       static_cast<unsigned long long>(journal->Dropped()));
+    }
+    journal.reset();
+}
 
-    beatLength = newBeatLength;
-
-    return bufferBar;
+// With no stream running this thread is the engine's only consumer, so it
+// applies commands itself instead of letting them pile up in the queue.
+void Metronome::ApplyWhileStopped()
+{
+    if (!playing.load() && !metronomeThread.joinable())
+    {
+        engine->ApplyPending();
+    }
 }
 
 void Metronome::InitializeAudio()
 {
-    WAVEFORMATEX wfx = {0};
+    const int channels = engine->Channels();
+    // Plain PCM covers mono and stereo; more channels need the extensible
+    // format, with the channels assigned to speakers in order.
+    WAVEFORMATEXTENSIBLE format = {};
+    WAVEFORMATEX &wfx = format.Format;
     wfx.wFormatTag = WAVE_FORMAT_PCM;
-    wfx.nChannels = 1;
+    wfx.nChannels = static_cast<WORD>(channels);
     wfx.nSamplesPerSec = sampleRate;
     wfx.wBitsPerSample = 16;
-    wfx.nBlockAlign = 2;
-    wfx.nAvgBytesPerSec = sampleRate * 2;
+    wfx.nBlockAlign = static_cast<WORD>(2 * channels);
+    wfx.nAvgBytesPerSec = sampleRate * wfx.nBlockAlign;
+    if (channels > 2)
+    {
+        wfx.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+        wfx.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+        format.Samples.wValidBitsPerSample = 16;
+        format.dwChannelMask = (1u << channels) - 1;
+        format.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+    }
 
     MMRESULT result = waveOutOpen(&hWaveOut, WAVE_MAPPER, &wfx,
                                   reinterpret_cast<DWORD_PTR>(&Metronome::WaveOutProc),
@@ -226,9 +349,29 @@ void Metronome::InitializeAudio()
 
     if (result != MMSYSERR_NOERROR)
     {
+        hWaveOut = nullptr;
         throw std::runtime_error("Failed to initialize audio device. Error: " + std::to_string(result));
     }
-    SetVolume(audioVolume);
+    DWORD flags = 0;
+    if (waveOutMessage(reinterpret_cast<HWAVEOUT>(static_cast<UINT_PTR>(WAVE_MAPPER)), DRVM_MAPPER_PREFERRED_GET,
+                       reinterpret_cast<DWORD_PTR>(&openedDevice), reinterpret_cast<DWORD_PTR>(&flags)) != MMSYSERR_NOERROR)
+    {
+        openedDevice = WAVE_MAPPER;
+    }
+    blocksSinceDeviceCheck = 0;
+
+    blockFrames = max(1, sampleRate / kBlocksPerSecond);
+    blockMemory.assign(static_cast<size_t>(blockFrames) * channels * kBufferCount, 0);
+    for (int i = 0; i < kBufferCount; i++)
+    {
+        headers[i].lpData = reinterpret_cast<char *>(blockMemory.data() + i * blockFrames * channels);
+        headers[i].dwBufferLength = blockFrames * channels * sizeof(int16_t);
+        result = waveOutPrepareHeader(hWaveOut, &headers[i], sizeof(WAVEHDR));
+        if (result != MMSYSERR_NOERROR)
+        {
+            throw std::runtime_error("Failed to prepare audio buffer. Error: " + std::to_string(result));
+        }
+    }
 }
 
 void CALLBACK Metronome::WaveOutProc(HWAVEOUT hwo, UINT uMsg,
@@ -236,128 +379,256 @@ void CALLBACK Metronome::WaveOutProc(HWAVEOUT hwo, UINT uMsg,
                                      DWORD_PTR dwParam1,
                                      DWORD_PTR dwParam2)
 {
+    // waveOut functions must not be called from here; only bookkeeping.
     if (uMsg == WOM_DONE)
     {
         WAVEHDR *hdr = reinterpret_cast<WAVEHDR *>(dwParam1);
         Metronome *metronome = reinterpret_cast<Metronome *>(dwInstance);
 
-        if (hdr)
+        if (metronome && hdr)
         {
-            waveOutUnprepareHeader(hwo, hdr, sizeof(WAVEHDR));
-            delete[] hdr->lpData;
-            delete hdr;
-        }
-
-        if (metronome && metronome->playing.load())
-        {
-            metronome->OnBufferDone();
+            metronome->OnBufferDone(hdr);
         }
     }
 }
-void Metronome::OnBufferDone()
+void Metronome::OnBufferDone(WAVEHDR *hdr)
 {
-    std::lock_guard<std::mutex> lock(bufferMutex);
-    playCursor += beatLength;
-    //
-    if (eventTickSink != nullptr)
     {
-        if (audioTimeSignature < 2)
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        freeBuffers++;
+        if (reopening.load())
         {
-            currentTick = 0;
+            return;
         }
-        else
+        if (freeBuffers == kBufferCount && playing.load())
         {
-            currentTick++;
-            if (currentTick >= audioTimeSignature)
-                currentTick = 0;
+            METRONOME_TRACE_INSTANT("underrun", static_cast<int64_t>(hdr->dwUser));
+            metronome::Log(metronome::LogLevel::Warning, "metronome", "Underrun at frame %lld",
+                           static_cast<long long>(hdr->dwUser));
         }
-        eventTickSink->Success(flutter::EncodableValue(currentTick));
     }
     bufferCV.notify_one();
-}
-void Metronome::PlaySound()
-{
-    if (!IsPlaying())
-        return;
-
-    //
-    WAVEHDR *hdr = new WAVEHDR{0};
-    int16_t *buffer = new int16_t[beatLength];
 
+    if (!playing.load())
+    {
+        return;
+    }
     //
-    size_t currentWriteCursor;
+    const int64_t played = static_cast<int64_t>(hdr->dwUser) + blockFrames;
+    playedFrame.store(played);
+    playedAtNs.store(SteadyNanoseconds());
+    while (hasPendingTick || engine->PopTick(pendingTick))
     {
-        std::lock_guard<std::mutex> lock(paramMutex);
-        currentWriteCursor = writeCursor;
-
-        //
-        size_t startPos = currentWriteCursor % audioBuffer.size();
-        size_t copySize = min(beatLength,
-                              static_cast<int>(audioBuffer.size() - startPos));
-
-        std::copy(audioBuffer.begin() + startPos,
-                  audioBuffer.begin() + startPos + copySize,
-                  buffer);
-
-        if (copySize < beatLength)
+        if (pendingTick.frame >= played)
+        {
+            hasPendingTick = true;
+            break;
+        }
+        hasPendingTick = false;
+        if (eventTickSink != nullptr)
+        {
+            METRONOME_TRACE_INSTANT("tick_dispatch", pendingTick.beat);
+            eventTickSink->Success(flutter::EncodableValue(flutter::EncodableMap{
+                {flutter::EncodableValue("beat"), flutter::EncodableValue(pendingTick.beat)},
+                {flutter::EncodableValue("muted"), flutter::EncodableValue(pendingTick.muted)},
+            }));
+        }
+    }
+}
+// Returns false when the device has stopped taking audio.
+bool Metronome::PlaySound()
+{
+    {
+        std::unique_lock<std::mutex> lock(bufferMutex);
+        // A removed device just stops returning blocks.
+        if (!bufferCV.wait_for(lock, std::chrono::milliseconds(kDeviceTimeoutMs), [this]
+                               { return freeBuffers > 0 || !playing.load() || stalled.load(); }))
+        {
+            return false;
+        }
+        // Blocks stopped coming back without an error.
+        if (stalled.exchange(false))
+        {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.stalls++;
+            return false;
+        }
+        if (!playing.load())
         {
-            std::copy(audioBuffer.begin(),
-                      audioBuffer.begin() + (beatLength - copySize),
-                      buffer + copySize);
+            return true;
         }
+        freeBuffers--;
+    }
 
-        writeCursor += beatLength;
+    WAVEHDR *hdr = &headers[nextBuffer];
+    nextBuffer = (nextBuffer + 1) % kBufferCount;
+
+    // dwUser carries the engine frame the block starts at. After a failover
+    // the block may open with silence standing in for frames the engine
+    // already rendered for the old device.
+    int16_t *samples = reinterpret_cast<int16_t *>(hdr->lpData);
+    const int silent = static_cast<int>(std::min<int64_t>(padding, blockFrames));
+    const int channels = engine->Channels();
+    std::fill(samples, samples + silent * channels, int16_t(0));
+    padding -= silent;
+    hdr->dwUser = static_cast<DWORD_PTR>(renderAhead->Position() - silent);
+    renderAhead->Read(samples + silent * channels, blockFrames - silent);
+
+    METRONOME_TRACE_BEGIN("sink_submit");
+    MMRESULT result = waveOutWrite(hWaveOut, hdr, sizeof(WAVEHDR));
+    METRONOME_TRACE_END("sink_submit");
+    switch (result)
+    {
+    case MMSYSERR_NOERROR:
+        return true;
+    case MMSYSERR_NODRIVER:
+    case MMSYSERR_BADDEVICEID:
+    case MMSYSERR_INVALHANDLE:
+    case MMSYSERR_ERROR:
+        return false;
+    default:
+        throw std::runtime_error("Failed to write audio block. Error: " + std::to_string(result));
     }
+}
 
-    hdr->lpData = reinterpret_cast<char *>(buffer);
-    hdr->dwBufferLength = beatLength * sizeof(int16_t);
+bool Metronome::DefaultDeviceChanged()
+{
+    if (++blocksSinceDeviceCheck < kDeviceCheckBlocks)
+    {
+        return false;
+    }
+    blocksSinceDeviceCheck = 0;
+    UINT device = WAVE_MAPPER;
+    DWORD flags = 0;
+    if (waveOutMessage(reinterpret_cast<HWAVEOUT>(static_cast<UINT_PTR>(WAVE_MAPPER)), DRVM_MAPPER_PREFERRED_GET,
+                       reinterpret_cast<DWORD_PTR>(&device), reinterpret_cast<DWORD_PTR>(&flags)) != MMSYSERR_NOERROR)
+    {
+        return false;
+    }
+    return device != openedDevice;
+}
 
-    //
-    MMRESULT result = waveOutPrepareHeader(hWaveOut, hdr, sizeof(WAVEHDR));
-    if (result != MMSYSERR_NOERROR)
+void Metronome::ReopenAudio()
+{
+    const int64_t detectedAt = SteadyNanoseconds();
+    metronome::Log(metronome::LogLevel::Warning, "metronome", "Output device lost, changed or stalled at frame %lld; reopening",
+                   static_cast<long long>(playedFrame.load()));
+    METRONOME_TRACE_INSTANT("device_lost", playedFrame.load());
+    reopening.store(true);
+    CloseAudio();
+
+    int retryMs = 10;
+    while (playing.load())
+    {
+        try
+        {
+            InitializeAudio();
+            break;
+        }
+        catch (const std::runtime_error &e)
+        {
+            metronome::Log(metronome::LogLevel::Debug, "metronome", "Reopening the output failed: %s", e.what());
+        }
+        std::unique_lock<std::mutex> lock(bufferMutex);
+        bufferCV.wait_for(lock, std::chrono::milliseconds(retryMs), [this]
+                          { return !playing.load(); });
+        retryMs = min(500, retryMs * 2);
+    }
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        freeBuffers = kBufferCount;
+        nextBuffer = 0;
+        // A stall reported meanwhile was this same outage.
+        stalled.store(false);
+    }
+    reopening.store(false);
+    if (!playing.load())
     {
-        delete[] buffer;
-        delete hdr;
         return;
     }
 
-    result = waveOutWrite(hWaveOut, hdr, sizeof(WAVEHDR));
-    if (result != MMSYSERR_NOERROR)
+    // Ticks in blocks sent to the old device were never heard; those still
+    // waiting to be read go to the new one.
+    while (hasPendingTick || engine->PopTick(pendingTick))
     {
-        waveOutUnprepareHeader(hWaveOut, hdr, sizeof(WAVEHDR));
-        delete[] buffer;
-        delete hdr;
-        return;
+        if (pendingTick.frame >= renderAhead->Position())
+        {
+            hasPendingTick = true;
+            break;
+        }
+        hasPendingTick = false;
     }
 
-    //
-    const int beatMs = 60000 / audioBpm;
-    auto sleepUntil = std::chrono::steady_clock::now() +
-                      std::chrono::milliseconds(beatMs);
-    std::this_thread::sleep_until(sleepUntil);
+    // Resume where the timeline would be had the old device kept playing
+    // since it last returned a block.
+    const int64_t now = SteadyNanoseconds();
+    const int64_t resumeAt = playedFrame.load() + (now - playedAtNs.load()) * sampleRate / 1000000000;
+    if (resumeAt > renderAhead->Position())
+    {
+        renderAhead->Skip(static_cast<size_t>(resumeAt - renderAhead->Position()));
+    }
+    else
+    {
+        padding = renderAhead->Position() - resumeAt;
+    }
+    playedFrame.store(resumeAt);
+    playedAtNs.store(now);
+
+    const double failoverMs = (now - detectedAt) / 1e6;
+    metronome::StreamStats reopened;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.failovers++;
+        stats.lastFailoverMs = failoverMs;
+        stats.maxFailoverMs = max(stats.maxFailoverMs, failoverMs);
+        reopened = stats;
+    }
+    METRONOME_TRACE_INSTANT("device_reopened", static_cast<int64_t>(failoverMs * 1000));
+    metronome::Log(metronome::LogLevel::Info, "metronome",
+                   "Output reopened after %.1f ms (failover %llu, %llu for stalls, worst %.1f ms); resuming at frame %lld",
+                   failoverMs, static_cast<unsigned long long>(reopened.failovers),
+                   static_cast<unsigned long long>(reopened.stalls), reopened.maxFailoverMs,
+                   static_cast<long long>(resumeAt));
 }
 
 void Metronome::StartMetronome()
 {
+    METRONOME_TRACE_THREAD_NAME("metronome");
     try
     {
         while (playing.load())
         {
-            PlaySound();
+            if (!PlaySound() || DefaultDeviceChanged())
+            {
+                ReopenAudio();
+            }
         }
     }
-    catch (...)
+    catch (const std::exception &e)
     {
+        metronome::Log(metronome::LogLevel::Error, "metronome", "Playback stopped: %s", e.what());
         playing.store(false);
-        throw;
     }
 }
-void Metronome::Destroy()
+void Metronome::CloseAudio()
 {
-    Stop();
     if (hWaveOut)
     {
+        waveOutReset(hWaveOut);
+        for (WAVEHDR &hdr : headers)
+        {
+            waveOutUnprepareHeader(hWaveOut, &hdr, sizeof(WAVEHDR));
+            hdr.dwFlags = 0;
+        }
         waveOutClose(hWaveOut);
         hWaveOut = nullptr;
     }
-}
\ No newline at end of file
+}
+
+void Metronome::Destroy()
+{
+    Stop();
+    osc.reset();
+    StopJournal();
+    CloseAudio();
+}
@@ -12,16 +12,30 @@
 #include <windows.h>
 #include <mmsystem.h>
 #include <cmath>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <condition_variable>
 #include <flutter/event_sink.h>
 #include <flutter/encodable_value.h>
+
+#include "metronome_engine.h"
+#include "metronome_journal.h"
+#include "metronome_log.h"
+#include "metronome_memory_budget.h"
+#include "metronome_osc.h"
+#include "metronome_pattern.h"
+#include "metronome_render_ahead.h"
+#include "metronome_stream.h"
+#include "metronome_trace.h"
+#include "metronome_watchdog.h"
 class Metronome
 {
 public:
     Metronome(const std::vector<uint8_t> &mainFileBytes,
               const std::vector<uint8_t> &accentedFileBytes,
-              int bpm, int timeSignature, double volume, int sampleRate);
+              int bpm, int timeSignature, double volume, int sampleRate, int channels = 1,
+              size_t memoryBudget = 0);
     ~Metronome();
 
     void Play();
@@ -29,41 +43,118 @@ public:
     void Stop();
     void SetBPM(int bpm);
     void SetTimeSignature(int timeSignature);
+    // Takes over at the next bar line; see ClickEngine::SetMeter.
+    void SetMeter(int numerator, int denominator, const std::vector<int> &grouping, bool feltInGroups);
+    // Plays grid instead of the click; see ClickEngine::SetGrid.
+    void SetGrid(const metronome::StepGrid &grid);
+    // Plays notation as a grid; see CompilePattern.
+    void SetPattern(const std::string &notation);
+    // Sounds for grid sample indices 2 onwards, replacing earlier ones.
+    void SetGridSamples(const std::vector<std::vector<uint8_t>> &samples);
+    // Trims every sound to the main sound's loudness; see MatchKitLoudness.
+    void SetLoudnessMatching(bool enabled);
+    // Sends a layer to an output channel; see ClickEngine::SetRoute.
+    void SetRoute(int layer, int channel, double pan);
+    // Plays playBars then mutes muteBars; see ClickEngine::SetGapClick.
+    void SetGapClick(int playBars, int muteBars, bool randomised);
     void SetVolume(double volume);
     void SetAudioFile(const std::vector<uint8_t> &mainFileBytes, const std::vector<uint8_t> &accentedSound);
     void EnableTickCallback(std::shared_ptr<flutter::EventSink<flutter::EncodableValue>> eventSink);
     bool IsPlaying() const;
     void Destroy();
-    int Metronome::GetVolume() const;
+    int GetVolume() const;
+    // Levels of the last block rendered, for meters.
+    metronome::BlockLevels GetLevels() const;
+    // Memory held against the budget given at construction.
+    metronome::MemoryUsage GetMemoryUsage() const;
+    // Device failovers and stalls since construction; the period and xrun
+    // counts stay zero, as waveOut reports neither.
+    metronome::StreamStats GetStreamStats() const;
+    // Sends every beat as OSC to host:port, lookAheadMs before it sounds,
+    // replacing any earlier broadcast; see OscBeatPublisher.
+    void StartOscBroadcast(const std::string &host, int port, int lookAheadMs);
+    void StopOscBroadcast();
+    // Records every command the engine applies to a journal at path, until
+    // StopJournal; see metronome_journal.h.
+    void StartJournal(const std::string &path);
+    void StopJournal();
     int audioBpm = 120;
     int audioTimeSignature = 4;
 
 private:
+    // 10 ms blocks, four deep, rendered four ahead: commands are heard
+    // within ~80 ms.
+    static constexpr int kBufferCount = 4;
+    static constexpr int kBlocksPerSecond = 100;
+    // Blocks the render thread keeps ready; waveOut takes a full queue of
+    // them at once when it starts.
+    static constexpr int kRenderAheadBlocks = kBufferCount;
+    // A block not coming back for this long means the device is gone.
+    static constexpr int kDeviceTimeoutMs = 500;
+    // The watchdog restarts the device sooner, once the played position
+    // has been stuck this long while blocks are still being written.
+    static constexpr int kStallMs = 200;
+    // How often, in blocks, to check whether the default output changed.
+    static constexpr int kDeviceCheckBlocks = kBlocksPerSecond;
+
     void StartMetronome();
     void InitializeAudio();
-    void OnBufferDone();
-    void PlaySound();
+    void CloseAudio();
+    // Moves playback to the current default device, keeping the beat grid.
+    void ReopenAudio();
+    bool DefaultDeviceChanged();
+    void OnBufferDone(WAVEHDR *hdr);
+    bool PlaySound();
+    void ApplyWhileStopped();
     std::shared_ptr<flutter::EventSink<flutter::EncodableValue>> eventTickSink;
-    std::vector<int16_t> Metronome::byteArrayToShortArray(const std::vector<uint8_t> &byteArray);
-    std::vector<int16_t> Metronome::generateBuffer();
     static void CALLBACK WaveOutProc(HWAVEOUT hwo, UINT uMsg, DWORD_PTR dwInstance, DWORD_PTR dwParam1, DWORD_PTR dwParam2);
-    HWAVEOUT hWaveOut;
-    size_t playCursor;
-    size_t writeCursor;
+    HWAVEOUT hWaveOut = nullptr;
+    // Caps the engine's kits, the render-ahead ring and the journal;
+    // outlives them all. Zero only keeps count.
+    metronome::MemoryBudget budget;
+    std::unique_ptr<metronome::ClickEngine> engine;
+    // Renders on a thread of its own; the stream thread only copies blocks
+    // out, so rendering cost never holds up a waveOutWrite.
+    std::unique_ptr<metronome::RenderAhead> renderAhead;
+    std::unique_ptr<metronome::CommandJournal> journal;
+    // Runs while playing; sets stalled when WOM_DONE stops arriving.
+    std::unique_ptr<metronome::StallWatchdog> watchdog;
+    std::atomic<bool> stalled{false};
+    // Sends beats while it exists, playing or not.
+    std::unique_ptr<metronome::OscBeatPublisher> osc;
+    // Patterns already compiled, for switching back to one.
+    metronome::PatternCache patterns;
+    // Blocks are handed to waveOut round-robin and come back in order.
+    WAVEHDR headers[kBufferCount] = {};
+    std::vector<int16_t> blockMemory;
+    int blockFrames = 0;
+    int nextBuffer = 0;
+    int freeBuffers = kBufferCount;
+    // The device WAVE_MAPPER resolved to when opened.
+    UINT openedDevice = 0;
+    int blocksSinceDeviceCheck = 0;
+    // Where the device last finished a block, for resuming after a failover.
+    std::atomic<int64_t> playedFrame{0};
+    std::atomic<int64_t> playedAtNs{0};
+    // Set while the old device is torn down, so flushed blocks aren't
+    // mistaken for played ones.
+    std::atomic<bool> reopening{false};
+    // Silent frames owed to the new device after a failover.
+    int64_t padding = 0;
+    // Written on the playback thread, read by GetStreamStats.
+    mutable std::mutex statsMutex;
+    metronome::StreamStats stats;
     std::mutex bufferMutex;
     std::condition_variable bufferCV;
-    std::mutex paramMutex;
-    int currentTick = 0;
-    //
-    std::vector<int16_t> audioBufferTemp;
-    std::vector<int16_t> audioBuffer;
-    std::vector<int16_t> mainSound;
-    std::vector<int16_t> accentedSound;
+    // Ticks rendered ahead of playback, reported when their block has played.
+    metronome::TickEvent pendingTick;
+    bool hasPendingTick = false;
+    // The sounds last sent to the engine, for partial SetAudioFile calls.
+    metronome::Kit kit;
     int sampleRate = 44100;
-    int beatLength = 0;
     double audioVolume = 1.0;
     std::atomic<bool> playing{false};
     std::thread metronomeThread;
 };
 
-#endif // METRONOME_H_
\ No newline at end of file
+#endif // METRONOME_H_
@@ -5,10 +5,220 @@
 #include <flutter/event_stream_handler_functions.h>
 #include <flutter/encodable_value.h>
 #include <flutter/plugin_registrar_windows.h>
-#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+
+#include "metronome_audio_file.h"
+#include "metronome_journal.h"
+#include "metronome_log.h"
+#include "metronome_midi.h"
+#include "metronome_trace.h"
 
 namespace metronome
 {
+  namespace
+  {
+    // Fails the call and keeps a record of it in the diagnostic log.
+    void ReportError(flutter::MethodResult<flutter::EncodableValue> &result, const std::string &method,
+                     const std::string &code, const std::string &message)
+    {
+      Log(LogLevel::Error, "plugin", "%s failed (%s): %s", method.c_str(), code.c_str(), message.c_str());
+      result.Error(code, message);
+    }
+
+    template <typename T>
+    T ValueOr(const flutter::EncodableMap &map, const char *key, T fallback)
+    {
+      auto it = map.find(flutter::EncodableValue(key));
+      if (it == map.end() || it->second.IsNull())
+      {
+        return fallback;
+      }
+      return std::get<T>(it->second);
+    }
+
+    std::vector<int> IntList(const flutter::EncodableList &list)
+    {
+      std::vector<int> values;
+      for (const auto &value : list)
+      {
+        values.push_back(std::get<int>(value));
+      }
+      return values;
+    }
+
+    // A grid as sent by MetronomeGrid.toMap: a step count and sparse hits.
+    StepGrid GridFrom(const flutter::EncodableMap &map)
+    {
+      StepGrid grid;
+      grid.steps = ValueOr<int>(map, "steps", 0);
+      for (const auto &value : ValueOr<flutter::EncodableList>(map, "hits", {}))
+      {
+        const auto &hit = std::get<flutter::EncodableMap>(value);
+        const int step = ValueOr<int>(hit, "step", 0);
+        const int lane = ValueOr<int>(hit, "lane", 0);
+        const int sample = ValueOr<int>(hit, "sample", 0);
+        const int velocity = ValueOr<int>(hit, "velocity", 100);
+        if (step < 0 || step >= kMaxGridSteps || lane < 0 || lane >= kGridLanes || sample < 0 || sample > 255 ||
+            velocity < 0 || velocity > 127)
+        {
+          throw std::invalid_argument("Grid hit out of range");
+        }
+        grid.cells[step][lane] = GridCell{static_cast<uint8_t>(sample), static_cast<uint8_t>(velocity)};
+      }
+      return grid;
+    }
+
+    Song SongFromMap(const flutter::EncodableMap &map)
+    {
+      Song song;
+      song.name = ValueOr<std::string>(map, "name", "");
+      song.sampleRate = ValueOr<int>(map, "sampleRate", 44100);
+      song.bars = ValueOr<int>(map, "bars", 1);
+      song.timeSignature = ValueOr<int>(map, "timeSignature", 4);
+      song.volume = ValueOr<double>(map, "volume", 1.0);
+      for (const auto &entry : ValueOr<flutter::EncodableList>(map, "tempoMap", {}))
+      {
+        const auto &segment = std::get<flutter::EncodableMap>(entry);
+        song.tempoMap.push_back(TempoSegment{
+            ValueOr<int>(segment, "bar", 0),
+            ValueOr<double>(segment, "bpm", 120.0),
+            ValueOr<double>(segment, "endBpm", 0.0),
+            ValueOr<double>(segment, "beat", 0.0)});
+      }
+      for (const auto &entry : ValueOr<flutter::EncodableList>(map, "meterMap", {}))
+      {
+        const auto &meter = std::get<flutter::EncodableMap>(entry);
+        song.meterMap.push_back(MeterChange{
+            ValueOr<int>(meter, "bar", 0),
+            ValueOr<int>(meter, "numerator", 4),
+            ValueOr<int>(meter, "denominator", 4),
+            IntList(ValueOr<flutter::EncodableList>(meter, "grouping", {})),
+            ValueOr<bool>(meter, "feltInGroups", false)});
+      }
+      for (const auto &entry : ValueOr<flutter::EncodableList>(map, "markers", {}))
+      {
+        const auto &marker = std::get<flutter::EncodableMap>(entry);
+        song.markers.push_back(Marker{
+            ValueOr<int>(marker, "bar", 0),
+            ValueOr<double>(marker, "beat", 0.0),
+            ValueOr<std::string>(marker, "text", "")});
+      }
+      for (const auto &accent : ValueOr<flutter::EncodableList>(map, "pattern", {}))
+      {
+        song.pattern.push_back(static_cast<BeatAccent>(std::get<int>(accent)));
+      }
+      song.kit.mainSound = BytesToPcm16(ValueOr<std::vector<uint8_t>>(map, "mainFileBytes", {}));
+      song.kit.accentedSound = BytesToPcm16(ValueOr<std::vector<uint8_t>>(map, "accentedFileBytes", {}));
+      return song;
+    }
+
+    ExportJob ExportJobFromMap(const flutter::EncodableMap &map)
+    {
+      ExportJob job;
+      job.path = ValueOr<std::string>(map, "path", "");
+      if (job.path.empty())
+      {
+        throw std::invalid_argument("Export path cannot be empty");
+      }
+      job.format = ValueOr<std::string>(map, "format", "wav") == "flac" ? AudioFileFormat::Flac : AudioFileFormat::Wav;
+      job.song = SongFromMap(map);
+      return job;
+    }
+
+    flutter::EncodableMap SongMapsToMap(const Song &song)
+    {
+      flutter::EncodableList tempoMap;
+      for (const TempoSegment &segment : song.tempoMap)
+      {
+        tempoMap.push_back(flutter::EncodableValue(flutter::EncodableMap{
+            {flutter::EncodableValue("bar"), flutter::EncodableValue(segment.startBar)},
+            {flutter::EncodableValue("beat"), flutter::EncodableValue(segment.beatOffset)},
+            {flutter::EncodableValue("bpm"), flutter::EncodableValue(segment.bpm)},
+            {flutter::EncodableValue("endBpm"), flutter::EncodableValue(segment.endBpm)},
+        }));
+      }
+      flutter::EncodableList meterMap;
+      for (const MeterChange &meter : song.meterMap)
+      {
+        meterMap.push_back(flutter::EncodableValue(flutter::EncodableMap{
+            {flutter::EncodableValue("bar"), flutter::EncodableValue(meter.startBar)},
+            {flutter::EncodableValue("numerator"), flutter::EncodableValue(meter.numerator)},
+            {flutter::EncodableValue("denominator"), flutter::EncodableValue(meter.denominator)},
+            {flutter::EncodableValue("grouping"), flutter::EncodableValue(flutter::EncodableList(meter.grouping.begin(), meter.grouping.end()))},
+            {flutter::EncodableValue("feltInGroups"), flutter::EncodableValue(meter.feltInGroups)},
+        }));
+      }
+      flutter::EncodableList markers;
+      for (const Marker &marker : song.markers)
+      {
+        markers.push_back(flutter::EncodableValue(flutter::EncodableMap{
+            {flutter::EncodableValue("bar"), flutter::EncodableValue(marker.bar)},
+            {flutter::EncodableValue("beat"), flutter::EncodableValue(marker.beatOffset)},
+            {flutter::EncodableValue("text"), flutter::EncodableValue(marker.text)},
+        }));
+      }
+      return flutter::EncodableMap{
+          {flutter::EncodableValue("bars"), flutter::EncodableValue(song.bars)},
+          {flutter::EncodableValue("tempoMap"), flutter::EncodableValue(tempoMap)},
+          {flutter::EncodableValue("meterMap"), flutter::EncodableValue(meterMap)},
+          {flutter::EncodableValue("markers"), flutter::EncodableValue(markers)},
+      };
+    }
+
+    flutter::EncodableValue LevelToValue(const Level &level)
+    {
+      return flutter::EncodableValue(flutter::EncodableMap{
+          {flutter::EncodableValue("peak"), flutter::EncodableValue(static_cast<double>(level.peak))},
+          {flutter::EncodableValue("rms"), flutter::EncodableValue(static_cast<double>(level.rms))},
+      });
+    }
+
+    flutter::EncodableMap LevelsToMap(const BlockLevels &levels)
+    {
+      flutter::EncodableList lanes;
+      for (const Level &lane : levels.lanes)
+      {
+        lanes.push_back(LevelToValue(lane));
+      }
+      return flutter::EncodableMap{
+          {flutter::EncodableValue("output"), LevelToValue(levels.output)},
+          {flutter::EncodableValue("click"), LevelToValue(levels.click)},
+          {flutter::EncodableValue("lanes"), flutter::EncodableValue(lanes)},
+      };
+    }
+
+    flutter::EncodableMap StreamStatsToMap(const StreamStats &stats)
+    {
+      return flutter::EncodableMap{
+          {flutter::EncodableValue("periods"), flutter::EncodableValue(static_cast<int64_t>(stats.periods))},
+          {flutter::EncodableValue("xruns"), flutter::EncodableValue(static_cast<int64_t>(stats.xruns))},
+          {flutter::EncodableValue("lostFrames"), flutter::EncodableValue(stats.lostFrames)},
+          {flutter::EncodableValue("failovers"), flutter::EncodableValue(static_cast<int64_t>(stats.failovers))},
+          {flutter::EncodableValue("lastFailoverMs"), flutter::EncodableValue(stats.lastFailoverMs)},
+          {flutter::EncodableValue("maxFailoverMs"), flutter::EncodableValue(stats.maxFailoverMs)},
+          {flutter::EncodableValue("stalls"), flutter::EncodableValue(static_cast<int64_t>(stats.stalls))},
+      };
+    }
+
+    flutter::EncodableMap MemoryUsageToMap(const MemoryUsage &usage)
+    {
+      flutter::EncodableMap map{
+          {flutter::EncodableValue("limit"), flutter::EncodableValue(static_cast<int64_t>(usage.limit))},
+          {flutter::EncodableValue("used"), flutter::EncodableValue(static_cast<int64_t>(usage.used))},
+          {flutter::EncodableValue("refusals"), flutter::EncodableValue(static_cast<int64_t>(usage.refusals))},
+      };
+      for (int component = 0; component < kMemoryComponents; component++)
+      {
+        map[flutter::EncodableValue(MemoryComponentName(static_cast<MemoryComponent>(component)))] =
+            flutter::EncodableValue(static_cast<int64_t>(usage.components[component]));
+      }
+      return map;
+    }
+  }
+
   void MetronomePlugin::RegisterWithRegistrar(flutter::PluginRegistrarWindows *registrar)
   {
     auto methodChannel =
@@ -21,7 +231,17 @@ namespace metronome
             registrar->messenger(), "metronome_tick",
             &flutter::StandardMethodCodec::GetInstance());
 
-    auto plugin = std::make_unique<MetronomePlugin>();
+    auto exportChannel =
+        std::make_unique<flutter::EventChannel<flutter::EncodableValue>>(
+            registrar->messenger(), "metronome_export",
+            &flutter::StandardMethodCodec::GetInstance());
+
+    auto logChannel =
+        std::make_unique<flutter::EventChannel<flutter::EncodableValue>>(
+            registrar->messenger(), "metronome_log",
+            &flutter::StandardMethodCodec::GetInstance());
+
+    auto plugin = std::make_unique<MetronomePlugin>(registrar);
 
     methodChannel->SetMethodCallHandler(
         [plugin_pointer = plugin.get()](const auto &call, auto result)
@@ -46,14 +266,123 @@ namespace metronome
               return nullptr;
             }));
 
+    exportChannel->SetStreamHandler(
+        std::make_unique<flutter::StreamHandlerFunctions<>>(
+            [plugin_pointer = plugin.get()](
+                const flutter::EncodableValue *arguments,
+                std::unique_ptr<flutter::EventSink<>> &&events)
+                -> std::unique_ptr<flutter::StreamHandlerError<>>
+            {
+              plugin_pointer->exportSink = std::shared_ptr<flutter::EventSink<flutter::EncodableValue>>(events.release());
+              return nullptr;
+            },
+            [plugin_pointer = plugin.get()](const flutter::EncodableValue *arguments)
+                -> std::unique_ptr<flutter::StreamHandlerError<>>
+            {
+              plugin_pointer->exportSink.reset();
+              return nullptr;
+            }));
+
+    // Records come from the log drainer thread and are delivered on the
+    // platform thread.
+    logChannel->SetStreamHandler(
+        std::make_unique<flutter::StreamHandlerFunctions<>>(
+            [plugin_pointer = plugin.get()](
+                const flutter::EncodableValue *arguments,
+                std::unique_ptr<flutter::EventSink<>> &&events)
+                -> std::unique_ptr<flutter::StreamHandlerError<>>
+            {
+              plugin_pointer->logSink = std::shared_ptr<flutter::EventSink<flutter::EncodableValue>>(events.release());
+              SetLogCallback([plugin_pointer](const LogRecord &record)
+                             { plugin_pointer->PostEvent(EventStream::Log, flutter::EncodableValue(flutter::EncodableMap{
+                                   {flutter::EncodableValue("time"), flutter::EncodableValue(record.time)},
+                                   {flutter::EncodableValue("level"), flutter::EncodableValue(static_cast<int>(record.level))},
+                                   {flutter::EncodableValue("category"), flutter::EncodableValue(std::string(record.category))},
+                                   {flutter::EncodableValue("message"), flutter::EncodableValue(std::string(record.message))},
+                               })); });
+              return nullptr;
+            },
+            [plugin_pointer = plugin.get()](const flutter::EncodableValue *arguments)
+                -> std::unique_ptr<flutter::StreamHandlerError<>>
+            {
+              SetLogCallback(nullptr);
+              plugin_pointer->logSink.reset();
+              return nullptr;
+            }));
+
     registrar->AddPlugin(std::move(plugin));
   }
 
-  MetronomePlugin::MetronomePlugin()
+  MetronomePlugin::MetronomePlugin(flutter::PluginRegistrarWindows *registrar)
+      : registrar(registrar)
   {
+    // Headless engines have no view, and no stream events are delivered.
+    if (registrar->GetView() != nullptr)
+    {
+      window = GetAncestor(registrar->GetView()->GetNativeWindow(), GA_ROOT);
+    }
+    eventMessage = RegisterWindowMessageA("metronome_plugin_events");
+    windowProcDelegate = registrar->RegisterTopLevelWindowProcDelegate(
+        [this](HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam) -> std::optional<LRESULT>
+        {
+          if (message != eventMessage)
+          {
+            return std::nullopt;
+          }
+          DeliverEvents();
+          return 0;
+        });
   }
 
-  MetronomePlugin::~MetronomePlugin() {}
+  MetronomePlugin::~MetronomePlugin()
+  {
+    SetLogCallback(nullptr);
+    // Joins the workers, so nothing posts once the delegate is gone.
+    exporter.reset();
+    registrar->UnregisterTopLevelWindowProcDelegate(windowProcDelegate);
+  }
+
+  void MetronomePlugin::PostEvent(EventStream stream, flutter::EncodableValue event)
+  {
+    bool wake;
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      // One message drains everything queued before it is handled.
+      wake = pendingEvents.empty();
+      pendingEvents.emplace_back(stream, std::move(event));
+    }
+    if (wake && window != nullptr)
+    {
+      PostMessage(window, eventMessage, 0, 0);
+    }
+  }
+
+  void MetronomePlugin::DeliverEvents()
+  {
+    std::vector<std::pair<EventStream, flutter::EncodableValue>> events;
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      events.swap(pendingEvents);
+    }
+    for (const auto &event : events)
+    {
+      const auto &sink = event.first == EventStream::Export ? exportSink : logSink;
+      if (sink)
+      {
+        sink->Success(event.second);
+      }
+    }
+  }
+
+  void MetronomePlugin::OnExportProgress(const ExportProgress &progress)
+  {
+    PostEvent(EventStream::Export, flutter::EncodableValue(flutter::EncodableMap{
+                                       {flutter::EncodableValue("jobId"), flutter::EncodableValue(progress.jobId)},
+                                       {flutter::EncodableValue("state"), flutter::EncodableValue(static_cast<int>(progress.state))},
+                                       {flutter::EncodableValue("progress"), flutter::EncodableValue(progress.progress)},
+                                       {flutter::EncodableValue("error"), flutter::EncodableValue(progress.error)},
+                                   }));
+  }
 
   void MetronomePlugin::HandleMethodCall(
       const flutter::MethodCall<flutter::EncodableValue> &method_call,
@@ -63,25 +392,48 @@ namespace metronome
     if (method == "init")
     {
       auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
-      std::vector<uint8_t> mainFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("mainFileBytes")]);
-      std::vector<uint8_t> accentedFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("accentedFileBytes")]);
-      int timeSignature = std::get<int>(arguments[flutter::EncodableValue("timeSignature")]);
-      int bpm = std::get<int>(arguments[flutter::EncodableValue("bpm")]);
-      double volume = std::get<double>(arguments[flutter::EncodableValue("volume")]);
-      int sampleRate = std::get<int>(arguments[flutter::EncodableValue("sampleRate")]);
-      bool enableTickCallback = std::get<bool>(arguments[flutter::EncodableValue("enableTickCallback")]);
+      try
+      {
+        std::vector<uint8_t> mainFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("mainFileBytes")]);
+        std::vector<uint8_t> accentedFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("accentedFileBytes")]);
+        int timeSignature = std::get<int>(arguments[flutter::EncodableValue("timeSignature")]);
+        int bpm = std::get<int>(arguments[flutter::EncodableValue("bpm")]);
+        double volume = std::get<double>(arguments[flutter::EncodableValue("volume")]);
+        int sampleRate = std::get<int>(arguments[flutter::EncodableValue("sampleRate")]);
+        bool enableTickCallback = std::get<bool>(arguments[flutter::EncodableValue("enableTickCallback")]);
+        int channels = ValueOr<int>(arguments, "channels", 1);
+        // Budgets past 2 GB arrive as 64-bit.
+        auto budget = arguments.find(flutter::EncodableValue("memoryBudget"));
+        int64_t memoryBudget = budget == arguments.end() || budget->second.IsNull() ? 0 : budget->second.LongValue();
 
-      metronome = std::make_unique<Metronome>(mainFileBytes, accentedFileBytes, bpm, timeSignature, volume, sampleRate);
-      if (enableTickCallback && eventSink)
+        metronome = std::make_unique<Metronome>(mainFileBytes, accentedFileBytes, bpm, timeSignature, volume, sampleRate,
+                                                channels, static_cast<size_t>(std::max<int64_t>(0, memoryBudget)));
+        if (enableTickCallback && eventSink)
+        {
+          metronome->EnableTickCallback(eventSink);
+        }
+        result->Success(true);
+      }
+      catch (const std::invalid_argument &e)
       {
-        metronome->EnableTickCallback(eventSink);
+        ReportError(*result, method, "invalid_argument", e.what());
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
       }
-      result->Success(true);
     }
     else if (method == "play")
     {
-      metronome->Play();
-      result->Success(true);
+      try
+      {
+        metronome->Play();
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
+      }
     }
     else if (method == "pause")
     {
@@ -97,9 +449,16 @@ namespace metronome
     {
       auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
       int bpm = std::get<int>(arguments[flutter::EncodableValue("bpm")]);
-      metronome->SetBPM(bpm);
-      std::cout << "bpm " << bpm << std::endl;
-      result->Success(true);
+      try
+      {
+        metronome->SetBPM(bpm);
+        Log(LogLevel::Debug, "plugin", "setBPM %d", bpm);
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
+      }
     }
     else if (method == "getBPM")
     {
@@ -109,8 +468,117 @@ namespace metronome
     {
       auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
       int timeSignature = std::get<int>(arguments[flutter::EncodableValue("timeSignature")]);
-      metronome->SetTimeSignature(timeSignature);
-      result->Success(true);
+      try
+      {
+        metronome->SetTimeSignature(timeSignature);
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
+      }
+    }
+    else if (method == "setMeter")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        metronome->SetMeter(ValueOr<int>(arguments, "numerator", 4),
+                            ValueOr<int>(arguments, "denominator", 4),
+                            IntList(ValueOr<flutter::EncodableList>(arguments, "grouping", {})),
+                            ValueOr<bool>(arguments, "feltInGroups", false));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_meter", e.what());
+      }
+    }
+    else if (method == "setGrid")
+    {
+      try
+      {
+        metronome->SetGrid(GridFrom(std::get<flutter::EncodableMap>(*method_call.arguments())));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_grid", e.what());
+      }
+    }
+    else if (method == "setPattern")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        metronome->SetPattern(ValueOr<std::string>(arguments, "notation", ""));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_grid", e.what());
+      }
+    }
+    else if (method == "setGridSamples")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        std::vector<std::vector<uint8_t>> samples;
+        for (const auto &value : ValueOr<flutter::EncodableList>(arguments, "samples", {}))
+        {
+          samples.push_back(std::get<std::vector<uint8_t>>(value));
+        }
+        metronome->SetGridSamples(samples);
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_samples", e.what());
+      }
+    }
+    else if (method == "setLoudnessMatching")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        metronome->SetLoudnessMatching(ValueOr<bool>(arguments, "enabled", false));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
+      }
+    }
+    else if (method == "setRoute")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        metronome->SetRoute(ValueOr<int>(arguments, "layer", 0),
+                            ValueOr<int>(arguments, "channel", 0),
+                            ValueOr<double>(arguments, "pan", 0.0));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_route", e.what());
+      }
+    }
+    else if (method == "setGapClick")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        metronome->SetGapClick(ValueOr<int>(arguments, "playBars", 1),
+                               ValueOr<int>(arguments, "muteBars", 0),
+                               ValueOr<bool>(arguments, "randomised", false));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_gap_click", e.what());
+      }
     }
     else if (method == "getTimeSignature")
     {
@@ -120,21 +588,70 @@ namespace metronome
     {
       auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
       double volume = std::get<double>(arguments[flutter::EncodableValue("volume")]);
-      metronome->SetVolume(volume);
-      result->Success(true);
+      try
+      {
+        metronome->SetVolume(volume);
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
+      }
     }
     else if (method == "getVolume")
     {
       result->Success(flutter::EncodableValue(metronome->GetVolume()));
     }
-    else if (method == "setAudioFile")
+    else if (method == "getLevels")
+    {
+      result->Success(flutter::EncodableValue(LevelsToMap(metronome->GetLevels())));
+    }
+    else if (method == "getMemoryUsage")
+    {
+      result->Success(flutter::EncodableValue(MemoryUsageToMap(metronome->GetMemoryUsage())));
+    }
+    else if (method == "getStreamStats")
+    {
+      result->Success(flutter::EncodableValue(StreamStatsToMap(metronome->GetStreamStats())));
+    }
+    else if (method == "startOscBroadcast")
     {
       auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
-      auto mainFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("mainFileBytes")]);
-      auto accentedFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("accentedFileBytes")]);
-      metronome->SetAudioFile(mainFileBytes, accentedFileBytes);
+      try
+      {
+        metronome->StartOscBroadcast(ValueOr<std::string>(arguments, "host", ""), ValueOr<int>(arguments, "port", 0),
+                                     ValueOr<int>(arguments, "lookAheadMs", 0));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "io_error", e.what());
+      }
+    }
+    else if (method == "stopOscBroadcast")
+    {
+      metronome->StopOscBroadcast();
       result->Success(true);
     }
+    else if (method == "setAudioFile")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        auto mainFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("mainFileBytes")]);
+        auto accentedFileBytes = std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("accentedFileBytes")]);
+        metronome->SetAudioFile(mainFileBytes, accentedFileBytes);
+        result->Success(true);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        ReportError(*result, method, "invalid_argument", e.what());
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "audio_error", e.what());
+      }
+    }
     else if (method == "isPlaying")
     {
       result->Success(flutter::EncodableValue(metronome->IsPlaying()));
@@ -148,6 +665,173 @@ namespace metronome
       metronome->Destroy();
       result->Success(true);
     }
+    else if (method == "exportSetlist")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto songs = std::get<flutter::EncodableList>(arguments[flutter::EncodableValue("songs")]);
+      std::vector<ExportJob> jobs;
+      try
+      {
+        for (const auto &song : songs)
+        {
+          jobs.push_back(ExportJobFromMap(std::get<flutter::EncodableMap>(song)));
+        }
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_song", e.what());
+        return;
+      }
+
+      if (!exporter)
+      {
+        exporter = std::make_unique<BatchExporter>(
+            [this](const ExportProgress &progress)
+            { OnExportProgress(progress); });
+      }
+      flutter::EncodableList jobIds;
+      for (auto &job : jobs)
+      {
+        jobIds.push_back(flutter::EncodableValue(exporter->Submit(std::move(job))));
+      }
+      result->Success(flutter::EncodableValue(jobIds));
+    }
+    else if (method == "importMidi")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        Song song = ReadMidiFile(std::get<std::vector<uint8_t>>(arguments[flutter::EncodableValue("midiFileBytes")]));
+        result->Success(flutter::EncodableValue(SongMapsToMap(song)));
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_midi", e.what());
+      }
+    }
+    else if (method == "exportMidi")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        Song song = SongFromMap(std::get<flutter::EncodableMap>(arguments[flutter::EncodableValue("song")]));
+        result->Success(flutter::EncodableValue(WriteMidiFile(song)));
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_song", e.what());
+      }
+    }
+    else if (method == "cancelExport")
+    {
+      if (exporter)
+      {
+        const auto *arguments = std::get_if<flutter::EncodableMap>(method_call.arguments());
+        int jobId = arguments ? ValueOr<int>(*arguments, "jobId", 0) : 0;
+        if (jobId > 0)
+        {
+          exporter->Cancel(jobId);
+        }
+        else
+        {
+          exporter->CancelAll();
+        }
+      }
+      result->Success(true);
+    }
+    else if (method == "startJournal")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        metronome->StartJournal(ValueOr<std::string>(arguments, "path", ""));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "io_error", e.what());
+      }
+    }
+    else if (method == "stopJournal")
+    {
+      try
+      {
+        metronome->StopJournal();
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "io_error", e.what());
+      }
+    }
+    else if (method == "renderJournal")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        Journal journal = ReadJournal(ValueOr<std::string>(arguments, "journalPath", ""));
+        std::vector<int16_t> pcm = RenderJournal(journal);
+        auto writer = CreateAudioFileWriter(
+            ValueOr<std::string>(arguments, "outputPath", ""),
+            ValueOr<std::string>(arguments, "format", "wav") == "flac" ? AudioFileFormat::Flac : AudioFileFormat::Wav,
+            journal.sampleRate, journal.channels);
+        // pcm holds journal.channels samples per frame, interleaved.
+        const size_t frames = pcm.size() / static_cast<size_t>(journal.channels);
+        writer->Write(pcm.data(), frames);
+        writer->Close();
+        result->Success(flutter::EncodableValue(static_cast<int64_t>(frames)));
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "invalid_journal", e.what());
+      }
+    }
+    else if (method == "setLogLevel")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      int level = ValueOr<int>(arguments, "level", static_cast<int>(LogLevel::Info));
+      SetLogLevel(static_cast<LogLevel>(std::clamp(level, 0, static_cast<int>(LogLevel::Off))));
+      result->Success(true);
+    }
+    else if (method == "setLogFile")
+    {
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        SetLogFile(ValueOr<std::string>(arguments, "path", ""));
+        result->Success(true);
+      }
+      catch (const std::exception &e)
+      {
+        ReportError(*result, method, "io_error", e.what());
+      }
+    }
+    else if (method == "dumpTrace")
+    {
+      if (!kTracingEnabled)
+      {
+        ReportError(*result, method, "tracing_disabled", "Build with METRONOME_ENABLE_TRACING=ON to record traces");
+        return;
+      }
+      auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+      std::string path = ValueOr<std::string>(arguments, "path", "");
+      std::string format = ValueOr<std::string>(arguments, "format", "chrome");
+      std::ofstream file(path, std::ios::binary | std::ios::trunc);
+      if (!file)
+      {
+        ReportError(*result, method, "io_error", "Cannot open " + path);
+        return;
+      }
+      if (format == "perfetto")
+      {
+        WritePerfettoTrace(file);
+      }
+      else
+      {
+        WriteChromeTrace(file);
+      }
+      result->Success(file.good());
+    }
     else
     {
       result->NotImplemented();
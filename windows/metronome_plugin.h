@@ -5,8 +5,12 @@
 #include <flutter/plugin_registrar_windows.h>
 #include <flutter/event_channel.h>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "metronome.h"
+#include "metronome_export.h"
 
 namespace metronome
 {
@@ -16,7 +20,7 @@ namespace metronome
     public:
         static void RegisterWithRegistrar(flutter::PluginRegistrarWindows *registrar);
 
-        MetronomePlugin();
+        explicit MetronomePlugin(flutter::PluginRegistrarWindows *registrar);
 
         virtual ~MetronomePlugin();
 
@@ -25,9 +29,34 @@ namespace metronome
             const flutter::MethodCall<flutter::EncodableValue> &method_call,
             std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
 
+        void OnExportProgress(const ExportProgress &progress);
+
+        // Event sinks may only be called on the platform thread, so events
+        // from exporter workers and the log drainer are queued here and the
+        // top-level window is woken to deliver them.
+        enum class EventStream
+        {
+            Export,
+            Log,
+        };
+        void PostEvent(EventStream stream, flutter::EncodableValue event);
+        // On the platform thread, to whichever sinks are listening now.
+        void DeliverEvents();
+
+        flutter::PluginRegistrarWindows *registrar;
+        HWND window = nullptr;
+        UINT eventMessage = 0;
+        int windowProcDelegate = 0;
+        std::mutex pendingMutex;
+        std::vector<std::pair<EventStream, flutter::EncodableValue>> pendingEvents;
+
         std::unique_ptr<Metronome> metronome;
         std::unique_ptr<flutter::EventChannel<flutter::EncodableValue>> eventChannel;
         std::shared_ptr<flutter::EventSink<flutter::EncodableValue>> eventSink;
+        std::shared_ptr<flutter::EventSink<flutter::EncodableValue>> exportSink;
+        std::shared_ptr<flutter::EventSink<flutter::EncodableValue>> logSink;
+        // Declared last so its workers are joined before the sink goes away.
+        std::unique_ptr<BatchExporter> exporter;
     };
 
 } // namespace metronome